@@ -0,0 +1,264 @@
+"""
+Benchmarks for the LittleFs packet protocol.
+
+These run against a device (normally running examples/Benchmark) through
+the LittleFsPlugin, and collect the results in a dictionary which can be
+written out as JSON to track regressions between releases.
+"""
+import io
+import json
+from os import path
+import time
+from typing import Any, Callable, Dict, List
+
+from duino_bus.packet import ErrorCode
+
+from duino_littlefs.duino_littlefs import (CAPS_JOBS, DEFAULT_WINDOW, FLAGS_DIR,
+                                           JOB_FORMAT, OPEN_READ, OPEN_WRITE,
+                                           REMOVE, RMDIR, LittleFsPlugin,
+                                           error_str)
+from duino_littlefs.version import __version__
+
+# Chunk sizes used for the READ and WRITE/APPEND throughput tests.
+DEFAULT_CHUNK_SIZES = [64, 256, 1024, 4096]
+
+# Directory sizes that LIST latency is measured at.
+DEFAULT_LIST_SIZES = [1, 10, 100, 1000, 5000]
+
+
+class BenchmarkError(Exception):
+    """Raised when a command fails part way through a benchmark."""
+
+
+class Benchmark:
+    """Runs benchmarks against a device using a LittleFsPlugin."""
+
+    def __init__(self, plugin: LittleFsPlugin, dirname: str):
+        self.plugin = plugin
+        self.dirname = dirname.rstrip('/')
+
+    def check(self, err: int, what: str) -> None:
+        """Raises BenchmarkError if err isn't ErrorCode.NONE."""
+        if err != ErrorCode.NONE:
+            raise BenchmarkError(f'Error: {error_str(err)} {what}')
+
+    @staticmethod
+    def timed(func: Callable[[], Any]) -> float:
+        """Calls func, returning the number of seconds it took."""
+        start = time.perf_counter()
+        func()
+        return time.perf_counter() - start
+
+    @staticmethod
+    def rate(num_bytes: int, seconds: float) -> Dict[str, Any]:
+        """Returns the JSON fields describing a transfer."""
+        return {
+            'bytes': num_bytes,
+            'seconds': round(seconds, 6),
+            'bytes_per_sec': round(num_bytes / seconds, 1) if seconds else 0,
+        }
+
+    def setup(self) -> None:
+        """Creates the directory that the benchmarks work in."""
+        parent, basename = path.split(self.dirname)
+        if any(file.filename == basename
+               for file in self.plugin.get_files(parent or '/')):
+            self.cleanup()
+        self.check(self.plugin.mkdir(self.dirname), f'creating {self.dirname}')
+
+    def cleanup(self) -> None:
+        """Removes anything left behind by a previous run."""
+        files = self.plugin.walk(self.dirname)[1]
+        # walk lists parents before their children, so remove from the end.
+        ops = [(RMDIR if file.flags & FLAGS_DIR else REMOVE,
+                f'{self.dirname}/{file.filename}') for file in reversed(files)]
+        ops.append((RMDIR, self.dirname))
+        self.plugin.batch(ops)
+
+    def bench_download(self, size: int,
+                       chunk_sizes: List[int]) -> List[Dict[str, Any]]:
+        """Measures how quickly a file can be read with READ at each chunk
+           size, and with STREAM_READ.
+        """
+        filename = f'{self.dirname}/download.bin'
+        data = bytes(i & 0xff for i in range(size))
+        self.upload(filename, data)
+        results = []
+        for chunk_size in chunk_sizes:
+
+            def read_all(chunk_size=chunk_size) -> None:
+                offset = 0
+                while offset < size:
+                    err, chunk = self.plugin.read_file(filename, offset,
+                                                       chunk_size)
+                    self.check(err, f'reading {filename}')
+                    if not chunk:
+                        break
+                    offset += len(chunk)
+
+            result = {'method': 'READ', 'chunk_size': chunk_size}
+            result.update(self.rate(size, self.timed(read_all)))
+            results.append(result)
+
+        result = {'method': 'STREAM_READ', 'window': DEFAULT_WINDOW}
+        result.update(
+            self.rate(size, self.timed(lambda: self.download(filename))))
+        results.append(result)
+        self.check(self.plugin.remove(filename), f'removing {filename}')
+        return results
+
+    def bench_upload(self, size: int,
+                     chunk_sizes: List[int]) -> List[Dict[str, Any]]:
+        """Measures how quickly a file can be written with WRITE and APPEND
+           at each chunk size, and with STREAM_WRITE.
+        """
+        filename = f'{self.dirname}/upload.bin'
+        data = bytes(i & 0xff for i in range(size))
+        results = []
+        for chunk_size in chunk_sizes:
+
+            def write_all(chunk_size=chunk_size) -> None:
+                self.check(self.plugin.write_file(filename, data[:chunk_size]),
+                           f'writing {filename}')
+                for offset in range(chunk_size, size, chunk_size):
+                    self.check(
+                        self.plugin.append_file(
+                            filename, data[offset:offset + chunk_size]),
+                        f'appending to {filename}')
+                self.check(self.plugin.flush(), f'flushing {filename}')
+
+            result = {'method': 'WRITE/APPEND', 'chunk_size': chunk_size}
+            result.update(self.rate(size, self.timed(write_all)))
+            results.append(result)
+
+        result = {'method': 'STREAM_WRITE', 'window': DEFAULT_WINDOW}
+        result.update(
+            self.rate(size, self.timed(lambda: self.upload(filename, data))))
+        results.append(result)
+        self.check(self.plugin.remove(filename), f'removing {filename}')
+        return results
+
+    def bench_small_files(self, list_sizes: List[int]) -> Dict[str, Any]:
+        """Creates a directory of empty files, measuring how long LIST takes
+           as the directory grows, and the rate that files are created and
+           removed.
+        """
+        dirname = f'{self.dirname}/list'
+        self.check(self.plugin.mkdir(dirname), f'creating {dirname}')
+        names: List[str] = []
+        create_seconds = 0.0
+        list_results = []
+        for list_size in list_sizes:
+            while len(names) < list_size:
+                filename = f'{dirname}/file_{len(names):05d}.txt'
+                start = time.perf_counter()
+                err = self.plugin.write_file(filename, b'')
+                create_seconds += time.perf_counter() - start
+                self.check(err, f'creating {filename}')
+                names.append(filename)
+            files: List[Any] = []
+            seconds = self.timed(
+                lambda: files.extend(self.plugin.get_files(dirname)))
+            if len(files) != list_size:
+                raise BenchmarkError(
+                    f'Error: listed {len(files)} of {list_size} files')
+            list_results.append({
+                'entries': list_size,
+                'seconds': round(seconds, 6),
+            })
+            self.plugin.print(f'Listed {list_size} files in {seconds:.3f}s')
+
+        remove_seconds = self.timed(lambda: self.check(
+            self.plugin.batch([(REMOVE, name) for name in names])[0],
+            f'removing files in {dirname}'))
+        self.check(self.plugin.rmdir(dirname), f'removing {dirname}')
+        return {
+            'list': list_results,
+            'create': {
+                'files': len(names),
+                'seconds': round(create_seconds, 6),
+                'files_per_sec': round(len(names) / create_seconds, 1),
+            },
+            'remove': {
+                'files': len(names),
+                'seconds': round(remove_seconds, 6),
+                'files_per_sec': round(len(names) / remove_seconds, 1),
+            },
+        }
+
+    def bench_format(self) -> Dict[str, Any]:
+        """Measures how long it takes to format the file system."""
+        if self.plugin.get_caps().capabilities & CAPS_JOBS:
+            seconds = self.timed(lambda: self.check(
+                self.plugin.run_job('Formatting', JOB_FORMAT),
+                'formatting'))
+        else:
+            seconds = self.timed(
+                lambda: self.check(self.plugin.format(), 'formatting'))
+        return {'seconds': round(seconds, 6)}
+
+    def download(self, filename: str) -> None:
+        """Reads filename using OPEN and STREAM_READ."""
+        err, handle = self.plugin.open_file(filename, OPEN_READ)
+        self.check(err, f'opening {filename}')
+        try:
+            self.check(
+                self.plugin.download_handle(handle, io.BytesIO(),
+                                            DEFAULT_WINDOW),
+                f'reading {filename}')
+            self.plugin.print('')
+        finally:
+            self.plugin.close_file(handle)
+
+    def upload(self, filename: str, data: bytes) -> None:
+        """Writes data to filename using OPEN and STREAM_WRITE."""
+        err, handle = self.plugin.open_file(filename, OPEN_WRITE)
+        self.check(err, f'opening {filename}')
+        try:
+            self.check(
+                self.plugin.upload_handle(handle, io.BytesIO(data),
+                                          DEFAULT_WINDOW),
+                f'writing {filename}')
+            self.plugin.print('')
+        finally:
+            self.plugin.close_file(handle)
+
+    def run(self,
+            size: int,
+            chunk_sizes: List[int],
+            list_sizes: List[int],
+            do_format: bool = False) -> Dict[str, Any]:
+        """Runs all of the benchmarks, returning the results."""
+        caps = self.plugin.get_caps()
+        results: Dict[str, Any] = {
+            'version': __version__,
+            'timestamp': int(time.time()),
+            'caps': caps._asdict(),
+        }
+        self.setup()
+        try:
+            self.plugin.stats(reset=True)
+            results['download'] = self.bench_download(size, chunk_sizes)
+            results['upload'] = self.bench_upload(size, chunk_sizes)
+            results['small_files'] = self.bench_small_files(list_sizes)
+            err, entries = self.plugin.stats()
+            if err == ErrorCode.NONE:
+                results['device_stats'] = [{
+                    'name': name,
+                    'count': count,
+                    'bytes': num_bytes,
+                    'total_usec': total_usec,
+                    'max_usec': max_usec,
+                } for (name, count, num_bytes, total_usec, max_usec) in entries]
+        finally:
+            self.cleanup()
+        if do_format:
+            results['format'] = self.bench_format()
+        return results
+
+
+def write_results(results: Dict[str, Any], filename: str) -> None:
+    """Writes benchmark results to filename as JSON."""
+    with open(filename, 'w', encoding='utf-8') as file:
+        json.dump(results, file, indent=2)
+        file.write('\n')
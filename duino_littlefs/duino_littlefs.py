@@ -5,7 +5,9 @@ import binascii
 from operator import attrgetter
 import os
 from os import path
-from typing import List, NamedTuple, Tuple, Union
+import time
+from typing import BinaryIO, List, NamedTuple, Tuple, Union
+import zlib
 
 from duino_bus.packer import Packer
 from duino_bus.packet import ErrorCode, Packet
@@ -26,8 +28,72 @@ class File(NamedTuple):
     filename: str
 
 
+class Caps(NamedTuple):
+    """
+    Type information for the Caps NamedTuple (the CAPS response)
+    """
+    capabilities: int
+    cmd_data_len: int
+    rsp_data_len: int
+    block_size: int
+    write_window: int
+    compress_size: int
+
+
+class Match(NamedTuple):
+    """
+    Type information for the Match NamedTuple (a line returned by SEARCH)
+    """
+    filename: str
+    line_num: int
+    offset: int
+    line: bytes
+    flags: int = 0  # SEARCH_LINE_CONTEXT and/or SEARCH_LINE_TRUNCATED
+
+
+class ArchiveEntry(NamedTuple):
+    """
+    Type information for the ArchiveEntry NamedTuple (a record of an EXPORT
+    archive)
+    """
+    record: int
+    filename: str
+    size: int
+    timestamp: int
+
+
+class StatFs(NamedTuple):
+    """
+    Type information for the StatFs NamedTuple (the STATFS response)
+    """
+    flags: int
+    block_size: int
+    block_count: int
+    free_blocks: int
+    name_max: int
+    file_max: int
+    cmd_data_len: int
+    rsp_data_len: int
+    num_files: int
+    num_dirs: int
+    file_bytes: int
+    file_blocks: int
+
+
 FLAGS_DIR = 1  # identifies a directory
 
+# Capabilities reported by the CAPS command
+CAPS_STREAM = 0x00000001  # STREAM_READ sends a window of packets.
+CAPS_HASH_SHA256 = 0x00000002  # HASH supports HASH_SHA256.
+CAPS_COMPRESSION = 0x00000004  # READ/WRITE_COMPRESSED support LZ4.
+CAPS_JOBS = 0x00000008  # Supports JOB_START and JOB_STATUS.
+CAPS_LIST_COMPACT = 0x00000010  # Supports LIST_COMPACT.
+CAPS_UPLOAD = 0x00000020  # Supports UPLOAD_BEGIN and UPLOAD_COMMIT.
+CAPS_SEARCH = 0x00000040  # Supports SEARCH.
+CAPS_TAIL = 0x00000080  # Supports TAIL.
+CAPS_ARCHIVE = 0x00000100  # Supports EXPORT and IMPORT.
+CAPS_STAT = 0x00000200  # Supports STAT.
+
 FORMAT = 0x40  # Format a file system.
 INFO = 0x41  # Return info about a file system.
 LIST = 0x42  # List files in a directory
@@ -39,19 +105,384 @@ READ = 0x47  # Read data from a file.
 WRITE = 0x48  # Write data to a file.
 APPEND = 0x49  # Append data to a file.
 RMDIR = 0x4a  # Remove a directory.
+OPEN = 0x4b  # Open a file, returning a handle.
+READ_HANDLE = 0x4c  # Read data from an open file.
+WRITE_HANDLE = 0x4d  # Write data to an open file.
+CLOSE = 0x4e  # Close an open file.
+LIST_CURSOR = 0x4f  # List files, resuming from a cursor.
+STREAM_READ = 0x50  # Read a window of packets from an open file.
+STREAM_WRITE = 0x51  # Write one chunk of a windowed upload.
+CAPS = 0x52  # Return capabilities and buffer sizes.
+FLUSH = 0x53  # Write buffered APPEND data to flash.
+HASH = 0x54  # Return a CRC-32 or SHA-256 of a file.
+
+# Algorithms supported by the HASH command
+HASH_CRC32 = 0  # CRC-32, as calculated by zlib.crc32
+HASH_SHA256 = 1  # SHA-256
+
+TO_END_OF_FILE = 0xffffffff  # HASH length which includes the rest of the file.
+
+SIGNATURE = 0x55  # Return checksums of each block of a file.
+PATCH = 0x56  # Rebuild a file from blocks and new data.
+
+# Operations contained in a PATCH command
+PATCH_BEGIN = 0  # Start building a new version of a file.
+PATCH_COPY = 1  # Copy blocks from the existing version of the file.
+PATCH_LITERAL = 2  # Add data sent by the host.
+PATCH_END = 3  # Verify the new file and replace the existing one.
+PATCH_ABORT = 4  # Throw away the new file.
+
+DEFAULT_DELTA_BLOCK_SIZE = 512  # Block size used for delta uploads.
+
+READ_COMPRESSED = 0x57  # Read compressed data from a file.
+WRITE_COMPRESSED = 0x58  # Write compressed data to a file.
+
+# Ways that READ_COMPRESSED and WRITE_COMPRESSED data can be encoded.
+CODEC_NONE = 0  # Data is sent as is.
+CODEC_LZ4 = 1  # Data is a single LZ4 block.
+
+LZ4_MIN_MATCH = 4  # Shortest match which can be encoded.
+LZ4_MF_LIMIT = 12  # The last match starts at least this far from the end.
+LZ4_LAST_LITERALS = 5  # The last few bytes of a block are always literals.
+
+WALK = 0x59  # List all of the files in a tree.
+BATCH = 0x5a  # Run several MKDIR/REMOVE/RMDIR/RENAME operations.
+
+BATCH_STOP_ON_ERROR = 0x01  # Don't run the rest of a BATCH after an error.
+
+JOB_START = 0x5b  # Start a long operation as a job.
+JOB_STATUS = 0x5c  # Return the progress or result of a job.
+
+LIST_COMPACT = 0x5d  # List selected fields of each file.
+
+# Fields included in each LIST_COMPACT entry (the name is always included)
+LIST_FLAGS = 0x01  # Include the entry flags.
+LIST_SIZE = 0x02  # Include the file size.
+LIST_TIMESTAMP = 0x04  # Include the last write time.
+LIST_ALL = LIST_FLAGS | LIST_SIZE | LIST_TIMESTAMP
+
+STATFS = 0x5e  # Return file system geometry and usage.
+
+# Flags passed with, and returned by, the STATFS command
+STATFS_SCAN = 0x01  # Add up the sizes of all of the files.
+STATFS_TRUNCATED = 0x02  # Some deeply nested directories weren't scanned.
+
+STATS = 0x5f  # Return timing counters.
+
+STATS_RESET = 0x01  # Clear the counters once they've all been sent.
+
+# Names of the file operations timed by STATS, indexed by phase.
+STATS_PHASE_STRS = ['open', 'seek', 'read', 'write', 'close', 'gc']
+
+WRITE_AT = 0x60  # Overwrite part of an existing file.
+TRUNCATE = 0x61  # Shrink or extend a file.
+UPLOAD_BEGIN = 0x62  # Start or resume an upload session.
+UPLOAD_COMMIT = 0x63  # Replace a file with a finished upload.
+
+# Flags passed with UPLOAD_BEGIN and UPLOAD_COMMIT
+UPLOAD_RESUME = 0x01  # UPLOAD_BEGIN: Keep data from an earlier session.
+UPLOAD_ABORT = 0x02  # UPLOAD_COMMIT: Remove the temporary file instead.
+
+SEARCH = 0x64  # Return the lines of files which match a pattern.
+
+# Flags passed with the SEARCH command
+SEARCH_IGNORE_CASE = 0x01  # Letters match in either case.
+SEARCH_REGEX = 0x02  # The pattern is a regex (supports c \c . * ^ $).
+
+# Flags returned with each line in a SEARCH response
+SEARCH_LINE_CONTEXT = 0x01  # The line is context around a match.
+SEARCH_LINE_TRUNCATED = 0x02  # The line was cut short to fit the packet.
+
+TAIL = 0x65  # Send data as it's appended to a file.
+
+# Flags passed with the TAIL command
+TAIL_STOP = 0x01  # Stop watching the file.
+
+# Seconds between the TAIL commands which keep a watch going (the device
+# stops a watch after 10 seconds without one).
+TAIL_KEEPALIVE = 3
+
+EXPORT = 0x66  # Read a directory tree as an archive.
+IMPORT = 0x67  # Unpack an archive into a directory.
+STAT = 0x68  # Return the size and type of one file.
+
+# Flags passed with the EXPORT and IMPORT commands
+EXPORT_COMPRESS = 0x01  # Compress the archive with LZ4 when it helps.
+IMPORT_BEGIN = 0x01  # Start unpacking a new archive.
+
+# Flags passed with, and returned by, the STAT command
+STAT_DIR_SIZE = 0x01  # Add up the sizes of the files in a directory.
+STAT_NO_CACHE = 0x02  # Read from the file system, not the cache.
+STAT_TRUNCATED = 0x04  # Some deeply nested directories weren't added up.
+STAT_CACHED = 0x08  # The response came from the metadata cache.
+
+# Types of the records in an archive
+ARCHIVE_END = 0  # End of the archive.
+ARCHIVE_DIR = 1  # A directory.
+ARCHIVE_FILE = 2  # A file, followed by its data and a CRC-32.
+
+# Operations which can be started by JOB_START
+JOB_COPY = 1  # Copy a file.
+JOB_RMTREE = 2  # Remove a directory and everything inside it.
+JOB_FORMAT = 3  # Format the file system.
+JOB_MAINTENANCE = 4  # Garbage collect each file system which supports it.
+
+# States reported by JOB_STATUS
+JOB_RUNNING = 0  # The job hasn't finished yet.
+JOB_DONE = 1  # The job has finished, and its result is available.
+
+# Flags sent with each STREAM_READ, WALK and SEARCH response
+STREAM_LAST = 0x01  # Last packet sent for this request.
+STREAM_END_OF_FILE = 0x02  # The end of the file was reached.
+
+# Number of STREAM_READ/STREAM_WRITE packets in flight at once.
+DEFAULT_WINDOW = 8
+
+NO_CURSOR = 0xff  # Starts a LIST_CURSOR/WALK/SEARCH, returned when complete.
+
+# Modes used with the OPEN command
+OPEN_READ = 0  # Open an existing file for reading.
+OPEN_WRITE = 1  # Create a file, truncating it if it already exists.
+OPEN_APPEND = 2  # Open a file for writing starting at the end.
+OPEN_UPDATE = 3  # Open an existing file for reading and writing in place.
 
 ERROR_STRS = [
-    'NONE', 'UNABLE_TO_OPEN_FILE', 'WRITE_FAILED', 'READ_FAILED', 'SEEK_FAILED'
+    'NONE', 'UNABLE_TO_OPEN_FILE', 'WRITE_FAILED', 'READ_FAILED',
+    'SEEK_FAILED', 'FORMAT_FAILED', 'MKDIR_FAILED', 'RMDIR_FAILED',
+    'REMOVE_FAILED', 'INVALID_HANDLE', 'NO_FREE_HANDLES', 'INVALID_CURSOR',
+    'OUT_OF_SEQUENCE', 'RENAME_FAILED', 'UNSUPPORTED', 'VERIFY_FAILED', 'BUSY',
+    'INVALID_JOB', 'INVALID_COMMAND', 'INVALID_PATH'
+]
+
+# Names of the commands, starting from FORMAT (these match the device's as_str)
+COMMAND_STRS = [
+    'FORMAT', 'INFO', 'LIST', 'MKDIR', 'REMOVE', 'RENAME', 'COPY', 'READ',
+    'WRITE', 'APPEND', 'RMDIR', 'OPEN', 'READ_HANDLE', 'WRITE_HANDLE', 'CLOSE',
+    'LIST_CURSOR', 'STREAM_READ', 'STREAM_WRITE', 'CAPS', 'FLUSH', 'HASH',
+    'SIGNATURE', 'PATCH', 'READ_COMPRESSED', 'WRITE_COMPRESSED', 'WALK',
+    'BATCH', 'JOB_START', 'JOB_STATUS', 'LIST_COMPACT', 'STATFS', 'STATS',
+    'WRITE_AT', 'TRUNCATE', 'UPLOAD_BEGIN', 'UPLOAD_COMMIT', 'SEARCH', 'TAIL',
+    'EXPORT', 'IMPORT', 'STAT'
 ]
 
+ERR_READ_FAILED = 3  # Reading from a file failed.
+ERR_OUT_OF_SEQUENCE = 12  # STREAM_WRITE chunk didn't follow the previous one.
+
+
+def command_str(cmd: int) -> str:
+    """Converts a command code into it's string equivalent."""
+    if cmd < FORMAT or cmd >= FORMAT + len(COMMAND_STRS):
+        return '???'
+    return COMMAND_STRS[cmd - FORMAT]
+
 
 def error_str(err: int) -> str:
     """Converts an error code into it's string equivalent."""
-    if err < 0 or err > len(ERROR_STRS):
+    if err < 0 or err >= len(ERROR_STRS):
         return '???'
     return ERROR_STRS[err]
 
 
+def crc32_host_file(filename: str) -> int:
+    """Calculates the CRC-32 of a file on the host."""
+    crc = 0
+    with open(filename, 'rb') as file:
+        while data := file.read(64 * 1024):
+            crc = zlib.crc32(data, crc)
+    return crc
+
+
+def weak_checksum(data: Union[bytes, bytearray]) -> Tuple[int, int]:
+    """Calculates the two halves of the rsync weak checksum of data (this
+       matches RollingChecksum on the device).
+    """
+    a = 0
+    b = 0
+    for byte in data:
+        a = (a + byte) & 0xffff
+        b = (b + a) & 0xffff
+    return (a, b)
+
+
+def delta_instructions(
+        data: Union[bytes, bytearray], block_size: int,
+        blocks: List[Tuple[int, int]]) -> List[Union[int, bytes]]:
+    """Works out how to build data from the blocks of the file on the device.
+
+       blocks contains the (weak checksum, CRC-32) of each full block on the
+       device. The result is a list containing block numbers (to be copied
+       from the device's file) and bytes (to be sent as literal data).
+    """
+    table = {}
+    for index, (weak, crc) in enumerate(blocks):
+        table.setdefault(weak, []).append((index, crc))
+
+    result: List[Union[int, bytes]] = []
+    data_len = len(data)
+    literal_start = 0
+    pos = 0
+    a, b = weak_checksum(data[0:block_size])
+    while pos + block_size <= data_len:
+        match = None
+        if ((b << 16) | a) in table:
+            crc = zlib.crc32(data[pos:pos + block_size])
+            for index, block_crc in table[(b << 16) | a]:
+                if block_crc == crc:
+                    match = index
+                    break
+        if match is not None:
+            if literal_start < pos:
+                result.append(bytes(data[literal_start:pos]))
+            result.append(match)
+            pos += block_size
+            literal_start = pos
+            a, b = weak_checksum(data[pos:pos + block_size])
+            continue
+        # Roll the checksum along by one byte.
+        if pos + block_size < data_len:
+            out_byte = data[pos]
+            a = (a - out_byte + data[pos + block_size]) & 0xffff
+            b = (b - block_size * out_byte + a) & 0xffff
+        pos += 1
+    if literal_start < data_len:
+        result.append(bytes(data[literal_start:]))
+    return result
+
+
+def lz4_store_length(out: bytearray, length: int) -> None:
+    """Stores the extra bytes of a length which doesn't fit in a token."""
+    length -= 15
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def lz4_compress(data: Union[bytes, bytearray]) -> bytes:
+    """Compresses data into a single LZ4 block (the same format that the
+       device uses for READ_COMPRESSED and WRITE_COMPRESSED).
+    """
+    out = bytearray()
+    table = {}
+    data_len = len(data)
+    anchor = 0
+    pos = 0
+    while True:
+        match_len = 0
+        offset = 0
+        while pos + LZ4_MF_LIMIT < data_len:
+            sequence = bytes(data[pos:pos + LZ4_MIN_MATCH])
+            ref = table.get(sequence)
+            table[sequence] = pos
+            if ref is not None and pos - ref <= 0xffff:
+                offset = pos - ref
+                match_len = LZ4_MIN_MATCH
+                while (pos + match_len < data_len - LZ4_LAST_LITERALS
+                       and data[ref + match_len] == data[pos + match_len]):
+                    match_len += 1
+                break
+            pos += 1
+
+        if match_len == 0:
+            pos = data_len
+        literal_len = pos - anchor
+        token = min(literal_len, 15) << 4
+        if match_len > 0:
+            token |= min(match_len - LZ4_MIN_MATCH, 15)
+        out.append(token)
+        if literal_len >= 15:
+            lz4_store_length(out, literal_len)
+        out += data[anchor:pos]
+        if match_len == 0:
+            return bytes(out)
+        out += offset.to_bytes(2, 'little')
+        if match_len - LZ4_MIN_MATCH >= 15:
+            lz4_store_length(out, match_len - LZ4_MIN_MATCH)
+        pos += match_len
+        anchor = pos
+
+
+def lz4_decompress(data: Union[bytes, bytearray]) -> bytes:
+    """Decompresses a single LZ4 block.
+
+       Raises ValueError if the data isn't valid.
+    """
+    out = bytearray()
+    data_len = len(data)
+    pos = 0
+    try:
+        while pos < data_len:
+            token = data[pos]
+            pos += 1
+            literal_len = token >> 4
+            if literal_len == 15:
+                while True:
+                    byte = data[pos]
+                    pos += 1
+                    literal_len += byte
+                    if byte != 255:
+                        break
+            if pos + literal_len > data_len:
+                raise ValueError('LZ4 literals run past the end of the data')
+            out += data[pos:pos + literal_len]
+            pos += literal_len
+            if pos == data_len:
+                break
+
+            offset = data[pos] | (data[pos + 1] << 8)
+            pos += 2
+            match_len = token & 0x0f
+            if match_len == 15:
+                while True:
+                    byte = data[pos]
+                    pos += 1
+                    match_len += byte
+                    if byte != 255:
+                        break
+            match_len += LZ4_MIN_MATCH
+            if offset == 0 or offset > len(out):
+                raise ValueError('LZ4 match offset is out of range')
+            start = len(out) - offset
+            for i in range(match_len):
+                out.append(out[start + i])
+    except IndexError as err:
+        raise ValueError('LZ4 data is truncated') from err
+    return bytes(out)
+
+
+def parse_archive(data: Union[bytes, bytearray]) -> List[ArchiveEntry]:
+    """Returns the records of an archive sent by EXPORT, checking the
+       CRC-32 of each file's data.
+
+       Raises ValueError if the archive is truncated or a CRC doesn't match.
+    """
+    entries = []
+    pos = 0
+    try:
+        while True:
+            record = data[pos]
+            pos += 1
+            if record == ARCHIVE_END:
+                return entries
+            name_len = int.from_bytes(data[pos:pos + 2], 'little')
+            pos += 2
+            filename = bytes(data[pos:pos + name_len]).decode()
+            pos += name_len
+            size = int.from_bytes(data[pos:pos + 4], 'little')
+            timestamp = int.from_bytes(data[pos + 4:pos + 8], 'little')
+            pos += 8
+            if record == ARCHIVE_FILE:
+                if pos + size + 4 > len(data):
+                    raise ValueError(f'Data for {filename} is truncated')
+                crc = int.from_bytes(data[pos + size:pos + size + 4], 'little')
+                if zlib.crc32(data[pos:pos + size]) != crc:
+                    raise ValueError(f'CRC-32 of {filename} does not match')
+                pos += size + 4
+            entries.append(ArchiveEntry(record, filename, size, timestamp))
+    except IndexError as err:
+        raise ValueError('Archive is truncated') from err
+
+
 # pylint: disable=too-many-public-methods
 class LittleFsPlugin(CliPluginBase):
     """Defines littlefs related commands."""
@@ -59,8 +490,129 @@ class LittleFsPlugin(CliPluginBase):
     def __init__(self, cli: CommandLineBase):
         super().__init__(cli)
         self.bus = cli.bus
+        self.caps: Union[None, Caps] = None
+
+    argparse_bench = (
+        add_arg('-o',
+                '--output',
+                dest='output',
+                action='store',
+                type=str,
+                help='File to write the results to, as JSON.',
+                default='littlefs_bench.json'),
+        add_arg('--size',
+                dest='size',
+                action='store',
+                type=int,
+                help='Size of the file used for throughput tests.',
+                default=256 * 1024),
+        add_arg('--max-entries',
+                dest='max_entries',
+                action='store',
+                type=int,
+                help='Largest directory to measure LIST with.',
+                default=5000),
+        add_arg('--format',
+                dest='format',
+                action='store_true',
+                help='Also time FORMAT (erases everything on the device).',
+                default=False),
+        add_arg('dirname',
+                metavar='DIR',
+                type=str,
+                nargs='?',
+                help='Directory on the Arduino to run the benchmarks in.',
+                default='/bench'),
+    )
+
+    def do_bench(self, args) -> None:
+        """bench [-o FILE] [--size BYTES] [--max-entries N] [--format] [DIR]
+
+           Measures download and upload throughput at several chunk sizes,
+           LIST latency against directory size, the rate that small files
+           can be created and removed, and optionally FORMAT time. The
+           results are written to FILE as JSON. Use the examples/Benchmark
+           sketch on the device.
+        """
+        # pylint: disable=import-outside-toplevel
+        from duino_littlefs.benchmark import (Benchmark, BenchmarkError,
+                                              DEFAULT_CHUNK_SIZES,
+                                              DEFAULT_LIST_SIZES,
+                                              write_results)
+        list_sizes = [
+            size for size in DEFAULT_LIST_SIZES if size < args.max_entries
+        ] + [args.max_entries]
+        bench = Benchmark(self, args.dirname)
+        try:
+            results = bench.run(args.size, DEFAULT_CHUNK_SIZES, list_sizes,
+                                args.format)
+        except BenchmarkError as err:
+            self.print(err)
+            return
+        write_results(results, args.output)
+        self.print(f'Results written to {args.output}')
+
+    def do_caps(self, _) -> None:
+        """caps
+
+           Reports the capabilities and packet buffer sizes of the Arduino.
+        """
+        caps = self.get_caps()
+        self.print(f'Capabilities:     0x{caps.capabilities:08x}')
+        self.print(f'Command buffer:   {caps.cmd_data_len} bytes')
+        self.print(f'Response buffer:  {caps.rsp_data_len} bytes')
+        self.print(f'Block size:       {caps.block_size} bytes')
+        self.print(f'Write window:     {caps.write_window} packets')
+
+    argparse_cp = (
+        add_arg('-b',
+                '--background',
+                dest='background',
+                action='store_true',
+                help='Copy using a job, so the Arduino stays responsive.',
+                default=False),
+        add_arg('src',
+                metavar='SRC',
+                type=str,
+                help='Name of file on the Arduino to copy.'),
+        add_arg('dst',
+                metavar='DST',
+                type=str,
+                help='Name of the file on the Arduino to create.'),
+    )
+
+    def do_cp(self, args) -> None:
+        """cp [-b] SRC DST
+
+           Copies the file SRC to DST on the Arduino.
+        """
+        if args.background:
+            err = self.run_job(f'Copying {args.src} to {args.dst}', JOB_COPY,
+                               args.src, args.dst)
+        else:
+            err = self.copy(args.src, args.dst)
+        if err == ErrorCode.NONE:
+            self.print(f'Copied {args.src} to {args.dst}')
 
     argparse_download = (
+        add_arg('--verify',
+                dest='verify',
+                action='store_true',
+                help='Compare CRC-32s of the source and destination afterwards.',
+                default=False),
+        add_arg('-w',
+                '--window',
+                dest='window',
+                action='store',
+                type=int,
+                help='Number of packets in flight at once (1 disables streaming).',
+                default=DEFAULT_WINDOW),
+        add_arg('-z',
+                '--compress',
+                dest='compress',
+                action='store_true',
+                help='Compress the data sent over the serial link.',
+                default=False),
         add_arg('filename',
                 metavar='FILE',
                 type=str,
@@ -72,7 +624,7 @@ class LittleFsPlugin(CliPluginBase):
     )
 
     def do_download(self, args) -> None:
-        """download FILE DIR
+        """download [--verify] [-w WINDOW] [-z] FILE DIR
 
            Downloads FILE from the Arduino to the host. The file will
            be placed in the directory DIR.
@@ -82,48 +634,393 @@ class LittleFsPlugin(CliPluginBase):
 
         self.print(f'Downloading from {src_file} to {dst_file}')
 
-        data_size = self.calc_read_data_size()
-        offset = 0
+        if args.compress and self.get_caps().compress_size > 0:
+            try:
+                with open(dst_file, 'wb') as dst:
+                    self.download_compressed(src_file, dst)
+                    self.print('')
+            except FileNotFoundError as err:
+                self.print(err)
+                return
+            if args.verify:
+                self.verify(src_file, dst_file)
+            return
+
+        err, handle = self.open_file(src_file, OPEN_READ)
+        if err != ErrorCode.NONE:
+            return
         try:
-            # Need to deal with src_file not existing
             with open(dst_file, 'wb') as dst:
-                while True:
-                    err, data = self.read_file(src_file, offset, data_size)
-                    if err != ErrorCode.NONE:
-                        break
-                    if not data:
-                        break
-                    offset += len(data)
-                    self.print(f'\rRead {offset} bytes', end='')
-                    dst.write(data)
+                self.download_handle(handle, dst, args.window)
                 self.print('')
         except FileNotFoundError as err:
             self.print(err)
+            return
+        finally:
+            self.close_file(handle)
+        if args.verify:
+            self.verify(src_file, dst_file)
+
+    argparse_export = (
+        add_arg('-w',
+                '--window',
+                dest='window',
+                action='store',
+                type=int,
+                help='Number of packets in flight at once.',
+                default=DEFAULT_WINDOW),
+        add_arg('-z',
+                '--compress',
+                dest='compress',
+                action='store_true',
+                help='Compress the data sent over the serial link.',
+                default=False),
+        add_arg('dirname',
+                metavar='DIR',
+                type=str,
+                help='Directory on the Arduino to export.'),
+        add_arg('filename',
+                metavar='FILE',
+                type=str,
+                help='Archive file on the host to create.'),
+    )
+
+    def do_export(self, args) -> None:
+        """export [-w WINDOW] [-z] DIR FILE
+
+           Saves everything inside DIR on the Arduino into a single archive
+           file on the host, which can be restored with import. The whole
+           tree is sent as one stream, so small files don't each cost a
+           round trip.
+        """
+        if (self.get_caps().capabilities & CAPS_ARCHIVE) == 0:
+            self.print('Error: EXPORT is not supported by the device')
+            return
+        flags = EXPORT_COMPRESS if args.compress else 0
+        err, archive = self.export_archive(args.dirname, flags, args.window)
+        if err != ErrorCode.NONE:
+            return
+        try:
+            entries = parse_archive(archive)
+        except ValueError as err:
+            self.print(f'Error: {err}')
+            return
+        with open(args.filename, 'wb') as dst:
+            dst.write(archive)
+        files = [entry for entry in entries if entry.record == ARCHIVE_FILE]
+        total = sum(entry.size for entry in files)
+        self.print(f'Exported {len(files)} files and '
+                   f'{len(entries) - len(files)} directories ({total} bytes) '
+                   f'to {args.filename}')
+
+    def do_flush(self, _) -> None:
+        """flush
+
+            Writes any buffered APPEND data to flash and closes the file.
+        """
+        err = self.flush()
+        if err == ErrorCode.NONE:
+            self.print('Flush successful')
 
     def do_format(self, _) -> None:
         """format
 
             Formats the file system, erasing all data present.
         """
-        err = self.format()
+        if self.get_caps().capabilities & CAPS_JOBS:
+            err = self.run_job('Formatting', JOB_FORMAT)
+        else:
+            err = self.format()
         if err == ErrorCode.NONE:
             self.print('Format successful')
 
-    def do_info(self, _) -> None:
-        """info
+    argparse_import = (
+        add_arg('-w',
+                '--window',
+                dest='window',
+                action='store',
+                type=int,
+                help='Number of packets in flight at once.',
+                default=DEFAULT_WINDOW),
+        add_arg('-z',
+                '--compress',
+                dest='compress',
+                action='store_true',
+                help='Compress the data sent over the serial link.',
+                default=False),
+        add_arg('filename',
+                metavar='FILE',
+                type=str,
+                help='Archive file on the host created by export.'),
+        add_arg('dirname',
+                metavar='DIR',
+                type=str,
+                help='Directory on the Arduino to unpack into.'),
+    )
+
+    def do_import(self, args) -> None:
+        """import [-w WINDOW] [-z] FILE DIR
+
+           Unpacks an archive created by export into DIR on the Arduino,
+           creating directories as needed and replacing existing files.
+        """
+        if (self.get_caps().capabilities & CAPS_ARCHIVE) == 0:
+            self.print('Error: IMPORT is not supported by the device')
+            return
+        try:
+            with open(args.filename, 'rb') as src:
+                archive = src.read()
+        except FileNotFoundError as err:
+            self.print(err)
+            return
+        err = self.import_archive(args.dirname, archive, args.window,
+                                  args.compress)
+        self.print('')
+        if err == ErrorCode.NONE:
+            self.print(f'Imported {args.filename} into {args.dirname}')
+        else:
+            self.print(f'Error: {error_str(err)} importing {args.filename}')
+
+    argparse_info = (add_arg('dirname',
+                             metavar='DIR',
+                             nargs='?',
+                             type=str,
+                             help='Directory in the file system to report on.',
+                             default=None), )
+
+    def do_info(self, args) -> None:
+        """info [DIR]
 
            Sends an INFO request to the Arduino to get information about the LittleFS filesystem.
+           If DIR is given, the file system that DIR is in is reported on.
         """
         info = Packet(INFO)
+        if args.dirname is not None:
+            packer = Packer(info)
+            packer.pack_str(args.dirname)
         err, rsp = self.bus.send_command_get_response(info)
         if err != ErrorCode.NONE or rsp is None:
             return
         unpacker = Unpacker(rsp.get_data())
         total_bytes = unpacker.unpack_u32()
         used_bytes = unpacker.unpack_u32()
+        if total_bytes == 0:
+            self.print(f'Used: {used_bytes/1024}K (total size unknown)')
+            return
         self.print(f'Used: {used_bytes/1024}K of {total_bytes/1024}K '
                    f'{round(used_bytes / total_bytes * 100.0, 1)}%')
 
+    argparse_stats = (add_arg('-r',
+                          '--reset',
+                          dest='reset',
+                          action='store_true',
+                          help='Clear the counters after printing them.',
+                          default=False), )
+
+    def do_stats(self, args) -> None:
+        """stats [-r]
+
+           Shows how many times each command and file operation has run on
+           the device, how many bytes each moved, and how long they took.
+        """
+        err, entries = self.stats(args.reset)
+        if err != ErrorCode.NONE:
+            return
+        self.print(f'{"name":<17} {"count":>8} {"bytes":>10} {"total ms":>10} '
+                   f'{"avg us":>8} {"max us":>8} {"KB/s":>8}')
+        for (name, count, num_bytes, total_usec, max_usec) in entries:
+            rate = ''
+            if total_usec > 0 and num_bytes > 0:
+                rate = f'{num_bytes * 1000000 / 1024 / total_usec:.1f}'
+            self.print(f'{name:<17} {count:>8} {num_bytes:>10} '
+                       f'{total_usec / 1000:>10.1f} {total_usec // count:>8} '
+                       f'{max_usec:>8} {rate:>8}')
+
+    argparse_stat = (
+        add_arg('-s',
+                '--size',
+                dest='dir_size',
+                action='store_true',
+                help='Add up the sizes of the files in a directory.',
+                default=False),
+        add_arg('-n',
+                '--no-cache',
+                dest='no_cache',
+                action='store_true',
+                help="Don't use the device's metadata cache.",
+                default=False),
+        add_arg('filename',
+                metavar='PATH',
+                type=str,
+                help='File or directory to report on.'),
+    )
+
+    def do_stat(self, args) -> None:
+        """stat [-s] [-n] PATH
+
+           Shows the size, type and modification time of a file or directory,
+           without listing the directory it's in. With -s the size of a
+           directory is the total size of all of the files inside it (like
+           du).
+        """
+        if (self.get_caps().capabilities & CAPS_STAT) == 0:
+            self.print('Error: STAT is not supported by the device')
+            return
+        err, file, flags = self.stat(args.filename, args.dir_size,
+                                     args.no_cache)
+        if err != ErrorCode.NONE:
+            return
+        kind = 'directory' if file.flags & FLAGS_DIR else 'file'
+        cached = ' (cached)' if flags & STAT_CACHED else ''
+        self.print(f'Name:     {file.filename}')
+        self.print(f'Type:     {kind}{cached}')
+        self.print(f'Size:     {file.filesize}')
+        self.print(f'Modified: {time.ctime(file.timestamp)}')
+        if flags & STAT_TRUNCATED:
+            self.print('Some directories were nested too deeply to add up')
+
+    argparse_statfs = (
+        add_arg('-s',
+                '--scan',
+                dest='scan',
+                action='store_true',
+                help='Add up the files to estimate fragmentation.',
+                default=False),
+        add_arg('dirname',
+                metavar='DIR',
+                nargs='?',
+                type=str,
+                help='Directory in the file system to report on.',
+                default=None),
+    )
+
+    def do_statfs(self, args) -> None:
+        """statfs [-s] [DIR]
+
+           Shows the geometry and usage of the LittleFS file system (or of
+           the file system that DIR is mounted from). With -s the device
+           also adds up the sizes of all of the files (inside DIR), to show
+           how many used blocks are taken up by metadata, partially filled
+           blocks and blocks waiting to be compacted.
+        """
+        err, stat = self.statfs(args.scan, args.dirname)
+        if err != ErrorCode.NONE:
+            return
+        used_blocks = stat.block_count - stat.free_blocks
+        self.print(f'Block size:  {stat.block_size}')
+        self.print(f'Blocks:      {used_blocks} used of {stat.block_count} '
+                   f'({stat.free_blocks} free)')
+        self.print(f'Name max:    {stat.name_max}')
+        self.print(f'File max:    {stat.file_max}')
+        self.print(f'Packet data: {stat.cmd_data_len} command, '
+                   f'{stat.rsp_data_len} response')
+        if stat.flags & STATFS_SCAN == 0:
+            return
+        self.print(f'Files:       {stat.num_files} files, '
+                   f'{stat.num_dirs} directories, {stat.file_bytes} bytes')
+        overhead = used_blocks - stat.file_blocks
+        if used_blocks > 0 and overhead > 0:
+            self.print(f'Overhead:    {overhead} blocks '
+                       f'{round(overhead / used_blocks * 100.0, 1)}% '
+                       'of used blocks')
+        if stat.flags & STATFS_TRUNCATED:
+            self.print('Some directories were nested too deeply to scan')
+
+    argparse_grep = (
+        add_arg('-i',
+                '--ignore-case',
+                dest='ignore_case',
+                action='store_true',
+                help='Letters match in either case.',
+                default=False),
+        add_arg('-E',
+                '--regex',
+                dest='regex',
+                action='store_true',
+                help='PATTERN is a regex (supports . * ^ $ and \\).',
+                default=False),
+        add_arg('-C',
+                '--context',
+                dest='context',
+                action='store',
+                type=int,
+                help='Lines of context to show around each match.',
+                default=0),
+        add_arg('pattern',
+                metavar='PATTERN',
+                type=str,
+                help='Text to search for.'),
+        add_arg('path',
+                metavar='PATH',
+                type=str,
+                help='File, directory or glob (like /logs/*.log) to search.'),
+    )
+
+    def do_grep(self, args) -> None:
+        """grep [-i] [-E] [-C NUM] PATTERN PATH
+
+           Searches files on the Arduino for lines containing PATTERN, and
+           shows each one with its file name, line number and offset. Only
+           the matching lines (and NUM lines of context around them) are
+           transferred. PATH may be a file, a directory (to search every file
+           in it) or a directory followed by a glob.
+        """
+        if (self.get_caps().capabilities & CAPS_SEARCH) == 0:
+            self.print('Error: SEARCH is not supported by the device')
+            return
+        flags = 0
+        if args.ignore_case:
+            flags |= SEARCH_IGNORE_CASE
+        if args.regex:
+            flags |= SEARCH_REGEX
+        _err, matches = self.search(args.path,
+                                    args.pattern,
+                                    flags,
+                                    context=args.context)
+        prev = None
+        for match in matches:
+            if (args.context > 0 and prev is not None and
+                (prev.filename != match.filename or
+                 match.line_num > prev.line_num + 1)):
+                self.print('--')
+            prev = match
+            # Like grep, context lines are shown with - rather than :
+            sep = '-' if match.flags & SEARCH_LINE_CONTEXT else ':'
+            line = match.line.decode(errors='replace')
+            if match.flags & SEARCH_LINE_TRUNCATED:
+                line += '...'
+            self.print(f'{match.filename}{sep}{match.line_num}{sep}'
+                       f'{match.offset}{sep} {line}')
+
+    argparse_hash = (
+        add_arg('--sha256',
+                dest='sha256',
+                action='store_true',
+                help='Calculate a SHA-256 rather than a CRC-32.',
+                default=False),
+        add_arg('filename',
+                metavar='FILE',
+                type=str,
+                help='Name of file on the Arduino to hash.'),
+    )
+
+    def do_hash(self, args) -> None:
+        """hash [--sha256] FILE
+
+           Calculates the CRC-32 (or SHA-256) of FILE on the Arduino, without
+           transferring the file.
+        """
+        hash_type = HASH_SHA256 if args.sha256 else HASH_CRC32
+        err, size, digest = self.hash_file(args.filename, hash_type)
+        if err != ErrorCode.NONE or digest is None:
+            return
+        if hash_type == HASH_CRC32:
+            self.print(
+                f'{int.from_bytes(digest, "little"):08x} {size:6d} {args.filename}'
+            )
+        else:
+            self.print(f'{digest.hex()} {size:6d} {args.filename}')
+
     argparse_hls = (add_arg('dirname',
                             metavar='DIR',
                             type=str,
@@ -142,24 +1039,111 @@ class LittleFsPlugin(CliPluginBase):
             for file in files:
                 self.print_file(file)
 
-    argparse_ls = (add_arg('dirname',
-                           metavar='DIR',
-                           type=str,
-                           nargs='*',
-                           help='Name of file/directory to list.'), )
+    argparse_ls = (
+        add_arg('-R',
+                '--recursive',
+                dest='recursive',
+                action='store_true',
+                help='List subdirectories recursively.',
+                default=False),
+        add_arg('dirname',
+                metavar='DIR',
+                type=str,
+                nargs='*',
+                help='Name of file/directory to list.'),
+    )
 
     def do_ls(self, args) -> None:
-        """ls DIR
+        """ls [-R] DIR
 
            Lists the files in a directory.
         """
         if not args.dirname:
             args.dirname = ['/']
         for filename in args.dirname:
-            files = self.get_files(filename)
+            if args.recursive:
+                _err, files = self.walk(filename)
+            else:
+                files = self.get_files(filename, LIST_FLAGS | LIST_SIZE)
             for file in files:
                 self.print_file(file)
 
+    def do_maintenance(self, _) -> None:
+        """maintenance
+
+            Garbage collects each file system on the device which supports it
+            (compacting metadata and erasing free blocks), so that later
+            writes don't have to.
+        """
+        err = self.run_job('Collecting file systems', JOB_MAINTENANCE)
+        if err == ErrorCode.UNSUPPORTED:
+            self.print('None of the file systems support garbage collection')
+        elif err == ErrorCode.NONE:
+            self.print('Maintenance successful')
+
+    argparse_mirror = (
+        add_arg('-n',
+                '--dry-run',
+                dest='dry_run',
+                action='store_true',
+                help='Show which files would be copied without copying them.',
+                default=False),
+        add_arg('--depth',
+                dest='depth',
+                action='store',
+                type=int,
+                help='Number of levels of directories to copy (0 = all).',
+                default=0),
+        add_arg('--pattern',
+                dest='pattern',
+                action='store',
+                type=str,
+                help='Only copy files whose names match this glob.',
+                default=''),
+        add_arg('dirname',
+                metavar='DIR',
+                type=str,
+                help='Directory on the Arduino to copy from.'),
+        add_arg('host_dirname',
+                metavar='HOSTDIR',
+                type=str,
+                help='Directory on the host to copy into.'),
+    )
+
+    def do_mirror(self, args) -> None:
+        """mirror [-n] [--depth N] [--pattern GLOB] DIR HOSTDIR
+
+           Copies all of the files under DIR on the Arduino into HOSTDIR on
+           the host. Files which already have the same size and
+           modification time are skipped.
+        """
+        err, files = self.walk(args.dirname, args.depth, args.pattern)
+        if err != ErrorCode.NONE:
+            return
+        num_copied = 0
+        num_skipped = 0
+        for file in files:
+            dst_file = path.join(args.host_dirname, *file.filename.split('/'))
+            if file.flags & FLAGS_DIR != 0:
+                if not args.dry_run:
+                    os.makedirs(dst_file, exist_ok=True)
+                continue
+            if (path.isfile(dst_file)
+                    and path.getsize(dst_file) == file.filesize
+                    and int(path.getmtime(dst_file)) == file.timestamp):
+                num_skipped += 1
+                continue
+            src_file = args.dirname.rstrip('/') + '/' + file.filename
+            self.print(f'{src_file} -> {dst_file}')
+            num_copied += 1
+            if args.dry_run:
+                continue
+            os.makedirs(path.dirname(dst_file), exist_ok=True)
+            if self.download_file(src_file, dst_file) != ErrorCode.NONE:
+                return
+            os.utime(dst_file, (file.timestamp, file.timestamp))
+        self.print(f'Copied {num_copied} files, {num_skipped} were unchanged')
+
     def print_file(self, file: File) -> None:
         """Prints a single file."""
         if file.flags & FLAGS_DIR != 0:
@@ -172,16 +1156,41 @@ class LittleFsPlugin(CliPluginBase):
     argparse_mkdir = (add_arg('dirname',
                               metavar='DIR',
                               type=str,
+                              nargs='+',
                               help='Name of directory to create.'), )
 
     def do_mkdir(self, args) -> None:
-        """mkdir DIR
+        """mkdir DIR...
 
-            Creates a directory.
+            Creates directories (in the order given).
         """
-        err = self.mkdir(args.dirname)
+        if len(args.dirname) > 1:
+            self.run_batch(MKDIR, args.dirname, 'Created directory',
+                           'creating directory')
+            return
+        err = self.mkdir(args.dirname[0])
         if err == ErrorCode.NONE:
-            self.print(f'Created directory {args.dirname}')
+            self.print(f'Created directory {args.dirname[0]}')
+
+    argparse_mv = (
+        add_arg('src',
+                metavar='SRC',
+                type=str,
+                help='Name of file or directory on the Arduino to rename.'),
+        add_arg('dst',
+                metavar='DST',
+                type=str,
+                help='New name for the file or directory.'),
+    )
+
+    def do_mv(self, args) -> None:
+        """mv SRC DST
+
+           Renames the file or directory SRC to DST on the Arduino.
+        """
+        err = self.rename(args.src, args.dst)
+        if err == ErrorCode.NONE:
+            self.print(f'Renamed {args.src} to {args.dst}')
 
     argparse_read = (
         add_arg('-o',
@@ -206,8 +1215,8 @@ class LittleFsPlugin(CliPluginBase):
 
            Read data from a file.
         """
-        length = self.calc_read_data_size()
-        err, data = self.read_file(args.filename, args.offset, length)
+        # The device clamps the length to what fits in a single response.
+        err, data = self.read_file(args.filename, args.offset, args.length)
         if err != ErrorCode.NONE or data is None:
             self.print(f'Error reading from {args.filename}')
         else:
@@ -217,18 +1226,59 @@ class LittleFsPlugin(CliPluginBase):
     argparse_remove = (add_arg('filename',
                                metavar='FILE',
                                type=str,
+                               nargs='+',
                                help='Name of file to remove.'), )
 
     def do_remove(self, args) -> None:
-        """remove FILE
+        """remove FILE...
 
-            Removes a file.
+            Removes files.
         """
-        err = self.remove(args.filename)
+        if len(args.filename) > 1:
+            self.run_batch(REMOVE, args.filename, 'Removed file',
+                           'removing file')
+            return
+        err = self.remove(args.filename[0])
         if err == ErrorCode.NONE:
-            self.print(f'File {args.filename} removed')
+            self.print(f'File {args.filename[0]} removed')
 
     argparse_upload = (
+        add_arg('-d',
+                '--delta',
+                dest='delta',
+                action='store_true',
+                help='Only send the parts of the file which have changed.',
+                default=False),
+        add_arg('--block-size',
+                dest='block_size',
+                action='store',
+                type=int,
+                help='Block size used to find changes with --delta.',
+                default=DEFAULT_DELTA_BLOCK_SIZE),
+        add_arg('-u',
+                '--update',
+                dest='update',
+                action='store_true',
+                help='Skip the upload if the file on the Arduino is the same.',
+                default=False),
+        add_arg('--verify',
+                dest='verify',
+                action='store_true',
+                help='Compare CRC-32s of the source and destination afterwards.',
+                default=False),
+        add_arg('-w',
+                '--window',
+                dest='window',
+                action='store',
+                type=int,
+                help='Number of packets in flight at once (1 disables streaming).',
+                default=DEFAULT_WINDOW),
+        add_arg('-z',
+                '--compress',
+                dest='compress',
+                action='store_true',
+                help='Compress the data sent over the serial link.',
+                default=False),
         add_arg('filename',
                 metavar='FILE',
                 type=str,
@@ -242,42 +1292,272 @@ class LittleFsPlugin(CliPluginBase):
     argparse_rmdir = (add_arg('dirname',
                               metavar='DIR',
                               type=str,
-                              help='Name of directory to create.'), )
+                              nargs='+',
+                              help='Name of directory to remove.'), )
 
     def do_rmdir(self, args) -> None:
-        """rmdir DIR
+        """rmdir DIR...
 
-            Removes a directory.
+            Removes directories (in the order given).
         """
-        err = self.rmdir(args.dirname)
+        if len(args.dirname) > 1:
+            self.run_batch(RMDIR, args.dirname, 'Removed directory',
+                           'removing directory')
+            return
+        err = self.rmdir(args.dirname[0])
+        if err == ErrorCode.NONE:
+            self.print(f'Removed directory {args.dirname[0]}')
+
+    def run_job(self, description: str, job_type: int, *args: str) -> int:
+        """Starts a job on the device and polls it until it finishes.
+
+           Returns the result of the job.
+        """
+        start = Packet(JOB_START)
+        packer = Packer(start)
+        packer.pack_u8(job_type)
+        for arg in args:
+            packer.pack_str(arg)
+        err, rsp = self.bus.send_command_get_response(start)
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} sending JOB_START command')
+            return err
+        if rsp is None:
+            self.print('Error: timeout sending JOB_START command')
+            return ErrorCode.TIMEOUT
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        job = unpacker.unpack_u8()
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} starting job')
+            return err
+
+        while True:
+            err, state, result, progress, total = self.job_status(job)
+            if err != ErrorCode.NONE:
+                self.print(f'Error: {error_str(err)} getting job status')
+                return err
+            if state == JOB_DONE:
+                self.print('')
+                if result != ErrorCode.NONE:
+                    self.print(f'Error: {error_str(result)} {description}')
+                return result
+            if total > 0:
+                self.print(f'\r{description}: {progress} of {total}', end='')
+            else:
+                self.print(f'\r{description}: {progress}', end='')
+            time.sleep(0.1)
+
+    def run_batch(self, cmd: int, names: List[str], done_msg: str,
+                  err_msg: str) -> None:
+        """Runs the same command on several names using BATCH, and reports
+           the result of each one.
+        """
+        err, errs = self.batch([(cmd, name) for name in names])
+        for name, op_err in zip(names, errs):
+            if op_err == ErrorCode.NONE:
+                self.print(f'{done_msg} {name}')
+            else:
+                self.print(f'Error: {error_str(op_err)} {err_msg} {name}')
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} sending BATCH command')
+
+    argparse_rmtree = (add_arg('dirname',
+                               metavar='DIR',
+                               type=str,
+                               help='Name of directory to remove.'), )
+
+    def do_rmtree(self, args) -> None:
+        """rmtree DIR
+
+            Removes a directory and everything inside it.
+        """
+        err = self.run_job(f'Removing {args.dirname}', JOB_RMTREE,
+                           args.dirname)
         if err == ErrorCode.NONE:
             self.print(f'Removed directory {args.dirname}')
 
+    argparse_tail = (
+        add_arg('-c',
+                '--bytes',
+                dest='bytes',
+                action='store',
+                type=int,
+                help='Number of bytes from the end of the file to show.',
+                default=1024),
+        add_arg('-f',
+                '--follow',
+                dest='follow',
+                action='store_true',
+                help='Keep showing data as it is appended to the file.',
+                default=False),
+        add_arg('-i',
+                '--interval',
+                dest='interval',
+                action='store',
+                type=int,
+                help='Shortest time between updates, in milliseconds.',
+                default=100),
+        add_arg('filename',
+                metavar='FILE',
+                type=str,
+                help='Name of file on the Arduino to show.'),
+    )
+
+    def do_tail(self, args) -> None:
+        """tail [-c BYTES] [-f] [-i MSEC] FILE
+
+           Shows the end of a file on the Arduino. With -f, data appended to
+           the file is shown as it arrives, until Ctrl-C is pressed. The
+           device sends the new data by itself, so nothing is sent while the
+           file isn't growing.
+        """
+        if (self.get_caps().capabilities & CAPS_TAIL) == 0:
+            self.print('Error: TAIL is not supported by the device')
+            return
+        err, watch, offset, size = self.tail_start(args.filename, args.bytes,
+                                                   args.interval)
+        if err != ErrorCode.NONE:
+            return
+        keepalive = time.monotonic() + TAIL_KEEPALIVE
+        try:
+            while args.follow or offset < size:
+                if args.follow and time.monotonic() >= keepalive:
+                    self.send_tail(watch, 0, args.interval)
+                    keepalive = time.monotonic() + TAIL_KEEPALIVE
+                err, rsp = self.bus.get_response(timeout=0.5)
+                if err != ErrorCode.NONE:
+                    self.print(f'Error: {error_str(err)} receiving TAIL data')
+                    return
+                if rsp is None or rsp.get_command() != TAIL:
+                    continue
+                unpacker = Unpacker(rsp.get_data())
+                err = unpacker.unpack_u8()
+                rsp_watch = unpacker.unpack_u8()
+                data_offset = unpacker.unpack_u32()
+                unpacker.unpack_u32()  # file size
+                if rsp_watch != watch:
+                    # The response to a keepalive.
+                    continue
+                if err != ErrorCode.NONE:
+                    self.print(f'Error: {error_str(err)} reading '
+                               f'{args.filename}')
+                    return
+                if data_offset < offset:
+                    self.print(f'\ntail: {args.filename}: file truncated')
+                data = rsp.get_data()[10:]
+                offset = data_offset + len(data)
+                self.print(bytes(data).decode(errors='replace'), end='')
+        except KeyboardInterrupt:
+            self.print('')
+        finally:
+            self.send_tail(watch, TAIL_STOP, 0)
+            self.drain_responses()
+
+    argparse_truncate = (
+        add_arg('filename',
+                metavar='FILE',
+                type=str,
+                help='Name of file on the Arduino to truncate.'),
+        add_arg('length',
+                metavar='LENGTH',
+                type=int,
+                help='New length of the file, in bytes.'),
+    )
+
+    def do_truncate(self, args) -> None:
+        """truncate FILE LENGTH
+
+           Sets the length of FILE, creating it if needed. Files which are
+           extended are padded with zeros, so a large file can be laid out
+           once and then filled in with write -o.
+        """
+        err = self.truncate(args.filename, args.length)
+        if err == ErrorCode.NONE:
+            self.print(f'Set length of {args.filename} to {args.length}')
+
     def do_upload(self, args) -> None:
-        """upload FILE DIR
+        """upload [-d] [--block-size N] [-u] [--verify] [-w WINDOW] [-z] FILE DIR
 
            Uploads FILE from the host to the Arduino. The file will
            be placed in the directory DIR.
+
+           If the device supports upload sessions, the existing file is
+           only replaced once all of FILE has been sent, and an upload
+           which was interrupted carries on where it left off.
         """
         src_file = args.filename
         dst_file = path.join(args.dirname, path.basename(src_file))
 
+        if args.update and path.isfile(src_file):
+            err, size, crc = self.crc32_file(dst_file)
+            if (err == ErrorCode.NONE and size == path.getsize(src_file)
+                    and crc == crc32_host_file(src_file)):
+                self.print(f'{dst_file} is unchanged')
+                return
+
         self.print(f'Uploading from {src_file} to {dst_file}')
 
-        data_size = self.calc_write_data_size(dst_file)
+        if args.delta:
+            try:
+                err = self.delta_upload(src_file, dst_file, args.block_size)
+            except FileNotFoundError as err:
+                self.print(err)
+                return
+            if err != ErrorCode.NONE:
+                self.print(f'Error: {error_str(err)} patching {dst_file}')
+                return
+            if args.verify:
+                self.verify(dst_file, src_file)
+            return
+
+        if args.compress and self.get_caps().compress_size > 0:
+            try:
+                with open(src_file, 'rb') as src:
+                    err = self.upload_compressed(dst_file, src)
+                    self.print('')
+            except FileNotFoundError as err:
+                self.print(err)
+                return
+            if err != ErrorCode.NONE:
+                self.print(f'Error: {error_str(err)} writing to {dst_file}')
+                return
+            if args.verify:
+                self.verify(dst_file, src_file)
+            return
+
+        if self.get_caps().capabilities & CAPS_UPLOAD:
+            try:
+                with open(src_file, 'rb') as src:
+                    err = self.upload_session(dst_file, src, args.window)
+            except FileNotFoundError as err:
+                self.print(err)
+                return
+            if err != ErrorCode.NONE:
+                self.print(f'Error: {error_str(err)} writing to {dst_file}')
+                return
+            if args.verify:
+                self.verify(dst_file, src_file)
+            return
+
         try:
             with open(src_file, 'rb') as src:
-                data = src.read(data_size)
-                self.write_file(dst_file, data)
-                bytes_written = len(data)
-                self.print(f'\rWrote {bytes_written} bytes', end='')
-                while (data := src.read(data_size)) != b'':
-                    self.append_file(dst_file, data)
-                    bytes_written += len(data)
-                    self.print(f'\rWrote {bytes_written} bytes', end='')
-                self.print('')
+                err, handle = self.open_file(dst_file, OPEN_WRITE)
+                if err != ErrorCode.NONE:
+                    return
+                try:
+                    err = self.upload_handle(handle, src, args.window)
+                    self.print('')
+                    if err != ErrorCode.NONE:
+                        self.print(
+                            f'Error: {error_str(err)} writing to {dst_file}')
+                finally:
+                    self.close_file(handle)
         except FileNotFoundError as err:
             self.print(err)
+            return
+        if args.verify:
+            self.verify(dst_file, src_file)
 
     argparse_write = (
         add_arg('--hex',
@@ -290,8 +1570,8 @@ class LittleFsPlugin(CliPluginBase):
                 dest='offset',
                 action='store',
                 type=int,
-                help='Offset in bytes to write data to.',
-                default=0),
+                help='Overwrite the existing file starting at this offset.',
+                default=None),
         add_arg('filename',
                 metavar='FILE',
                 type=str,
@@ -306,7 +1586,8 @@ class LittleFsPlugin(CliPluginBase):
     def do_write(self, args) -> None:
         """write [--hex] [-o OFFSET] FILE STRING...
 
-           Write data into a file.
+           Write data into a file. With -o the data overwrites part of an
+           existing file, otherwise the file is replaced.
         """
         data = bytes(' '.join(args.string), 'utf-8')
         if args.hex:
@@ -314,42 +1595,417 @@ class LittleFsPlugin(CliPluginBase):
         else:
             data += b'\n'
 
-        err = self.write_file(args.filename, data)
+        if args.offset is None:
+            err = self.write_file(args.filename, data)
+        else:
+            err, _size = self.write_at(args.filename, args.offset, data)
 
         if err != ErrorCode.NONE:
             self.print(f'Error: {error_str(err)} writing to {args.filename}')
             return
         self.print(f'Wrote {len(data)} bytes into {args.filename}')
 
-    def append_file(self, filename: str, data: Union[bytes, bytearray]) -> int:
+    def append_file(self,
+                    filename: str,
+                    data: Union[bytes, bytearray],
+                    compress: bool = False) -> int:
         """Sends an APPEND command and parses the reposnee.
 
-           The append operation appends to an existing file.
+           The append operation appends to an existing file. The device
+           buffers consecutive appends, so use flush() after the last one
+           (any other command also flushes the data).
+        """
+        return self.write_or_append_file(APPEND, filename, data, compress)
+
+    def batch(self,
+              ops: List[tuple],
+              stop_on_error: bool = False) -> Tuple[int, List[int]]:
+        """Sends BATCH commands to run several operations, packing as many
+           into each packet as will fit.
+
+           Each operation is a tuple containing the command (MKDIR, REMOVE,
+           RMDIR or RENAME) followed by its string arguments. Returns the
+           error code, and a list with the error code of each operation
+           which was run.
+        """
+        max_len = self.get_caps().cmd_data_len - 20
+        errs: List[int] = []
+        start = 0
+        while start < len(ops):
+            # The packet starts with the flags and number of operations.
+            end = start
+            batch_len = 1 + 1
+            while end < len(ops) and end - start < 255:
+                op_len = 1 + sum(len(arg.encode()) + 2 for arg in ops[end][1:])
+                if end > start and batch_len + op_len > max_len:
+                    break
+                batch_len += op_len
+                end += 1
+
+            bat = Packet(BATCH)
+            packer = Packer(bat)
+            packer.pack_u8(BATCH_STOP_ON_ERROR if stop_on_error else 0)
+            packer.pack_u8(end - start)
+            for op in ops[start:end]:
+                packer.pack_u8(op[0])
+                for arg in op[1:]:
+                    packer.pack_str(arg)
+            err, rsp = self.bus.send_command_get_response(bat, timeout=10)
+            if err != ErrorCode.NONE:
+                return (err, errs)
+            if rsp is None:
+                return (ErrorCode.TIMEOUT, errs)
+            unpacker = Unpacker(rsp.get_data())
+            err = unpacker.unpack_u8()
+            num_run = unpacker.unpack_u8()
+            op_errs = [unpacker.unpack_u8() for _ in range(num_run)]
+            errs.extend(op_errs)
+            if err != ErrorCode.NONE:
+                return (err, errs)
+            if stop_on_error and any(op_errs):
+                break
+            start = end
+        return (ErrorCode.NONE, errs)
+
+    def calc_data_size(self, packet_len: int, header_len: int) -> int:
+        """Calculates the amount of file data which fits in a packet
+           with room for packet_len bytes, after header_len bytes of other
+           fields.
+
+           Sizes larger than a LittleFS block are rounded down to a
+           multiple of the block size.
         """
-        return self.write_or_append_file(APPEND, filename, data)
+        data_size = packet_len - header_len - 20
+        block_size = self.get_caps().block_size
+        if block_size > 0 and data_size > block_size:
+            data_size -= data_size % block_size
+        return data_size
 
     def calc_read_data_size(self) -> int:
         """Calculates the maximum amount of data that can be included in
            a READ packet.
         """
-        # The beginning of the packet has the following fields
-        #   1 - Error Code
-        #   4 - Offset
-        #   4 - Length
-        #   The remainder of the packet is the data
-        header_len = 1 + 4 + 4
-        return Packet.MAX_DATA_LEN - header_len - 20
+        # The beginning of the packet has the following fields
+        #   1 - Error Code
+        #   4 - Offset
+        #   4 - Length
+        #   The remainder of the packet is the data
+        header_len = 1 + 4 + 4
+        return self.calc_data_size(self.get_caps().rsp_data_len, header_len)
+
+    def calc_write_data_size(self, filename: str) -> int:
+        """Calculates the maximum amount of data that can be included in
+           a WRITE or APPEND packet.
+        """
+        # The beginning of the packet has the following fields
+        #   N - Filename (N = length of filename + 2)
+        #   4 - Length of data
+        #   The remainder of the packet is the data
+        header_len = len(filename) + 2 + 4
+        return self.calc_data_size(self.get_caps().cmd_data_len, header_len)
+
+    def calc_write_at_data_size(self, filename: str) -> int:
+        """Calculates the maximum amount of data that can be included in
+           a WRITE_AT packet.
+        """
+        # The beginning of the packet has the following fields
+        #   N - Filename (N = length of filename + 2)
+        #   4 - Offset
+        #   4 - Length of data
+        #   The remainder of the packet is the data
+        header_len = len(filename) + 2 + 4 + 4
+        return self.calc_data_size(self.get_caps().cmd_data_len, header_len)
+
+    def calc_write_handle_data_size(self) -> int:
+        """Calculates the maximum amount of data that can be included in
+           a WRITE_HANDLE packet.
+        """
+        # The beginning of the packet has the following fields
+        #   1 - Handle
+        #   4 - Offset
+        #   4 - Length of data
+        #   The remainder of the packet is the data
+        header_len = 1 + 4 + 4
+        return self.calc_data_size(self.get_caps().cmd_data_len, header_len)
+
+    def close_file(self, handle: int) -> int:
+        """Sends a CLOSE command and parses the response."""
+        close = Packet(CLOSE)
+        packer = Packer(close)
+        packer.pack_u8(handle)
+        err, rsp = self.bus.send_command_get_response(close, timeout=10)
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} sending CLOSE command')
+            return err
+        if rsp is None:
+            self.print('Error: timeout sending CLOSE command')
+            return ErrorCode.TIMEOUT
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} closing handle {handle}')
+            return err
+        return ErrorCode.NONE
+
+    def calc_stream_read_data_size(self) -> int:
+        """Calculates the maximum amount of data that can be included in
+           a STREAM_READ response packet.
+        """
+        # The beginning of the packet has the following fields
+        #   1 - Error Code
+        #   1 - Flags
+        #   1 - Sequence number
+        #   4 - Offset
+        #   4 - Length
+        #   The remainder of the packet is the data
+        header_len = 1 + 1 + 1 + 4 + 4
+        return self.calc_data_size(self.get_caps().rsp_data_len, header_len)
+
+    def calc_stream_write_data_size(self) -> int:
+        """Calculates the maximum amount of data that can be included in
+           a STREAM_WRITE packet.
+        """
+        # The beginning of the packet has the following fields
+        #   1 - Handle
+        #   1 - Sequence number
+        #   4 - Offset
+        #   4 - Length of data
+        #   The remainder of the packet is the data
+        header_len = 1 + 1 + 4 + 4
+        return self.calc_data_size(self.get_caps().cmd_data_len, header_len)
+
+    def copy(self, src: str, dst: str) -> int:
+        """Sends a COPY command and parses the responses.
+
+           The device sends progress responses while copying large files.
+        """
+        cpy = Packet(COPY)
+        packer = Packer(cpy)
+        packer.pack_str(src)
+        packer.pack_str(dst)
+        self.bus.send_command(cpy)
+        while True:
+            err, rsp = self.bus.get_response(timeout=10)
+            if err != ErrorCode.NONE:
+                self.print(f'Error: {error_str(err)} sending COPY command')
+                return err
+            if rsp is None:
+                self.print('Error: timeout sending COPY command')
+                return ErrorCode.TIMEOUT
+            unpacker = Unpacker(rsp.get_data())
+            err = unpacker.unpack_u8()
+            flags = unpacker.unpack_u8()
+            copied = unpacker.unpack_u32()
+            size = unpacker.unpack_u32()
+            if err != ErrorCode.NONE:
+                self.print(f'Error: {error_str(err)} copying {src} to {dst}')
+                return err
+            if flags & STREAM_LAST:
+                return ErrorCode.NONE
+            self.print(f'\rCopied {copied} of {size} bytes', end='')
+
+    def crc32_file(self, filename: str) -> Tuple[int, int, int]:
+        """Calculates the CRC-32 of a file on the device.
+
+           Returns the error code, the size of the file and the CRC.
+        """
+        err, size, digest = self.hash_file(filename, HASH_CRC32)
+        if err != ErrorCode.NONE or digest is None:
+            return (err, 0, 0)
+        return (ErrorCode.NONE, size, int.from_bytes(digest, 'little'))
+
+    def delta_upload(self, src_file: str, dst_file: str,
+                     block_size: int) -> int:
+        """Uploads src_file to dst_file, only sending the blocks which aren't
+           already present in dst_file on the device.
+        """
+        with open(src_file, 'rb') as src:
+            data = src.read()
+
+        err, size, blocks = self.get_signature(dst_file, block_size)
+        if err != ErrorCode.NONE:
+            # The destination doesn't exist, so send everything.
+            size = 0
+            blocks = []
+        # Only full blocks can be matched.
+        blocks = blocks[:size // block_size]
+
+        literal_size = self.calc_data_size(self.get_caps().cmd_data_len,
+                                           1 + 1 + 4)
+        ops: List[tuple] = [(PATCH_BEGIN, dst_file, block_size)]
+        num_copied = 0
+        for instr in delta_instructions(data, block_size, blocks):
+            if isinstance(instr, int):
+                num_copied += 1
+                if (ops[-1][0] == PATCH_COPY
+                        and ops[-1][1] + ops[-1][2] == instr):
+                    ops[-1] = (PATCH_COPY, ops[-1][1], ops[-1][2] + 1)
+                else:
+                    ops.append((PATCH_COPY, instr, 1))
+            else:
+                for offset in range(0, len(instr), literal_size):
+                    ops.append(
+                        (PATCH_LITERAL, instr[offset:offset + literal_size]))
+        ops.append((PATCH_END, zlib.crc32(data)))
+
+        err = self.send_patch(ops)
+        if err == ErrorCode.NONE:
+            self.print(f'Reused {num_copied} blocks of {block_size} bytes, '
+                       f'sent {len(data) - num_copied * block_size} bytes')
+        return err
+
+    def download_compressed(self, filename: str, dst: BinaryIO) -> int:
+        """Reads filename using READ_COMPRESSED, writing the data to dst."""
+        offset = 0
+        while True:
+            err, data = self.read_file(filename,
+                                       offset,
+                                       self.get_caps().compress_size,
+                                       compress=True)
+            if err != ErrorCode.NONE or data is None:
+                return err
+            if not data:
+                return ErrorCode.NONE
+            offset += len(data)
+            self.print(f'\rRead {offset} bytes', end='')
+            dst.write(data)
+
+    def download_file(self, src_file: str, dst_file: str) -> int:
+        """Downloads src_file from the device, storing it in dst_file."""
+        err, handle = self.open_file(src_file, OPEN_READ)
+        if err != ErrorCode.NONE:
+            return err
+        try:
+            with open(dst_file, 'wb') as dst:
+                err = self.download_handle(handle, dst, DEFAULT_WINDOW)
+        finally:
+            self.close_file(handle)
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} reading from {src_file}')
+        return err
+
+    def download_handle(self, handle: int, dst: BinaryIO, window: int) -> int:
+        """Reads the file opened as handle, writing the data to dst.
+
+           STREAM_READ is used when window is greater than 1, falling back
+           to READ_HANDLE if the device doesn't support it.
+        """
+        data_size = self.calc_read_data_size()
+        if (self.get_caps().capabilities & CAPS_STREAM) == 0:
+            window = 1
+        offset = 0
+        while True:
+            if window > 1:
+                err, data, eof = self.stream_read(handle, offset, window)
+                if err != ErrorCode.NONE and offset == 0:
+                    window = 1
+                    continue
+            else:
+                err, data = self.read_handle(handle, offset, data_size)
+                eof = not data
+            if err != ErrorCode.NONE:
+                return err
+            if data:
+                offset += len(data)
+                self.print(f'\rRead {offset} bytes', end='')
+                dst.write(data)
+            if eof:
+                return ErrorCode.NONE
+
+    def drain_responses(self) -> None:
+        """Discards any responses which are still in flight."""
+        while True:
+            err, rsp = self.bus.get_response(timeout=0.5)
+            if err != ErrorCode.NONE or rsp is None:
+                return
+
+    def export_archive(
+            self,
+            dirname: str,
+            flags: int = 0,
+            window: int = DEFAULT_WINDOW) -> Tuple[int, bytearray]:
+        """Sends EXPORT commands to read everything inside dirname as an
+           archive.
+
+           Returns the error code and the (uncompressed) archive.
+        """
+        if (self.get_caps().capabilities & CAPS_STREAM) == 0:
+            window = 1
+        if self.get_caps().compress_size == 0:
+            flags &= ~EXPORT_COMPRESS
+        archive = bytearray()
+        cursor = NO_CURSOR
+        while True:
+            exp = Packet(EXPORT)
+            packer = Packer(exp)
+            packer.pack_u8(cursor)
+            packer.pack_u8(window)
+            if cursor == NO_CURSOR:
+                packer.pack_u8(flags)
+                packer.pack_str(dirname)
+            self.bus.send_command(exp)
+
+            while True:
+                err, rsp = self.bus.get_response(timeout=10)
+                if err != ErrorCode.NONE:
+                    self.print(
+                        f'Error: {error_str(err)} sending EXPORT command')
+                    return (err, archive)
+                if rsp is None:
+                    self.print('Error: timeout sending EXPORT command')
+                    return (ErrorCode.TIMEOUT, archive)
+                unpacker = Unpacker(rsp.get_data())
+                err = unpacker.unpack_u8()
+                rsp_flags = unpacker.unpack_u8()
+                _seq = unpacker.unpack_u8()
+                cursor = unpacker.unpack_u8()
+                offset = unpacker.unpack_u32()
+                codec = unpacker.unpack_u8()
+                length = unpacker.unpack_u32()
+                if err != ErrorCode.NONE:
+                    self.print(f'\nError: {error_str(err)} exporting '
+                               f'{dirname}')
+                    return (err, archive)
+                if offset != len(archive):
+                    # A packet was lost, and the device has moved on.
+                    self.print(f'\nError: lost part of the archive of '
+                               f'{dirname}')
+                    self.drain_responses()
+                    return (ERR_OUT_OF_SEQUENCE, archive)
+                data = bytes(rsp.get_data()[13:])
+                if codec == CODEC_LZ4:
+                    data = lz4_decompress(data)
+                if len(data) != length:
+                    self.print('\nError: EXPORT data has the wrong length')
+                    return (ERR_READ_FAILED, archive)
+                archive += data
+                self.print(f'\rRead {len(archive)} bytes', end='')
+                if rsp_flags & STREAM_LAST:
+                    break
+            if cursor == NO_CURSOR:
+                self.print('')
+                return (ErrorCode.NONE, archive)
 
-    def calc_write_data_size(self, filename: str) -> int:
-        """Calculates the maximum amount of data that can be included in
-           a WRITE or APPEND packet.
+    def flush(self) -> int:
+        """Sends a FLUSH command to the Arduino.
+
+           APPEND data is buffered on the device until the end of a block is
+           reached, so this should be sent after the last APPEND.
         """
-        # The beginning of the packet has the following fields
-        #   N - Filename (N = length of filename + 2)
-        #   4 - Length of data
-        #   The remainder of the packet is the data
-        header_len = len(filename) + 2 + 4
-        return Packet.MAX_DATA_LEN - header_len - 20
+        flush = Packet(FLUSH)
+        err, rsp = self.bus.send_command_get_response(flush, timeout=10)
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} sending FLUSH command')
+            return err
+        if rsp is None:
+            self.print('Error: timeout sending FLUSH command')
+            return ErrorCode.TIMEOUT
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} flushing buffered data')
+            return err
+        return ErrorCode.NONE
 
     def format(self) -> int:
         """Sends a FORMAT command to the Arduino."""
@@ -368,6 +2024,177 @@ class LittleFsPlugin(CliPluginBase):
             return err
         return ErrorCode.NONE
 
+    def get_caps(self) -> Caps:
+        """Sends a CAPS command and parses the response.
+
+           The result is remembered, so only the first call talks to the
+           device. Devices which don't support CAPS are assumed to use
+           Packet.MAX_DATA_LEN sized buffers and have no optional features.
+        """
+        if self.caps is not None:
+            return self.caps
+        self.caps = Caps(0, Packet.MAX_DATA_LEN, Packet.MAX_DATA_LEN, 0, 1, 0)
+        caps = Packet(CAPS)
+        err, rsp = self.bus.send_command_get_response(caps)
+        if err == ErrorCode.NONE and rsp is not None:
+            unpacker = Unpacker(rsp.get_data())
+            capabilities = unpacker.unpack_u32()
+            cmd_data_len = unpacker.unpack_u32()
+            rsp_data_len = unpacker.unpack_u32()
+            block_size = unpacker.unpack_u32()
+            write_window = unpacker.unpack_u8()
+            compress_size = 0
+            if unpacker.more_data():
+                compress_size = unpacker.unpack_u32()
+            if (capabilities & CAPS_COMPRESSION) == 0:
+                compress_size = 0
+            self.caps = Caps(capabilities, cmd_data_len, rsp_data_len,
+                             block_size, write_window, compress_size)
+        return self.caps
+
+    def stats(
+            self,
+            reset: bool = False
+    ) -> Tuple[int, List[Tuple[str, int, int, int, int]]]:
+        """Sends STATS commands until all of the counters have been returned.
+
+           Returns the error code, and a list containing the (name, count,
+           bytes, total microseconds, max microseconds) of each file
+           operation and command which has run. Lowercase names are file
+           operations, and uppercase names are commands.
+        """
+        entries = []
+        index = 0
+        while True:
+            sts = Packet(STATS)
+            packer = Packer(sts)
+            packer.pack_u8(STATS_RESET if reset else 0)
+            packer.pack_u8(index)
+            err, rsp = self.bus.send_command_get_response(sts)
+            if err != ErrorCode.NONE:
+                self.print(f'Error: {error_str(err)} sending STATS command')
+                return (err, [])
+            if rsp is None:
+                self.print('Error: timeout sending STATS command')
+                return (ErrorCode.TIMEOUT, [])
+            unpacker = Unpacker(rsp.get_data())
+            err = unpacker.unpack_u8()
+            index = unpacker.unpack_u8()
+            if err != ErrorCode.NONE:
+                self.print(f'Error: {error_str(err)} getting stats')
+                return (err, [])
+            while unpacker.more_data():
+                entry_id = unpacker.unpack_u8()
+                if entry_id < len(STATS_PHASE_STRS):
+                    name = STATS_PHASE_STRS[entry_id]
+                else:
+                    name = command_str(entry_id)
+                count = unpacker.unpack_u32()
+                num_bytes = unpacker.unpack_u32()
+                total_usec = unpacker.unpack_u32()
+                max_usec = unpacker.unpack_u32()
+                entries.append((name, count, num_bytes, total_usec, max_usec))
+            if index == 0:
+                return (ErrorCode.NONE, entries)
+
+    def stat(self,
+             filename: str,
+             dir_size: bool = False,
+             no_cache: bool = False) -> Tuple[int, File, int]:
+        """Sends a STAT command and parses the response.
+
+           Returns the error code, the file (with a filenum of 0) and the
+           STAT flags of the response.
+        """
+        stat = Packet(STAT)
+        packer = Packer(stat)
+        flags = STAT_DIR_SIZE if dir_size else 0
+        if no_cache:
+            flags |= STAT_NO_CACHE
+        packer.pack_u8(flags)
+        packer.pack_str(filename)
+        empty = File(0, 0, 0, 0, filename)
+        err, rsp = self.bus.send_command_get_response(stat, timeout=10)
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} sending STAT command')
+            return (err, empty, 0)
+        if rsp is None:
+            self.print('Error: timeout sending STAT command')
+            return (ErrorCode.TIMEOUT, empty, 0)
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} getting info for {filename}')
+            return (err, empty, 0)
+        rsp_flags = unpacker.unpack_u8()
+        file_flags = unpacker.unpack_u8()
+        filesize = unpacker.unpack_u32()
+        timestamp = unpacker.unpack_u32()
+        file = File(0, file_flags, filesize, timestamp, filename)
+        return (ErrorCode.NONE, file, rsp_flags)
+
+    def statfs(self,
+               scan: bool = False,
+               dirname: Union[str, None] = None) -> Tuple[int, StatFs]:
+        """Sends a STATFS command and parses the response."""
+        statfs = Packet(STATFS)
+        packer = Packer(statfs)
+        packer.pack_u8(STATFS_SCAN if scan else 0)
+        if dirname is not None:
+            packer.pack_str(dirname)
+        empty = StatFs(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0)
+        err, rsp = self.bus.send_command_get_response(statfs, timeout=10)
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} sending STATFS command')
+            return (err, empty)
+        if rsp is None:
+            self.print('Error: timeout sending STATFS command')
+            return (ErrorCode.TIMEOUT, empty)
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} getting file system stats')
+            return (err, empty)
+        flags = unpacker.unpack_u8()
+        values = [unpacker.unpack_u32() for _ in range(11)]
+        return (ErrorCode.NONE, StatFs(flags, *values))
+
+    def get_signature(
+            self, filename: str,
+            block_size: int) -> Tuple[int, int, List[Tuple[int, int]]]:
+        """Sends SIGNATURE commands to get the checksums of every block of a
+           file on the device.
+
+           Returns the error code, the size of the file, and a list
+           containing the (weak checksum, CRC-32) of each block.
+        """
+        blocks = []
+        size = 0
+        while True:
+            sig = Packet(SIGNATURE)
+            packer = Packer(sig)
+            packer.pack_str(filename)
+            packer.pack_u32(block_size)
+            packer.pack_u32(len(blocks))
+            err, rsp = self.bus.send_command_get_response(sig, timeout=10)
+            if err != ErrorCode.NONE:
+                return (err, 0, [])
+            if rsp is None:
+                return (ErrorCode.TIMEOUT, 0, [])
+            unpacker = Unpacker(rsp.get_data())
+            err = unpacker.unpack_u8()
+            size = unpacker.unpack_u32()
+            _first_block = unpacker.unpack_u32()
+            if err != ErrorCode.NONE:
+                return (err, 0, [])
+            num_blocks = len(blocks)
+            while unpacker.more_data():
+                weak = unpacker.unpack_u32()
+                crc = unpacker.unpack_u32()
+                blocks.append((weak, crc))
+            if len(blocks) == num_blocks or len(blocks) * block_size >= size:
+                return (ErrorCode.NONE, size, blocks)
+
     def get_host_files(self, dirname: str) -> List[File]:
         """Retrieves a list of files from the host computer."""
         files = []
@@ -384,15 +2211,64 @@ class LittleFsPlugin(CliPluginBase):
                 filenum += 1
         return sorted(files, key=attrgetter("filename"))
 
-    def get_files(self, dirname: str) -> List[File]:
-        """Retrieves a list of files from the device."""
+    def get_files(self, dirname: str, fields: int = LIST_ALL) -> List[File]:
+        """Retrieves a list of files from the device.
+
+           fields selects which of the flags, size and timestamp are needed.
+           Devices which support LIST_COMPACT then only send those, and any
+           that weren't requested are returned as zero.
+        """
         files = []
-        index = 0
-        while some_files := self.list_files(index, dirname):
+        cursor = NO_CURSOR
+        compact = (self.get_caps().capabilities & CAPS_LIST_COMPACT) != 0
+        while True:
+            if compact:
+                err, cursor, some_files = self.list_files_compact(
+                    cursor, dirname, fields, len(files))
+            else:
+                err, cursor, some_files = self.list_files_cursor(
+                    cursor, dirname)
+            if err != ErrorCode.NONE:
+                break
             files.extend(some_files)
-            index += len(some_files)
+            if cursor == NO_CURSOR:
+                break
         return sorted(files, key=attrgetter("filename"))
 
+    def hash_file(
+            self,
+            filename: str,
+            hash_type: int,
+            offset: int = 0,
+            length: int = TO_END_OF_FILE
+    ) -> Tuple[int, int, Union[None, bytes, bytearray]]:
+        """Sends a HASH command and parses the response.
+
+           Returns the error code, the number of bytes hashed and the digest.
+        """
+        hsh = Packet(HASH)
+        packer = Packer(hsh)
+        packer.pack_str(filename)
+        packer.pack_u32(offset)
+        packer.pack_u32(length)
+        packer.pack_u8(hash_type)
+        err, rsp = self.bus.send_command_get_response(hsh, timeout=10)
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} sending HASH command')
+            return (err, 0, None)
+        if rsp is None:
+            self.print('Error: timeout sending HASH command')
+            return (ErrorCode.TIMEOUT, 0, None)
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        size = unpacker.unpack_u32()
+        digest_len = unpacker.unpack_u8()
+        digest = unpacker.unpack_data(digest_len)
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} hashing {filename}')
+            return (err, 0, None)
+        return (ErrorCode.NONE, size, digest)
+
     def list_files(self, index: int, filename: str) -> List[File]:
         """Sends a LIST command and parses the response."""
         files = []
@@ -416,6 +2292,196 @@ class LittleFsPlugin(CliPluginBase):
             files.append(File(filenum, flags, filesize, timestamp, filename))
         return files
 
+    def import_archive(self,
+                       dirname: str,
+                       archive: Union[bytes, bytearray],
+                       window: int = DEFAULT_WINDOW,
+                       compress: bool = False) -> int:
+        """Sends IMPORT commands to unpack archive into dirname, keeping
+           up to window chunks in flight.
+
+           Chunks which compress are sent using LZ4 when compress is set.
+        """
+        if (self.get_caps().capabilities & CAPS_STREAM) == 0:
+            window = 1
+        compress_size = self.get_caps().compress_size if compress else 0
+        # The beginning of the packet has the following fields
+        #   1 - Flags
+        #   4 - Offset
+        #   n - Directory name (only in the first chunk)
+        #   1 - Codec
+        #   4 - Length
+        #   4 - Length of data
+        #   The remainder of the packet is the data
+        header_len = 1 + 4 + len(dirname) + 2 + 1 + 4 + 4
+        data_size = self.calc_data_size(self.get_caps().cmd_data_len,
+                                        header_len)
+        offset = 0  # Offset of the next chunk to send
+        committed = 0  # Offset acknowledged by the device
+        pending = 0
+        retries = 0
+        while True:
+            # Only the first chunk is sent until the device has started the
+            # import, so that a lost BEGIN can't leave chunks to be applied to
+            # an earlier import.
+            while offset < len(archive) and pending < (window
+                                                       if committed else 1):
+                codec = CODEC_NONE
+                data = bytes(archive[offset:offset + data_size])
+                if compress_size > 0:
+                    chunk = archive[offset:offset + compress_size]
+                    compressed = lz4_compress(chunk)
+                    if len(compressed) <= data_size and len(
+                            compressed) < len(chunk):
+                        codec = CODEC_LZ4
+                        data = bytes(chunk)
+                imp = Packet(IMPORT)
+                packer = Packer(imp)
+                packer.pack_u8(IMPORT_BEGIN if offset == 0 else 0)
+                packer.pack_u32(offset)
+                if offset == 0:
+                    packer.pack_str(dirname)
+                packer.pack_u8(codec)
+                packer.pack_u32(len(data))
+                if codec == CODEC_LZ4:
+                    packer.pack_u32(len(compressed))
+                    packer.pack_data(compressed)
+                else:
+                    packer.pack_u32(len(data))
+                    packer.pack_data(data)
+                self.bus.send_command(imp)
+                offset += len(data)
+                pending += 1
+            if pending == 0:
+                return ErrorCode.NONE
+
+            err, rsp = self.bus.get_response(timeout=10)
+            if err == ErrorCode.NONE and rsp is not None:
+                pending -= 1
+                unpacker = Unpacker(rsp.get_data())
+                err = unpacker.unpack_u8()
+                rsp_flags = unpacker.unpack_u8()
+                r_committed = unpacker.unpack_u32()
+                if err == ErrorCode.NONE:
+                    committed = max(committed, r_committed)
+                    self.print(f'\rWrote {committed} bytes', end='')
+                    if pending == 0 and offset >= len(archive) and (
+                            rsp_flags & STREAM_END_OF_FILE) == 0:
+                        # Everything was sent, but the device didn't see
+                        # the end of the archive.
+                        return ERR_READ_FAILED
+                    continue
+                if err != ERR_OUT_OF_SEQUENCE:
+                    return err
+                committed = r_committed
+
+            # A chunk (or its response) was lost. Throw away whatever is
+            # still in flight and resend everything after committed.
+            retries += 1
+            if retries > 3:
+                return ErrorCode.TIMEOUT
+            self.drain_responses()
+            pending = 0
+            offset = committed
+
+    def job_status(self, job: int) -> Tuple[int, int, int, int, int]:
+        """Sends a JOB_STATUS command and parses the response.
+
+           Returns the error code, the state of the job, the result of the
+           job, and the progress and total.
+        """
+        status = Packet(JOB_STATUS)
+        packer = Packer(status)
+        packer.pack_u8(job)
+        err, rsp = self.bus.send_command_get_response(status)
+        if err != ErrorCode.NONE:
+            return (err, JOB_DONE, 0, 0, 0)
+        if rsp is None:
+            return (ErrorCode.TIMEOUT, JOB_DONE, 0, 0, 0)
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        state = unpacker.unpack_u8()
+        result = unpacker.unpack_u8()
+        progress = unpacker.unpack_u32()
+        total = unpacker.unpack_u32()
+        return (err, state, result, progress, total)
+
+    def list_files_compact(self, cursor: int, dirname: str, fields: int,
+                           index: int) -> Tuple[int, int, List[File]]:
+        """Sends a LIST_COMPACT command and parses the response.
+
+           Works like list_files_cursor, but only the requested fields are
+           sent, and each name is sent as the number of characters it
+           shares with the previous name, followed by the rest of it. index
+           is the file number to give the first file returned.
+        """
+        files = []
+        lst = Packet(LIST_COMPACT)
+        packer = Packer(lst)
+        packer.pack_u8(cursor)
+        packer.pack_u8(fields)
+        packer.pack_str(dirname)
+        err, rsp = self.bus.send_command_get_response(lst)
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} sending LIST_COMPACT command')
+            return (err, NO_CURSOR, [])
+        if rsp is None:
+            self.print('Error: timeout sending LIST_COMPACT command')
+            return (ErrorCode.TIMEOUT, NO_CURSOR, [])
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        cursor = unpacker.unpack_u8()
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} listing {dirname}')
+            return (err, NO_CURSOR, [])
+        name = b''
+        while unpacker.more_data():
+            flags = unpacker.unpack_u8() if fields & LIST_FLAGS else 0
+            filesize = unpacker.unpack_u32() if fields & LIST_SIZE else 0
+            timestamp = unpacker.unpack_u32() if fields & LIST_TIMESTAMP else 0
+            prefix_len = unpacker.unpack_u8()
+            suffix_len = unpacker.unpack_u8()
+            name = name[:prefix_len] + bytes(unpacker.unpack_data(suffix_len))
+            files.append(File(index, flags, filesize, timestamp,
+                              name.decode()))
+            index += 1
+        return (ErrorCode.NONE, cursor, files)
+
+    def list_files_cursor(self, cursor: int,
+                          dirname: str) -> Tuple[int, int, List[File]]:
+        """Sends a LIST_CURSOR command and parses the response.
+
+           Pass NO_CURSOR to start a new listing, and the returned cursor to
+           continue it. The returned cursor is NO_CURSOR once all of the
+           files have been returned.
+        """
+        files = []
+        lst = Packet(LIST_CURSOR)
+        packer = Packer(lst)
+        packer.pack_u8(cursor)
+        packer.pack_str(dirname)
+        err, rsp = self.bus.send_command_get_response(lst)
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} sending LIST_CURSOR command')
+            return (err, NO_CURSOR, [])
+        if rsp is None:
+            self.print('Error: timeout sending LIST_CURSOR command')
+            return (ErrorCode.TIMEOUT, NO_CURSOR, [])
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        cursor = unpacker.unpack_u8()
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} listing {dirname}')
+            return (err, NO_CURSOR, [])
+        while unpacker.more_data():
+            filenum = unpacker.unpack_u16()
+            flags = unpacker.unpack_u8()
+            filesize = unpacker.unpack_u32()
+            timestamp = unpacker.unpack_u32()
+            filename = str(unpacker.unpack_str())
+            files.append(File(filenum, flags, filesize, timestamp, filename))
+        return (ErrorCode.NONE, cursor, files)
+
     def mkdir(self, dirname: str) -> int:
         """Sends a MKDIR command annd parses the response."""
         mkd = Packet(MKDIR)
@@ -435,9 +2501,73 @@ class LittleFsPlugin(CliPluginBase):
             return err
         return ErrorCode.NONE
 
-    def read_file(self, filename: str, offset: int,
-                  length: int) -> Tuple[int, Union[None, bytes, bytearray]]:
-        """Sends a READ command and parses the response."""
+    def open_file(self, filename: str, mode: int) -> Tuple[int, int]:
+        """Sends an OPEN command and parses the response.
+
+           Returns the error code and the handle to use with READ_HANDLE,
+           WRITE_HANDLE and CLOSE.
+        """
+        opn = Packet(OPEN)
+        packer = Packer(opn)
+        packer.pack_u8(mode)
+        packer.pack_str(filename)
+        err, rsp = self.bus.send_command_get_response(opn)
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} sending OPEN command')
+            return (err, 0)
+        if rsp is None:
+            self.print('Error: timeout sending OPEN command')
+            return (ErrorCode.TIMEOUT, 0)
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        handle = unpacker.unpack_u8()
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} opening {filename}')
+            return (err, 0)
+        return (ErrorCode.NONE, handle)
+
+    def patch(self, ops: List[tuple]) -> int:
+        """Sends a single PATCH command containing ops and parses the
+           response.
+        """
+        pch = Packet(PATCH)
+        packer = Packer(pch)
+        packer.pack_u8(len(ops))
+        for op in ops:
+            packer.pack_u8(op[0])
+            if op[0] == PATCH_BEGIN:
+                packer.pack_str(op[1])
+                packer.pack_u32(op[2])
+            elif op[0] == PATCH_COPY:
+                packer.pack_u32(op[1])
+                packer.pack_u32(op[2])
+            elif op[0] == PATCH_LITERAL:
+                packer.pack_u32(len(op[1]))
+                packer.pack_data(op[1])
+            elif op[0] == PATCH_END:
+                packer.pack_u32(op[1])
+        err, rsp = self.bus.send_command_get_response(pch, timeout=10)
+        if err != ErrorCode.NONE:
+            return err
+        if rsp is None:
+            return ErrorCode.TIMEOUT
+        unpacker = Unpacker(rsp.get_data())
+        return unpacker.unpack_u8()
+
+    def read_file(self,
+                  filename: str,
+                  offset: int,
+                  length: int,
+                  compress: bool = False
+                  ) -> Tuple[int, Union[None, bytes, bytearray]]:
+        """Sends a READ command and parses the response.
+
+           When compress is True (and the device supports it) a
+           READ_COMPRESSED command is used instead, and the data is
+           decompressed before being returned.
+        """
+        if compress and self.get_caps().compress_size > 0:
+            return self.read_file_compressed(filename, offset, length)
         read = Packet(READ)
         packer = Packer(read)
         packer.pack_str(filename)
@@ -459,6 +2589,280 @@ class LittleFsPlugin(CliPluginBase):
             return (err, None)
         return (ErrorCode.NONE, data)
 
+    def read_file_compressed(
+            self, filename: str, offset: int,
+            length: int) -> Tuple[int, Union[None, bytes, bytearray]]:
+        """Sends a READ_COMPRESSED command and parses the response."""
+        read = Packet(READ_COMPRESSED)
+        packer = Packer(read)
+        packer.pack_str(filename)
+        packer.pack_u32(offset)
+        packer.pack_u32(length)
+        err, rsp = self.bus.send_command_get_response(read)
+        if err != ErrorCode.NONE:
+            return (err, None)
+        if rsp is None:
+            return (ErrorCode.TIMEOUT, None)
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        _r_offset = unpacker.unpack_u32()
+        r_length = unpacker.unpack_u32()
+        codec = unpacker.unpack_u8()
+        data_len = unpacker.unpack_u32()
+        data = unpacker.unpack_data(data_len)
+
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} reading from {filename}')
+            return (err, None)
+        if codec == CODEC_LZ4:
+            try:
+                data = lz4_decompress(data)
+            except ValueError as val_err:
+                self.print(f'Error: {val_err} reading from {filename}')
+                return (ERR_READ_FAILED, None)
+        if len(data) != r_length:
+            self.print(f'Error: expected {r_length} bytes from {filename}')
+            return (ERR_READ_FAILED, None)
+        return (ErrorCode.NONE, data)
+
+    def read_handle(self, handle: int, offset: int,
+                    length: int) -> Tuple[int, Union[None, bytes, bytearray]]:
+        """Sends a READ_HANDLE command and parses the response."""
+        read = Packet(READ_HANDLE)
+        packer = Packer(read)
+        packer.pack_u8(handle)
+        packer.pack_u32(offset)
+        packer.pack_u32(length)
+        err, rsp = self.bus.send_command_get_response(read)
+        if err != ErrorCode.NONE:
+            return (err, None)
+        if rsp is None:
+            return (ErrorCode.TIMEOUT, None)
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        _r_offset = unpacker.unpack_u32()
+        r_length = unpacker.unpack_u32()
+        data = unpacker.unpack_data(r_length)
+
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} reading from handle {handle}')
+            return (err, None)
+        return (ErrorCode.NONE, data)
+
+    def search(self,
+               path: str,
+               pattern: str,
+               flags: int = 0,
+               window: int = DEFAULT_WINDOW,
+               context: int = 0) -> Tuple[int, List[Match]]:
+        """Sends SEARCH commands to find the lines of the files at path
+           which match pattern.
+
+           path may be a file, a directory or a directory followed by a
+           glob. Lines longer than the device's line buffer are returned in
+           pieces, each with the line number of the whole line. context
+           lines before and after each match are returned too (flagged with
+           SEARCH_LINE_CONTEXT), up to the device's limit.
+        """
+        if (self.get_caps().capabilities & CAPS_STREAM) == 0:
+            window = 1
+        matches = []
+        cursor = NO_CURSOR
+        while True:
+            srch = Packet(SEARCH)
+            packer = Packer(srch)
+            packer.pack_u8(cursor)
+            packer.pack_u8(window)
+            if cursor == NO_CURSOR:
+                packer.pack_u8(flags)
+                packer.pack_str(path)
+                packer.pack_str(pattern)
+                packer.pack_u8(min(context, 255))
+            self.bus.send_command(srch)
+
+            seq = 0
+            while True:
+                err, rsp = self.bus.get_response(timeout=5)
+                if err != ErrorCode.NONE:
+                    self.print(
+                        f'Error: {error_str(err)} sending SEARCH command')
+                    return (err, matches)
+                if rsp is None:
+                    self.print('Error: timeout sending SEARCH command')
+                    return (ErrorCode.TIMEOUT, matches)
+                unpacker = Unpacker(rsp.get_data())
+                err = unpacker.unpack_u8()
+                rsp_flags = unpacker.unpack_u8()
+                r_seq = unpacker.unpack_u8()
+                cursor = unpacker.unpack_u8()
+                if err != ErrorCode.NONE:
+                    self.print(f'Error: {error_str(err)} searching {path}')
+                    return (err, matches)
+                if r_seq != seq:
+                    # A packet was lost, and the device has moved on.
+                    self.print(f'Error: lost part of the results for {path}')
+                    self.drain_responses()
+                    return (ERR_OUT_OF_SEQUENCE, matches)
+                seq += 1
+                while unpacker.more_data():
+                    filename = str(unpacker.unpack_str())
+                    line_num = unpacker.unpack_u32()
+                    offset = unpacker.unpack_u32()
+                    line_flags = unpacker.unpack_u8()
+                    line_len = unpacker.unpack_u16()
+                    line = bytes(unpacker.unpack_data(line_len))
+                    matches.append(
+                        Match(filename, line_num, offset, line, line_flags))
+                if rsp_flags & STREAM_LAST:
+                    break
+            if cursor == NO_CURSOR:
+                return (ErrorCode.NONE, matches)
+
+    def send_patch(self, ops: List[tuple]) -> int:
+        """Sends PATCH operations, packing as many into each packet as
+           will fit.
+        """
+        max_len = self.get_caps().cmd_data_len - 20
+        batch: List[tuple] = []
+        batch_len = 1
+        for op in ops:
+            if op[0] == PATCH_BEGIN:
+                op_len = 1 + len(op[1]) + 2 + 4
+            elif op[0] == PATCH_COPY:
+                op_len = 1 + 4 + 4
+            elif op[0] == PATCH_LITERAL:
+                op_len = 1 + 4 + len(op[1])
+            else:
+                op_len = 1 + 4
+            if batch and batch_len + op_len > max_len:
+                err = self.patch(batch)
+                if err != ErrorCode.NONE:
+                    return err
+                batch = []
+                batch_len = 1
+            batch.append(op)
+            batch_len += op_len
+        if batch:
+            return self.patch(batch)
+        return ErrorCode.NONE
+
+    def stream_read(self, handle: int, offset: int,
+                    window: int) -> Tuple[int, bytes, bool]:
+        """Sends a STREAM_READ command and collects the window of packets
+           sent in response.
+
+           Returns the error code, the data which was received in order
+           starting at offset, and whether the end of the file was reached.
+           Data following a lost packet is discarded, and the next
+           STREAM_READ (starting at the end of the returned data) acts as
+           the acknowledgement.
+        """
+        read = Packet(STREAM_READ)
+        packer = Packer(read)
+        packer.pack_u8(handle)
+        packer.pack_u32(offset)
+        packer.pack_u8(window)
+        packer.pack_u16(self.calc_stream_read_data_size())
+        self.bus.send_command(read)
+
+        data = bytearray()
+        while True:
+            err, rsp = self.bus.get_response(timeout=2)
+            if err != ErrorCode.NONE or rsp is None:
+                if data:
+                    return (ErrorCode.NONE, bytes(data), False)
+                return (ErrorCode.TIMEOUT if err == ErrorCode.NONE else err,
+                        b'', False)
+            unpacker = Unpacker(rsp.get_data())
+            err = unpacker.unpack_u8()
+            flags = unpacker.unpack_u8()
+            _seq = unpacker.unpack_u8()
+            r_offset = unpacker.unpack_u32()
+            r_length = unpacker.unpack_u32()
+            chunk = unpacker.unpack_data(r_length)
+            if err != ErrorCode.NONE:
+                self.print(
+                    f'Error: {error_str(err)} reading from handle {handle}')
+                return (err, bytes(data), False)
+            in_order = r_offset == offset + len(data)
+            if in_order:
+                data.extend(chunk)
+            if flags & STREAM_LAST:
+                eof = in_order and (flags & STREAM_END_OF_FILE) != 0
+                return (ErrorCode.NONE, bytes(data), eof)
+
+    def stream_write_file(self,
+                          handle: int,
+                          src: BinaryIO,
+                          window: int,
+                          start: int = 0) -> Tuple[int, int]:
+        """Writes the contents of src, from offset start onwards, to the file
+           opened as handle using STREAM_WRITE, keeping up to window chunks
+           in flight.
+
+           Returns the error code and the offset that the device has
+           acknowledged writing up to.
+        """
+        data_size = self.calc_stream_write_data_size()
+        seq = 0
+        offset = start  # Offset of the next chunk to send
+        committed = start  # Offset acknowledged by the device
+        src.seek(start)
+        pending = 0
+        retries = 0
+        received = False
+        done = False
+        while True:
+            while not done and pending < window:
+                data = src.read(data_size)
+                if not data:
+                    done = True
+                    break
+                write = Packet(STREAM_WRITE)
+                packer = Packer(write)
+                packer.pack_u8(handle)
+                packer.pack_u8(seq)
+                packer.pack_u32(offset)
+                packer.pack_u32(len(data))
+                packer.pack_data(data)
+                self.bus.send_command(write)
+                seq = (seq + 1) & 0xff
+                offset += len(data)
+                pending += 1
+            if pending == 0:
+                return (ErrorCode.NONE, committed)
+
+            err, rsp = self.bus.get_response(timeout=10)
+            if err == ErrorCode.NONE and rsp is not None:
+                received = True
+                pending -= 1
+                unpacker = Unpacker(rsp.get_data())
+                err = unpacker.unpack_u8()
+                _seq = unpacker.unpack_u8()
+                r_committed = unpacker.unpack_u32()
+                if err == ErrorCode.NONE:
+                    committed = max(committed, r_committed)
+                    self.print(f'\rWrote {committed} bytes', end='')
+                    continue
+                if err != ERR_OUT_OF_SEQUENCE:
+                    return (err, committed)
+                committed = r_committed
+            elif not received:
+                # Nothing was acknowledged, so streaming isn't supported.
+                return (err if err != ErrorCode.NONE else ErrorCode.TIMEOUT,
+                        start)
+
+            # A chunk (or its response) was lost. Throw away whatever is
+            # still in flight and resend everything after committed.
+            retries += 1
+            if retries > 3:
+                return (ErrorCode.TIMEOUT, committed)
+            self.drain_responses()
+            pending = 0
+            offset = committed
+            src.seek(offset)
+            done = False
+
     def remove(self, filename: str) -> int:
         """Sends a REMOVE command annd parses the response."""
         rem = Packet(REMOVE)
@@ -478,6 +2882,27 @@ class LittleFsPlugin(CliPluginBase):
             return err
         return ErrorCode.NONE
 
+    def rename(self, old_name: str, new_name: str) -> int:
+        """Sends a RENAME command annd parses the response."""
+        ren = Packet(RENAME)
+        packer = Packer(ren)
+        packer.pack_str(old_name)
+        packer.pack_str(new_name)
+        err, rsp = self.bus.send_command_get_response(ren)
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} sending RENAME command')
+            return err
+        if rsp is None:
+            self.print('Error: timeout sending RENAME command')
+            return ErrorCode.TIMEOUT
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        if err != ErrorCode.NONE:
+            self.print(
+                f'Error: {error_str(err)} renaming {old_name} to {new_name}')
+            return err
+        return ErrorCode.NONE
+
     def rmdir(self, dirname: str) -> int:
         """Sends a RMDIR command annd parses the response."""
         rmd = Packet(RMDIR)
@@ -497,17 +2922,348 @@ class LittleFsPlugin(CliPluginBase):
             return err
         return ErrorCode.NONE
 
-    def write_file(self, filename: str, data: Union[bytes, bytearray]) -> int:
+    def send_tail(self, watch: int, flags: int, interval: int) -> None:
+        """Sends a TAIL command for an existing watch, without waiting for
+           the response (which may arrive after some of the watch's data).
+        """
+        tail = Packet(TAIL)
+        packer = Packer(tail)
+        packer.pack_u8(watch)
+        packer.pack_u8(flags)
+        packer.pack_u16(interval)
+        packer.pack_u16(0)
+        self.bus.send_command(tail)
+
+    def tail_start(self, filename: str, back: int,
+                   interval: int) -> Tuple[int, int, int, int]:
+        """Sends a TAIL command to start watching filename, starting back
+           bytes before the end of the file.
+
+           Returns the error code, the watch, the offset that data will start
+           from and the size of the file. The data is then sent by the device
+           as TAIL packets, at most once every interval milliseconds.
+        """
+        tail = Packet(TAIL)
+        packer = Packer(tail)
+        packer.pack_u8(NO_CURSOR)
+        packer.pack_u8(0)
+        packer.pack_u16(interval)
+        packer.pack_u16(0)
+        packer.pack_str(filename)
+        packer.pack_u32(min(back, TO_END_OF_FILE))
+        err, rsp = self.bus.send_command_get_response(tail, timeout=5)
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} sending TAIL command')
+            return (err, NO_CURSOR, 0, 0)
+        if rsp is None:
+            self.print('Error: timeout sending TAIL command')
+            return (ErrorCode.TIMEOUT, NO_CURSOR, 0, 0)
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        watch = unpacker.unpack_u8()
+        offset = unpacker.unpack_u32()
+        size = unpacker.unpack_u32()
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} watching {filename}')
+        return (err, watch, offset, size)
+
+    def truncate(self, filename: str, length: int) -> int:
+        """Sends a TRUNCATE command and parses the response."""
+        trunc = Packet(TRUNCATE)
+        packer = Packer(trunc)
+        packer.pack_str(filename)
+        packer.pack_u32(length)
+        err, rsp = self.bus.send_command_get_response(trunc, timeout=10)
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} sending TRUNCATE command')
+            return err
+        if rsp is None:
+            self.print('Error: timeout sending TRUNCATE command')
+            return ErrorCode.TIMEOUT
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} truncating {filename}')
+            return err
+        return ErrorCode.NONE
+
+    def upload_compressed(self, filename: str, src: BinaryIO) -> int:
+        """Writes the contents of src to filename using WRITE_COMPRESSED.
+
+           Data which doesn't compress well enough to fit in a packet is
+           sent in smaller pieces.
+        """
+        # The beginning of the packet has the following fields
+        #   2+n - filename
+        #   1 - Mode
+        #   1 - Codec
+        #   4 - Length
+        #   4 - Data length
+        #   The remainder of the packet is the data
+        data_size = (self.get_caps().cmd_data_len -
+                     (len(filename) + 2 + 1 + 1 + 4 + 4) - 20)
+        cmd = WRITE
+        bytes_written = 0
+        pending = b''
+        while True:
+            pending += src.read(self.get_caps().compress_size - len(pending))
+            if not pending and cmd == APPEND:
+                break
+            chunk_len = len(pending)
+            while (chunk_len > data_size
+                   and len(lz4_compress(pending[:chunk_len])) > data_size):
+                chunk_len = max(chunk_len // 2, data_size)
+            err = self.write_or_append_file(cmd,
+                                            filename,
+                                            pending[:chunk_len],
+                                            compress=True)
+            if err != ErrorCode.NONE:
+                return err
+            bytes_written += chunk_len
+            pending = pending[chunk_len:]
+            cmd = APPEND
+            self.print(f'\rWrote {bytes_written} bytes', end='')
+        return self.flush()
+
+    def upload_handle(self,
+                      handle: int,
+                      src: BinaryIO,
+                      window: int,
+                      start: int = 0) -> int:
+        """Writes the contents of src, from offset start onwards, to the file
+           opened as handle.
+
+           STREAM_WRITE is used when window is greater than 1, falling back
+           to WRITE_HANDLE if the device doesn't support it.
+        """
+        bytes_written = start
+        window = min(window, self.get_caps().write_window)
+        if window > 1:
+            err, bytes_written = self.stream_write_file(
+                handle, src, window, start)
+            if err == ErrorCode.NONE or bytes_written > start:
+                return err
+        src.seek(start)
+        data_size = self.calc_write_handle_data_size()
+        while (data := src.read(data_size)) != b'':
+            err = self.write_handle(handle, bytes_written, data)
+            if err != ErrorCode.NONE:
+                return err
+            bytes_written += len(data)
+            self.print(f'\rWrote {bytes_written} bytes', end='')
+        return ErrorCode.NONE
+
+    def upload_begin(self, filename: str,
+                     resume: bool) -> Tuple[int, int, int, int]:
+        """Sends an UPLOAD_BEGIN command and parses the response.
+
+           Returns the error code, the handle to write the data to, the
+           number of bytes kept from an earlier session and their CRC-32.
+        """
+        begin = Packet(UPLOAD_BEGIN)
+        packer = Packer(begin)
+        packer.pack_u8(UPLOAD_RESUME if resume else 0)
+        packer.pack_str(filename)
+        # Resuming reads back the data already uploaded, which takes a while.
+        err, rsp = self.bus.send_command_get_response(begin, timeout=10)
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} sending UPLOAD_BEGIN command')
+            return (err, 0, 0, 0)
+        if rsp is None:
+            self.print('Error: timeout sending UPLOAD_BEGIN command')
+            return (ErrorCode.TIMEOUT, 0, 0, 0)
+        unpacker = Unpacker(rsp.get_data())
+        err = unpacker.unpack_u8()
+        handle = unpacker.unpack_u8()
+        committed = unpacker.unpack_u32()
+        crc = unpacker.unpack_u32()
+        if err != ErrorCode.NONE:
+            self.print(f'Error: {error_str(err)} uploading {filename}')
+            return (err, 0, 0, 0)
+        return (ErrorCode.NONE, handle, committed, crc)
+
+    def upload_commit(self,
+                      handle: int,
+                      length: int,
+                      abort: bool = False) -> int:
+        """Sends an UPLOAD_COMMIT command and parses the response."""
+        commit = Packet(UPLOAD_COMMIT)
+        packer = Packer(commit)
+        packer.pack_u8(handle)
+        packer.pack_u8(UPLOAD_ABORT if abort else 0)
+        packer.pack_u32(length)
+        err, rsp = self.bus.send_command_get_response(commit)
+        if err != ErrorCode.NONE:
+            self.print(
+                f'Error: {error_str(err)} sending UPLOAD_COMMIT command')
+            return err
+        if rsp is None:
+            self.print('Error: timeout sending UPLOAD_COMMIT command')
+            return ErrorCode.TIMEOUT
+        unpacker = Unpacker(rsp.get_data())
+        return unpacker.unpack_u8()
+
+    def upload_session(self, filename: str, src: BinaryIO, window: int) -> int:
+        """Writes the contents of src to filename using an upload session.
+
+           Data left behind by an interrupted upload is kept if it matches
+           the start of src, so only the rest of src needs to be sent.
+        """
+        length = src.seek(0, os.SEEK_END)
+        err, handle, committed, crc = self.upload_begin(filename, resume=True)
+        if err != ErrorCode.NONE:
+            return err
+        if committed > 0:
+            src.seek(0)
+            src_crc = 0
+            remaining = committed
+            while remaining > 0 and (data := src.read(min(remaining,
+                                                          64 * 1024))):
+                src_crc = zlib.crc32(data, src_crc)
+                remaining -= len(data)
+            if remaining == 0 and src_crc == crc:
+                self.print(f'Resuming upload after {committed} bytes')
+            else:
+                # The data is from some other version of the file.
+                self.upload_commit(handle, 0, abort=True)
+                err, handle, committed, crc = self.upload_begin(filename,
+                                                                resume=False)
+                if err != ErrorCode.NONE:
+                    return err
+        err = self.upload_handle(handle, src, window, committed)
+        self.print('')
+        if err != ErrorCode.NONE:
+            # Leave the temporary file behind, so the upload can be resumed.
+            self.close_file(handle)
+            return err
+        return self.upload_commit(handle, length)
+
+    def verify(self, device_file: str, host_file: str) -> bool:
+        """Compares the CRC-32 of a file on the device with one on the host."""
+        err, size, crc = self.crc32_file(device_file)
+        if err != ErrorCode.NONE:
+            return False
+        if size != path.getsize(host_file) or crc != crc32_host_file(host_file):
+            self.print(f'Error: {device_file} and {host_file} are different')
+            return False
+        self.print(f'Verified {size} bytes (CRC-32 {crc:08x})')
+        return True
+
+    def walk(self,
+             dirname: str,
+             max_depth: int = 0,
+             pattern: str = '',
+             window: int = DEFAULT_WINDOW) -> Tuple[int, List[File]]:
+        """Sends WALK commands to list every file in the tree under dirname.
+
+           The filename of each returned File is relative to dirname, and
+           subdirectories are listed after the entry for their directory.
+           max_depth limits how many levels of directories are listed (0
+           for no limit) and only entries matching the glob pattern are
+           returned.
+        """
+        if (self.get_caps().capabilities & CAPS_STREAM) == 0:
+            window = 1
+        files = []
+        cursor = NO_CURSOR
+        while True:
+            wlk = Packet(WALK)
+            packer = Packer(wlk)
+            packer.pack_u8(cursor)
+            packer.pack_u8(window)
+            if cursor == NO_CURSOR:
+                packer.pack_str(dirname)
+                packer.pack_u8(max_depth)
+                packer.pack_str(pattern)
+            self.bus.send_command(wlk)
+
+            seq = 0
+            while True:
+                err, rsp = self.bus.get_response(timeout=2)
+                if err != ErrorCode.NONE:
+                    self.print(f'Error: {error_str(err)} sending WALK command')
+                    return (err, files)
+                if rsp is None:
+                    self.print('Error: timeout sending WALK command')
+                    return (ErrorCode.TIMEOUT, files)
+                unpacker = Unpacker(rsp.get_data())
+                err = unpacker.unpack_u8()
+                flags = unpacker.unpack_u8()
+                r_seq = unpacker.unpack_u8()
+                cursor = unpacker.unpack_u8()
+                if err != ErrorCode.NONE:
+                    self.print(f'Error: {error_str(err)} walking {dirname}')
+                    return (err, files)
+                if r_seq != seq:
+                    # A packet was lost, and the device has moved on.
+                    self.print(f'Error: lost part of the listing of {dirname}')
+                    self.drain_responses()
+                    return (ERR_OUT_OF_SEQUENCE, files)
+                seq += 1
+                while unpacker.more_data():
+                    file_flags = unpacker.unpack_u8()
+                    filesize = unpacker.unpack_u32()
+                    timestamp = unpacker.unpack_u32()
+                    filename = str(unpacker.unpack_str())
+                    files.append(
+                        File(len(files), file_flags, filesize, timestamp,
+                             filename))
+                if flags & STREAM_LAST:
+                    break
+            if cursor == NO_CURSOR:
+                return (ErrorCode.NONE, files)
+
+    def write_at(self, filename: str, offset: int,
+                 data: Union[bytes, bytearray]) -> Tuple[int, int]:
+        """Sends WRITE_AT commands to overwrite part of an existing file,
+           splitting data across as many packets as needed.
+
+           Returns the error code and the size of the file afterwards.
+        """
+        data_size = self.calc_write_at_data_size(filename)
+        size = 0
+        for start in range(0, max(len(data), 1), data_size):
+            chunk = data[start:start + data_size]
+            wrt = Packet(WRITE_AT)
+            packer = Packer(wrt)
+            packer.pack_str(filename)
+            packer.pack_u32(offset + start)
+            packer.pack_u32(len(chunk))
+            packer.pack_data(chunk)
+            err, rsp = self.bus.send_command_get_response(wrt, timeout=10)
+            if err != ErrorCode.NONE:
+                return (err, 0)
+            if rsp is None:
+                return (ErrorCode.TIMEOUT, 0)
+            unpacker = Unpacker(rsp.get_data())
+            err = unpacker.unpack_u8()
+            size = unpacker.unpack_u32()
+            if err != ErrorCode.NONE:
+                return (err, size)
+        return (ErrorCode.NONE, size)
+
+    def write_file(self,
+                   filename: str,
+                   data: Union[bytes, bytearray],
+                   compress: bool = False) -> int:
         """Sends a WRITE command and parses the response.
 
             The write opeartion will create a file if it doesn't already exist,
-            and will erase a file if it exists already.
+            and will erase a file if it exists already. When compress is True
+            (and the device supports it) the data is sent compressed using
+            WRITE_COMPRESSED.
         """
-        return self.write_or_append_file(WRITE, filename, data)
+        return self.write_or_append_file(WRITE, filename, data, compress)
 
-    def write_or_append_file(self, cmd: int, filename: str,
-                             data: Union[bytes, bytearray]) -> int:
+    def write_or_append_file(self,
+                             cmd: int,
+                             filename: str,
+                             data: Union[bytes, bytearray],
+                             compress: bool = False) -> int:
         """Sends a WRITE or APPEND command and parses the response."""
+        if compress and self.get_caps().compress_size > 0:
+            mode = OPEN_APPEND if cmd == APPEND else OPEN_WRITE
+            return self.write_file_compressed(mode, filename, data)
         write = Packet(cmd)
         length = len(data)
 
@@ -523,3 +3279,50 @@ class LittleFsPlugin(CliPluginBase):
 
         unpacker = Unpacker(rsp.get_data())
         return unpacker.unpack_u8()
+
+    def write_file_compressed(self, mode: int, filename: str,
+                              data: Union[bytes, bytearray]) -> int:
+        """Sends a WRITE_COMPRESSED command and parses the response.
+
+           The data is sent uncompressed if compressing it doesn't make it
+           any smaller.
+        """
+        codec = CODEC_LZ4
+        compressed = lz4_compress(data)
+        if len(compressed) >= len(data):
+            codec = CODEC_NONE
+            compressed = bytes(data)
+        write = Packet(WRITE_COMPRESSED)
+        packer = Packer(write)
+        packer.pack_str(filename)
+        packer.pack_u8(mode)
+        packer.pack_u8(codec)
+        packer.pack_u32(len(data))
+        packer.pack_u32(len(compressed))
+        packer.pack_data(compressed)
+        err, rsp = self.bus.send_command_get_response(write, timeout=10)
+        if err != ErrorCode.NONE:
+            return err
+        if rsp is None:
+            return ErrorCode.TIMEOUT
+
+        unpacker = Unpacker(rsp.get_data())
+        return unpacker.unpack_u8()
+
+    def write_handle(self, handle: int, offset: int,
+                     data: Union[bytes, bytearray]) -> int:
+        """Sends a WRITE_HANDLE command and parses the response."""
+        write = Packet(WRITE_HANDLE)
+        packer = Packer(write)
+        packer.pack_u8(handle)
+        packer.pack_u32(offset)
+        packer.pack_u32(len(data))
+        packer.pack_data(data)
+        err, rsp = self.bus.send_command_get_response(write, timeout=10)
+        if err != ErrorCode.NONE:
+            return err
+        if rsp is None:
+            return ErrorCode.TIMEOUT
+
+        unpacker = Unpacker(rsp.get_data())
+        return unpacker.unpack_u8()
@@ -0,0 +1,109 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   Benchmark.ino
+ *
+ *   @brief  Device side of the LittleFs protocol benchmarks.
+ *
+ *   Run the bench command from duino_cli against this sketch. It only
+ *   handles packets, so that nothing else competes with the handler for
+ *   time, and it runs the serial port as fast as the USB bridge allows. The
+ *   host needs to open the port at BENCHMARK_BAUD.
+ *
+ ****************************************************************************/
+
+#include <Arduino.h>
+
+#include "ArduinoSerialBus.h"
+#include "CorePacketHandler.h"
+#include "duino_util.h"
+#include "FS.h"
+#include "LittleFS.h"
+#include "LittleFsPacketHandler.h"
+#include "LittleFsWorker.h"
+#include "Log.h"
+#include "RamFs.h"
+
+#if !defined(BENCHMARK_BAUD)
+#define BENCHMARK_BAUD 921600
+#endif
+
+// Size of a RAM disk to mount as /ram (0 for none). Running "bench /ram/bench"
+// then measures the protocol without any flash latency (use --size to keep
+// the test file smaller than the RAM disk).
+#if !defined(BENCHMARK_RAMFS_SIZE)
+#define BENCHMARK_RAMFS_SIZE 0
+#endif
+
+#define FORMAT_LITTLEFS_IF_FAILED true
+
+// Room for a full LittleFS block plus the packet header. The host finds out
+// about these sizes using the CAPS command.
+static uint8_t cmdPacketData[LITTLEFS_BLOCK_SIZE + 64];
+static uint8_t rspPacketData[LITTLEFS_BLOCK_SIZE + 64];
+static Packet cmdPacket(LEN(cmdPacketData), cmdPacketData);
+static Packet rspPacket(LEN(rspPacketData), rspPacketData);
+
+static ArduinoSerialBus serialBus(&Serial, &cmdPacket, &rspPacket);
+
+// The core packet handler deals with PING requests
+static CorePacketHandler corePacketHandler;
+
+static LittleFsPacketHandler littleFsPacketHandler{&serialBus};
+
+#if BENCHMARK_RAMFS_SIZE > 0
+static RamFs ramFs{BENCHMARK_RAMFS_SIZE};
+static FormattableFsBackend<RamFs> ramFsBackend{ramFs};
+#endif
+
+#if LITTLEFS_THREADED
+static LittleFsWorker littleFsWorker{&littleFsPacketHandler, &serialBus};
+#endif
+
+void setup() {
+    // Room for a whole STREAM_WRITE window (see the Esp32-LittleFs example).
+    Serial.setRxBufferSize(LITTLEFS_STREAM_WRITE_WINDOW * LEN(cmdPacketData));
+    Serial.begin(BENCHMARK_BAUD);
+    serialBus.add(corePacketHandler);
+
+    if (!LittleFS.begin(FORMAT_LITTLEFS_IF_FAILED)) {
+        Log::error("LittleFS Mount Failed");
+        return;
+    }
+#if BENCHMARK_RAMFS_SIZE > 0
+    littleFsPacketHandler.mount("/ram", &ramFsBackend);
+#endif
+
+#if LITTLEFS_THREADED
+    if (!littleFsWorker.begin()) {
+        Log::error("LittleFs worker failed to start");
+        return;
+    }
+#else
+    serialBus.add(littleFsPacketHandler);
+#endif
+}
+
+void loop() {
+    if (serialBus.processByte() == Packet::Error::NONE) {
+#if LITTLEFS_THREADED
+        if (!littleFsWorker.submit(cmdPacket)) {
+            littleFsWorker.lockBus();
+            serialBus.handlePacket();
+            littleFsWorker.unlockBus();
+        }
+#else
+        serialBus.handlePacket();
+#endif
+    }
+#if !LITTLEFS_THREADED
+    littleFsPacketHandler.run();
+#endif
+}
@@ -23,6 +23,7 @@
 #include "FS.h"
 #include "LittleFS.h"
 #include "LittleFsPacketHandler.h"
+#include "LittleFsWorker.h"
 #include "Log.h"
 
 #if !defined(LED_BUILTIN)
@@ -52,8 +53,10 @@ static TimedActionSequence::Action activity_list[] = {
 static TimedActionSequence activity{
     activity_list, LEN(activity_list), TimedActionSequence::Mode::ONE_SHOT};
 
-static uint8_t cmdPacketData[256];
-static uint8_t rspPacketData[256];
+// Room for a full LittleFS block plus the packet header. The host finds out
+// about these sizes using the CAPS command.
+static uint8_t cmdPacketData[LITTLEFS_BLOCK_SIZE + 64];
+static uint8_t rspPacketData[LITTLEFS_BLOCK_SIZE + 64];
 static Packet cmdPacket(LEN(cmdPacketData), cmdPacketData);
 static Packet rspPacket(LEN(rspPacketData), rspPacketData);
 
@@ -62,9 +65,21 @@ static ArduinoSerialBus serialBus(&Serial, &cmdPacket, &rspPacket);
 // The core packet handler deals with PING requests
 static CorePacketHandler corePacketHandler;
 
-static LittleFsPacketHandler littleFsPacketHandler;
+static LittleFsPacketHandler littleFsPacketHandler{&serialBus};
+
+#if LITTLEFS_THREADED
+// Runs littleFsPacketHandler on the other core, so that the next command can
+// be received while the current one is accessing flash.
+static LittleFsWorker littleFsWorker{&littleFsPacketHandler, &serialBus};
+#endif
 
 void setup() {
+    // Leave room for several STREAM_WRITE packets to arrive while a previous
+    // one is being written to flash. That's 16.6 KB with the default window
+    // and block size. The host uses the window reported by CAPS, so building
+    // with a smaller LITTLEFS_STREAM_WRITE_WINDOW shrinks this buffer (see
+    // LittleFsConfig.h for what the rest of the RAM goes to).
+    Serial.setRxBufferSize(LITTLEFS_STREAM_WRITE_WINDOW * LEN(cmdPacketData));
     Serial.begin(115200);
     led.init();
     heartbeat.init();
@@ -76,7 +91,14 @@ void setup() {
         return;
     }
 
+#if LITTLEFS_THREADED
+    if (!littleFsWorker.begin()) {
+        Log::error("LittleFs worker failed to start");
+        return;
+    }
+#else
     serialBus.add(littleFsPacketHandler);
+#endif
 }
 
 uint32_t lastMillis = 0;
@@ -84,8 +106,21 @@ uint32_t lastMillis = 0;
 void loop() {
     if (serialBus.processByte() == Packet::Error::NONE) {
         activity.start();
+#if LITTLEFS_THREADED
+        // LittleFs commands are handed to the worker task. Anything else is
+        // handled here, but the worker may be sending a response as well.
+        if (!littleFsWorker.submit(cmdPacket)) {
+            littleFsWorker.lockBus();
+            serialBus.handlePacket();
+            littleFsWorker.unlockBus();
+        }
+#else
         serialBus.handlePacket();
+#endif
     }
+#if !LITTLEFS_THREADED
+    littleFsPacketHandler.run();
+#endif
     heartbeat.run();
     activity.run();
 }
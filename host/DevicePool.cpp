@@ -0,0 +1,120 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   DevicePool.cpp
+ *
+ *   @brief  Runs jobs on many devices in parallel using a pool of threads.
+ *
+ ****************************************************************************/
+
+#include "DevicePool.h"
+
+#include <string>
+#include <utility>
+
+DevicePool::DevicePool(size_t numThreads) {
+    if (numThreads == 0) {
+        numThreads = 1;
+    }
+    for (size_t i = 0; i < numThreads; i++) {
+        this->m_threads.emplace_back(&DevicePool::workerThread, this);
+    }
+}
+
+DevicePool::~DevicePool() {
+    this->wait();
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        this->m_stopping = true;
+    }
+    this->m_readyCond.notify_all();
+    for (auto& thread : this->m_threads) {
+        thread.join();
+    }
+}
+
+size_t DevicePool::addDevice(
+    char const* portName,
+    uint32_t baud,
+    std::future<Error>* connected) {
+    size_t deviceIndex;
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        deviceIndex = this->m_devices.size();
+        this->m_devices.push_back(std::make_unique<Device>());
+    }
+    // The job keeps its own copy of the port name.
+    std::future<Error> result = this->submit(
+        deviceIndex, [port = std::string(portName), baud](LittleFsClient& client) {
+            return client.connect(port.c_str(), baud);
+        });
+    if (connected != nullptr) {
+        *connected = std::move(result);
+    }
+    return deviceIndex;
+}
+
+size_t DevicePool::numDevices() const {
+    std::lock_guard<std::mutex> lock(this->m_mutex);
+    return this->m_devices.size();
+}
+
+std::future<DevicePool::Error> DevicePool::submit(size_t deviceIndex, Job job) {
+    std::packaged_task<Error(LittleFsClient&)> task(std::move(job));
+    std::future<Error> result = task.get_future();
+    {
+        std::lock_guard<std::mutex> lock(this->m_mutex);
+        Device* device = this->m_devices.at(deviceIndex).get();
+        // A device which is running a job, or already has jobs queued, is
+        // in m_ready (or will be put back there) already.
+        if (!device->running && device->jobs.empty()) {
+            this->m_ready.push_back(deviceIndex);
+        }
+        device->jobs.push_back(std::move(task));
+        this->m_numQueued++;
+    }
+    this->m_readyCond.notify_one();
+    return result;
+}
+
+void DevicePool::wait() {
+    std::unique_lock<std::mutex> lock(this->m_mutex);
+    this->m_idleCond.wait(lock, [this] { return this->m_numQueued == 0; });
+}
+
+void DevicePool::workerThread() {
+    std::unique_lock<std::mutex> lock(this->m_mutex);
+    while (true) {
+        this->m_readyCond.wait(
+            lock, [this] { return this->m_stopping || !this->m_ready.empty(); });
+        if (this->m_ready.empty()) {
+            return;
+        }
+        size_t deviceIndex = this->m_ready.front();
+        this->m_ready.pop_front();
+        Device* device = this->m_devices[deviceIndex].get();
+        std::packaged_task<Error(LittleFsClient&)> task = std::move(device->jobs.front());
+        device->jobs.pop_front();
+        device->running = true;
+
+        lock.unlock();
+        task(device->client);
+        lock.lock();
+
+        device->running = false;
+        if (!device->jobs.empty()) {
+            this->m_ready.push_back(deviceIndex);
+            this->m_readyCond.notify_one();
+        }
+        if (--this->m_numQueued == 0) {
+            this->m_idleCond.notify_all();
+        }
+    }
+}
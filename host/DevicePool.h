@@ -0,0 +1,94 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   DevicePool.h
+ *
+ *   @brief  Runs jobs on many devices in parallel using a pool of threads.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "LittleFsClient.h"
+
+//! Runs jobs on a set of devices using a fixed number of threads.
+//!
+//! The jobs submitted for each device run one at a time, in the order they
+//! were submitted (a serial port can only carry one conversation), while
+//! jobs for different devices run in parallel. This lets one process keep
+//! a whole rack of devices busy with as many threads as there are ports.
+class DevicePool {
+ public:
+    using Error = LittleFsClient::Error;
+
+    //! A job to run on a device.
+    using Job = std::function<Error(LittleFsClient&)>;
+
+    //! Constructor.
+    explicit DevicePool(size_t numThreads  //!< [in] Number of worker threads to start.
+    );
+
+    //! Destructor. Waits for all of the submitted jobs to finish.
+    ~DevicePool();
+
+    DevicePool(DevicePool const&) = delete;
+    DevicePool& operator=(DevicePool const&) = delete;
+
+    //! Adds a device to the pool, and submits a job which connects to it.
+    //! @returns The index of the device, to pass to submit.
+    size_t addDevice(
+        char const* portName,          //!< [in] Port the device is connected to.
+        uint32_t baud,                 //!< [in] Baud rate to use.
+        std::future<Error>* connected  //!< [out] Result of connecting (may be nullptr).
+    );
+
+    //! @returns The number of devices in the pool.
+    size_t numDevices() const;
+
+    //! Queues a job to run on a device, after any jobs already queued for it.
+    //! @returns The result of the job, once it has run.
+    std::future<Error> submit(
+        size_t deviceIndex,  //!< [in] Device to run the job on.
+        Job job              //!< [in] Job to run.
+    );
+
+    //! Waits until every submitted job has finished.
+    void wait();
+
+ private:
+    //! A device, and the jobs waiting to run on it.
+    struct Device {
+        LittleFsClient client;                                        //!< Talks to the device.
+        std::deque<std::packaged_task<Error(LittleFsClient&)>> jobs;  //!< Jobs not started yet.
+        bool running = false;                                         //!< A job is running.
+    };
+
+    //! Runs jobs until the pool is destroyed.
+    void workerThread();
+
+    mutable std::mutex m_mutex;                      //!< Protects everything below.
+    std::condition_variable m_readyCond;             //!< Signalled when m_ready gets an entry.
+    std::condition_variable m_idleCond;              //!< Signalled when all the jobs finish.
+    std::vector<std::unique_ptr<Device>> m_devices;  //!< Devices in the pool.
+    std::deque<size_t> m_ready;                      //!< Idle devices which have jobs queued.
+    size_t m_numQueued = 0;                          //!< Jobs submitted which haven't finished.
+    bool m_stopping = false;                         //!< The destructor is stopping the threads.
+    std::vector<std::thread> m_threads;              //!< Worker threads.
+};
@@ -0,0 +1,567 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   LittleFsClient.cpp
+ *
+ *   @brief  Talks to a LittleFsPacketHandler running on one device.
+ *
+ ****************************************************************************/
+
+#include "LittleFsClient.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include "Crc32.h"
+#include "Unpacker.h"
+
+using LittleFs::Capabilities;
+using LittleFs::Command;
+using LittleFs::OpenMode;
+using LittleFs::StreamFlags;
+using LittleFs::UploadFlags;
+using Error = LittleFsClient::Error;
+
+//! Buffer size assumed for devices which don't support the CAPS command.
+static constexpr uint32_t DEFAULT_DATA_LEN = 256;
+
+//! Number of STREAM_READ packets requested at a time.
+static constexpr uint8_t READ_WINDOW = 8;
+
+//! Number of times a window of STREAM_WRITE packets is resent before giving up.
+static constexpr int WRITE_RETRIES = 3;
+
+//! How long to wait for the response to most commands.
+static constexpr uint32_t TIMEOUT_MSEC = 2000;
+
+//! How long to wait for commands which write to flash (or read a whole file).
+static constexpr uint32_t SLOW_TIMEOUT_MSEC = 10000;
+
+//! Reads a whole file on the host.
+//! @returns true if the file was read.
+static bool readLocalFile(
+    std::string const& fileName,  //!< [in] File to read.
+    std::vector<uint8_t>* data    //!< [out] Contents of the file.
+) {
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    data->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !file.bad();
+}
+
+//! Writes a whole file on the host.
+//! @returns true if the file was written.
+static bool writeLocalFile(
+    std::string const& fileName,      //!< [in] File to write.
+    std::vector<uint8_t> const& data  //!< [in] Contents of the file.
+) {
+    std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    file.write(reinterpret_cast<char const*>(data.data()), data.size());
+    return static_cast<bool>(file);
+}
+
+//! @returns dir and name joined with a slash.
+static std::string joinPath(
+    std::string const& dir,  //!< [in] Directory.
+    std::string const& name  //!< [in] Name within the directory.
+) {
+    if (dir.empty() || dir.back() == '/') {
+        return dir + name;
+    }
+    return dir + "/" + name;
+}
+
+LittleFsClient::LittleFsClient()
+    : m_cmdDataLen{DEFAULT_DATA_LEN},
+      m_rspDataLen{DEFAULT_DATA_LEN},
+      m_cmdData(HOST_MAX_PACKET_SIZE),
+      m_cmd{m_cmdData.size(), m_cmdData.data()} {}
+
+Error LittleFsClient::connect(char const* portName, uint32_t baud) {
+    this->m_portName = portName;
+    if (!this->m_bus.open(portName, baud)) {
+        return Error::PORT_ERROR;
+    }
+
+    this->newCommand(Command::CAPS);
+    if (this->call(TIMEOUT_MSEC) != Error::NONE) {
+        return Error::NONE;
+    }
+    Unpacker unpacker(this->response());
+    unpacker.unpack(&this->m_capabilities);
+    unpacker.unpack(&this->m_cmdDataLen);
+    unpacker.unpack(&this->m_rspDataLen);
+    unpacker.unpack(&this->m_blockSize);
+    unpacker.unpack(&this->m_writeWindow);
+
+    // Both sides have to be able to hold a packet, so use the smaller size.
+    this->m_cmdDataLen = std::min<uint32_t>(this->m_cmdDataLen, HOST_MAX_PACKET_SIZE);
+    this->m_rspDataLen = std::min<uint32_t>(this->m_rspDataLen, HOST_MAX_PACKET_SIZE);
+    return Error::NONE;
+}
+
+void LittleFsClient::disconnect() {
+    this->m_bus.close();
+}
+
+Error LittleFsClient::mkdir(std::string const& dirName) {
+    Packet& cmd = this->newCommand(Command::MKDIR);
+    cmd.append(dirName.c_str());
+    return this->callForError(TIMEOUT_MSEC);
+}
+
+Error LittleFsClient::listDir(std::string const& dirName, std::vector<DirEntry>* entries) {
+    entries->clear();
+    uint8_t cursor = LittleFs::NO_CURSOR;
+    do {
+        Packet& cmd = this->newCommand(Command::LIST_CURSOR);
+        cmd.appendByte(cursor);
+        cmd.append(dirName.c_str());
+        Error err = this->call(TIMEOUT_MSEC);
+        if (err != Error::NONE) {
+            return err;
+        }
+
+        Packet const& rsp = this->response();
+        Unpacker unpacker(rsp);
+        uint8_t rspErr;
+        unpacker.unpack(&rspErr);
+        unpacker.unpack(&cursor);
+        if (rspErr != to_underlying(Error::NONE)) {
+            return static_cast<Error>(rspErr);
+        }
+
+        // Each entry is u16 index, u8 flags, u32 size, u32 timestamp, str name.
+        size_t used = sizeof(rspErr) + sizeof(cursor);
+        while (used < rsp.getDataLength()) {
+            uint16_t index;
+            DirEntry entry;
+            char const* name;
+            unpacker.unpack(&index);
+            unpacker.unpack(&entry.flags);
+            unpacker.unpack(&entry.size);
+            unpacker.unpack(&entry.timestamp);
+            unpacker.unpack(&name);
+            entry.name = name;
+            used += sizeof(index) + sizeof(entry.flags) + sizeof(entry.size) +
+                    sizeof(entry.timestamp) + entry.name.size() + 2;
+            entries->push_back(entry);
+        }
+    } while (cursor != LittleFs::NO_CURSOR);
+    return Error::NONE;
+}
+
+Error LittleFsClient::pushFile(std::string const& localName, std::string const& remoteName) {
+    std::vector<uint8_t> data;
+    if (!readLocalFile(localName, &data)) {
+        return Error::LOCAL_FILE;
+    }
+
+    if ((this->m_capabilities & Capabilities::UPLOAD) == 0) {
+        uint8_t handle;
+        Error err = this->open(remoteName, OpenMode::WRITE, &handle);
+        if (err != Error::NONE) {
+            return err;
+        }
+        err = this->writeData(handle, data, 0);
+        Error closeErr = this->close(handle);
+        return (err != Error::NONE) ? err : closeErr;
+    }
+
+    // Upload into a temporary file, so an interrupted push doesn't leave
+    // a partial file behind, and a retried push only sends the rest.
+    uint8_t flags = UploadFlags::RESUME;
+    uint8_t handle = 0;
+    uint32_t committed = 0;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        Packet& cmd = this->newCommand(Command::UPLOAD_BEGIN);
+        cmd.appendByte(flags);
+        cmd.append(remoteName.c_str());
+        Error err = this->call(SLOW_TIMEOUT_MSEC);
+        if (err != Error::NONE) {
+            return err;
+        }
+        Unpacker unpacker(this->response());
+        uint8_t rspErr;
+        uint32_t crc;
+        unpacker.unpack(&rspErr);
+        unpacker.unpack(&handle);
+        unpacker.unpack(&committed);
+        unpacker.unpack(&crc);
+        if (rspErr != to_underlying(Error::NONE)) {
+            return static_cast<Error>(rspErr);
+        }
+        if (committed == 0) {
+            break;
+        }
+        if (committed <= data.size()) {
+            Crc32 localCrc;
+            localCrc.update(data.data(), committed);
+            if (localCrc.value() == crc) {
+                break;
+            }
+        }
+        // The data is from some other version of the file, so start again.
+        Packet& abort = this->newCommand(Command::UPLOAD_COMMIT);
+        abort.appendByte(handle);
+        abort.appendByte(UploadFlags::ABORT);
+        abort.append(static_cast<uint32_t>(0));
+        this->callForError(SLOW_TIMEOUT_MSEC);
+        flags = 0;
+        committed = 0;
+    }
+
+    Error err = this->writeData(handle, data, committed);
+    if (err != Error::NONE) {
+        // Leave the temporary file behind, so the upload can be resumed.
+        this->close(handle);
+        return err;
+    }
+    Packet& commit = this->newCommand(Command::UPLOAD_COMMIT);
+    commit.appendByte(handle);
+    commit.appendByte(0);
+    commit.append(static_cast<uint32_t>(data.size()));
+    return this->callForError(SLOW_TIMEOUT_MSEC);
+}
+
+Error LittleFsClient::pullFile(std::string const& remoteName, std::string const& localName) {
+    uint8_t handle;
+    Error err = this->open(remoteName, OpenMode::READ, &handle);
+    if (err != Error::NONE) {
+        return err;
+    }
+    std::vector<uint8_t> data;
+    err = this->readData(handle, &data);
+    Error closeErr = this->close(handle);
+    if (err == Error::NONE) {
+        err = closeErr;
+    }
+    if (err != Error::NONE) {
+        return err;
+    }
+    if (!writeLocalFile(localName, data)) {
+        return Error::LOCAL_FILE;
+    }
+    return Error::NONE;
+}
+
+Error LittleFsClient::pushTree(std::string const& localDir, std::string const& remoteDir) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    // MKDIR fails if the directory already exists, which is fine, and any
+    // other problem shows up when the files are opened.
+    this->mkdir(remoteDir);
+    for (fs::recursive_directory_iterator it(localDir, ec), end; !ec && it != end;
+         it.increment(ec)) {
+        std::string relName = fs::relative(it->path(), localDir, ec).generic_string();
+        if (ec) {
+            break;
+        }
+        std::string remoteName = joinPath(remoteDir, relName);
+        if (it->is_directory(ec)) {
+            this->mkdir(remoteName);
+            continue;
+        }
+        if (!it->is_regular_file(ec)) {
+            continue;
+        }
+        Error err = this->pushFile(it->path().string(), remoteName);
+        if (err != Error::NONE) {
+            return err;
+        }
+    }
+    return ec ? Error::LOCAL_FILE : Error::NONE;
+}
+
+Error LittleFsClient::pullTree(std::string const& remoteDir, std::string const& localDir) {
+    std::error_code ec;
+    std::filesystem::create_directories(localDir, ec);
+    if (ec) {
+        return Error::LOCAL_FILE;
+    }
+    std::vector<DirEntry> entries;
+    Error err = this->listDir(remoteDir, &entries);
+    if (err != Error::NONE) {
+        return err;
+    }
+    for (auto const& entry : entries) {
+        std::string remoteName = joinPath(remoteDir, entry.name);
+        std::string localName = joinPath(localDir, entry.name);
+        if (entry.isDir()) {
+            err = this->pullTree(remoteName, localName);
+        } else {
+            err = this->pullFile(remoteName, localName);
+        }
+        if (err != Error::NONE) {
+            return err;
+        }
+    }
+    return Error::NONE;
+}
+
+Packet& LittleFsClient::newCommand(Command::Type cmd) {
+    this->m_cmd.setDataLength(0);
+    this->m_cmd.setCommand(cmd);
+    return this->m_cmd;
+}
+
+Error LittleFsClient::send() {
+    if (!this->m_bus.sendPacket(this->m_cmd)) {
+        return Error::PORT_ERROR;
+    }
+    return Error::NONE;
+}
+
+Error LittleFsClient::receive(Command::Type cmd, uint32_t timeoutMsec) {
+    while (this->m_bus.receivePacket(timeoutMsec)) {
+        if (this->response().getCommand() == cmd) {
+            return Error::NONE;
+        }
+    }
+    return this->m_bus.isOpen() ? Error::TIMEOUT : Error::PORT_ERROR;
+}
+
+Error LittleFsClient::call(uint32_t timeoutMsec) {
+    Error err = this->send();
+    if (err != Error::NONE) {
+        return err;
+    }
+    return this->receive(this->m_cmd.getCommand(), timeoutMsec);
+}
+
+Error LittleFsClient::callForError(uint32_t timeoutMsec) {
+    Error err = this->call(timeoutMsec);
+    if (err != Error::NONE) {
+        return err;
+    }
+    Unpacker unpacker(this->response());
+    uint8_t rspErr;
+    unpacker.unpack(&rspErr);
+    return static_cast<Error>(rspErr);
+}
+
+void LittleFsClient::drainResponses() {
+    while (this->m_bus.receivePacket(500)) {
+    }
+}
+
+size_t LittleFsClient::dataSize(size_t packetLen, size_t headerLen) const {
+    // The same 20 bytes of slack as the Python client leaves for framing.
+    size_t size = packetLen - headerLen - 20;
+    if (this->m_blockSize > 0 && size > this->m_blockSize) {
+        size -= size % this->m_blockSize;
+    }
+    return size;
+}
+
+Error LittleFsClient::open(std::string const& remoteName, OpenMode mode, uint8_t* handle) {
+    Packet& cmd = this->newCommand(Command::OPEN);
+    cmd.appendByte(to_underlying(mode));
+    cmd.append(remoteName.c_str());
+    Error err = this->call(TIMEOUT_MSEC);
+    if (err != Error::NONE) {
+        return err;
+    }
+    Unpacker unpacker(this->response());
+    uint8_t rspErr;
+    unpacker.unpack(&rspErr);
+    unpacker.unpack(handle);
+    return static_cast<Error>(rspErr);
+}
+
+Error LittleFsClient::close(uint8_t handle) {
+    Packet& cmd = this->newCommand(Command::CLOSE);
+    cmd.appendByte(handle);
+    return this->callForError(SLOW_TIMEOUT_MSEC);
+}
+
+Error LittleFsClient::writeData(uint8_t handle, std::vector<uint8_t> const& data, uint32_t start) {
+    uint32_t length = data.size();
+    if (this->m_writeWindow <= 1) {
+        // Header is u8 handle, u32 offset, u32 length.
+        size_t chunkSize = this->dataSize(this->m_cmdDataLen, 1 + 4 + 4);
+        for (uint32_t offset = start; offset < length; offset += chunkSize) {
+            uint32_t chunkLen = std::min<uint32_t>(chunkSize, length - offset);
+            Packet& cmd = this->newCommand(Command::WRITE_HANDLE);
+            cmd.appendByte(handle);
+            cmd.append(offset);
+            cmd.append(chunkLen);
+            memcpy(cmd.getWriteData(chunkLen), &data[offset], chunkLen);
+            Error err = this->callForError(SLOW_TIMEOUT_MSEC);
+            if (err != Error::NONE) {
+                return err;
+            }
+        }
+        return Error::NONE;
+    }
+
+    // Header is u8 handle, u8 sequence, u32 offset, u32 length.
+    size_t chunkSize = this->dataSize(this->m_cmdDataLen, 1 + 1 + 4 + 4);
+    uint8_t seq = 0;
+    uint32_t offset = start;     // Offset of the next chunk to send.
+    uint32_t committed = start;  // Offset acknowledged by the device.
+    int pending = 0;
+    int retries = 0;
+    while (committed < length) {
+        while (offset < length && pending < this->m_writeWindow) {
+            uint32_t chunkLen = std::min<uint32_t>(chunkSize, length - offset);
+            Packet& cmd = this->newCommand(Command::STREAM_WRITE);
+            cmd.appendByte(handle);
+            cmd.appendByte(seq++);
+            cmd.append(offset);
+            cmd.append(chunkLen);
+            memcpy(cmd.getWriteData(chunkLen), &data[offset], chunkLen);
+            Error err = this->send();
+            if (err != Error::NONE) {
+                return err;
+            }
+            offset += chunkLen;
+            pending++;
+        }
+
+        Error err = this->receive(Command::STREAM_WRITE, SLOW_TIMEOUT_MSEC);
+        if (err == Error::NONE) {
+            pending--;
+            Unpacker unpacker(this->response());
+            uint8_t rspErr;
+            uint8_t rspSeq;
+            uint32_t rspCommitted;
+            unpacker.unpack(&rspErr);
+            unpacker.unpack(&rspSeq);
+            unpacker.unpack(&rspCommitted);
+            if (rspErr == to_underlying(Error::NONE)) {
+                committed = std::max(committed, rspCommitted);
+                continue;
+            }
+            if (rspErr != to_underlying(Error::OUT_OF_SEQUENCE)) {
+                return static_cast<Error>(rspErr);
+            }
+            committed = rspCommitted;
+        } else if (err != Error::TIMEOUT) {
+            return err;
+        }
+
+        // A chunk (or its response) was lost. Throw away whatever is still
+        // in flight and resend everything after committed.
+        if (++retries > WRITE_RETRIES) {
+            return Error::TIMEOUT;
+        }
+        this->drainResponses();
+        pending = 0;
+        offset = committed;
+    }
+    return Error::NONE;
+}
+
+Error LittleFsClient::readData(uint8_t handle, std::vector<uint8_t>* data) {
+    data->clear();
+    if ((this->m_capabilities & Capabilities::STREAM) == 0) {
+        // Header is u8 error, u32 offset, u32 length.
+        uint32_t chunkSize = this->dataSize(this->m_rspDataLen, 1 + 4 + 4);
+        while (true) {
+            Packet& cmd = this->newCommand(Command::READ_HANDLE);
+            cmd.appendByte(handle);
+            cmd.append(static_cast<uint32_t>(data->size()));
+            cmd.append(chunkSize);
+            Error err = this->call(SLOW_TIMEOUT_MSEC);
+            if (err != Error::NONE) {
+                return err;
+            }
+            Unpacker unpacker(this->response());
+            uint8_t rspErr;
+            uint32_t rspOffset;
+            uint32_t rspLength;
+            uint8_t const* rspData;
+            unpacker.unpack(&rspErr);
+            unpacker.unpack(&rspOffset);
+            unpacker.unpack(&rspLength);
+            if (rspErr != to_underlying(Error::NONE)) {
+                return static_cast<Error>(rspErr);
+            }
+            if (rspLength == 0) {
+                return Error::NONE;
+            }
+            unpacker.unpack(rspLength, &rspData);
+            data->insert(data->end(), rspData, rspData + rspLength);
+        }
+    }
+
+    // Header is u8 error, u8 flags, u8 sequence, u32 offset, u32 length.
+    uint16_t chunkSize = this->dataSize(this->m_rspDataLen, 1 + 1 + 1 + 4 + 4);
+    int retries = 0;
+    while (true) {
+        uint32_t offset = data->size();
+        Packet& cmd = this->newCommand(Command::STREAM_READ);
+        cmd.appendByte(handle);
+        cmd.append(offset);
+        cmd.appendByte(READ_WINDOW);
+        cmd.append(chunkSize);
+        Error err = this->send();
+        if (err != Error::NONE) {
+            return err;
+        }
+
+        // Collect the window. Data following a lost packet is discarded, and
+        // the next STREAM_READ (starting after the data received in order)
+        // acts as the acknowledgement.
+        bool last = false;
+        bool eof = false;
+        while (!last) {
+            err = this->receive(Command::STREAM_READ, TIMEOUT_MSEC);
+            if (err != Error::NONE) {
+                break;
+            }
+            Unpacker unpacker(this->response());
+            uint8_t rspErr;
+            uint8_t flags;
+            uint8_t seq;
+            uint32_t rspOffset;
+            uint32_t rspLength;
+            uint8_t const* rspData;
+            unpacker.unpack(&rspErr);
+            unpacker.unpack(&flags);
+            unpacker.unpack(&seq);
+            unpacker.unpack(&rspOffset);
+            unpacker.unpack(&rspLength);
+            if (rspErr != to_underlying(Error::NONE)) {
+                return static_cast<Error>(rspErr);
+            }
+            unpacker.unpack(rspLength, &rspData);
+            bool inOrder = (rspOffset == data->size());
+            if (inOrder) {
+                data->insert(data->end(), rspData, rspData + rspLength);
+            }
+            last = (flags & StreamFlags::LAST) != 0;
+            eof = last && inOrder && (flags & StreamFlags::END_OF_FILE) != 0;
+        }
+        if (eof) {
+            return Error::NONE;
+        }
+        if (err == Error::PORT_ERROR) {
+            return err;
+        }
+        if (data->size() > offset) {
+            retries = 0;
+        } else if (++retries > WRITE_RETRIES) {
+            return Error::TIMEOUT;
+        }
+        if (!last) {
+            this->drainResponses();
+        }
+    }
+}
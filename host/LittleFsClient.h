@@ -0,0 +1,190 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   LittleFsClient.h
+ *
+ *   @brief  Talks to a LittleFsPacketHandler running on one device.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+#include "LittleFsProtocol.h"
+#include "Packet.h"
+#include "PosixSerialBus.h"
+
+//! The host side of the LittleFs packet protocol, for one device.
+//!
+//! This does the same job as the LittleFsPlugin in duino_littlefs.py, but
+//! keeps a window of STREAM_READ and STREAM_WRITE packets in flight rather
+//! than waiting for each response, so transfers are limited by the serial
+//! port instead of the round trip time. A client is only used by one thread
+//! at a time; DevicePool runs many clients in parallel.
+class LittleFsClient {
+ public:
+    using Error = LittleFs::Error;
+
+    //! An entry returned by listDir.
+    struct DirEntry {
+        std::string name;    //!< Name of the file (without the directory).
+        uint8_t flags;       //!< LittleFs::Flags of the entry.
+        uint32_t size;       //!< Size of the file in bytes.
+        uint32_t timestamp;  //!< Time the file was last written.
+
+        //! @returns true if the entry is a directory.
+        bool isDir() const { return (this->flags & LittleFs::Flags::DIR) != 0; }
+    };
+
+    //! Constructor.
+    LittleFsClient();
+
+    //! Opens the serial port and asks the device for its capabilities (devices
+    //! without CAPS are assumed to have the default buffer sizes).
+    //! @returns Error::NONE if the port was opened.
+    Error connect(
+        char const* portName,  //!< [in] Port the device is connected to.
+        uint32_t baud          //!< [in] Baud rate to use.
+    );
+
+    //! Closes the serial port.
+    void disconnect();
+
+    //! @returns The port passed to connect.
+    std::string const& portName() const { return this->m_portName; }
+
+    //! @returns The LittleFs::Capabilities reported by the device.
+    uint32_t capabilities() const { return this->m_capabilities; }
+
+    //! Creates a directory on the device.
+    //! @returns Error::NONE if the directory was created.
+    Error mkdir(std::string const& dirName  //!< [in] Directory to create.
+    );
+
+    //! Lists the files in a directory on the device.
+    //! @returns Error::NONE if the whole directory was listed.
+    Error listDir(
+        std::string const& dirName,     //!< [in] Directory to list.
+        std::vector<DirEntry>* entries  //!< [out] Files found in the directory.
+    );
+
+    //! Copies a file from the host to the device.
+    //! @returns Error::NONE if the whole file was copied.
+    Error pushFile(
+        std::string const& localName,  //!< [in] File on the host to copy.
+        std::string const& remoteName  //!< [in] File on the device to create.
+    );
+
+    //! Copies a file from the device to the host.
+    //! @returns Error::NONE if the whole file was copied.
+    Error pullFile(
+        std::string const& remoteName,  //!< [in] File on the device to copy.
+        std::string const& localName    //!< [in] File on the host to create.
+    );
+
+    //! Copies a directory tree from the host to the device, creating any
+    //! directories which are needed.
+    //! @returns Error::NONE if every file was copied.
+    Error pushTree(
+        std::string const& localDir,  //!< [in] Directory on the host to copy.
+        std::string const& remoteDir  //!< [in] Directory on the device to copy into.
+    );
+
+    //! Copies a directory tree from the device to the host, creating any
+    //! directories which are needed.
+    //! @returns Error::NONE if every file was copied.
+    Error pullTree(
+        std::string const& remoteDir,  //!< [in] Directory on the device to copy.
+        std::string const& localDir    //!< [in] Directory on the host to copy into.
+    );
+
+ private:
+    //! @returns The command packet, emptied and set to send cmd.
+    Packet& newCommand(LittleFs::Command::Type cmd  //!< [in] Command to send.
+    );
+
+    //! Sends the command packet.
+    //! @returns Error::NONE if the packet was written.
+    Error send();
+
+    //! Waits for a response to the command, skipping any stray responses
+    //! left over from earlier commands.
+    //! @returns Error::NONE if the response is available from response().
+    Error receive(
+        LittleFs::Command::Type cmd,  //!< [in] Command being responded to.
+        uint32_t timeoutMsec          //!< [in] How long to wait.
+    );
+
+    //! Sends the command packet and waits for its response.
+    //! @returns Error::NONE if the response is available from response().
+    Error call(uint32_t timeoutMsec  //!< [in] How long to wait for the response.
+    );
+
+    //! @returns The response most recently received.
+    Packet const& response() const { return this->m_bus.received(); }
+
+    //! Discards any responses which are still in flight.
+    void drainResponses();
+
+    //! @returns The amount of file data which fits in a packet which can
+    //!          hold packetLen bytes, after headerLen bytes of other fields.
+    size_t dataSize(
+        size_t packetLen,  //!< [in] Size of the device's packet buffer.
+        size_t headerLen   //!< [in] Size of the fields before the data.
+    ) const;
+
+    //! Sends a command whose response is just an error code.
+    //! @returns The error code.
+    Error callForError(uint32_t timeoutMsec  //!< [in] How long to wait for the response.
+    );
+
+    //! Opens a file on the device.
+    //! @returns Error::NONE if the file was opened.
+    Error open(
+        std::string const& remoteName,  //!< [in] File to open.
+        LittleFs::OpenMode mode,        //!< [in] How to open the file.
+        uint8_t* handle                 //!< [out] Handle of the open file.
+    );
+
+    //! Closes a file on the device.
+    //! @returns Error::NONE if the file was closed.
+    Error close(uint8_t handle  //!< [in] Handle to close.
+    );
+
+    //! Writes data to an open file, keeping a window of STREAM_WRITE packets
+    //! in flight (or using WRITE_HANDLE if the device doesn't stream).
+    //! @returns Error::NONE if all of the data was written.
+    Error writeData(
+        uint8_t handle,                    //!< [in] Handle to write to.
+        std::vector<uint8_t> const& data,  //!< [in] Whole contents of the file.
+        uint32_t start                     //!< [in] Offset to start writing at.
+    );
+
+    //! Reads the rest of an open file, keeping a window of STREAM_READ packets
+    //! in flight (or using READ_HANDLE if the device doesn't stream).
+    //! @returns Error::NONE if the whole file was read.
+    Error readData(
+        uint8_t handle,             //!< [in] Handle to read from.
+        std::vector<uint8_t>* data  //!< [out] Contents of the file.
+    );
+
+    std::string m_portName;          //!< Port passed to connect.
+    PosixSerialBus m_bus;            //!< Serial port the device is connected to.
+    uint32_t m_capabilities = 0;     //!< LittleFs::Capabilities of the device.
+    uint32_t m_cmdDataLen;           //!< Size of the device's command buffer.
+    uint32_t m_rspDataLen;           //!< Size of the device's response buffer.
+    uint32_t m_blockSize = 0;        //!< LittleFS block size (0 if unknown).
+    uint8_t m_writeWindow = 1;       //!< STREAM_WRITE packets which may be in flight.
+    std::vector<uint8_t> m_cmdData;  //!< Data of m_cmd.
+    Packet m_cmd;                    //!< Command being sent to the device.
+};
@@ -0,0 +1,66 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   LittleFsProtocol.cpp
+ *
+ *   @brief  Command codes and values used by the LittleFs packet protocol.
+ *
+ ****************************************************************************/
+
+#include "LittleFsProtocol.h"
+
+namespace LittleFs {
+
+char const* errorStr(Error err) {
+    // Names of the device's error codes (these match ERROR_STRS in
+    // duino_littlefs.py).
+    static char const* const ERROR_STRS[] = {
+        "NONE",
+        "UNABLE_TO_OPEN_FILE",
+        "WRITE_FAILED",
+        "READ_FAILED",
+        "SEEK_FAILED",
+        "FORMAT_FAILED",
+        "MKDIR_FAILED",
+        "RMDIR_FAILED",
+        "REMOVE_FAILED",
+        "INVALID_HANDLE",
+        "NO_FREE_HANDLES",
+        "INVALID_CURSOR",
+        "OUT_OF_SEQUENCE",
+        "RENAME_FAILED",
+        "UNSUPPORTED",
+        "VERIFY_FAILED",
+        "BUSY",
+        "INVALID_JOB",
+        "INVALID_COMMAND",
+        "INVALID_PATH",
+    };
+    switch (err) {
+        case Error::TIMEOUT: {
+            return "TIMEOUT";
+        }
+        case Error::PORT_ERROR: {
+            return "PORT_ERROR";
+        }
+        case Error::LOCAL_FILE: {
+            return "LOCAL_FILE";
+        }
+        default: {
+            break;
+        }
+    }
+    if (to_underlying(err) < LEN(ERROR_STRS)) {
+        return ERROR_STRS[to_underlying(err)];
+    }
+    return "???";
+}
+
+}  // namespace LittleFs
@@ -0,0 +1,151 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   LittleFsProtocol.h
+ *
+ *   @brief  Command codes and values used by the LittleFs packet protocol.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cinttypes>
+
+#include "duino_util.h"
+#include "Packet.h"
+
+//! The parts of the LittleFsPacketHandler protocol which the host client uses.
+//! These have to be kept in sync with src/LittleFsPacketHandler.h (the
+//! device's header can't be used here since it needs the Arduino FS
+//! library).
+namespace LittleFs {
+
+//! Commands accepted by the LittleFs packet handler.
+struct Command : public Packet::Command {
+    static constexpr Type FORMAT = 0x40;            //!< Format a file system.
+    static constexpr Type INFO = 0x41;              //!< Return info about a file system.
+    static constexpr Type LIST = 0x42;              //!< List files in a directory
+    static constexpr Type MKDIR = 0x43;             //!< Create a new directory.
+    static constexpr Type REMOVE = 0x44;            //!< Remove a file or directory.
+    static constexpr Type RENAME = 0x45;            //!< Rename a file or directory.
+    static constexpr Type COPY = 0x46;              //!< Copy a file
+    static constexpr Type READ = 0x47;              //!< Read data from a file.
+    static constexpr Type WRITE = 0x48;             //!< Write data to a file.
+    static constexpr Type APPEND = 0x49;            //!< Append data to a file.
+    static constexpr Type RMDIR = 0x4a;             //!< Remove a directory.
+    static constexpr Type OPEN = 0x4b;              //!< Open a file, returning a handle.
+    static constexpr Type READ_HANDLE = 0x4c;       //!< Read data from an open file.
+    static constexpr Type WRITE_HANDLE = 0x4d;      //!< Write data to an open file.
+    static constexpr Type CLOSE = 0x4e;             //!< Close an open file.
+    static constexpr Type LIST_CURSOR = 0x4f;       //!< List files, resuming from a cursor.
+    static constexpr Type STREAM_READ = 0x50;       //!< Read a window of packets from a file.
+    static constexpr Type STREAM_WRITE = 0x51;      //!< Write one chunk of a windowed upload.
+    static constexpr Type CAPS = 0x52;              //!< Return capabilities and buffer sizes.
+    static constexpr Type FLUSH = 0x53;             //!< Write buffered APPEND data to flash.
+    static constexpr Type HASH = 0x54;              //!< Return a CRC-32 or SHA-256 of a file.
+    static constexpr Type SIGNATURE = 0x55;         //!< Return per-block checksums of a file.
+    static constexpr Type PATCH = 0x56;             //!< Build a file from blocks and new data.
+    static constexpr Type READ_COMPRESSED = 0x57;   //!< Read compressed data from a file.
+    static constexpr Type WRITE_COMPRESSED = 0x58;  //!< Write compressed data to a file.
+    static constexpr Type WALK = 0x59;              //!< List all of the files in a tree.
+    static constexpr Type BATCH = 0x5a;             //!< Run several MKDIR/REMOVE/RMDIR/RENAMEs.
+    static constexpr Type JOB_START = 0x5b;         //!< Start a long operation as a job.
+    static constexpr Type JOB_STATUS = 0x5c;        //!< Return the progress or result of a job.
+    static constexpr Type LIST_COMPACT = 0x5d;      //!< List selected fields of each file.
+    static constexpr Type STATFS = 0x5e;            //!< Return file system geometry and usage.
+    static constexpr Type STATS = 0x5f;             //!< Return timing counters.
+    static constexpr Type WRITE_AT = 0x60;          //!< Overwrite part of an existing file.
+    static constexpr Type TRUNCATE = 0x61;          //!< Shrink or extend a file.
+    static constexpr Type UPLOAD_BEGIN = 0x62;      //!< Start or resume an upload session.
+    static constexpr Type UPLOAD_COMMIT = 0x63;     //!< Replace a file with a finished upload.
+    static constexpr Type SEARCH = 0x64;            //!< Return the lines of files which match.
+    static constexpr Type TAIL = 0x65;              //!< Send data as it's appended to a file.
+    static constexpr Type EXPORT = 0x66;            //!< Read a directory tree as an archive.
+    static constexpr Type IMPORT = 0x67;            //!< Unpack an archive into a directory.
+    static constexpr Type STAT = 0x68;              //!< Return the size and type of one file.
+};
+
+//! Error codes
+enum class Error : uint8_t {
+    NONE = 0,                 //!< No Error
+    UNABLE_TO_OPEN_FILE = 1,  //!< File doesn't exits
+    WRITE_FAILED = 2,         //!< Writing to a file failed.
+    READ_FAILED = 3,          //!< Reading from a file failed.
+    SEEK_FAILED = 4,          //!< Seeking to a position within a file failed.
+    FORMAT_FAILED = 5,        //!< Formatting the filesystem failed.
+    MKDIR_FAILED = 6,         //!< Creating a directory failed.
+    RMDIR_FAILED = 7,         //!< Removing a directory failed.
+    REMOVE_FAILED = 8,        //!< Remmoving a file failed.
+    INVALID_HANDLE = 9,       //!< The file handle isn't open.
+    NO_FREE_HANDLES = 10,     //!< All of the file handles are in use.
+    INVALID_CURSOR = 11,      //!< The directory cursor doesn't exist (or has expired).
+    OUT_OF_SEQUENCE = 12,     //!< A STREAM_WRITE chunk didn't follow the previous one.
+    RENAME_FAILED = 13,       //!< Renaming a file or directory failed.
+    UNSUPPORTED = 14,         //!< The requested option isn't supported by this device.
+    VERIFY_FAILED = 15,       //!< The data written doesn't match the expected CRC.
+    BUSY = 16,                //!< A job is running which the command would disturb.
+    INVALID_JOB = 17,         //!< The job doesn't exist (or its result was collected).
+    INVALID_COMMAND = 18,     //!< The command is too short to hold its arguments.
+    INVALID_PATH = 19,        //!< A path would leave the directory it belongs in.
+
+    // Errors which only happen on the host.
+    TIMEOUT = 0x80,     //!< The device didn't respond in time.
+    PORT_ERROR = 0x81,  //!< The serial port couldn't be opened, read or written.
+    LOCAL_FILE = 0x82,  //!< A file on the host couldn't be opened, read or written.
+};
+
+//! Modes that a file can be opened with using the OPEN command.
+enum class OpenMode : uint8_t {
+    READ = 0,    //!< Open an existing file for reading.
+    WRITE = 1,   //!< Create a file, truncating it if it already exists.
+    APPEND = 2,  //!< Open a file for writing starting at the end.
+    UPDATE = 3,  //!< Open an existing file for reading and writing, without truncating it.
+};
+
+//! Flags for a directory entry
+struct Flags : public Bits<uint8_t> {
+    static constexpr Type DIR = 0x01;  //!< Directory entry is a directory.
+};
+
+//! Optional features reported by the CAPS command.
+struct Capabilities : public Bits<uint32_t> {
+    static constexpr Type STREAM = 0x00000001;        //!< STREAM_READ sends many packets.
+    static constexpr Type HASH_SHA256 = 0x00000002;   //!< HASH supports HashType::SHA256.
+    static constexpr Type COMPRESSION = 0x00000004;   //!< READ/WRITE_COMPRESSED support LZ4.
+    static constexpr Type JOBS = 0x00000008;          //!< Supports JOB_START and JOB_STATUS.
+    static constexpr Type LIST_COMPACT = 0x00000010;  //!< Supports LIST_COMPACT.
+    static constexpr Type UPLOAD = 0x00000020;        //!< Supports UPLOAD_BEGIN/COMMIT.
+    static constexpr Type SEARCH = 0x00000040;        //!< Supports SEARCH.
+    static constexpr Type TAIL = 0x00000080;          //!< Supports TAIL.
+    static constexpr Type ARCHIVE = 0x00000100;       //!< Supports EXPORT and IMPORT.
+    static constexpr Type STAT = 0x00000200;          //!< Supports STAT.
+};
+
+//! Flags passed with the UPLOAD_BEGIN and UPLOAD_COMMIT commands.
+struct UploadFlags : public Bits<uint8_t> {
+    static constexpr Type RESUME = 0x01;  //!< UPLOAD_BEGIN: Keep data from an earlier session.
+    static constexpr Type ABORT = 0x02;   //!< UPLOAD_COMMIT: Remove the temporary file instead.
+};
+
+//! Flags sent with each STREAM_READ response.
+struct StreamFlags : public Bits<uint8_t> {
+    static constexpr Type LAST = 0x01;         //!< Last packet sent for this request.
+    static constexpr Type END_OF_FILE = 0x02;  //!< The end of the file (or WALK) was reached.
+};
+
+//! Cursor value which starts a new LIST_CURSOR listing, and which is returned
+//! once the listing is complete.
+static constexpr uint8_t NO_CURSOR = 0xff;
+
+//! @returns The name of an error code.
+char const* errorStr(Error err  //!< [in] Error code to convert.
+);
+
+}  // namespace LittleFs
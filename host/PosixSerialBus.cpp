@@ -0,0 +1,210 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   PosixSerialBus.cpp
+ *
+ *   @brief  Sends and receives packets over a serial port on a POSIX host.
+ *
+ ****************************************************************************/
+
+#include "PosixSerialBus.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+
+#include "duino_util.h"
+
+//! Converts a baud rate into the termios speed for it.
+//! @returns true if the baud rate is supported.
+static bool baudToSpeed(
+    uint32_t baud,  //!< [in] Baud rate.
+    speed_t* speed  //!< [out] Matching termios speed.
+) {
+    switch (baud) {
+        case 9600: {
+            *speed = B9600;
+            return true;
+        }
+        case 19200: {
+            *speed = B19200;
+            return true;
+        }
+        case 38400: {
+            *speed = B38400;
+            return true;
+        }
+        case 57600: {
+            *speed = B57600;
+            return true;
+        }
+        case 115200: {
+            *speed = B115200;
+            return true;
+        }
+        case 230400: {
+            *speed = B230400;
+            return true;
+        }
+#if defined(B460800)
+        case 460800: {
+            *speed = B460800;
+            return true;
+        }
+#endif
+#if defined(B921600)
+        case 921600: {
+            *speed = B921600;
+            return true;
+        }
+#endif
+    }
+    return false;
+}
+
+PosixSerialBus::PosixSerialBus()
+    : IBus{&this->m_rxPacket, &this->m_txPacket},
+      m_rxPacket{LEN(this->m_rxPacketData), this->m_rxPacketData},
+      m_txPacket{LEN(this->m_txPacketData), this->m_txPacketData} {}
+
+PosixSerialBus::~PosixSerialBus() {
+    this->close();
+}
+
+bool PosixSerialBus::open(char const* portName, uint32_t baud) {
+    this->close();
+    speed_t speed;
+    if (!baudToSpeed(baud, &speed)) {
+        return false;
+    }
+    int fd = ::open(portName, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+        return false;
+    }
+    struct termios tio;
+    if (tcgetattr(fd, &tio) != 0) {
+        ::close(fd);
+        return false;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    if (cfsetispeed(&tio, speed) != 0 || cfsetospeed(&tio, speed) != 0 ||
+        tcsetattr(fd, TCSANOW, &tio) != 0) {
+        ::close(fd);
+        return false;
+    }
+    // Throw away anything the device sent before the port was opened.
+    tcflush(fd, TCIOFLUSH);
+    this->m_fd = fd;
+    this->m_rxLen = 0;
+    this->m_rxPos = 0;
+    this->m_txLen = 0;
+    return true;
+}
+
+void PosixSerialBus::close() {
+    if (this->m_fd >= 0) {
+        ::close(this->m_fd);
+        this->m_fd = -1;
+    }
+}
+
+bool PosixSerialBus::sendPacket(Packet const& packet) {
+    if (this->m_fd < 0) {
+        return false;
+    }
+    this->m_writeFailed = false;
+    this->writePacket(packet);
+    return this->flush() && !this->m_writeFailed;
+}
+
+bool PosixSerialBus::receivePacket(uint32_t timeoutMsec) {
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMsec);
+    while (this->m_fd >= 0) {
+        while (this->isDataAvailable()) {
+            if (this->processByte() == Packet::Error::NONE) {
+                return true;
+            }
+        }
+        Clock::time_point now = Clock::now();
+        if (now >= deadline) {
+            return false;
+        }
+        uint32_t remaining =
+            std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+        this->fill(remaining + 1);
+    }
+    return false;
+}
+
+bool PosixSerialBus::isDataAvailable() const {
+    return this->m_rxPos < this->m_rxLen;
+}
+
+bool PosixSerialBus::readByte(uint8_t* byte) {
+    if (!this->isDataAvailable()) {
+        return false;
+    }
+    *byte = this->m_rxBuffer[this->m_rxPos++];
+    return true;
+}
+
+bool PosixSerialBus::isSpaceAvailable() const {
+    return true;
+}
+
+void PosixSerialBus::writeByte(uint8_t byte) {
+    if (this->m_txLen >= sizeof(this->m_txBuffer) && !this->flush()) {
+        this->m_writeFailed = true;
+        return;
+    }
+    this->m_txBuffer[this->m_txLen++] = byte;
+}
+
+bool PosixSerialBus::flush() {
+    size_t written = 0;
+    while (written < this->m_txLen) {
+        ssize_t len = ::write(this->m_fd, &this->m_txBuffer[written], this->m_txLen - written);
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                this->m_txLen = 0;
+                return false;
+            }
+            struct pollfd pfd = {this->m_fd, POLLOUT, 0};
+            poll(&pfd, 1, 100);
+            continue;
+        }
+        written += len;
+    }
+    this->m_txLen = 0;
+    return true;
+}
+
+bool PosixSerialBus::fill(uint32_t timeoutMsec) {
+    struct pollfd pfd = {this->m_fd, POLLIN, 0};
+    if (poll(&pfd, 1, static_cast<int>(timeoutMsec)) <= 0) {
+        return false;
+    }
+    ssize_t len = ::read(this->m_fd, this->m_rxBuffer, sizeof(this->m_rxBuffer));
+    if (len <= 0) {
+        return false;
+    }
+    this->m_rxLen = len;
+    this->m_rxPos = 0;
+    return true;
+}
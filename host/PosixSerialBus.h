@@ -0,0 +1,100 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   PosixSerialBus.h
+ *
+ *   @brief  Sends and receives packets over a serial port on a POSIX host.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+#include "Bus.h"
+#include "Packet.h"
+
+//! Largest packet which can be sent or received. This needs to be at least as
+//! big as the device's buffers (which are reported by the CAPS command).
+#if !defined(HOST_MAX_PACKET_SIZE)
+#define HOST_MAX_PACKET_SIZE 8192
+#endif
+
+//! A bus which talks to a device connected to a serial port, using the same
+//! packet framing as the device's ArduinoSerialBus.
+//!
+//! The packets sent by the device are decoded into the bus's receive packet,
+//! which is returned by received(). Each bus is only used by one thread at
+//! a time.
+class PosixSerialBus : public IBus {
+ public:
+    //! Constructor.
+    PosixSerialBus();
+
+    ~PosixSerialBus() override;
+
+    //! Opens the serial port, using 8 data bits, no parity, 1 stop bit and no
+    //! flow control.
+    //! @returns true if the port was opened.
+    bool open(
+        char const* portName,  //!< [in] Port to open (like /dev/ttyUSB0).
+        uint32_t baud          //!< [in] Baud rate to use.
+    );
+
+    //! Closes the serial port.
+    void close();
+
+    //! @returns true if the serial port is open.
+    bool isOpen() const { return this->m_fd >= 0; }
+
+    //! Sends a packet to the device.
+    //! @returns true if the whole packet was written.
+    bool sendPacket(Packet const& packet  //!< [in] Packet to send.
+    );
+
+    //! Waits for the device to send a packet, which is then available from
+    //! received().
+    //! @returns true if a packet arrived, false if the timeout expired first.
+    bool receivePacket(uint32_t timeoutMsec  //!< [in] How long to wait.
+    );
+
+    //! @returns The packet most recently returned by receivePacket.
+    Packet const& received() const { return this->m_rxPacket; }
+
+    bool isDataAvailable() const override;
+    bool readByte(uint8_t* byte) override;
+    bool isSpaceAvailable() const override;
+    void writeByte(uint8_t byte) override;
+
+ private:
+    //! Writes any buffered bytes to the serial port.
+    //! @returns true if everything was written.
+    bool flush();
+
+    //! Waits for more bytes to arrive from the serial port.
+    //! @returns true if some bytes were read.
+    bool fill(uint32_t timeoutMsec  //!< [in] How long to wait.
+    );
+
+    int m_fd = -1;               //!< Serial port (or -1 when closed).
+    bool m_writeFailed = false;  //!< A write failed since the last sendPacket.
+
+    uint8_t m_rxPacketData[HOST_MAX_PACKET_SIZE];  //!< Data of m_rxPacket.
+    uint8_t m_txPacketData[1];                     //!< Data of the unused response packet.
+    Packet m_rxPacket;                             //!< Packets decoded from the device.
+    Packet m_txPacket;                             //!< Passed to IBus, but never used.
+
+    uint8_t m_rxBuffer[512];  //!< Bytes read from the port, waiting to be decoded.
+    size_t m_rxLen = 0;       //!< Number of bytes in m_rxBuffer.
+    size_t m_rxPos = 0;       //!< Next byte of m_rxBuffer to decode.
+    uint8_t m_txBuffer[512];  //!< Encoded bytes waiting to be written to the port.
+    size_t m_txLen = 0;       //!< Number of bytes in m_txBuffer.
+};
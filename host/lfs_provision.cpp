@@ -0,0 +1,116 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   lfs_provision.cpp
+ *
+ *   @brief  Copies a directory tree to or from many devices at once.
+ *
+ ****************************************************************************/
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "DevicePool.h"
+#include "LittleFsClient.h"
+
+using Error = LittleFsClient::Error;
+
+//! Prints the command line usage.
+static void usage() {
+    fprintf(stderr,
+            "Usage: lfs_provision [-b BAUD] [-j THREADS] push|pull LOCAL REMOTE PORT...\n"
+            "\n"
+            "  push  Copies the LOCAL directory tree into REMOTE on every device.\n"
+            "  pull  Copies REMOTE from every device into LOCAL/<port name>.\n"
+            "\n"
+            "  -b BAUD     Baud rate to use (default 115200).\n"
+            "  -j THREADS  Number of devices to talk to at once (default: one per port).\n");
+}
+
+int main(int argc, char** argv) {
+    uint32_t baud = 115200;
+    size_t numThreads = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:j:h")) != -1) {
+        switch (opt) {
+            case 'b': {
+                baud = strtoul(optarg, nullptr, 0);
+                break;
+            }
+            case 'j': {
+                numThreads = strtoul(optarg, nullptr, 0);
+                break;
+            }
+            default: {
+                usage();
+                return 1;
+            }
+        }
+    }
+    if (argc - optind < 4) {
+        usage();
+        return 1;
+    }
+    std::string op = argv[optind];
+    std::string local = argv[optind + 1];
+    std::string remote = argv[optind + 2];
+    std::vector<char const*> ports(&argv[optind + 3], &argv[argc]);
+    if (op != "push" && op != "pull") {
+        usage();
+        return 1;
+    }
+    if (numThreads == 0) {
+        numThreads = ports.size();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::future<Error>> connected(ports.size());
+    std::vector<std::future<Error>> results;
+    {
+        DevicePool pool(numThreads);
+        for (size_t i = 0; i < ports.size(); i++) {
+            size_t device = pool.addDevice(ports[i], baud, &connected[i]);
+            std::string portName = ports[i];
+            results.push_back(
+                pool.submit(device, [&op, &local, &remote, portName](LittleFsClient& client) {
+                    if (op == "push") {
+                        return client.pushTree(local, remote);
+                    }
+                    // Each device gets its own directory, named after its port.
+                    std::string baseName = portName.substr(portName.find_last_of('/') + 1);
+                    return client.pullTree(remote, local + "/" + baseName);
+                }));
+        }
+        pool.wait();
+    }
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int numFailed = 0;
+    for (size_t i = 0; i < ports.size(); i++) {
+        Error err = connected[i].get();
+        if (err == Error::NONE) {
+            err = results[i].get();
+        }
+        if (err != Error::NONE) {
+            numFailed++;
+        }
+        printf("%s: %s\n", ports[i], LittleFs::errorStr(err));
+    }
+    printf("%zu devices in %.1f seconds, %d failed\n", ports.size(), elapsed, numFailed);
+    return (numFailed == 0) ? 0 : 1;
+}
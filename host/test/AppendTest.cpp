@@ -0,0 +1,104 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   AppendTest.cpp
+ *
+ *   @brief  Tests for collecting APPEND data into block sized writes.
+ *
+ ****************************************************************************/
+
+#include <string>
+
+#include "HandlerTest.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using StatsPhase = LittleFsPacketHandler::StatsPhase;
+
+//! Appends to a file using the APPEND command.
+//! @returns The error returned by APPEND.
+static Error appendData(
+    HandlerTest* t,          //!< [mod] Handler to send the command to.
+    char const* filename,    //!< [in] File to append to.
+    std::string const& data  //!< [in] Data to append.
+) {
+    Packet& cmd = t->command(Command::APPEND);
+    cmd.append(filename);
+    cmd.append(static_cast<uint32_t>(data.size()));
+    cmd.appendData(data.size(), data.data());
+    return t->callForError();
+}
+
+//! @returns The number of writes to flash since the last call (and clears
+//!          the STATS counters).
+static uint32_t numWrites(HandlerTest* t  //!< [mod] Handler to query.
+) {
+    uint32_t count = 0;
+    uint32_t bytes = 0;
+    t->takePhaseStats(StatsPhase::WRITE, &count, &bytes);
+    return count;
+}
+
+HANDLER_TEST(appendCoalescesWrites) {
+    numWrites(t);
+    std::string expected;
+    for (int i = 0; i < 20; i++) {
+        std::string line = "log line " + std::to_string(i) + "\n";
+        CHECK(appendData(t, "/log.txt", line) == Error::NONE);
+        expected += line;
+    }
+    // Nothing has been written yet, and STATS didn't write it either.
+    CHECK(numWrites(t) == 0);
+    CHECK(t->readFile("/log.txt").empty());
+
+    t->command(Command::FLUSH);
+    CHECK(t->callForError() == Error::NONE);
+    CHECK(numWrites(t) == 1);
+    CHECK(t->readFile("/log.txt") == expected);
+}
+
+HANDLER_TEST(appendWritesWholeBlocks) {
+    // The file doesn't start on a block boundary, so the first write fills
+    // up to the boundary, and the next ones are a block each.
+    t->writeFile("/log.txt", "start");
+    numWrites(t);
+    std::string data(2 * LITTLEFS_APPEND_BUFFER_SIZE + 100, 'a');
+    for (size_t offset = 0; offset < data.size(); offset += 1000) {
+        CHECK(appendData(t, "/log.txt", data.substr(offset, 1000)) == Error::NONE);
+    }
+    CHECK(numWrites(t) == 2);
+    CHECK(t->readFile("/log.txt").size() == 2 * LITTLEFS_APPEND_BUFFER_SIZE);
+
+    t->command(Command::FLUSH);
+    CHECK(t->callForError() == Error::NONE);
+    CHECK(t->readFile("/log.txt") == "start" + data);
+}
+
+HANDLER_TEST(appendFlushedByOtherCommands) {
+    CHECK(appendData(t, "/log.txt", "buffered") == Error::NONE);
+    t->command(Command::CAPS);
+    t->call();
+    CHECK(t->readFile("/log.txt").empty());
+
+    // Commands which use files see the buffered data.
+    Packet& cmd = t->command(Command::READ);
+    cmd.append("/log.txt");
+    cmd.append(static_cast<uint32_t>(0));
+    cmd.append(static_cast<uint32_t>(100));
+    t->call();
+    CHECK(t->readFile("/log.txt") == "buffered");
+}
+
+HANDLER_TEST(appendToAnotherFileFlushes) {
+    CHECK(appendData(t, "/a.txt", "first") == Error::NONE);
+    CHECK(appendData(t, "/b.txt", "second") == Error::NONE);
+    CHECK(t->readFile("/a.txt") == "first");
+    CHECK(t->readFile("/b.txt").empty());
+}
@@ -0,0 +1,303 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   ArchiveTest.cpp
+ *
+ *   @brief  Tests for EXPORT and IMPORT of directory trees.
+ *
+ ****************************************************************************/
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "HandlerTest.h"
+#include "Lz4.h"
+#include "Unpacker.h"
+
+using ArchiveRecord = LittleFsPacketHandler::ArchiveRecord;
+using Codec = LittleFsPacketHandler::Codec;
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using ExportFlags = LittleFsPacketHandler::ExportFlags;
+using ImportFlags = LittleFsPacketHandler::ImportFlags;
+using StatsPhase = LittleFsPacketHandler::StatsPhase;
+using StreamFlags = LittleFsPacketHandler::StreamFlags;
+
+//! Number of packets requested by each EXPORT command.
+static constexpr uint8_t EXPORT_WINDOW = 4;
+
+//! Number of bytes before the data in each EXPORT response.
+static constexpr size_t EXPORT_HEADER_LEN = 13;
+
+//! Creates a tree of files and directories below /src.
+static void makeTree(HandlerTest* t  //!< [mod] Test whose file system gets the tree.
+) {
+    std::string big;
+    for (unsigned line = 0; big.size() < 20000; line++) {
+        big += "telemetry " + std::to_string(line % 97) + "\n";
+    }
+    t->fs().mkdir("/src");
+    t->fs().mkdir("/src/sub");
+    t->fs().mkdir("/src/sub/deeper");
+    t->fs().mkdir("/src/empty");
+    t->writeFile("/src/a.txt", "hello");
+    t->writeFile("/src/sub/b.txt", big);
+    t->writeFile("/src/sub/deeper/c.bin", std::string(3000, 'z'));
+    t->writeFile("/src/zero", "");
+}
+
+//! Reads a whole archive using EXPORT.
+//! @returns The error from the first packet which had one.
+static Error exportTree(
+    HandlerTest* t,        //!< [mod] Handler to send the commands to.
+    char const* dirName,   //!< [in] Directory to export.
+    uint8_t flags,         //!< [in] ExportFlags.
+    std::string* archive,  //!< [out] The archive, after decompressing it.
+    bool* compressed       //!< [out] Set if any of the packets were compressed.
+) {
+    uint8_t cursor = LittleFsPacketHandler::NO_CURSOR;
+    archive->clear();
+    *compressed = false;
+    do {
+        Packet& cmd = t->command(Command::EXPORT);
+        cmd.appendByte(cursor);
+        cmd.appendByte(EXPORT_WINDOW);
+        if (cursor == LittleFsPacketHandler::NO_CURSOR) {
+            cmd.appendByte(flags);
+            cmd.append(dirName);
+        }
+        size_t numPackets = t->call();
+        for (size_t i = 0; i < numPackets; i++) {
+            Packet const& rsp = t->response(i);
+            Unpacker unpacker(rsp);
+            uint8_t err = 0;
+            uint8_t rspFlags = 0;
+            uint8_t seq = 0;
+            uint32_t offset = 0;
+            uint8_t codec = 0;
+            uint32_t length = 0;
+            unpacker.unpack(&err);
+            unpacker.unpack(&rspFlags);
+            unpacker.unpack(&seq);
+            unpacker.unpack(&cursor);
+            unpacker.unpack(&offset);
+            unpacker.unpack(&codec);
+            unpacker.unpack(&length);
+            if (err != to_underlying(Error::NONE)) {
+                return static_cast<Error>(err);
+            }
+            if (seq != i || offset != archive->size()) {
+                return Error::OUT_OF_SEQUENCE;
+            }
+            // The data takes up the rest of the packet.
+            uint8_t const* data = rsp.getData() + EXPORT_HEADER_LEN;
+            size_t dataLen = rsp.getDataLength() - EXPORT_HEADER_LEN;
+            if (codec == to_underlying(Codec::LZ4)) {
+                std::vector<uint8_t> decompressed(length);
+                size_t len = 0;
+                if (!Lz4::decompress(data, dataLen, decompressed.data(), length, &len) ||
+                    len != length) {
+                    return Error::VERIFY_FAILED;
+                }
+                archive->append(reinterpret_cast<char const*>(decompressed.data()), len);
+                *compressed = true;
+            } else {
+                archive->append(reinterpret_cast<char const*>(data), dataLen);
+            }
+        }
+    } while (cursor != LittleFsPacketHandler::NO_CURSOR);
+    return Error::NONE;
+}
+
+//! Unpacks an archive using IMPORT, sending chunkSize bytes at a time.
+//! @returns The error from the first chunk which had one.
+static Error importTree(
+    HandlerTest* t,              //!< [mod] Handler to send the commands to.
+    char const* dirName,         //!< [in] Directory to unpack into.
+    std::string const& archive,  //!< [in] Archive to unpack.
+    size_t chunkSize,            //!< [in] Number of bytes to send in each IMPORT.
+    bool* endOfFile              //!< [out] Set once the END record has been unpacked.
+) {
+    *endOfFile = false;
+    for (size_t offset = 0; offset < archive.size(); offset += chunkSize) {
+        uint32_t length = std::min(chunkSize, archive.size() - offset);
+        Packet& cmd = t->command(Command::IMPORT);
+        cmd.appendByte(offset == 0 ? ImportFlags::BEGIN : 0);
+        cmd.append(static_cast<uint32_t>(offset));
+        if (offset == 0) {
+            cmd.append(dirName);
+        }
+        cmd.appendByte(to_underlying(Codec::NONE));
+        cmd.append(length);
+        cmd.append(length);
+        cmd.appendData(length, &archive[offset]);
+        t->call();
+        Unpacker unpacker(t->reply());
+        uint8_t err = 0;
+        uint8_t flags = 0;
+        uint32_t committed = 0;
+        unpacker.unpack(&err);
+        unpacker.unpack(&flags);
+        unpacker.unpack(&committed);
+        if (err != to_underlying(Error::NONE)) {
+            return static_cast<Error>(err);
+        }
+        if (committed != offset + length) {
+            return Error::OUT_OF_SEQUENCE;
+        }
+        *endOfFile = (flags & StreamFlags::END_OF_FILE) != 0;
+    }
+    return Error::NONE;
+}
+
+//! Sends one IMPORT chunk.
+//! @returns The error code from the reply.
+static Error importChunk(
+    HandlerTest* t,              //!< [mod] Handler to send the command to.
+    std::string const& archive,  //!< [in] Whole archive.
+    uint32_t offset,             //!< [in] Offset of the chunk.
+    uint32_t length,             //!< [in] Length of the chunk.
+    uint32_t* committed          //!< [out] Archive bytes unpacked so far.
+) {
+    Packet& cmd = t->command(Command::IMPORT);
+    cmd.appendByte(offset == 0 ? ImportFlags::BEGIN : 0);
+    cmd.append(offset);
+    if (offset == 0) {
+        cmd.append("/dst");
+    }
+    cmd.appendByte(to_underlying(Codec::NONE));
+    cmd.append(length);
+    cmd.append(length);
+    cmd.appendData(length, &archive[offset]);
+    t->call();
+    Unpacker unpacker(t->reply());
+    uint8_t err = 0;
+    uint8_t flags = 0;
+    *committed = 0;
+    unpacker.unpack(&err);
+    unpacker.unpack(&flags);
+    unpacker.unpack(committed);
+    return static_cast<Error>(err);
+}
+
+//! @returns A DIR record followed by an END record.
+static std::string dirArchive(std::string const& path  //!< [in] Path stored in the record.
+) {
+    std::string archive(1, static_cast<char>(ArchiveRecord::DIR));
+    uint16_t pathLen = path.size();
+    archive.append(reinterpret_cast<char const*>(&pathLen), sizeof(pathLen));
+    archive += path;
+    // Size and timestamp.
+    archive.append(8, '\0');
+    archive += static_cast<char>(ArchiveRecord::END);
+    return archive;
+}
+
+HANDLER_TEST(archiveRoundTrip) {
+    makeTree(t);
+    std::string archive;
+    bool compressed = true;
+    CHECK(exportTree(t, "/src", 0, &archive, &compressed) == Error::NONE);
+    CHECK(!compressed);
+    CHECK(archive.size() > 23000);
+
+    bool endOfFile = false;
+    CHECK(importTree(t, "/dst", archive, 700, &endOfFile) == Error::NONE);
+    CHECK(endOfFile);
+    char const* const files[] = {"/a.txt", "/sub/b.txt", "/sub/deeper/c.bin", "/zero"};
+    for (char const* file : files) {
+        std::string src = std::string("/src") + file;
+        std::string dst = std::string("/dst") + file;
+        CHECK(t->fs().exists(dst.c_str()));
+        CHECK(t->readFile(dst.c_str()) == t->readFile(src.c_str()));
+    }
+    CHECK(t->fs().exists("/dst/empty"));
+}
+
+HANDLER_TEST(archiveClosesExportedFiles) {
+    makeTree(t);
+    uint32_t count = 0;
+    uint32_t bytes = 0;
+    t->takePhaseStats(StatsPhase::CLOSE, &count, &bytes);
+    std::string archive;
+    bool compressed = false;
+    CHECK(exportTree(t, "/src", 0, &archive, &compressed) == Error::NONE);
+    // Each of the 4 files is closed once its data has been sent.
+    t->takePhaseStats(StatsPhase::CLOSE, &count, &bytes);
+    CHECK(count == 4);
+}
+
+HANDLER_TEST(archiveCompressedExport) {
+    makeTree(t);
+    std::string archive;
+    std::string compressedArchive;
+    bool compressed = false;
+    CHECK(exportTree(t, "/src", 0, &archive, &compressed) == Error::NONE);
+    CHECK(exportTree(t, "/src", ExportFlags::COMPRESS, &compressedArchive, &compressed) ==
+          Error::NONE);
+    CHECK(compressed);
+    CHECK(compressedArchive == archive);
+}
+
+HANDLER_TEST(archiveResentChunks) {
+    makeTree(t);
+    std::string archive;
+    bool compressed = false;
+    CHECK(exportTree(t, "/src", 0, &archive, &compressed) == Error::NONE);
+
+    uint32_t committed = 0;
+    CHECK(importChunk(t, archive, 0, 20, &committed) == Error::NONE);
+    CHECK(committed == 20);
+    // A chunk past the data unpacked so far is rejected...
+    CHECK(importChunk(t, archive, 30, 10, &committed) == Error::OUT_OF_SEQUENCE);
+    CHECK(committed == 20);
+    // ...one which was already unpacked changes nothing...
+    CHECK(importChunk(t, archive, 5, 10, &committed) == Error::NONE);
+    CHECK(committed == 20);
+    // ...and one which overlaps the end only unpacks the new part.
+    CHECK(importChunk(t, archive, 10, 20, &committed) == Error::NONE);
+    CHECK(committed == 30);
+    for (uint32_t offset = 30; offset < archive.size(); offset += 1000) {
+        uint32_t length = std::min<size_t>(1000, archive.size() - offset);
+        CHECK(importChunk(t, archive, offset, length, &committed) == Error::NONE);
+    }
+    CHECK(committed == archive.size());
+    CHECK(t->readFile("/dst/sub/b.txt") == t->readFile("/src/sub/b.txt"));
+}
+
+HANDLER_TEST(archiveCorruptFile) {
+    makeTree(t);
+    std::string archive;
+    bool compressed = false;
+    CHECK(exportTree(t, "/src", 0, &archive, &compressed) == Error::NONE);
+    archive[archive.find("hello")] = 'j';
+    bool endOfFile = false;
+    CHECK(importTree(t, "/dst", archive, 4000, &endOfFile) == Error::VERIFY_FAILED);
+    CHECK(!endOfFile);
+}
+
+HANDLER_TEST(archiveRejectsEscapingPaths) {
+    std::string const paths[] = {
+        "../boot", "a/../../boot", "/abs", "..", "x/..", std::string("a\0b", 3),
+    };
+    for (std::string const& path : paths) {
+        bool endOfFile = false;
+        CHECK(importTree(t, "/dst", dirArchive(path), 4000, &endOfFile) == Error::INVALID_PATH);
+    }
+    CHECK(!t->fs().exists("/boot"));
+    CHECK(!t->fs().exists("/abs"));
+
+    // Names which just start or end with dots are fine.
+    bool endOfFile = false;
+    CHECK(importTree(t, "/dst", dirArchive("..a"), 4000, &endOfFile) == Error::NONE);
+    CHECK(endOfFile);
+    CHECK(t->fs().exists("/dst/..a"));
+}
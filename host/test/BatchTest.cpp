@@ -0,0 +1,121 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   BatchTest.cpp
+ *
+ *   @brief  Tests for BATCH.
+ *
+ ****************************************************************************/
+
+#include <vector>
+
+#include "HandlerTest.h"
+#include "Unpacker.h"
+
+using BatchFlags = LittleFsPacketHandler::BatchFlags;
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+
+//! Sends a BATCH command, whose operations have already been added to cmd.
+//! @returns The error code, and stores the result of each operation which
+//!          was run in results.
+static Error sendBatch(
+    HandlerTest* t,              //!< [mod] Handler to send the command to.
+    std::vector<Error>* results  //!< [out] Result of each operation which was run.
+) {
+    t->call();
+    Unpacker unpacker(t->reply());
+    uint8_t err = 0;
+    uint8_t numRun = 0;
+    unpacker.unpack(&err);
+    unpacker.unpack(&numRun);
+    for (uint8_t i = 0; i < numRun; i++) {
+        uint8_t result = 0;
+        unpacker.unpack(&result);
+        results->push_back(static_cast<Error>(result));
+    }
+    return static_cast<Error>(err);
+}
+
+//! @returns The packet for a BATCH command containing numOps operations.
+static Packet& batch(
+    HandlerTest* t,  //!< [mod] Handler to send the command to.
+    uint8_t flags,   //!< [in] BatchFlags.
+    uint8_t numOps   //!< [in] Number of operations which will be added.
+) {
+    Packet& cmd = t->command(Command::BATCH);
+    cmd.appendByte(flags);
+    cmd.appendByte(numOps);
+    return cmd;
+}
+
+//! Adds an operation which takes one path to a BATCH command.
+static void pathOp(
+    Packet* cmd,               //!< [mod] BATCH command to add to.
+    Packet::Command::Type op,  //!< [in] MKDIR, REMOVE or RMDIR.
+    char const* path           //!< [in] Path to pass to the operation.
+) {
+    cmd->appendByte(op);
+    cmd->append(path);
+}
+
+//! Adds a RENAME operation to a BATCH command.
+static void renameOp(
+    Packet* cmd,          //!< [mod] BATCH command to add to.
+    char const* oldName,  //!< [in] Existing name.
+    char const* newName   //!< [in] New name.
+) {
+    cmd->appendByte(Command::RENAME);
+    cmd->append(oldName);
+    cmd->append(newName);
+}
+
+HANDLER_TEST(batchRunsEachOperation) {
+    t->writeFile("/old", "data");
+    t->writeFile("/gone", "data");
+    t->fs().mkdir("/empty");
+    Packet& cmd = batch(t, 0, 5);
+    pathOp(&cmd, Command::MKDIR, "/new");
+    renameOp(&cmd, "/old", "/new/moved");
+    pathOp(&cmd, Command::REMOVE, "/gone");
+    pathOp(&cmd, Command::RMDIR, "/empty");
+    pathOp(&cmd, Command::REMOVE, "/missing");
+    std::vector<Error> results;
+    CHECK(sendBatch(t, &results) == Error::NONE);
+    CHECK(results == std::vector<Error>({Error::NONE, Error::NONE, Error::NONE, Error::NONE,
+                                         Error::REMOVE_FAILED}));
+    CHECK(t->readFile("/new/moved") == "data");
+    CHECK(!t->fs().exists("/old"));
+    CHECK(!t->fs().exists("/gone"));
+    CHECK(!t->fs().exists("/empty"));
+}
+
+HANDLER_TEST(batchStopOnError) {
+    Packet& cmd = batch(t, BatchFlags::STOP_ON_ERROR, 3);
+    pathOp(&cmd, Command::MKDIR, "/a");
+    pathOp(&cmd, Command::REMOVE, "/missing");
+    pathOp(&cmd, Command::MKDIR, "/b");
+    std::vector<Error> results;
+    CHECK(sendBatch(t, &results) == Error::NONE);
+    CHECK(results == std::vector<Error>({Error::NONE, Error::REMOVE_FAILED}));
+    CHECK(t->fs().exists("/a"));
+    CHECK(!t->fs().exists("/b"));
+}
+
+HANDLER_TEST(batchUnsupportedOperation) {
+    Packet& cmd = batch(t, 0, 3);
+    pathOp(&cmd, Command::MKDIR, "/a");
+    pathOp(&cmd, Command::READ, "/a");
+    pathOp(&cmd, Command::MKDIR, "/b");
+    std::vector<Error> results;
+    CHECK(sendBatch(t, &results) == Error::UNSUPPORTED);
+    CHECK(results == std::vector<Error>({Error::NONE}));
+    CHECK(!t->fs().exists("/b"));
+}
@@ -0,0 +1,207 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   CompressionTest.cpp
+ *
+ *   @brief  Tests for LZ4 and the READ/WRITE_COMPRESSED commands.
+ *
+ ****************************************************************************/
+
+#include <string>
+#include <vector>
+
+#include "HandlerTest.h"
+#include "Lz4.h"
+#include "Unpacker.h"
+
+using Codec = LittleFsPacketHandler::Codec;
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using OpenMode = LittleFsPacketHandler::OpenMode;
+
+//! @returns Text which compresses well, like a log file.
+static std::string logData(size_t len  //!< [in] Number of bytes to make.
+) {
+    std::string data;
+    for (unsigned line = 0; data.size() < len; line++) {
+        data += "sample " + std::to_string(line % 37) + " value " + std::to_string(line % 5) + "\n";
+    }
+    data.resize(len);
+    return data;
+}
+
+//! @returns Data which doesn't compress.
+static std::string randomData(size_t len  //!< [in] Number of bytes to make.
+) {
+    std::string data;
+    uint32_t state = 12345;
+    for (size_t i = 0; i < len; i++) {
+        state = state * 1103515245 + 12345;
+        data += static_cast<char>(state >> 24);
+    }
+    return data;
+}
+
+//! Sends part of a file using WRITE_COMPRESSED, compressing it with LZ4.
+//! @returns The error returned by WRITE_COMPRESSED.
+static Error writeCompressed(
+    HandlerTest* t,           //!< [mod] Handler to send the command to.
+    char const* filename,     //!< [in] File to write.
+    OpenMode mode,            //!< [in] WRITE for the first part, otherwise APPEND.
+    std::string const& data,  //!< [in] Data to write.
+    size_t* compressedLen     //!< [out] Number of bytes sent.
+) {
+    Lz4 lz4;
+    std::vector<uint8_t> compressed(Lz4::maxCompressedSize(data.size()));
+    *compressedLen = lz4.compress(reinterpret_cast<uint8_t const*>(data.data()), data.size(),
+                                  compressed.data(), compressed.size());
+    Packet& cmd = t->command(Command::WRITE_COMPRESSED);
+    cmd.append(filename);
+    cmd.appendByte(to_underlying(mode));
+    cmd.appendByte(to_underlying(Codec::LZ4));
+    cmd.append(static_cast<uint32_t>(data.size()));
+    cmd.append(static_cast<uint32_t>(*compressedLen));
+    cmd.appendData(*compressedLen, compressed.data());
+    return t->callForError();
+}
+
+//! Reads part of a file using READ_COMPRESSED, which may return less than
+//! length bytes.
+//! @returns The error returned by READ_COMPRESSED.
+static Error readCompressed(
+    HandlerTest* t,        //!< [mod] Handler to send the command to.
+    char const* filename,  //!< [in] File to read.
+    uint32_t offset,       //!< [in] Where to start reading.
+    uint32_t length,       //!< [in] Number of bytes to read.
+    Codec* codec,          //!< [out] How the data was sent.
+    std::string* data      //!< [out] The data, after decompressing it.
+) {
+    Packet& cmd = t->command(Command::READ_COMPRESSED);
+    cmd.append(filename);
+    cmd.append(offset);
+    cmd.append(length);
+    t->call();
+    Unpacker unpacker(t->reply());
+    uint8_t err = 0;
+    uint32_t rspOffset = 0;
+    uint32_t rspLength = 0;
+    uint8_t rspCodec = 0;
+    uint32_t dataLen = 0;
+    uint8_t const* rspData = nullptr;
+    unpacker.unpack(&err);
+    unpacker.unpack(&rspOffset);
+    unpacker.unpack(&rspLength);
+    unpacker.unpack(&rspCodec);
+    unpacker.unpack(&dataLen);
+    unpacker.unpack(dataLen, &rspData);
+    *codec = static_cast<Codec>(rspCodec);
+    data->clear();
+    if (err != to_underlying(Error::NONE) || rspOffset != offset) {
+        return static_cast<Error>(err);
+    }
+    if (*codec == Codec::LZ4) {
+        std::vector<uint8_t> decompressed(rspLength);
+        size_t len = 0;
+        if (!Lz4::decompress(rspData, dataLen, decompressed.data(), decompressed.size(), &len) ||
+            len != rspLength) {
+            return Error::VERIFY_FAILED;
+        }
+        data->assign(reinterpret_cast<char const*>(decompressed.data()), len);
+    } else if (dataLen == rspLength) {
+        data->assign(reinterpret_cast<char const*>(rspData), dataLen);
+    } else {
+        return Error::VERIFY_FAILED;
+    }
+    return Error::NONE;
+}
+
+HANDLER_TEST(lz4CompressDecompress) {
+    std::string data = logData(Lz4::MAX_BLOCK_SIZE);
+    Lz4 lz4;
+    std::vector<uint8_t> compressed(Lz4::maxCompressedSize(data.size()));
+    size_t compressedLen = lz4.compress(reinterpret_cast<uint8_t const*>(data.data()),
+                                        data.size(), compressed.data(), compressed.size());
+    CHECK(compressedLen > 0 && compressedLen < data.size() / 2);
+
+    std::vector<uint8_t> out(data.size());
+    size_t len = 0;
+    CHECK(Lz4::decompress(compressed.data(), compressedLen, out.data(), out.size(), &len));
+    CHECK(std::string(reinterpret_cast<char const*>(out.data()), len) == data);
+
+    // Data which doesn't fit in dst is rejected, rather than overrunning it.
+    CHECK(!Lz4::decompress(compressed.data(), compressedLen, out.data(), out.size() / 2, &len));
+    CHECK(lz4.compress(reinterpret_cast<uint8_t const*>(data.data()), data.size(),
+                       compressed.data(), 16) == 0);
+}
+
+HANDLER_TEST(lz4WriteCompressedRoundTrip) {
+    std::string data = logData(3 * LITTLEFS_COMPRESS_BUFFER_SIZE + 1000);
+    size_t compressedLen = 0;
+    size_t sent = 0;
+    for (size_t offset = 0; offset < data.size(); offset += LITTLEFS_COMPRESS_BUFFER_SIZE) {
+        OpenMode mode = (offset == 0) ? OpenMode::WRITE : OpenMode::APPEND;
+        std::string part = data.substr(offset, LITTLEFS_COMPRESS_BUFFER_SIZE);
+        CHECK(writeCompressed(t, "/log.txt", mode, part, &compressedLen) == Error::NONE);
+        sent += compressedLen;
+    }
+    CHECK(sent < data.size() / 2);
+    // The appended parts are collected in the APPEND buffer.
+    t->command(Command::FLUSH);
+    CHECK(t->callForError() == Error::NONE);
+    CHECK(t->readFile("/log.txt") == data);
+
+    std::string readBack;
+    while (readBack.size() < data.size()) {
+        Codec codec = Codec::NONE;
+        std::string part;
+        CHECK(readCompressed(t, "/log.txt", readBack.size(), LITTLEFS_COMPRESS_BUFFER_SIZE, &codec,
+                             &part) == Error::NONE);
+        CHECK(codec == Codec::LZ4);
+        CHECK(!part.empty());
+        readBack += part;
+    }
+    CHECK(readBack == data);
+}
+
+HANDLER_TEST(lz4ReadIncompressible) {
+    std::string data = randomData(LITTLEFS_COMPRESS_BUFFER_SIZE);
+    t->writeFile("/random.bin", data);
+    // Data which doesn't compress is sent as is, so it takes more than one
+    // READ_COMPRESSED to read what was asked for.
+    std::string readBack;
+    unsigned numReads = 0;
+    while (readBack.size() < data.size()) {
+        Codec codec = Codec::LZ4;
+        std::string part;
+        CHECK(readCompressed(t, "/random.bin", readBack.size(), data.size() - readBack.size(),
+                             &codec, &part) == Error::NONE);
+        CHECK(codec == Codec::NONE);
+        CHECK(!part.empty());
+        readBack += part;
+        numReads++;
+    }
+    CHECK(numReads > 1);
+    CHECK(readBack == data);
+}
+
+HANDLER_TEST(lz4WriteCorruptData) {
+    std::string data = logData(1000);
+    Packet& cmd = t->command(Command::WRITE_COMPRESSED);
+    cmd.append("/log.txt");
+    cmd.appendByte(to_underlying(OpenMode::WRITE));
+    cmd.appendByte(to_underlying(Codec::LZ4));
+    cmd.append(static_cast<uint32_t>(data.size()));
+    // A literal run which claims to be longer than the data sent.
+    uint8_t const corrupt[] = {0xf0, 0xff, 0x10, 'a', 'b'};
+    cmd.append(static_cast<uint32_t>(sizeof(corrupt)));
+    cmd.appendData(sizeof(corrupt), corrupt);
+    CHECK(t->callForError() == Error::WRITE_FAILED);
+    CHECK(!t->fs().exists("/log.txt"));
+}
@@ -0,0 +1,103 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   CopyTest.cpp
+ *
+ *   @brief  Tests for COPY, which copies a file on the device.
+ *
+ ****************************************************************************/
+
+#include <string>
+
+#include "HandlerTest.h"
+#include "Unpacker.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using StatsPhase = LittleFsPacketHandler::StatsPhase;
+using StreamFlags = LittleFsPacketHandler::StreamFlags;
+
+//! Response to COPY.
+struct CopyProgress {
+    Error err = Error::NONE;  //!< Error code.
+    uint8_t flags = 0;        //!< StreamFlags.
+    uint32_t copied = 0;      //!< Number of bytes copied so far.
+    uint32_t size = 0;        //!< Size of the source file.
+};
+
+//! @returns The contents of one of the COPY responses.
+static CopyProgress copyProgress(Packet const& rsp  //!< [in] Response to decode.
+) {
+    Unpacker unpacker(rsp);
+    CopyProgress progress;
+    uint8_t err = 0;
+    unpacker.unpack(&err);
+    unpacker.unpack(&progress.flags);
+    unpacker.unpack(&progress.copied);
+    unpacker.unpack(&progress.size);
+    progress.err = static_cast<Error>(err);
+    return progress;
+}
+
+//! Sends a COPY command.
+//! @returns The number of responses.
+static size_t copyFile(
+    HandlerTest* t,   //!< [mod] Handler to send the command to.
+    char const* src,  //!< [in] File to copy.
+    char const* dst   //!< [in] Name of the copy.
+) {
+    Packet& cmd = t->command(Command::COPY);
+    cmd.append(src);
+    cmd.append(dst);
+    return t->call();
+}
+
+HANDLER_TEST(copySendsProgress) {
+    std::string data(LITTLEFS_COPY_PROGRESS_BYTES * 2 + 100, 'c');
+    t->writeFile("/src.bin", data);
+    CHECK(copyFile(t, "/src.bin", "/dst.bin") == 3);
+    for (size_t i = 0; i < 2; i++) {
+        CopyProgress progress = copyProgress(t->response(i));
+        CHECK(progress.err == Error::NONE);
+        CHECK(progress.flags == 0);
+        CHECK(progress.copied >= (i + 1) * LITTLEFS_COPY_PROGRESS_BYTES);
+        CHECK(progress.size == data.size());
+    }
+    CopyProgress last = copyProgress(t->reply());
+    CHECK(last.err == Error::NONE);
+    CHECK(last.flags == StreamFlags::LAST);
+    CHECK(last.copied == data.size());
+    CHECK(t->readFile("/dst.bin") == data);
+}
+
+HANDLER_TEST(copyMissingSource) {
+    copyFile(t, "/nope", "/dst.bin");
+    CHECK(copyProgress(t->reply()).err == Error::UNABLE_TO_OPEN_FILE);
+    CHECK(!t->fs().exists("/dst.bin"));
+}
+
+HANDLER_TEST(copyFailureRemovesPartialFile) {
+    // The mounted file system is too small to hold the copy.
+    CHECK(t->mount("/ram"));
+    std::string data(t->mountedFs().totalBytes() + 1000, 'c');
+    t->writeFile("/src.bin", data);
+    uint32_t count = 0;
+    uint32_t bytes = 0;
+    t->takePhaseStats(StatsPhase::CLOSE, &count, &bytes);
+
+    copyFile(t, "/src.bin", "/ram/dst.bin");
+    CopyProgress last = copyProgress(t->reply());
+    CHECK(last.err == Error::WRITE_FAILED);
+    CHECK(last.copied < data.size());
+    CHECK(!t->mountedFs().exists("/dst.bin"));
+    // Both files were closed.
+    t->takePhaseStats(StatsPhase::CLOSE, &count, &bytes);
+    CHECK(count == 2);
+}
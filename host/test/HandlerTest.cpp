@@ -0,0 +1,142 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   HandlerTest.cpp
+ *
+ *   @brief  Runs a LittleFsPacketHandler over a RamFs, for the host tests.
+ *
+ ****************************************************************************/
+
+#include "HandlerTest.h"
+
+#include <cstdio>
+
+#include "Unpacker.h"
+#include "duino_util.h"
+
+TestCase* TestCase::first = nullptr;
+
+TestCase::TestCase(char const* name, void (*run)(HandlerTest* t))
+    : name{name}, run{run}, next{nullptr} {
+    // Tests run in the order that they're defined within each file.
+    TestCase** link = &TestCase::first;
+    while (*link != nullptr) {
+        link = &(*link)->next;
+    }
+    *link = this;
+}
+
+HandlerTest::Response::Response(Packet const& packet)
+    : m_data(packet.getData(), packet.getData() + packet.getDataLength()),
+      m_packet{this->m_data.size(), this->m_data.data()} {
+    this->m_packet.setCommand(packet.getCommand());
+    this->m_packet.setDataLength(this->m_data.size());
+}
+
+HandlerTest::HandlerTest()
+    : m_fs{1024 * 1024},
+      m_backend{this->m_fs},
+      m_mountedFs{64 * 1024},
+      m_mountedBackend{this->m_mountedFs},
+      m_handler{&this->m_bus, &this->m_backend},
+      m_cmd{LEN(this->m_cmdData), this->m_cmdData},
+      m_rsp{LEN(this->m_rspData), this->m_rspData} {}
+
+Packet& HandlerTest::command(Packet::Command::Type cmd) {
+    this->m_cmd.setCommand(cmd);
+    this->m_cmd.setDataLength(0);
+    return this->m_cmd;
+}
+
+size_t HandlerTest::call() {
+    this->m_rsp.setDataLength(0);
+    this->m_responses.clear();
+    if (this->m_handler.handlePacket(this->m_cmd, &this->m_rsp)) {
+        // Send the reply the same way as the device's bus does, after the
+        // packets which the handler sent itself.
+        this->m_bus.writePacket(this->m_rsp);
+    }
+    while (this->m_bus.receivePacket()) {
+        this->m_responses.emplace_back(new Response(this->m_bus.received()));
+    }
+    return this->m_responses.size();
+}
+
+HandlerTest::Error HandlerTest::callForError() {
+    if (this->call() == 0 || this->reply().getDataLength() == 0) {
+        return Error::INVALID_COMMAND;
+    }
+    return static_cast<Error>(this->reply().getData()[0]);
+}
+
+size_t HandlerTest::run() {
+    this->m_responses.clear();
+    this->m_handler.run();
+    while (this->m_bus.receivePacket()) {
+        this->m_responses.emplace_back(new Response(this->m_bus.received()));
+    }
+    return this->m_responses.size();
+}
+
+void HandlerTest::takePhaseStats(
+    LittleFsPacketHandler::StatsPhase phase,
+    uint32_t* count,
+    uint32_t* bytes) {
+    *count = 0;
+    *bytes = 0;
+    uint8_t index = 0;
+    do {
+        Packet& cmd = this->command(Command::STATS);
+        cmd.appendByte(LittleFsPacketHandler::StatsFlags::RESET);
+        cmd.appendByte(index);
+        this->call();
+        Unpacker unpacker(this->reply());
+        uint8_t err = 0;
+        unpacker.unpack(&err);
+        unpacker.unpack(&index);
+        // Each entry is the id, count, bytes, total time and longest time.
+        uint8_t id = 0;
+        uint32_t counters[4] = {};
+        while (unpacker.unpack(&id) && unpacker.unpack(&counters[0]) &&
+               unpacker.unpack(&counters[1]) && unpacker.unpack(&counters[2]) &&
+               unpacker.unpack(&counters[3])) {
+            if (id == to_underlying(phase)) {
+                *count = counters[0];
+                *bytes = counters[1];
+            }
+        }
+    } while (index != 0);
+}
+
+void HandlerTest::writeFile(char const* path, std::string const& data) {
+    File file = this->m_fs.open(path, FILE_WRITE, true);
+    file.write(reinterpret_cast<uint8_t const*>(data.data()), data.size());
+    file.close();
+}
+
+std::string HandlerTest::readFile(char const* path) {
+    std::string data;
+    File file = this->m_fs.open(path, FILE_READ);
+    uint8_t buffer[256];
+    size_t bytesRead;
+    while ((bytesRead = file.read(buffer, sizeof(buffer))) > 0) {
+        data.append(reinterpret_cast<char const*>(buffer), bytesRead);
+    }
+    file.close();
+    return data;
+}
+
+bool HandlerTest::check(bool ok, char const* expr, char const* file, int line) {
+    if (!ok) {
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, expr);
+        this->m_failed = true;
+    }
+    return ok;
+}
@@ -0,0 +1,176 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   HandlerTest.h
+ *
+ *   @brief  Runs a LittleFsPacketHandler over a RamFs, for the host tests.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cinttypes>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FsBackend.h"
+#include "LittleFsPacketHandler.h"
+#include "LoopbackBus.h"
+#include "Packet.h"
+#include "RamFs.h"
+
+//! Size of the handler's command and response packets (the same as the
+//! packets used by LittleFsWorker).
+static constexpr size_t HANDLER_TEST_PACKET_SIZE = LITTLEFS_BLOCK_SIZE + 64;
+
+//! A packet handler serving a new RamFs, along with the packets used to talk
+//! to it. Each test case gets its own.
+class HandlerTest {
+ public:
+    using Command = LittleFsPacketHandler::Command;
+    using Error = LittleFsPacketHandler::Error;
+
+    //! A packet sent by the handler.
+    class Response {
+     public:
+        //! Constructor, which copies the packet.
+        explicit Response(Packet const& packet  //!< [in] Packet to copy.
+        );
+
+        Response(Response const&) = delete;
+        Response& operator=(Response const&) = delete;
+
+        //! @returns The copy of the packet.
+        Packet const& packet() const { return this->m_packet; }
+
+     private:
+        std::vector<uint8_t> m_data;  //!< Data of m_packet.
+        Packet m_packet;              //!< The packet.
+    };
+
+    //! Constructor.
+    HandlerTest();
+
+    //! @returns The command packet, emptied and set to send cmd.
+    Packet& command(Packet::Command::Type cmd  //!< [in] Command to send.
+    );
+
+    //! Passes the command packet to the handler.
+    //! @returns The number of packets sent in response. The last one is the
+    //!          reply, and any before it were sent through the bus.
+    size_t call();
+
+    //! @returns A packet sent in response to the last call.
+    Packet const& response(size_t index  //!< [in] Which packet (0 for the first).
+    ) const {
+        return this->m_responses[index]->packet();
+    }
+
+    //! @returns The reply to the last call.
+    Packet const& reply() const { return this->m_responses.back()->packet(); }
+
+    //! Sends a command which replies with just an error code.
+    //! @returns The error code.
+    Error callForError();
+
+    //! Calls the handler's run(), like loop() does.
+    //! @returns The number of packets which run() sent, available from
+    //!          response().
+    size_t run();
+
+    //! @returns The handler being tested.
+    LittleFsPacketHandler& handler() { return this->m_handler; }
+
+    //! @returns The file system that the handler serves.
+    RamFs& fs() { return this->m_fs; }
+
+    //! @returns The second file system, which mount() makes available.
+    RamFs& mountedFs() { return this->m_mountedFs; }
+
+    //! Mounts mountedFs() in the handler.
+    //! @returns The result of LittleFsPacketHandler::mount.
+    bool mount(char const* prefix  //!< [in] Directory the file system appears as.
+    ) {
+        return this->m_handler.mount(prefix, &this->m_mountedBackend);
+    }
+
+    //! Reads the STATS counters of a phase, and clears all of the counters.
+    void takePhaseStats(
+        LittleFsPacketHandler::StatsPhase phase,  //!< [in] Phase to return the counters of.
+        uint32_t* count,                          //!< [out] Number of operations.
+        uint32_t* bytes                           //!< [out] Number of bytes transferred.
+    );
+
+    //! Creates a file directly in the file system.
+    void writeFile(
+        char const* path,        //!< [in] File to create.
+        std::string const& data  //!< [in] Its contents.
+    );
+
+    //! @returns The contents of a file (empty if it doesn't exist).
+    std::string readFile(char const* path  //!< [in] File to read.
+    );
+
+    //! Records the result of a CHECK.
+    //! @returns ok.
+    bool check(
+        bool ok,           //!< [in] Whether the check passed.
+        char const* expr,  //!< [in] Expression which was checked.
+        char const* file,  //!< [in] Source file containing the check.
+        int line           //!< [in] Line number of the check.
+    );
+
+    //! @returns true if a check has failed.
+    bool failed() const { return this->m_failed; }
+
+ private:
+    RamFs m_fs;                                          //!< File system being served.
+    FormattableFsBackend<RamFs> m_backend;               //!< Backend wrapping m_fs.
+    RamFs m_mountedFs;                                   //!< File system for mount().
+    FormattableFsBackend<RamFs> m_mountedBackend;        //!< Backend wrapping m_mountedFs.
+    LoopbackBus m_bus;                                   //!< Carries the responses.
+    LittleFsPacketHandler m_handler;                     //!< Handler being tested.
+    uint8_t m_cmdData[HANDLER_TEST_PACKET_SIZE];         //!< Data of m_cmd.
+    uint8_t m_rspData[HANDLER_TEST_PACKET_SIZE];         //!< Data of m_rsp.
+    Packet m_cmd;                                        //!< Command sent to the handler.
+    Packet m_rsp;                                        //!< Reply from the handler.
+    std::vector<std::unique_ptr<Response>> m_responses;  //!< Packets from the last call.
+    bool m_failed = false;                               //!< A check has failed.
+};
+
+//! A test, registered with HANDLER_TEST.
+struct TestCase {
+    //! Constructor, which adds the test to the list.
+    TestCase(
+        char const* name,            //!< [in] Name of the test.
+        void (*run)(HandlerTest* t)  //!< [in] Function which runs the test.
+    );
+
+    char const* name;             //!< Name of the test.
+    void (*run)(HandlerTest* t);  //!< Function which runs the test.
+    TestCase* next;               //!< Next test in the list.
+
+    static TestCase* first;  //!< First test in the list.
+};
+
+//! Defines a test, which is run with a new HandlerTest called t.
+#define HANDLER_TEST(testName)                           \
+    static void testName(HandlerTest* t);                \
+    static TestCase testName##Case{#testName, testName}; \
+    static void testName(HandlerTest* t)
+
+//! Checks a condition, ending the test if it's false.
+#define CHECK(expr)                                         \
+    do {                                                    \
+        if (!t->check((expr), #expr, __FILE__, __LINE__)) { \
+            return;                                         \
+        }                                                   \
+    } while (0)
@@ -0,0 +1,225 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   JobTest.cpp
+ *
+ *   @brief  Tests for JOB_START and JOB_STATUS.
+ *
+ ****************************************************************************/
+
+#include <string>
+
+#include "HandlerTest.h"
+#include "Unpacker.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using JobState = LittleFsPacketHandler::JobState;
+using JobType = LittleFsPacketHandler::JobType;
+
+//! Reply to JOB_STATUS.
+struct JobStatus {
+    Error err = Error::NONE;          //!< Error code.
+    JobState state = JobState::DONE;  //!< State of the job.
+    Error result = Error::NONE;       //!< Result of the job (once DONE).
+    uint32_t progress = 0;            //!< Bytes copied or entries removed.
+    uint32_t total = 0;               //!< Size of the file being copied.
+};
+
+//! Sends a JOB_START command, with the arguments already in cmd.
+//! @returns The error code, and stores the job number in jobNum.
+static Error startJob(
+    HandlerTest* t,  //!< [mod] Handler to send the command to.
+    uint8_t* jobNum  //!< [out] Job number to pass to JOB_STATUS.
+) {
+    t->call();
+    Unpacker unpacker(t->reply());
+    uint8_t err = 0;
+    unpacker.unpack(&err);
+    unpacker.unpack(jobNum);
+    return static_cast<Error>(err);
+}
+
+//! Starts a RMTREE job.
+//! @returns The error code, and stores the job number in jobNum.
+static Error startRmTree(
+    HandlerTest* t,       //!< [mod] Handler to send the command to.
+    char const* dirName,  //!< [in] Directory to remove.
+    uint8_t* jobNum       //!< [out] Job number to pass to JOB_STATUS.
+) {
+    Packet& cmd = t->command(Command::JOB_START);
+    cmd.appendByte(to_underlying(JobType::RMTREE));
+    cmd.append(dirName);
+    return startJob(t, jobNum);
+}
+
+//! Starts a COPY job.
+//! @returns The error code, and stores the job number in jobNum.
+static Error startCopy(
+    HandlerTest* t,   //!< [mod] Handler to send the command to.
+    char const* src,  //!< [in] File to copy.
+    char const* dst,  //!< [in] Name of the copy.
+    uint8_t* jobNum   //!< [out] Job number to pass to JOB_STATUS.
+) {
+    Packet& cmd = t->command(Command::JOB_START);
+    cmd.appendByte(to_underlying(JobType::COPY));
+    cmd.append(src);
+    cmd.append(dst);
+    return startJob(t, jobNum);
+}
+
+//! Sends a JOB_STATUS command.
+static JobStatus jobStatus(
+    HandlerTest* t,  //!< [mod] Handler to send the command to.
+    uint8_t jobNum   //!< [in] Job number returned by JOB_START.
+) {
+    Packet& cmd = t->command(Command::JOB_STATUS);
+    cmd.appendByte(jobNum);
+    t->call();
+    Unpacker unpacker(t->reply());
+    JobStatus status;
+    uint8_t err = 0;
+    uint8_t state = 0;
+    uint8_t result = 0;
+    unpacker.unpack(&err);
+    unpacker.unpack(&state);
+    unpacker.unpack(&result);
+    unpacker.unpack(&status.progress);
+    unpacker.unpack(&status.total);
+    status.err = static_cast<Error>(err);
+    status.state = static_cast<JobState>(state);
+    status.result = static_cast<Error>(result);
+    return status;
+}
+
+//! Calls run() until the job is DONE, and collects it.
+//! @returns The final JOB_STATUS reply.
+static JobStatus finishJob(
+    HandlerTest* t,  //!< [mod] Handler running the job.
+    uint8_t jobNum   //!< [in] Job number returned by JOB_START.
+) {
+    JobStatus status = jobStatus(t, jobNum);
+    for (int i = 0; i < 1000 && status.state == JobState::RUNNING; i++) {
+        t->handler().run();
+        status = jobStatus(t, jobNum);
+    }
+    return status;
+}
+
+//! Sends a command which takes a filename, and replies with an error code.
+//! @returns The error code.
+static Error sendPath(
+    HandlerTest* t,             //!< [mod] Handler to send the command to.
+    Packet::Command::Type cmd,  //!< [in] Command to send.
+    char const* path            //!< [in] File or directory to send.
+) {
+    t->command(cmd).append(path);
+    return t->callForError();
+}
+
+//! Creates a directory tree which takes RMTREE several slices to remove.
+static void makeTree(HandlerTest* t  //!< [mod] Test whose file system gets the files.
+) {
+    t->fs().mkdir("/d");
+    t->fs().mkdir("/d/e");
+    for (int i = 0; i < 8; i++) {
+        std::string name = "/d/f" + std::to_string(i);
+        t->writeFile(name.c_str(), "data");
+        name = "/d/e/g" + std::to_string(i);
+        t->writeFile(name.c_str(), "data");
+    }
+    t->writeFile("/other", "other");
+}
+
+HANDLER_TEST(rmtreeRemovesTree) {
+    makeTree(t);
+    uint8_t jobNum = 0;
+    CHECK(startRmTree(t, "/d/", &jobNum) == Error::NONE);
+    t->handler().run();
+    JobStatus status = jobStatus(t, jobNum);
+    CHECK(status.err == Error::NONE);
+    CHECK(status.state == JobState::RUNNING);
+
+    status = finishJob(t, jobNum);
+    CHECK(status.state == JobState::DONE);
+    CHECK(status.result == Error::NONE);
+    CHECK(status.progress == 18);
+    CHECK(!t->fs().exists("/d"));
+    CHECK(t->readFile("/other") == "other");
+
+    // The job is freed once JOB_STATUS has reported it as DONE.
+    CHECK(jobStatus(t, jobNum).err == Error::INVALID_JOB);
+}
+
+HANDLER_TEST(rmtreeRejectsRoot) {
+    uint8_t jobNum = 0;
+    CHECK(startRmTree(t, "/", &jobNum) == Error::RMDIR_FAILED);
+}
+
+HANDLER_TEST(jobRejectsModifyingCommands) {
+    makeTree(t);
+    uint8_t jobNum = 0;
+    CHECK(startRmTree(t, "/d", &jobNum) == Error::NONE);
+
+    // Nothing can change files while the job is running.
+    CHECK(sendPath(t, Command::REMOVE, "/d/f0") == Error::BUSY);
+    CHECK(sendPath(t, Command::MKDIR, "/d/new") == Error::BUSY);
+    CHECK(sendPath(t, Command::RMDIR, "/d/e") == Error::BUSY);
+    Packet& rename = t->command(Command::RENAME);
+    rename.append("/other");
+    rename.append("/d/other");
+    CHECK(t->callForError() == Error::BUSY);
+    Packet& write = t->command(Command::WRITE);
+    write.append("/d/e/new");
+    write.append(static_cast<uint32_t>(1));
+    write.appendByte('x');
+    CHECK(t->callForError() == Error::BUSY);
+    Packet& open = t->command(Command::OPEN);
+    open.appendByte(0);
+    open.append("/d/f1");
+    CHECK(t->callForError() == Error::BUSY);
+    uint8_t otherJob = 0;
+    CHECK(startRmTree(t, "/d/e", &otherJob) == Error::BUSY);
+
+    // Commands which only read still work.
+    Packet& read = t->command(Command::READ);
+    read.append("/other");
+    read.append(static_cast<uint32_t>(0));
+    read.append(static_cast<uint32_t>(5));
+    CHECK(t->callForError() == Error::NONE);
+
+    CHECK(finishJob(t, jobNum).result == Error::NONE);
+    CHECK(!t->fs().exists("/d"));
+    CHECK(sendPath(t, Command::REMOVE, "/other") == Error::NONE);
+}
+
+HANDLER_TEST(copyJobCopiesFile) {
+    std::string data;
+    for (int i = 0; i < 3000; i++) {
+        data += static_cast<char>('a' + i % 26);
+    }
+    t->writeFile("/src", data);
+    uint8_t jobNum = 0;
+    CHECK(startCopy(t, "/src", "/dst", &jobNum) == Error::NONE);
+    CHECK(sendPath(t, Command::REMOVE, "/src") == Error::BUSY);
+
+    JobStatus status = finishJob(t, jobNum);
+    CHECK(status.state == JobState::DONE);
+    CHECK(status.result == Error::NONE);
+    CHECK(status.progress == data.size());
+    CHECK(status.total == data.size());
+    CHECK(t->readFile("/dst") == data);
+}
+
+HANDLER_TEST(copyJobMissingSource) {
+    uint8_t jobNum = 0;
+    CHECK(startCopy(t, "/missing", "/dst", &jobNum) == Error::UNABLE_TO_OPEN_FILE);
+    CHECK(!t->fs().exists("/dst"));
+}
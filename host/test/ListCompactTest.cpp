@@ -0,0 +1,155 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   ListCompactTest.cpp
+ *
+ *   @brief  Tests for LIST_COMPACT.
+ *
+ ****************************************************************************/
+
+#include <map>
+#include <string>
+
+#include "HandlerTest.h"
+#include "Unpacker.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using Flags = LittleFsPacketHandler::Flags;
+using ListFields = LittleFsPacketHandler::ListFields;
+
+//! Number of files created by makeDir (more than one response can hold).
+static constexpr int NUM_FILES = 500;
+
+//! Entry returned by LIST_COMPACT.
+struct CompactEntry {
+    uint8_t flags = 0;  //!< Flags (if requested).
+    uint32_t size = 0;  //!< Size of the file (if requested).
+};
+
+//! Result of listing a directory with LIST_COMPACT.
+struct CompactListing {
+    Error err = Error::NONE;                      //!< First error returned.
+    int numResponses = 0;                         //!< Number of LIST_COMPACT commands sent.
+    bool firstEntriesFull = true;                 //!< Each response started with a whole name.
+    size_t numBytes = 0;                          //!< Total size of the responses.
+    std::map<std::string, CompactEntry> entries;  //!< Entries, by name.
+};
+
+//! Creates /d containing NUM_FILES files whose names share a long prefix, and
+//! a directory.
+static void makeDir(HandlerTest* t  //!< [mod] Test whose file system gets the files.
+) {
+    t->fs().mkdir("/d");
+    for (int i = 0; i < NUM_FILES; i++) {
+        std::string name = "/d/sensor_log_" + std::to_string(i);
+        t->writeFile(name.c_str(), std::string(i % 10, 'x'));
+    }
+    t->fs().mkdir("/d/sub");
+}
+
+//! Lists a directory using LIST_COMPACT.
+static CompactListing listCompact(
+    HandlerTest* t,       //!< [mod] Handler to send the commands to.
+    char const* dirName,  //!< [in] Directory to list.
+    uint8_t fields        //!< [in] ListFields to ask for.
+) {
+    CompactListing listing;
+    uint8_t cursor = LittleFsPacketHandler::NO_CURSOR;
+    do {
+        Packet& cmd = t->command(Command::LIST_COMPACT);
+        cmd.appendByte(cursor);
+        cmd.appendByte(fields);
+        if (cursor == LittleFsPacketHandler::NO_CURSOR) {
+            cmd.append(dirName);
+        }
+        t->call();
+        listing.numResponses++;
+        Packet const& rsp = t->reply();
+        listing.numBytes += rsp.getDataLength();
+        Unpacker unpacker(rsp);
+        uint8_t err = 0;
+        unpacker.unpack(&err);
+        unpacker.unpack(&cursor);
+        if (err != 0) {
+            listing.err = static_cast<Error>(err);
+            return listing;
+        }
+        std::string name;
+        bool first = true;
+        while (true) {
+            CompactEntry entry;
+            if ((fields & ListFields::FLAGS) != 0 && !unpacker.unpack(&entry.flags)) {
+                break;
+            }
+            if ((fields & ListFields::SIZE) != 0 && !unpacker.unpack(&entry.size)) {
+                break;
+            }
+            uint32_t timestamp;
+            if ((fields & ListFields::TIMESTAMP) != 0 && !unpacker.unpack(&timestamp)) {
+                break;
+            }
+            uint8_t sharedLen = 0;
+            uint8_t suffixLen = 0;
+            if (!unpacker.unpack(&sharedLen)) {
+                break;
+            }
+            unpacker.unpack(&suffixLen);
+            uint8_t const* suffix = nullptr;
+            unpacker.unpack(suffixLen, &suffix);
+            if (first && sharedLen != 0) {
+                listing.firstEntriesFull = false;
+            }
+            first = false;
+            name = name.substr(0, sharedLen) +
+                   std::string(reinterpret_cast<char const*>(suffix), suffixLen);
+            listing.entries[name] = entry;
+        }
+    } while (cursor != LittleFsPacketHandler::NO_CURSOR && listing.numResponses < 100);
+    return listing;
+}
+
+HANDLER_TEST(listCompactAllFields) {
+    makeDir(t);
+    CompactListing listing =
+        listCompact(t, "/d", ListFields::FLAGS | ListFields::SIZE | ListFields::TIMESTAMP);
+    CHECK(listing.err == Error::NONE);
+    CHECK(listing.numResponses > 1);
+    CHECK(listing.firstEntriesFull);
+    CHECK(listing.entries.size() == NUM_FILES + 1);
+    for (int i = 0; i < NUM_FILES; i++) {
+        auto entry = listing.entries.find("sensor_log_" + std::to_string(i));
+        CHECK(entry != listing.entries.end());
+        CHECK(entry->second.size == static_cast<uint32_t>(i % 10));
+        CHECK((entry->second.flags & Flags::DIR) == 0);
+    }
+    CHECK((listing.entries["sub"].flags & Flags::DIR) != 0);
+}
+
+HANDLER_TEST(listCompactNamesOnly) {
+    makeDir(t);
+    CompactListing full =
+        listCompact(t, "/d", ListFields::FLAGS | ListFields::SIZE | ListFields::TIMESTAMP);
+    CompactListing names = listCompact(t, "/d", 0);
+    CHECK(names.err == Error::NONE);
+    CHECK(names.entries.size() == full.entries.size());
+    for (auto const& entry : full.entries) {
+        CHECK(names.entries.count(entry.first) == 1);
+    }
+    CHECK(names.numBytes < full.numBytes);
+}
+
+HANDLER_TEST(listCompactErrors) {
+    CHECK(listCompact(t, "/missing", 0).err == Error::UNABLE_TO_OPEN_FILE);
+    Packet& cmd = t->command(Command::LIST_COMPACT);
+    cmd.appendByte(1);
+    cmd.appendByte(0);
+    CHECK(t->callForError() == Error::INVALID_CURSOR);
+}
@@ -0,0 +1,129 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   ListCursorTest.cpp
+ *
+ *   @brief  Tests for LIST_CURSOR.
+ *
+ ****************************************************************************/
+
+#include <cstring>
+#include <set>
+#include <string>
+
+#include "HandlerTest.h"
+#include "Unpacker.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using Flags = LittleFsPacketHandler::Flags;
+
+//! Number of files created by makeDir (more than one response can hold).
+static constexpr int NUM_FILES = 150;
+
+//! Creates /d containing NUM_FILES files with long names, and a directory.
+//! @returns The names of the entries in /d.
+static std::set<std::string> makeDir(
+    HandlerTest* t  //!< [mod] Test whose file system gets the files.
+) {
+    std::set<std::string> names;
+    t->fs().mkdir("/d");
+    for (int i = 0; i < NUM_FILES; i++) {
+        std::string name = "a_long_file_name_to_fill_up_the_packet_" + std::to_string(i);
+        t->writeFile(("/d/" + name).c_str(), std::to_string(i));
+        names.insert(name);
+    }
+    t->fs().mkdir("/d/sub");
+    names.insert("sub");
+    return names;
+}
+
+//! Sends a LIST_CURSOR command, and adds the entries it returns to names.
+//! @returns The error code, and stores the next cursor in cursor.
+static Error listCursor(
+    HandlerTest* t,                //!< [mod] Handler to send the command to.
+    uint8_t* cursor,               //!< [mod] Cursor to send, and the one returned.
+    char const* dirName,           //!< [in] Directory to list (for a new listing).
+    std::set<std::string>* names,  //!< [mod] Names of the entries found so far.
+    bool* sawDir                   //!< [mod] Set if sub was reported as a directory.
+) {
+    Packet& cmd = t->command(Command::LIST_CURSOR);
+    cmd.appendByte(*cursor);
+    if (*cursor == LittleFsPacketHandler::NO_CURSOR) {
+        cmd.append(dirName);
+    }
+    t->call();
+    Unpacker unpacker(t->reply());
+    uint8_t err = 0;
+    unpacker.unpack(&err);
+    unpacker.unpack(cursor);
+    uint16_t index;
+    while (unpacker.unpack(&index)) {
+        uint8_t flags = 0;
+        uint32_t size = 0;
+        uint32_t timestamp = 0;
+        char const* name = nullptr;
+        unpacker.unpack(&flags);
+        unpacker.unpack(&size);
+        unpacker.unpack(&timestamp);
+        unpacker.unpack(&name);
+        if (strcmp(name, "sub") == 0 && (flags & Flags::DIR) != 0) {
+            *sawDir = true;
+        }
+        names->insert(name);
+    }
+    return static_cast<Error>(err);
+}
+
+HANDLER_TEST(listCursorResumes) {
+    std::set<std::string> expected = makeDir(t);
+    std::set<std::string> names;
+    bool sawDir = false;
+    uint8_t cursor = LittleFsPacketHandler::NO_CURSOR;
+    int numCalls = 0;
+    do {
+        CHECK(listCursor(t, &cursor, "/d", &names, &sawDir) == Error::NONE);
+        numCalls++;
+    } while (cursor != LittleFsPacketHandler::NO_CURSOR && numCalls < 100);
+    CHECK(numCalls > 1);
+    CHECK(names == expected);
+    CHECK(sawDir);
+}
+
+HANDLER_TEST(listCursorEmptyDir) {
+    t->fs().mkdir("/empty");
+    std::set<std::string> names;
+    bool sawDir = false;
+    uint8_t cursor = LittleFsPacketHandler::NO_CURSOR;
+    CHECK(listCursor(t, &cursor, "/empty", &names, &sawDir) == Error::NONE);
+    CHECK(cursor == LittleFsPacketHandler::NO_CURSOR);
+    CHECK(names.empty());
+}
+
+HANDLER_TEST(listCursorErrors) {
+    t->writeFile("/f", "data");
+    std::set<std::string> names;
+    bool sawDir = false;
+    uint8_t cursor = LittleFsPacketHandler::NO_CURSOR;
+    CHECK(listCursor(t, &cursor, "/missing", &names, &sawDir) == Error::UNABLE_TO_OPEN_FILE);
+    cursor = LittleFsPacketHandler::NO_CURSOR;
+    CHECK(listCursor(t, &cursor, "/f", &names, &sawDir) == Error::UNABLE_TO_OPEN_FILE);
+
+    // A finished listing frees its cursor.
+    makeDir(t);
+    cursor = LittleFsPacketHandler::NO_CURSOR;
+    while (listCursor(t, &cursor, "/d", &names, &sawDir) == Error::NONE &&
+           cursor != LittleFsPacketHandler::NO_CURSOR) {
+    }
+    cursor = 0;
+    CHECK(listCursor(t, &cursor, "/d", &names, &sawDir) == Error::INVALID_CURSOR);
+    cursor = 200;
+    CHECK(listCursor(t, &cursor, "/d", &names, &sawDir) == Error::INVALID_CURSOR);
+}
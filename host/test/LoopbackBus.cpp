@@ -0,0 +1,54 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   LoopbackBus.cpp
+ *
+ *   @brief  A bus which decodes the packets written to it.
+ *
+ ****************************************************************************/
+
+#include "LoopbackBus.h"
+
+#include "duino_util.h"
+
+LoopbackBus::LoopbackBus()
+    : IBus{&this->m_rxPacket, &this->m_txPacket},
+      m_rxPacket{LEN(this->m_rxPacketData), this->m_rxPacketData},
+      m_txPacket{LEN(this->m_txPacketData), this->m_txPacketData} {}
+
+bool LoopbackBus::receivePacket() {
+    while (this->isDataAvailable()) {
+        if (this->processByte() == Packet::Error::NONE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LoopbackBus::isDataAvailable() const {
+    return !this->m_bytes.empty();
+}
+
+bool LoopbackBus::readByte(uint8_t* byte) {
+    if (this->m_bytes.empty()) {
+        return false;
+    }
+    *byte = this->m_bytes.front();
+    this->m_bytes.pop_front();
+    return true;
+}
+
+bool LoopbackBus::isSpaceAvailable() const {
+    return true;
+}
+
+void LoopbackBus::writeByte(uint8_t byte) {
+    this->m_bytes.push_back(byte);
+}
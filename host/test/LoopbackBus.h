@@ -0,0 +1,59 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   LoopbackBus.h
+ *
+ *   @brief  A bus which decodes the packets written to it, for testing the
+ *           packet handler without a device.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <deque>
+
+#include "Bus.h"
+#include "Packet.h"
+
+//! Largest packet which the tests send or receive.
+static constexpr size_t LOOPBACK_MAX_PACKET_SIZE = 8192;
+
+//! A bus whose written bytes are read back by the same bus.
+//!
+//! The packet handler writes its extra responses to the bus, and the tests
+//! write the reply to each command the same way, so everything the device
+//! would send can then be decoded in order by receivePacket.
+class LoopbackBus : public IBus {
+ public:
+    //! Constructor.
+    LoopbackBus();
+
+    //! Decodes the next packet written to the bus, which is then available
+    //! from received().
+    //! @returns true if a whole packet was decoded.
+    bool receivePacket();
+
+    //! @returns The packet most recently returned by receivePacket.
+    Packet const& received() const { return this->m_rxPacket; }
+
+    bool isDataAvailable() const override;
+    bool readByte(uint8_t* byte) override;
+    bool isSpaceAvailable() const override;
+    void writeByte(uint8_t byte) override;
+
+ private:
+    uint8_t m_rxPacketData[LOOPBACK_MAX_PACKET_SIZE];  //!< Data of m_rxPacket.
+    uint8_t m_txPacketData[1];                         //!< Data of the unused response packet.
+    Packet m_rxPacket;                                 //!< Packets decoded from the bus.
+    Packet m_txPacket;                                 //!< Passed to IBus, but never used.
+    std::deque<uint8_t> m_bytes;                       //!< Bytes written but not yet read.
+};
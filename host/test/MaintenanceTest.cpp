@@ -0,0 +1,131 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   MaintenanceTest.cpp
+ *
+ *   @brief  Tests for the MAINTENANCE job.
+ *
+ ****************************************************************************/
+
+#include "HandlerTest.h"
+#include "Unpacker.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using JobState = LittleFsPacketHandler::JobState;
+using JobType = LittleFsPacketHandler::JobType;
+using StatsPhase = LittleFsPacketHandler::StatsPhase;
+
+//! Backend which counts the garbage collections, standing in for one which
+//! calls lfs_fs_gc.
+class GcBackend : public FormattableFsBackend<RamFs> {
+ public:
+    //! Constructor.
+    explicit GcBackend(RamFs& fs  //!< [in] File system to use.
+                       )
+        : FormattableFsBackend<RamFs>{fs} {}
+
+    bool canGc() override { return true; }
+
+    bool gc() override {
+        this->numGcs++;
+        return this->gcWorks;
+    }
+
+    int numGcs = 0;       //!< Number of calls to gc.
+    bool gcWorks = true;  //!< Value returned by gc.
+};
+
+//! Reply to JOB_STATUS.
+struct JobStatus {
+    JobState state = JobState::DONE;  //!< State of the job.
+    Error result = Error::NONE;       //!< Result of the job (once DONE).
+    uint32_t progress = 0;            //!< File systems collected.
+    uint32_t total = 0;               //!< File systems which can be collected.
+};
+
+//! Starts a MAINTENANCE job.
+//! @returns The error code, and stores the job number in jobNum.
+static Error startMaintenance(
+    HandlerTest* t,  //!< [mod] Handler to send the command to.
+    uint8_t* jobNum  //!< [out] Job number to pass to JOB_STATUS.
+) {
+    t->command(Command::JOB_START).appendByte(to_underlying(JobType::MAINTENANCE));
+    t->call();
+    Unpacker unpacker(t->reply());
+    uint8_t err = 0;
+    unpacker.unpack(&err);
+    unpacker.unpack(jobNum);
+    return static_cast<Error>(err);
+}
+
+//! Calls run() until the job is DONE, and collects it.
+//! @returns The final JOB_STATUS reply.
+static JobStatus finishJob(
+    HandlerTest* t,  //!< [mod] Handler running the job.
+    uint8_t jobNum   //!< [in] Job number returned by JOB_START.
+) {
+    JobStatus status;
+    for (int i = 0; i < 100; i++) {
+        t->handler().run();
+        t->command(Command::JOB_STATUS).appendByte(jobNum);
+        t->call();
+        Unpacker unpacker(t->reply());
+        uint8_t err = 0;
+        uint8_t state = 0;
+        uint8_t result = 0;
+        unpacker.unpack(&err);
+        unpacker.unpack(&state);
+        unpacker.unpack(&result);
+        unpacker.unpack(&status.progress);
+        unpacker.unpack(&status.total);
+        status.state = static_cast<JobState>(state);
+        status.result = static_cast<Error>(result);
+        if (status.state == JobState::DONE) {
+            break;
+        }
+    }
+    return status;
+}
+
+HANDLER_TEST(maintenanceUnsupported) {
+    uint8_t jobNum = 0;
+    CHECK(startMaintenance(t, &jobNum) == Error::UNSUPPORTED);
+}
+
+HANDLER_TEST(maintenanceCollectsEachFs) {
+    GcBackend backend{t->mountedFs()};
+    CHECK(t->handler().mount("/gc", &backend));
+    uint32_t count = 0;
+    uint32_t bytes = 0;
+    t->takePhaseStats(StatsPhase::GC, &count, &bytes);
+
+    uint8_t jobNum = 0;
+    CHECK(startMaintenance(t, &jobNum) == Error::NONE);
+    JobStatus status = finishJob(t, jobNum);
+    CHECK(status.state == JobState::DONE);
+    CHECK(status.result == Error::NONE);
+    CHECK(status.progress == 1);
+    CHECK(status.total == 1);
+    CHECK(backend.numGcs == 1);
+    t->takePhaseStats(StatsPhase::GC, &count, &bytes);
+    CHECK(count == 1);
+}
+
+HANDLER_TEST(maintenanceGcFails) {
+    GcBackend backend{t->mountedFs()};
+    backend.gcWorks = false;
+    CHECK(t->handler().mount("/gc", &backend));
+    uint8_t jobNum = 0;
+    CHECK(startMaintenance(t, &jobNum) == Error::NONE);
+    JobStatus status = finishJob(t, jobNum);
+    CHECK(status.state == JobState::DONE);
+    CHECK(status.result == Error::WRITE_FAILED);
+}
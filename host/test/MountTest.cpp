@@ -0,0 +1,89 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   MountTest.cpp
+ *
+ *   @brief  Tests for mounting several file systems in one handler.
+ *
+ ****************************************************************************/
+
+#include <cstring>
+#include <string>
+
+#include "HandlerTest.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+
+//! Writes a file using the WRITE command.
+//! @returns The error returned by WRITE.
+static Error writeFile(
+    HandlerTest* t,        //!< [mod] Handler to send the command to.
+    char const* filename,  //!< [in] File to write.
+    char const* data       //!< [in] Contents of the file.
+) {
+    uint32_t length = strlen(data);
+    Packet& cmd = t->command(Command::WRITE);
+    cmd.append(filename);
+    cmd.append(length);
+    cmd.appendData(length, data);
+    return t->callForError();
+}
+
+//! Renames a file using the RENAME command.
+//! @returns The error returned by RENAME.
+static Error renameFile(
+    HandlerTest* t,    //!< [mod] Handler to send the command to.
+    char const* from,  //!< [in] File to rename.
+    char const* to     //!< [in] New name.
+) {
+    Packet& cmd = t->command(Command::RENAME);
+    cmd.append(from);
+    cmd.append(to);
+    return t->callForError();
+}
+
+HANDLER_TEST(mountRejectsBadPrefixes) {
+    CHECK(!t->mount("ram"));
+    CHECK(!t->mount("/"));
+    CHECK(!t->mount("/ram/"));
+    CHECK(t->mount("/ram"));
+}
+
+HANDLER_TEST(mountRoutesPaths) {
+    CHECK(t->mount("/ram"));
+    CHECK(writeFile(t, "/ram/a.txt", "mounted") == Error::NONE);
+    CHECK(writeFile(t, "/a.txt", "default") == Error::NONE);
+    CHECK(writeFile(t, "/ramdisk.txt", "not a mount") == Error::NONE);
+
+    // The prefix is removed, and only matches a whole directory name.
+    CHECK(t->mountedFs().exists("/a.txt"));
+    CHECK(!t->mountedFs().exists("/disk.txt"));
+    CHECK(t->fs().exists("/ramdisk.txt"));
+    CHECK(t->readFile("/a.txt") == "default");
+
+    Packet& cmd = t->command(Command::MKDIR);
+    cmd.append("/ram/logs");
+    CHECK(t->callForError() == Error::NONE);
+    CHECK(t->mountedFs().exists("/logs"));
+    CHECK(!t->fs().exists("/logs"));
+}
+
+HANDLER_TEST(mountRenameStaysWithinFs) {
+    CHECK(t->mount("/ram"));
+    CHECK(writeFile(t, "/ram/a.txt", "mounted") == Error::NONE);
+    CHECK(renameFile(t, "/ram/a.txt", "/ram/b.txt") == Error::NONE);
+    CHECK(t->mountedFs().exists("/b.txt"));
+
+    // Files can't be renamed from one file system to another.
+    CHECK(renameFile(t, "/ram/b.txt", "/b.txt") == Error::RENAME_FAILED);
+    CHECK(t->mountedFs().exists("/b.txt"));
+    CHECK(!t->fs().exists("/b.txt"));
+}
@@ -0,0 +1,265 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   PatchTest.cpp
+ *
+ *   @brief  Tests for SIGNATURE and PATCH, which send the changes to a file.
+ *
+ ****************************************************************************/
+
+#include <string>
+
+#include "Crc32.h"
+#include "HandlerTest.h"
+#include "Unpacker.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using HashType = LittleFsPacketHandler::HashType;
+using PatchOp = LittleFsPacketHandler::PatchOp;
+using StatsPhase = LittleFsPacketHandler::StatsPhase;
+
+//! Size of the blocks which the tests copy from the existing file.
+static constexpr uint32_t BLOCK_SIZE = 4;
+
+//! Contents of the file being patched.
+static char const OLD_DATA[] = "0123456789abcdef";
+
+//! Adds a BEGIN operation to a PATCH command.
+static void beginOp(
+    Packet* cmd,          //!< [mod] PATCH command to add to.
+    char const* filename  //!< [in] File to patch.
+) {
+    cmd->appendByte(to_underlying(PatchOp::BEGIN));
+    cmd->append(filename);
+    cmd->append(BLOCK_SIZE);
+}
+
+//! Adds a COPY operation to a PATCH command.
+static void copyOp(
+    Packet* cmd,          //!< [mod] PATCH command to add to.
+    uint32_t firstBlock,  //!< [in] First block to copy.
+    uint32_t numBlocks    //!< [in] Number of blocks to copy.
+) {
+    cmd->appendByte(to_underlying(PatchOp::COPY));
+    cmd->append(firstBlock);
+    cmd->append(numBlocks);
+}
+
+//! Adds a LITERAL operation to a PATCH command.
+static void literalOp(
+    Packet* cmd,             //!< [mod] PATCH command to add to.
+    std::string const& data  //!< [in] Data to add to the new file.
+) {
+    cmd->appendByte(to_underlying(PatchOp::LITERAL));
+    cmd->append(static_cast<uint32_t>(data.size()));
+    cmd->appendData(data.size(), data.data());
+}
+
+//! Adds an END operation to a PATCH command.
+static void endOp(
+    Packet* cmd,             //!< [mod] PATCH command to add to.
+    std::string const& data  //!< [in] Expected contents of the new file.
+) {
+    Crc32 crc;
+    crc.update(reinterpret_cast<uint8_t const*>(data.data()), data.size());
+    cmd->appendByte(to_underlying(PatchOp::END));
+    cmd->append(crc.value());
+}
+
+//! Sends the PATCH command.
+//! @returns The error code from the reply.
+static Error sendPatch(
+    HandlerTest* t,     //!< [mod] Handler to send the command to.
+    uint32_t* patchLen   //!< [out] Length of the new file so far.
+) {
+    t->call();
+    Unpacker unpacker(t->reply());
+    uint8_t err = 0;
+    *patchLen = 0;
+    unpacker.unpack(&err);
+    unpacker.unpack(patchLen);
+    return static_cast<Error>(err);
+}
+
+//! Sends a SIGNATURE command.
+//! @returns The error code from the reply.
+static Error sendSignature(
+    HandlerTest* t,       //!< [mod] Handler to send the command to.
+    uint32_t firstBlock,  //!< [in] First block to checksum.
+    uint32_t* numBlocks   //!< [out] Number of blocks in the reply.
+) {
+    Packet& cmd = t->command(Command::SIGNATURE);
+    cmd.append("/f");
+    cmd.append(BLOCK_SIZE);
+    cmd.append(firstBlock);
+    t->call();
+    Unpacker unpacker(t->reply());
+    uint8_t err = 0;
+    unpacker.unpack(&err);
+    // Error code, file size and first block, then 8 bytes per block.
+    *numBlocks = (t->reply().getDataLength() - 9) / 8;
+    return static_cast<Error>(err);
+}
+
+//! Reads the STATS counters for a phase, and clears all of the counters.
+//! @returns The number of bytes counted for phase.
+static uint32_t phaseBytes(
+    HandlerTest* t,   //!< [mod] Handler to send the commands to.
+    StatsPhase phase  //!< [in] Phase to return the bytes of.
+) {
+    uint32_t count = 0;
+    uint32_t bytes = 0;
+    t->takePhaseStats(phase, &count, &bytes);
+    return bytes;
+}
+
+HANDLER_TEST(signatureBlocks) {
+    t->writeFile("/f", OLD_DATA);
+    uint32_t numBlocks = 0;
+    CHECK(sendSignature(t, 0, &numBlocks) == Error::NONE);
+    CHECK(numBlocks == 4);
+    CHECK(sendSignature(t, 3, &numBlocks) == Error::NONE);
+    CHECK(numBlocks == 1);
+}
+
+HANDLER_TEST(signatureFirstBlockOverflow) {
+    t->writeFile("/f", OLD_DATA);
+    // 0x40000000 blocks of 4 bytes wraps around to offset 0.
+    uint32_t numBlocks = 0;
+    CHECK(sendSignature(t, 0x40000000, &numBlocks) == Error::INVALID_COMMAND);
+    CHECK(numBlocks == 0);
+}
+
+HANDLER_TEST(signatureAndHashCountReads) {
+    t->writeFile("/f", OLD_DATA);
+    phaseBytes(t, StatsPhase::READ);
+    uint32_t numBlocks = 0;
+    CHECK(sendSignature(t, 0, &numBlocks) == Error::NONE);
+    CHECK(phaseBytes(t, StatsPhase::READ) == sizeof(OLD_DATA) - 1);
+
+    Packet& cmd = t->command(Command::HASH);
+    cmd.append("/f");
+    cmd.append(static_cast<uint32_t>(4));
+    cmd.append(LittleFsPacketHandler::TO_END_OF_FILE);
+    cmd.appendByte(to_underlying(HashType::CRC32));
+    CHECK(t->callForError() == Error::NONE);
+    CHECK(phaseBytes(t, StatsPhase::READ) == sizeof(OLD_DATA) - 1 - 4);
+}
+
+HANDLER_TEST(signatureAndHashReuseCachedFile) {
+    t->writeFile("/f", OLD_DATA);
+    uint32_t numBlocks = 0;
+    CHECK(sendSignature(t, 0, &numBlocks) == Error::NONE);
+    for (int i = 0; i < 2; i++) {
+        Packet& cmd = t->command(Command::HASH);
+        cmd.append("/f");
+        cmd.append(static_cast<uint32_t>(0));
+        cmd.append(LittleFsPacketHandler::TO_END_OF_FILE);
+        cmd.appendByte(to_underlying(HashType::CRC32));
+        CHECK(t->callForError() == Error::NONE);
+    }
+    uint32_t count = 0;
+    uint32_t bytes = 0;
+    t->takePhaseStats(StatsPhase::OPEN, &count, &bytes);
+    CHECK(count == 1);
+}
+
+HANDLER_TEST(patchCopyAndLiteral) {
+    t->writeFile("/f", OLD_DATA);
+    std::string newData = "456789abXYZ";
+    Packet& cmd = t->command(Command::PATCH);
+    cmd.appendByte(4);
+    beginOp(&cmd, "/f");
+    copyOp(&cmd, 1, 2);
+    literalOp(&cmd, "XYZ");
+    endOp(&cmd, newData);
+    uint32_t patchLen = 0;
+    CHECK(sendPatch(t, &patchLen) == Error::NONE);
+    CHECK(patchLen == newData.size());
+    CHECK(t->readFile("/f") == newData);
+    CHECK(!t->fs().exists("/.f.patch"));
+}
+
+HANDLER_TEST(patchAcrossCommands) {
+    t->writeFile("/f", OLD_DATA);
+    std::string newData = "cdefAB0123";
+    uint32_t patchLen = 0;
+
+    Packet& begin = t->command(Command::PATCH);
+    begin.appendByte(2);
+    beginOp(&begin, "/f");
+    copyOp(&begin, 3, 1);
+    CHECK(sendPatch(t, &patchLen) == Error::NONE);
+    CHECK(patchLen == BLOCK_SIZE);
+    // The file isn't changed until the END operation.
+    CHECK(t->readFile("/f") == OLD_DATA);
+
+    Packet& end = t->command(Command::PATCH);
+    end.appendByte(3);
+    literalOp(&end, "AB");
+    copyOp(&end, 0, 1);
+    endOp(&end, newData);
+    CHECK(sendPatch(t, &patchLen) == Error::NONE);
+    CHECK(patchLen == newData.size());
+    CHECK(t->readFile("/f") == newData);
+}
+
+HANDLER_TEST(patchBadCrcKeepsFile) {
+    t->writeFile("/f", OLD_DATA);
+    Packet& cmd = t->command(Command::PATCH);
+    cmd.appendByte(3);
+    beginOp(&cmd, "/f");
+    copyOp(&cmd, 0, 2);
+    endOp(&cmd, "not the new data");
+    uint32_t patchLen = 0;
+    CHECK(sendPatch(t, &patchLen) == Error::VERIFY_FAILED);
+    CHECK(t->readFile("/f") == OLD_DATA);
+    CHECK(!t->fs().exists("/.f.patch"));
+}
+
+HANDLER_TEST(patchCopyOverflow) {
+    t->writeFile("/f", OLD_DATA);
+    uint32_t patchLen = 0;
+
+    // Block numbers whose offset doesn't fit in 32 bits are rejected rather
+    // than wrapping around to the start of the file.
+    Packet& first = t->command(Command::PATCH);
+    first.appendByte(2);
+    beginOp(&first, "/f");
+    copyOp(&first, 0x40000000, 1);
+    CHECK(sendPatch(t, &patchLen) == Error::INVALID_COMMAND);
+
+    Packet& num = t->command(Command::PATCH);
+    num.appendByte(2);
+    beginOp(&num, "/f");
+    copyOp(&num, 1, 0x40000000);
+    CHECK(sendPatch(t, &patchLen) == Error::INVALID_COMMAND);
+    CHECK(t->readFile("/f") == OLD_DATA);
+}
+
+HANDLER_TEST(patchAbort) {
+    t->writeFile("/f", OLD_DATA);
+    uint32_t patchLen = 0;
+
+    Packet& begin = t->command(Command::PATCH);
+    begin.appendByte(2);
+    beginOp(&begin, "/f");
+    literalOp(&begin, "new");
+    CHECK(sendPatch(t, &patchLen) == Error::NONE);
+    CHECK(t->fs().exists("/.f.patch"));
+
+    Packet& abort = t->command(Command::PATCH);
+    abort.appendByte(1);
+    abort.appendByte(to_underlying(PatchOp::ABORT));
+    CHECK(sendPatch(t, &patchLen) == Error::NONE);
+    CHECK(!t->fs().exists("/.f.patch"));
+    CHECK(t->readFile("/f") == OLD_DATA);
+}
@@ -0,0 +1,129 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   ReadAheadTest.cpp
+ *
+ *   @brief  Tests for prefetching sequentially read files.
+ *
+ ****************************************************************************/
+
+#include <string>
+
+#include "HandlerTest.h"
+#include "Unpacker.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using StatsPhase = LittleFsPacketHandler::StatsPhase;
+
+//! Number of bytes asked for by each READ.
+static constexpr uint32_t CHUNK_SIZE = 1000;
+
+//! @returns Data which is different at each offset of a chunk.
+static std::string makeData(size_t size  //!< [in] Number of bytes to return.
+) {
+    std::string data;
+    for (size_t i = 0; i < size; i++) {
+        data += static_cast<char>('a' + (i * 7) % 26);
+    }
+    return data;
+}
+
+//! Sends a READ command.
+//! @returns The data returned (empty if an error was returned).
+static std::string readChunk(
+    HandlerTest* t,        //!< [mod] Handler to send the command to.
+    char const* filename,  //!< [in] File to read.
+    uint32_t offset        //!< [in] Offset to read from.
+) {
+    Packet& cmd = t->command(Command::READ);
+    cmd.append(filename);
+    cmd.append(offset);
+    cmd.append(CHUNK_SIZE);
+    t->call();
+    Unpacker unpacker(t->reply());
+    uint8_t err = 0;
+    uint32_t rspOffset = 0;
+    uint32_t length = 0;
+    uint8_t const* data = nullptr;
+    unpacker.unpack(&err);
+    unpacker.unpack(&rspOffset);
+    unpacker.unpack(&length);
+    unpacker.unpack(length, &data);
+    if (err != 0 || rspOffset != offset) {
+        return std::string();
+    }
+    return std::string(reinterpret_cast<char const*>(data), length);
+}
+
+//! @returns The number of bytes read from files since the last call.
+static uint32_t bytesRead(HandlerTest* t  //!< [mod] Handler to ask.
+) {
+    uint32_t count = 0;
+    uint32_t bytes = 0;
+    t->takePhaseStats(StatsPhase::READ, &count, &bytes);
+    return bytes;
+}
+
+HANDLER_TEST(readAheadPrefetchesNextChunk) {
+    std::string data = makeData(10 * CHUNK_SIZE + 123);
+    t->writeFile("/f", data);
+    std::string received;
+    for (int i = 0; i < 2; i++) {
+        received += readChunk(t, "/f", received.size());
+        t->handler().run();
+    }
+    bytesRead(t);
+
+    // The next chunk was read by run(), so READ doesn't touch the file.
+    received += readChunk(t, "/f", received.size());
+    CHECK(bytesRead(t) == 0);
+    t->handler().run();
+    CHECK(bytesRead(t) == CHUNK_SIZE);
+
+    while (received.size() < data.size()) {
+        std::string chunk = readChunk(t, "/f", received.size());
+        CHECK(!chunk.empty());
+        received += chunk;
+        t->handler().run();
+    }
+    CHECK(received == data);
+}
+
+HANDLER_TEST(readAheadDroppedByOtherReads) {
+    std::string data = makeData(4 * CHUNK_SIZE);
+    t->writeFile("/f", data);
+    CHECK(readChunk(t, "/f", 0) == data.substr(0, CHUNK_SIZE));
+    t->handler().run();
+    CHECK(readChunk(t, "/f", CHUNK_SIZE) == data.substr(CHUNK_SIZE, CHUNK_SIZE));
+    t->handler().run();
+
+    // Going back to the start doesn't use the prefetched data.
+    CHECK(readChunk(t, "/f", 0) == data.substr(0, CHUNK_SIZE));
+    CHECK(readChunk(t, "/f", 3 * CHUNK_SIZE) == data.substr(3 * CHUNK_SIZE));
+}
+
+HANDLER_TEST(readAheadDroppedByWrites) {
+    std::string data = makeData(4 * CHUNK_SIZE);
+    t->writeFile("/f", data);
+    std::string received;
+    for (int i = 0; i < 2; i++) {
+        received += readChunk(t, "/f", received.size());
+        t->handler().run();
+    }
+
+    std::string newData = makeData(3 * CHUNK_SIZE + 500).substr(7);
+    Packet& cmd = t->command(Command::WRITE);
+    cmd.append("/f");
+    cmd.append(static_cast<uint32_t>(newData.size()));
+    cmd.appendData(newData.size(), newData.data());
+    CHECK(t->callForError() == Error::NONE);
+    CHECK(readChunk(t, "/f", received.size()) == newData.substr(received.size(), CHUNK_SIZE));
+}
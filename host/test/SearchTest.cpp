@@ -0,0 +1,170 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   SearchTest.cpp
+ *
+ *   @brief  Tests for SEARCH.
+ *
+ ****************************************************************************/
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "HandlerTest.h"
+#include "Unpacker.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using SearchFlags = LittleFsPacketHandler::SearchFlags;
+using SearchLineFlags = LittleFsPacketHandler::SearchLineFlags;
+
+//! Line returned by SEARCH.
+struct SearchLine {
+    std::string file;     //!< Name of the file.
+    uint32_t line = 0;    //!< Line number (starting at 1).
+    uint32_t offset = 0;  //!< Offset of the start of the line.
+    uint8_t flags = 0;    //!< SearchLineFlags.
+    std::string text;     //!< The line.
+};
+
+//! Creates the files which the tests search.
+static void makeFiles(HandlerTest* t  //!< [mod] Test whose file system gets the files.
+) {
+    t->fs().mkdir("/logs");
+    t->writeFile("/logs/a.txt", "hello\nworld\nHello again\n");
+    t->writeFile("/logs/b.log", "nothing\nhello there");
+}
+
+//! Runs a search to the end, one response at a time.
+//! @returns The error code from the first response which had one.
+static Error search(
+    HandlerTest* t,                 //!< [mod] Handler to send the commands to.
+    uint8_t flags,                  //!< [in] SearchFlags.
+    char const* path,               //!< [in] File, directory or glob to search.
+    char const* pattern,            //!< [in] Pattern to look for.
+    uint8_t context,                //!< [in] Lines of context around each match.
+    std::vector<SearchLine>* lines  //!< [out] Lines returned.
+) {
+    uint8_t cursor = LittleFsPacketHandler::NO_CURSOR;
+    for (int i = 0; i < 100; i++) {
+        Packet& cmd = t->command(Command::SEARCH);
+        cmd.appendByte(cursor);
+        cmd.appendByte(1);
+        if (cursor == LittleFsPacketHandler::NO_CURSOR) {
+            cmd.appendByte(flags);
+            cmd.append(path);
+            cmd.append(pattern);
+            cmd.appendByte(context);
+        }
+        t->call();
+        Unpacker unpacker(t->reply());
+        uint8_t err = 0;
+        uint8_t streamFlags = 0;
+        uint8_t seq = 0;
+        unpacker.unpack(&err);
+        unpacker.unpack(&streamFlags);
+        unpacker.unpack(&seq);
+        unpacker.unpack(&cursor);
+        if (err != 0) {
+            return static_cast<Error>(err);
+        }
+        // Each match starts with a string, so count the bytes to find the end.
+        size_t pos = 4;
+        while (pos < t->reply().getDataLength()) {
+            SearchLine line;
+            char const* file = nullptr;
+            uint16_t length = 0;
+            uint8_t const* text = nullptr;
+            unpacker.unpack(&file);
+            unpacker.unpack(&line.line);
+            unpacker.unpack(&line.offset);
+            unpacker.unpack(&line.flags);
+            unpacker.unpack(&length);
+            unpacker.unpack(length, &text);
+            pos += 2 + strlen(file) + sizeof(line.line) + sizeof(line.offset) + sizeof(line.flags) +
+                   sizeof(length) + length;
+            line.file = file;
+            line.text = std::string(reinterpret_cast<char const*>(text), length);
+            lines->push_back(line);
+        }
+        if (cursor == LittleFsPacketHandler::NO_CURSOR) {
+            break;
+        }
+    }
+    return Error::NONE;
+}
+
+HANDLER_TEST(searchFile) {
+    makeFiles(t);
+    std::vector<SearchLine> lines;
+    CHECK(search(t, 0, "/logs/a.txt", "hello", 0, &lines) == Error::NONE);
+    CHECK(lines.size() == 1);
+    CHECK(lines[0].line == 1);
+    CHECK(lines[0].offset == 0);
+    CHECK(lines[0].flags == 0);
+    CHECK(lines[0].text == "hello");
+}
+
+HANDLER_TEST(searchDirIgnoringCase) {
+    makeFiles(t);
+    std::vector<SearchLine> lines;
+    CHECK(search(t, SearchFlags::IGNORE_CASE, "/logs", "HELLO", 0, &lines) == Error::NONE);
+    CHECK(lines.size() == 3);
+    int numInA = 0;
+    for (auto const& line : lines) {
+        if (line.file.find("a.txt") != std::string::npos) {
+            numInA++;
+            CHECK(line.line == 1 || (line.line == 3 && line.text == "Hello again"));
+        } else {
+            CHECK(line.file.find("b.log") != std::string::npos);
+            CHECK(line.line == 2);
+            CHECK(line.offset == 8);
+            CHECK(line.text == "hello there");
+        }
+    }
+    CHECK(numInA == 2);
+}
+
+HANDLER_TEST(searchGlob) {
+    makeFiles(t);
+    std::vector<SearchLine> lines;
+    CHECK(search(t, 0, "/logs/*.log", "hello", 0, &lines) == Error::NONE);
+    CHECK(lines.size() == 1);
+    CHECK(lines[0].file.find("b.log") != std::string::npos);
+}
+
+HANDLER_TEST(searchRegex) {
+    makeFiles(t);
+    std::vector<SearchLine> lines;
+    CHECK(search(t, SearchFlags::REGEX, "/logs/a.txt", "^w.*d$", 0, &lines) == Error::NONE);
+    CHECK(lines.size() == 1);
+    CHECK(lines[0].line == 2);
+    CHECK(lines[0].offset == 6);
+    CHECK(lines[0].text == "world");
+}
+
+HANDLER_TEST(searchContext) {
+    makeFiles(t);
+    std::vector<SearchLine> lines;
+    CHECK(search(t, 0, "/logs/a.txt", "world", 1, &lines) == Error::NONE);
+    CHECK(lines.size() == 3);
+    CHECK(lines[0].line == 1);
+    CHECK(lines[0].flags == SearchLineFlags::CONTEXT);
+    CHECK(lines[1].line == 2);
+    CHECK(lines[1].flags == 0);
+    CHECK(lines[2].line == 3);
+    CHECK(lines[2].flags == SearchLineFlags::CONTEXT);
+}
+
+HANDLER_TEST(searchMissingFile) {
+    std::vector<SearchLine> lines;
+    CHECK(search(t, 0, "/missing", "x", 0, &lines) == Error::UNABLE_TO_OPEN_FILE);
+}
@@ -0,0 +1,183 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   StatTest.cpp
+ *
+ *   @brief  Tests for STAT and its metadata cache.
+ *
+ ****************************************************************************/
+
+#include <cstring>
+#include <string>
+
+#include "HandlerTest.h"
+#include "Unpacker.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using Flags = LittleFsPacketHandler::Flags;
+using StatFlags = LittleFsPacketHandler::StatFlags;
+
+//! Reply to STAT.
+struct StatResult {
+    Error err = Error::NONE;  //!< Error code.
+    uint8_t flags = 0;        //!< StatFlags.
+    uint8_t entryFlags = 0;   //!< Flags of the entry.
+    uint32_t size = 0;        //!< Size of the file (or directory with DIR_SIZE).
+
+    //! @returns true if the reply came from the metadata cache.
+    bool cached() const { return (this->flags & StatFlags::CACHED) != 0; }
+};
+
+//! Sends a STAT command.
+static StatResult stat(
+    HandlerTest* t,    //!< [mod] Handler to send the command to.
+    char const* path,  //!< [in] File or directory to report on.
+    uint8_t flags = 0  //!< [in] StatFlags.
+) {
+    Packet& cmd = t->command(Command::STAT);
+    cmd.appendByte(flags);
+    cmd.append(path);
+    t->call();
+    Unpacker unpacker(t->reply());
+    StatResult result;
+    uint8_t err = 0;
+    unpacker.unpack(&err);
+    unpacker.unpack(&result.flags);
+    unpacker.unpack(&result.entryFlags);
+    unpacker.unpack(&result.size);
+    result.err = static_cast<Error>(err);
+    return result;
+}
+
+//! Sends a command which writes data to a file (WRITE or APPEND).
+//! @returns The error returned by the command.
+static Error sendData(
+    HandlerTest* t,             //!< [mod] Handler to send the command to.
+    Packet::Command::Type cmd,  //!< [in] WRITE or APPEND.
+    char const* filename,       //!< [in] File to write to.
+    char const* data            //!< [in] Data to write.
+) {
+    uint32_t length = strlen(data);
+    Packet& packet = t->command(cmd);
+    packet.append(filename);
+    packet.append(length);
+    packet.appendData(length, data);
+    return t->callForError();
+}
+
+//! Creates the files used by the tests.
+static void makeTree(HandlerTest* t  //!< [mod] Test whose file system gets the files.
+) {
+    t->fs().mkdir("/d");
+    t->fs().mkdir("/d/e");
+    t->writeFile("/d/a.txt", "hello");
+    t->writeFile("/d/e/b.txt", "world!!");
+}
+
+HANDLER_TEST(statCachesResult) {
+    makeTree(t);
+    StatResult first = stat(t, "/d/a.txt");
+    CHECK(first.err == Error::NONE);
+    CHECK(!first.cached());
+    CHECK(first.size == 5);
+    CHECK(first.entryFlags == 0);
+
+    StatResult second = stat(t, "/d/a.txt");
+    CHECK(second.cached());
+    CHECK(second.size == 5);
+    CHECK(!stat(t, "/d/a.txt", StatFlags::NO_CACHE).cached());
+
+    // Trailing slashes name the same entry.
+    StatResult dir = stat(t, "/d/");
+    CHECK(dir.entryFlags == Flags::DIR);
+    CHECK(dir.size == 0);
+    CHECK(stat(t, "/d").cached());
+}
+
+HANDLER_TEST(statMissingFile) {
+    CHECK(stat(t, "/nope").err == Error::UNABLE_TO_OPEN_FILE);
+    StatResult cached = stat(t, "/nope");
+    CHECK(cached.err == Error::UNABLE_TO_OPEN_FILE);
+    CHECK(cached.cached());
+
+    // Creating the file replaces the cached miss.
+    CHECK(sendData(t, Command::APPEND, "/nope", "x") == Error::NONE);
+    StatResult created = stat(t, "/nope");
+    CHECK(created.err == Error::NONE);
+    CHECK(created.size == 1);
+}
+
+HANDLER_TEST(statDirSize) {
+    makeTree(t);
+    StatResult dir = stat(t, "/d", StatFlags::DIR_SIZE);
+    CHECK(dir.err == Error::NONE);
+    CHECK(!dir.cached());
+    CHECK(dir.entryFlags == Flags::DIR);
+    CHECK(dir.size == 12);
+    CHECK(stat(t, "/d", StatFlags::DIR_SIZE).cached());
+    // Without DIR_SIZE, a directory's size is 0 even if the total is cached.
+    CHECK(stat(t, "/d").size == 0);
+}
+
+HANDLER_TEST(statInvalidatedByWrite) {
+    makeTree(t);
+    CHECK(stat(t, "/d/a.txt").size == 5);
+    CHECK(stat(t, "/d", StatFlags::DIR_SIZE).size == 12);
+    CHECK(sendData(t, Command::WRITE, "/d/a.txt", "hi") == Error::NONE);
+
+    StatResult file = stat(t, "/d/a.txt");
+    CHECK(!file.cached());
+    CHECK(file.size == 2);
+    // The totals of the directories containing the file are updated too.
+    StatResult dir = stat(t, "/d", StatFlags::DIR_SIZE);
+    CHECK(!dir.cached());
+    CHECK(dir.size == 9);
+}
+
+HANDLER_TEST(statInvalidatedByAppend) {
+    makeTree(t);
+    CHECK(stat(t, "/d/e/b.txt").size == 7);
+    CHECK(stat(t, "/d", StatFlags::DIR_SIZE).size == 12);
+    CHECK(sendData(t, Command::APPEND, "/d/e/b.txt", "12345") == Error::NONE);
+
+    // The APPEND data may still be buffered, but STAT includes it.
+    CHECK(stat(t, "/d/e/b.txt").size == 12);
+    CHECK(stat(t, "/d", StatFlags::DIR_SIZE).size == 17);
+    CHECK(t->readFile("/d/e/b.txt") == "world!!12345");
+}
+
+HANDLER_TEST(statInvalidatedByRemove) {
+    makeTree(t);
+    CHECK(stat(t, "/d/a.txt").err == Error::NONE);
+    CHECK(stat(t, "/d", StatFlags::DIR_SIZE).size == 12);
+
+    Packet& cmd = t->command(Command::REMOVE);
+    cmd.append("/d/a.txt");
+    CHECK(t->callForError() == Error::NONE);
+    CHECK(stat(t, "/d/a.txt").err == Error::UNABLE_TO_OPEN_FILE);
+    CHECK(stat(t, "/d", StatFlags::DIR_SIZE).size == 7);
+}
+
+HANDLER_TEST(statInvalidatedByRename) {
+    makeTree(t);
+    CHECK(stat(t, "/d/e/b.txt").err == Error::NONE);
+    CHECK(stat(t, "/z/e/b.txt").err == Error::UNABLE_TO_OPEN_FILE);
+
+    Packet& cmd = t->command(Command::RENAME);
+    cmd.append("/d");
+    cmd.append("/z");
+    CHECK(t->callForError() == Error::NONE);
+    // Both the old and new paths of everything inside the directory change.
+    CHECK(stat(t, "/d/e/b.txt").err == Error::UNABLE_TO_OPEN_FILE);
+    StatResult moved = stat(t, "/z/e/b.txt");
+    CHECK(moved.err == Error::NONE);
+    CHECK(moved.size == 7);
+}
@@ -0,0 +1,187 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   StreamWriteTest.cpp
+ *
+ *   @brief  Tests for STREAM_WRITE, with several chunks in flight.
+ *
+ ****************************************************************************/
+
+#include <algorithm>
+#include <string>
+
+#include "HandlerTest.h"
+#include "Unpacker.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using OpenMode = LittleFsPacketHandler::OpenMode;
+
+//! Size of each chunk sent by the tests.
+static constexpr uint32_t CHUNK_SIZE = 1000;
+
+//! @returns Data which is different at every offset that the tests use.
+static std::string testData(size_t len  //!< [in] Number of bytes to make.
+) {
+    std::string data;
+    for (size_t i = 0; i < len; i++) {
+        data += static_cast<char>('a' + (i * 7 + i / 251) % 26);
+    }
+    return data;
+}
+
+//! Opens a file using the OPEN command.
+//! @returns The handle of the file.
+static uint8_t openFile(
+    HandlerTest* t,    //!< [mod] Handler to send the command to.
+    char const* path,  //!< [in] File to open.
+    OpenMode mode,     //!< [in] How to open it.
+    Error* err         //!< [out] Error returned by OPEN.
+) {
+    Packet& cmd = t->command(Command::OPEN);
+    cmd.appendByte(to_underlying(mode));
+    cmd.append(path);
+    t->call();
+    Unpacker unpacker(t->reply());
+    uint8_t errByte = 0;
+    uint8_t handle = 0;
+    unpacker.unpack(&errByte);
+    unpacker.unpack(&handle);
+    *err = static_cast<Error>(errByte);
+    return handle;
+}
+
+//! Sends the chunk of data starting at offset.
+//! @returns The error returned by STREAM_WRITE.
+static Error sendChunk(
+    HandlerTest* t,           //!< [mod] Handler to send the command to.
+    uint8_t handle,           //!< [in] File to write to.
+    uint8_t seq,              //!< [in] Sequence number of the chunk.
+    std::string const& data,  //!< [in] Whole contents of the file.
+    uint32_t offset,          //!< [in] Offset of the chunk.
+    uint32_t* committed       //!< [out] Bytes written in order, from the reply.
+) {
+    uint32_t length = data.size() - offset;
+    if (length > CHUNK_SIZE) {
+        length = CHUNK_SIZE;
+    }
+    Packet& cmd = t->command(Command::STREAM_WRITE);
+    cmd.appendByte(handle);
+    cmd.appendByte(seq);
+    cmd.append(offset);
+    cmd.append(length);
+    cmd.appendData(length, &data[offset]);
+    t->call();
+    Unpacker unpacker(t->reply());
+    uint8_t err = 0;
+    uint8_t rspSeq = 0;
+    unpacker.unpack(&err);
+    unpacker.unpack(&rspSeq);
+    unpacker.unpack(committed);
+    return (rspSeq == seq) ? static_cast<Error>(err) : Error::OUT_OF_SEQUENCE;
+}
+
+//! Closes a file using the CLOSE command.
+//! @returns The error returned by CLOSE.
+static Error closeFile(
+    HandlerTest* t,  //!< [mod] Handler to send the command to.
+    uint8_t handle   //!< [in] File to close.
+) {
+    Packet& cmd = t->command(Command::CLOSE);
+    cmd.appendByte(handle);
+    return t->callForError();
+}
+
+HANDLER_TEST(streamWriteReportsWindow) {
+    t->command(Command::CAPS);
+    CHECK(t->call() == 1);
+    Unpacker unpacker(t->reply());
+    uint32_t caps = 0;
+    uint32_t cmdLen = 0;
+    uint32_t rspLen = 0;
+    uint32_t blockSize = 0;
+    uint8_t window = 0;
+    unpacker.unpack(&caps);
+    unpacker.unpack(&cmdLen);
+    unpacker.unpack(&rspLen);
+    unpacker.unpack(&blockSize);
+    unpacker.unpack(&window);
+    CHECK((caps & LittleFsPacketHandler::Capabilities::STREAM) != 0);
+    CHECK(cmdLen == HANDLER_TEST_PACKET_SIZE);
+    CHECK(window == LITTLEFS_STREAM_WRITE_WINDOW);
+}
+
+HANDLER_TEST(streamWriteInOrder) {
+    std::string data = testData(10 * CHUNK_SIZE + 123);
+    Error err = Error::NONE;
+    uint8_t handle = openFile(t, "/file.bin", OpenMode::WRITE, &err);
+    CHECK(err == Error::NONE);
+
+    // A whole window is sent before looking at the replies, like the host does.
+    uint8_t seq = 0;
+    for (uint32_t offset = 0; offset < data.size(); offset += CHUNK_SIZE) {
+        uint32_t committed;
+        CHECK(sendChunk(t, handle, seq++, data, offset, &committed) == Error::NONE);
+        CHECK(committed == std::min<size_t>(offset + CHUNK_SIZE, data.size()));
+    }
+    CHECK(closeFile(t, handle) == Error::NONE);
+    CHECK(t->readFile("/file.bin") == data);
+}
+
+HANDLER_TEST(streamWriteLostChunk) {
+    std::string data = testData(6 * CHUNK_SIZE);
+    Error err = Error::NONE;
+    uint8_t handle = openFile(t, "/file.bin", OpenMode::WRITE, &err);
+    CHECK(err == Error::NONE);
+
+    uint32_t committed = 0;
+    CHECK(sendChunk(t, handle, 0, data, 0, &committed) == Error::NONE);
+    // Chunk 1 is lost, so the rest of the window is rejected...
+    CHECK(sendChunk(t, handle, 2, data, 2 * CHUNK_SIZE, &committed) == Error::OUT_OF_SEQUENCE);
+    CHECK(committed == CHUNK_SIZE);
+    CHECK(sendChunk(t, handle, 3, data, 3 * CHUNK_SIZE, &committed) == Error::OUT_OF_SEQUENCE);
+    CHECK(committed == CHUNK_SIZE);
+
+    // ...and the host resends from the offset in the replies.
+    uint8_t seq = 4;
+    for (uint32_t offset = committed; offset < data.size(); offset += CHUNK_SIZE) {
+        CHECK(sendChunk(t, handle, seq++, data, offset, &committed) == Error::NONE);
+    }
+    CHECK(committed == data.size());
+    CHECK(closeFile(t, handle) == Error::NONE);
+    CHECK(t->readFile("/file.bin") == data);
+}
+
+HANDLER_TEST(streamWriteResentChunk) {
+    std::string data = testData(3 * CHUNK_SIZE);
+    Error err = Error::NONE;
+    uint8_t handle = openFile(t, "/file.bin", OpenMode::WRITE, &err);
+    CHECK(err == Error::NONE);
+
+    uint32_t committed = 0;
+    CHECK(sendChunk(t, handle, 0, data, 0, &committed) == Error::NONE);
+    CHECK(sendChunk(t, handle, 1, data, CHUNK_SIZE, &committed) == Error::NONE);
+    // A chunk which was already written (because its reply was lost) is
+    // written again, which moves the file position back to its end.
+    CHECK(sendChunk(t, handle, 2, data, 0, &committed) == Error::NONE);
+    CHECK(committed == CHUNK_SIZE);
+    CHECK(sendChunk(t, handle, 3, data, 2 * CHUNK_SIZE, &committed) == Error::OUT_OF_SEQUENCE);
+    CHECK(sendChunk(t, handle, 4, data, committed, &committed) == Error::NONE);
+    CHECK(sendChunk(t, handle, 5, data, committed, &committed) == Error::NONE);
+    CHECK(committed == data.size());
+    CHECK(closeFile(t, handle) == Error::NONE);
+    CHECK(t->readFile("/file.bin") == data);
+}
+
+HANDLER_TEST(streamWriteInvalidHandle) {
+    std::string data = testData(CHUNK_SIZE);
+    uint32_t committed = 0;
+    CHECK(sendChunk(t, 3, 0, data, 0, &committed) == Error::INVALID_HANDLE);
+}
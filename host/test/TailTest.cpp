@@ -0,0 +1,173 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   TailTest.cpp
+ *
+ *   @brief  Tests for TAIL.
+ *
+ ****************************************************************************/
+
+#include <string>
+
+#include "HandlerTest.h"
+#include "Unpacker.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using TailFlags = LittleFsPacketHandler::TailFlags;
+
+//! Contents of a TAIL response, or of a packet sent by run().
+struct TailData {
+    Error err = Error::NONE;  //!< Error code.
+    uint8_t watch = 0;        //!< Watch the data is for.
+    uint32_t offset = 0;      //!< File offset of the data.
+    uint32_t size = 0;        //!< Size of the file.
+    std::string data;         //!< Data from the file.
+};
+
+//! @returns The contents of a TAIL packet.
+static TailData tailData(Packet const& pkt  //!< [in] Packet to decode.
+) {
+    Unpacker unpacker(pkt);
+    TailData tail;
+    uint8_t err = 0;
+    unpacker.unpack(&err);
+    unpacker.unpack(&tail.watch);
+    unpacker.unpack(&tail.offset);
+    unpacker.unpack(&tail.size);
+    tail.err = static_cast<Error>(err);
+    size_t headerLen = 10;
+    if (pkt.getDataLength() > headerLen) {
+        tail.data = std::string(
+            reinterpret_cast<char const*>(pkt.getData()) + headerLen,
+            pkt.getDataLength() - headerLen);
+    }
+    return tail;
+}
+
+//! Sends a TAIL command for an existing watch.
+//! @returns The reply.
+static TailData tail(
+    HandlerTest* t,        //!< [mod] Handler to send the command to.
+    uint8_t watch,         //!< [in] Watch returned by startTail.
+    uint8_t flags = 0,     //!< [in] TailFlags.
+    uint16_t maxBytes = 0  //!< [in] Most data to send in each packet.
+) {
+    Packet& cmd = t->command(Command::TAIL);
+    cmd.appendByte(watch);
+    cmd.appendByte(flags);
+    cmd.append(static_cast<uint16_t>(0));
+    cmd.append(maxBytes);
+    t->call();
+    return tailData(t->reply());
+}
+
+//! Starts watching a file, sending new data on every run().
+//! @returns The reply.
+static TailData startTail(
+    HandlerTest* t,        //!< [mod] Handler to send the command to.
+    char const* filename,  //!< [in] File to watch.
+    uint32_t back,         //!< [in] Bytes before the end of the file to start from.
+    uint16_t maxBytes = 0  //!< [in] Most data to send in each packet.
+) {
+    Packet& cmd = t->command(Command::TAIL);
+    cmd.appendByte(LittleFsPacketHandler::NO_CURSOR);
+    cmd.appendByte(0);
+    cmd.append(static_cast<uint16_t>(0));
+    cmd.append(maxBytes);
+    cmd.append(filename);
+    cmd.append(back);
+    t->call();
+    return tailData(t->reply());
+}
+
+//! Appends data to a file directly in the file system.
+static void appendFile(
+    HandlerTest* t,          //!< [mod] Test whose file system has the file.
+    char const* path,        //!< [in] File to add to.
+    std::string const& data  //!< [in] Data to add.
+) {
+    File file = t->fs().open(path, FILE_APPEND);
+    file.write(reinterpret_cast<uint8_t const*>(data.data()), data.size());
+    file.close();
+}
+
+HANDLER_TEST(tailSendsAppendedData) {
+    t->writeFile("/log", "hello");
+    TailData start = startTail(t, "/log", LittleFsPacketHandler::TO_END_OF_FILE);
+    CHECK(start.err == Error::NONE);
+    CHECK(start.watch != LittleFsPacketHandler::NO_CURSOR);
+    CHECK(start.offset == 0);
+    CHECK(start.size == 5);
+
+    CHECK(t->run() == 1);
+    TailData first = tailData(t->response(0));
+    CHECK(first.err == Error::NONE);
+    CHECK(first.watch == start.watch);
+    CHECK(first.offset == 0);
+    CHECK(first.data == "hello");
+
+    // Nothing is sent until the file grows.
+    CHECK(t->run() == 0);
+    appendFile(t, "/log", " world");
+    CHECK(t->run() == 1);
+    TailData next = tailData(t->response(0));
+    CHECK(next.offset == 5);
+    CHECK(next.size == 11);
+    CHECK(next.data == " world");
+}
+
+HANDLER_TEST(tailStartsBeforeEnd) {
+    t->writeFile("/log", "0123456789");
+    TailData start = startTail(t, "/log", 3);
+    CHECK(start.offset == 7);
+    CHECK(t->run() == 1);
+    CHECK(tailData(t->response(0)).data == "789");
+}
+
+HANDLER_TEST(tailMaxBytes) {
+    t->writeFile("/log", "abcde");
+    TailData start = startTail(t, "/log", LittleFsPacketHandler::TO_END_OF_FILE, 2);
+    std::string received;
+    for (int i = 0; i < 3; i++) {
+        CHECK(t->run() == 1);
+        TailData data = tailData(t->response(0));
+        CHECK(data.offset == received.size());
+        CHECK(data.data.size() <= 2);
+        received += data.data;
+    }
+    CHECK(received == "abcde");
+    CHECK(t->run() == 0);
+    CHECK(tail(t, start.watch).err == Error::NONE);
+}
+
+HANDLER_TEST(tailResendsTruncatedFile) {
+    t->writeFile("/log", "a long line");
+    startTail(t, "/log", LittleFsPacketHandler::TO_END_OF_FILE);
+    CHECK(t->run() == 1);
+    t->writeFile("/log", "new");
+    CHECK(t->run() == 1);
+    TailData data = tailData(t->response(0));
+    CHECK(data.offset == 0);
+    CHECK(data.data == "new");
+}
+
+HANDLER_TEST(tailStop) {
+    t->writeFile("/log", "data");
+    TailData start = startTail(t, "/log", 0);
+    CHECK(tail(t, start.watch, TailFlags::STOP).watch == LittleFsPacketHandler::NO_CURSOR);
+    appendFile(t, "/log", "more");
+    CHECK(t->run() == 0);
+    CHECK(tail(t, start.watch).err == Error::INVALID_CURSOR);
+}
+
+HANDLER_TEST(tailMissingFile) {
+    CHECK(startTail(t, "/missing", 0).err == Error::UNABLE_TO_OPEN_FILE);
+}
@@ -0,0 +1,201 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   UploadTest.cpp
+ *
+ *   @brief  Tests for resumable uploads (UPLOAD_BEGIN and UPLOAD_COMMIT).
+ *
+ ****************************************************************************/
+
+#include <string>
+
+#include "Crc32.h"
+#include "HandlerTest.h"
+#include "Unpacker.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using UploadFlags = LittleFsPacketHandler::UploadFlags;
+
+//! Name of the file that the tests upload.
+static char const FILENAME[] = "/fw.bin";
+
+//! Name of the temporary file which holds the upload.
+static char const TEMP_FILENAME[] = "/.fw.bin.upload";
+
+//! Reply to UPLOAD_BEGIN.
+struct UploadSession {
+    Error err = Error::NONE;  //!< Error code.
+    uint8_t handle = 0;       //!< Handle to send the data to.
+    uint32_t committed = 0;   //!< Number of bytes already uploaded.
+    uint32_t crc = 0;         //!< CRC-32 of the bytes already uploaded.
+};
+
+//! @returns Data which is different at every offset that the tests use.
+static std::string testData(size_t len  //!< [in] Number of bytes to make.
+) {
+    std::string data;
+    for (size_t i = 0; i < len; i++) {
+        data += static_cast<char>(i * 13 + i / 256);
+    }
+    return data;
+}
+
+//! @returns The CRC-32 of the start of data.
+static uint32_t crcOf(
+    std::string const& data,  //!< [in] Data to check.
+    size_t len                //!< [in] Number of bytes to include.
+) {
+    Crc32 crc;
+    crc.update(reinterpret_cast<uint8_t const*>(data.data()), len);
+    return crc.value();
+}
+
+//! Starts an upload using UPLOAD_BEGIN.
+static UploadSession beginUpload(
+    HandlerTest* t,  //!< [mod] Handler to send the command to.
+    uint8_t flags    //!< [in] UploadFlags.
+) {
+    Packet& cmd = t->command(Command::UPLOAD_BEGIN);
+    cmd.appendByte(flags);
+    cmd.append(FILENAME);
+    t->call();
+    Unpacker unpacker(t->reply());
+    UploadSession session;
+    uint8_t err = 0;
+    unpacker.unpack(&err);
+    unpacker.unpack(&session.handle);
+    unpacker.unpack(&session.committed);
+    unpacker.unpack(&session.crc);
+    session.err = static_cast<Error>(err);
+    return session;
+}
+
+//! Sends part of data to an upload using WRITE_HANDLE.
+//! @returns The error returned by WRITE_HANDLE.
+static Error sendData(
+    HandlerTest* t,           //!< [mod] Handler to send the command to.
+    uint8_t handle,           //!< [in] Handle returned by UPLOAD_BEGIN.
+    std::string const& data,  //!< [in] Whole contents of the file.
+    uint32_t offset,          //!< [in] Offset of the part to send.
+    uint32_t length           //!< [in] Number of bytes to send.
+) {
+    Packet& cmd = t->command(Command::WRITE_HANDLE);
+    cmd.appendByte(handle);
+    cmd.append(offset);
+    cmd.append(length);
+    cmd.appendData(length, &data[offset]);
+    return t->callForError();
+}
+
+//! Finishes an upload using UPLOAD_COMMIT.
+//! @returns The error returned by UPLOAD_COMMIT.
+static Error commitUpload(
+    HandlerTest* t,  //!< [mod] Handler to send the command to.
+    uint8_t handle,  //!< [in] Handle returned by UPLOAD_BEGIN.
+    uint8_t flags,   //!< [in] UploadFlags.
+    uint32_t length  //!< [in] Length of the complete file.
+) {
+    Packet& cmd = t->command(Command::UPLOAD_COMMIT);
+    cmd.appendByte(handle);
+    cmd.appendByte(flags);
+    cmd.append(length);
+    return t->callForError();
+}
+
+//! Closes a handle using the CLOSE command, like a host which lost the link
+//! part way through an upload.
+//! @returns The error returned by CLOSE.
+static Error closeHandle(
+    HandlerTest* t,  //!< [mod] Handler to send the command to.
+    uint8_t handle   //!< [in] Handle to close.
+) {
+    Packet& cmd = t->command(Command::CLOSE);
+    cmd.appendByte(handle);
+    return t->callForError();
+}
+
+HANDLER_TEST(uploadInOneSession) {
+    std::string data = testData(3000);
+    t->writeFile(FILENAME, "old");
+    UploadSession session = beginUpload(t, 0);
+    CHECK(session.err == Error::NONE);
+    CHECK(session.committed == 0);
+    CHECK(sendData(t, session.handle, data, 0, 2000) == Error::NONE);
+    // The file isn't replaced until the upload is committed.
+    CHECK(t->readFile(FILENAME) == "old");
+    CHECK(sendData(t, session.handle, data, 2000, 1000) == Error::NONE);
+    CHECK(commitUpload(t, session.handle, 0, data.size()) == Error::NONE);
+    CHECK(t->readFile(FILENAME) == data);
+    CHECK(!t->fs().exists(TEMP_FILENAME));
+}
+
+HANDLER_TEST(uploadResume) {
+    std::string data = testData(5000);
+    UploadSession first = beginUpload(t, UploadFlags::RESUME);
+    CHECK(first.err == Error::NONE);
+    CHECK(first.committed == 0);
+    CHECK(sendData(t, first.handle, data, 0, 1500) == Error::NONE);
+    CHECK(sendData(t, first.handle, data, 1500, 1500) == Error::NONE);
+    CHECK(closeHandle(t, first.handle) == Error::NONE);
+    CHECK(t->fs().exists(TEMP_FILENAME));
+
+    // The new session carries on from the end of the temporary file, and
+    // the CRC lets the host check that it came from the same data.
+    UploadSession second = beginUpload(t, UploadFlags::RESUME);
+    CHECK(second.err == Error::NONE);
+    CHECK(second.committed == 3000);
+    CHECK(second.crc == crcOf(data, 3000));
+    CHECK(sendData(t, second.handle, data, second.committed, data.size() - second.committed) ==
+          Error::NONE);
+    CHECK(commitUpload(t, second.handle, 0, data.size()) == Error::NONE);
+    CHECK(t->readFile(FILENAME) == data);
+    CHECK(!t->fs().exists(TEMP_FILENAME));
+}
+
+HANDLER_TEST(uploadWithoutResumeStartsAgain) {
+    std::string data = testData(2000);
+    UploadSession first = beginUpload(t, 0);
+    CHECK(sendData(t, first.handle, data, 0, 1000) == Error::NONE);
+    CHECK(closeHandle(t, first.handle) == Error::NONE);
+
+    UploadSession second = beginUpload(t, 0);
+    CHECK(second.err == Error::NONE);
+    CHECK(second.committed == 0);
+    CHECK(second.crc == crcOf(data, 0));
+    CHECK(commitUpload(t, second.handle, UploadFlags::ABORT, 0) == Error::NONE);
+}
+
+HANDLER_TEST(uploadShortCommitKeepsData) {
+    std::string data = testData(4000);
+    UploadSession session = beginUpload(t, 0);
+    CHECK(sendData(t, session.handle, data, 0, 2500) == Error::NONE);
+    CHECK(commitUpload(t, session.handle, 0, data.size()) == Error::VERIFY_FAILED);
+    CHECK(!t->fs().exists(FILENAME));
+    CHECK(t->fs().exists(TEMP_FILENAME));
+
+    // The handle was closed, but the upload can still be resumed.
+    CHECK(commitUpload(t, session.handle, 0, data.size()) == Error::INVALID_HANDLE);
+    UploadSession resumed = beginUpload(t, UploadFlags::RESUME);
+    CHECK(resumed.committed == 2500);
+    CHECK(sendData(t, resumed.handle, data, 2500, 1500) == Error::NONE);
+    CHECK(commitUpload(t, resumed.handle, 0, data.size()) == Error::NONE);
+    CHECK(t->readFile(FILENAME) == data);
+}
+
+HANDLER_TEST(uploadAbort) {
+    std::string data = testData(1000);
+    t->writeFile(FILENAME, "old");
+    UploadSession session = beginUpload(t, 0);
+    CHECK(sendData(t, session.handle, data, 0, 1000) == Error::NONE);
+    CHECK(commitUpload(t, session.handle, UploadFlags::ABORT, 0) == Error::NONE);
+    CHECK(t->readFile(FILENAME) == "old");
+    CHECK(!t->fs().exists(TEMP_FILENAME));
+}
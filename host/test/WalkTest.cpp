@@ -0,0 +1,137 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   WalkTest.cpp
+ *
+ *   @brief  Tests for WALK.
+ *
+ ****************************************************************************/
+
+#include <set>
+#include <string>
+
+#include "HandlerTest.h"
+#include "Unpacker.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+using Flags = LittleFsPacketHandler::Flags;
+
+//! Creates the directory tree which the tests walk.
+static void makeTree(HandlerTest* t  //!< [mod] Test whose file system gets the files.
+) {
+    t->fs().mkdir("/w");
+    t->fs().mkdir("/w/sub");
+    t->fs().mkdir("/w/sub/deep");
+    t->writeFile("/w/a.txt", "a");
+    t->writeFile("/w/b.log", "bb");
+    t->writeFile("/w/sub/c.txt", "ccc");
+    t->writeFile("/w/sub/deep/d.txt", "dddd");
+}
+
+//! Walks a directory, one response at a time.
+//! @returns The error code from the first response which had one.
+static Error walk(
+    HandlerTest* t,                //!< [mod] Handler to send the commands to.
+    char const* dirName,           //!< [in] Directory to walk.
+    uint8_t maxDepth,              //!< [in] Deepest level to list (0 for all).
+    char const* pattern,           //!< [in] Glob pattern (empty for everything).
+    std::set<std::string>* paths,  //!< [out] Paths of the entries found.
+    std::set<std::string>* dirs    //!< [out] Paths of the directories found.
+) {
+    uint8_t cursor = LittleFsPacketHandler::NO_CURSOR;
+    for (int i = 0; i < 100; i++) {
+        Packet& cmd = t->command(Command::WALK);
+        cmd.appendByte(cursor);
+        cmd.appendByte(1);
+        if (cursor == LittleFsPacketHandler::NO_CURSOR) {
+            cmd.append(dirName);
+            cmd.appendByte(maxDepth);
+            cmd.append(pattern);
+        }
+        t->call();
+        Unpacker unpacker(t->reply());
+        uint8_t err = 0;
+        uint8_t streamFlags = 0;
+        uint8_t seq = 0;
+        unpacker.unpack(&err);
+        unpacker.unpack(&streamFlags);
+        unpacker.unpack(&seq);
+        unpacker.unpack(&cursor);
+        if (err != 0) {
+            return static_cast<Error>(err);
+        }
+        uint8_t flags;
+        while (unpacker.unpack(&flags)) {
+            uint32_t size = 0;
+            uint32_t timestamp = 0;
+            char const* path = nullptr;
+            unpacker.unpack(&size);
+            unpacker.unpack(&timestamp);
+            unpacker.unpack(&path);
+            paths->insert(path);
+            if ((flags & Flags::DIR) != 0) {
+                dirs->insert(path);
+            }
+        }
+        if (cursor == LittleFsPacketHandler::NO_CURSOR) {
+            break;
+        }
+    }
+    return Error::NONE;
+}
+
+HANDLER_TEST(walkListsEverything) {
+    makeTree(t);
+    std::set<std::string> paths;
+    std::set<std::string> dirs;
+    CHECK(walk(t, "/w", 0, "", &paths, &dirs) == Error::NONE);
+    CHECK(paths == std::set<std::string>({"a.txt", "b.log", "sub", "sub/c.txt", "sub/deep",
+                                          "sub/deep/d.txt"}));
+    CHECK(dirs == std::set<std::string>({"sub", "sub/deep"}));
+}
+
+HANDLER_TEST(walkMaxDepth) {
+    makeTree(t);
+    std::set<std::string> paths;
+    std::set<std::string> dirs;
+    CHECK(walk(t, "/w", 1, "", &paths, &dirs) == Error::NONE);
+    CHECK(paths == std::set<std::string>({"a.txt", "b.log", "sub"}));
+}
+
+HANDLER_TEST(walkPatterns) {
+    makeTree(t);
+    std::set<std::string> paths;
+    std::set<std::string> dirs;
+    CHECK(walk(t, "/w", 0, "*.txt", &paths, &dirs) == Error::NONE);
+    CHECK(paths == std::set<std::string>({"a.txt", "sub/c.txt", "sub/deep/d.txt"}));
+
+    // A pattern with a slash matches the whole relative path, and * matches
+    // slashes too.
+    paths.clear();
+    CHECK(walk(t, "/w", 0, "sub/?.txt", &paths, &dirs) == Error::NONE);
+    CHECK(paths == std::set<std::string>({"sub/c.txt"}));
+    paths.clear();
+    CHECK(walk(t, "/w", 0, "sub/*.txt", &paths, &dirs) == Error::NONE);
+    CHECK(paths == std::set<std::string>({"sub/c.txt", "sub/deep/d.txt"}));
+}
+
+HANDLER_TEST(walkErrors) {
+    makeTree(t);
+    std::set<std::string> paths;
+    std::set<std::string> dirs;
+    CHECK(walk(t, "/missing", 0, "", &paths, &dirs) == Error::UNABLE_TO_OPEN_FILE);
+    CHECK(walk(t, "/w/a.txt", 0, "", &paths, &dirs) == Error::UNABLE_TO_OPEN_FILE);
+
+    Packet& cmd = t->command(Command::WALK);
+    cmd.appendByte(42);
+    cmd.appendByte(1);
+    CHECK(t->callForError() == Error::INVALID_CURSOR);
+}
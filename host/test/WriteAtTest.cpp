@@ -0,0 +1,130 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   WriteAtTest.cpp
+ *
+ *   @brief  Tests for WRITE_AT and TRUNCATE.
+ *
+ ****************************************************************************/
+
+#include <string>
+
+#include "HandlerTest.h"
+#include "Unpacker.h"
+
+using Command = LittleFsPacketHandler::Command;
+using Error = LittleFsPacketHandler::Error;
+
+//! Sends a WRITE_AT command.
+//! @returns The error code, and stores the size of the file in size.
+static Error writeAt(
+    HandlerTest* t,           //!< [mod] Handler to send the command to.
+    char const* filename,     //!< [in] File to write to.
+    uint32_t offset,          //!< [in] Where to write the data.
+    std::string const& data,  //!< [in] Data to write.
+    uint32_t* size            //!< [out] Size of the file afterwards.
+) {
+    Packet& cmd = t->command(Command::WRITE_AT);
+    cmd.append(filename);
+    cmd.append(offset);
+    cmd.append(static_cast<uint32_t>(data.size()));
+    cmd.appendData(data.size(), data.data());
+    t->call();
+    Unpacker unpacker(t->reply());
+    uint8_t err = 0;
+    unpacker.unpack(&err);
+    unpacker.unpack(size);
+    return static_cast<Error>(err);
+}
+
+//! Sends a TRUNCATE command.
+//! @returns The error code.
+static Error truncate(
+    HandlerTest* t,        //!< [mod] Handler to send the command to.
+    char const* filename,  //!< [in] File to change the length of.
+    uint32_t length        //!< [in] New length of the file.
+) {
+    Packet& cmd = t->command(Command::TRUNCATE);
+    cmd.append(filename);
+    cmd.append(length);
+    return t->callForError();
+}
+
+HANDLER_TEST(writeAtOverwrites) {
+    t->writeFile("/f", "0123456789");
+    uint32_t size = 0;
+    CHECK(writeAt(t, "/f", 3, "abc", &size) == Error::NONE);
+    CHECK(size == 10);
+    CHECK(t->readFile("/f") == "012abc6789");
+
+    CHECK(writeAt(t, "/f", 8, "XYZ", &size) == Error::NONE);
+    CHECK(size == 11);
+    CHECK(t->readFile("/f") == "012abc67XYZ");
+}
+
+HANDLER_TEST(writeAtMissingFile) {
+    uint32_t size = 0;
+    CHECK(writeAt(t, "/missing", 0, "abc", &size) == Error::UNABLE_TO_OPEN_FILE);
+    CHECK(!t->fs().exists("/missing"));
+}
+
+HANDLER_TEST(writeAtSeesCachedReads) {
+    t->writeFile("/f", "0123456789");
+    Packet& cmd = t->command(Command::READ);
+    cmd.append("/f");
+    cmd.append(static_cast<uint32_t>(0));
+    cmd.append(static_cast<uint32_t>(4));
+    CHECK(t->callForError() == Error::NONE);
+
+    uint32_t size = 0;
+    CHECK(writeAt(t, "/f", 0, "ab", &size) == Error::NONE);
+    Packet& read = t->command(Command::READ);
+    read.append("/f");
+    read.append(static_cast<uint32_t>(0));
+    read.append(static_cast<uint32_t>(4));
+    t->call();
+    Unpacker unpacker(t->reply());
+    uint8_t err = 0;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    uint8_t const* data = nullptr;
+    unpacker.unpack(&err);
+    unpacker.unpack(&offset);
+    unpacker.unpack(&length);
+    unpacker.unpack(length, &data);
+    CHECK(std::string(reinterpret_cast<char const*>(data), length) == "ab23");
+}
+
+HANDLER_TEST(truncateShrinks) {
+    t->writeFile("/f", "0123456789");
+    CHECK(truncate(t, "/f", 4) == Error::NONE);
+    CHECK(t->readFile("/f") == "0123");
+    CHECK(truncate(t, "/f", 0) == Error::NONE);
+    CHECK(t->fs().exists("/f"));
+    CHECK(t->readFile("/f").empty());
+}
+
+HANDLER_TEST(truncateExtendsWithZeros) {
+    t->writeFile("/f", "abc");
+    CHECK(truncate(t, "/f", 6) == Error::NONE);
+    CHECK(t->readFile("/f") == std::string("abc\0\0\0", 6));
+
+    // Missing files are created.
+    CHECK(truncate(t, "/new", 3) == Error::NONE);
+    CHECK(t->readFile("/new") == std::string(3, '\0'));
+    uint32_t size = 0;
+    CHECK(writeAt(t, "/new", 1, "x", &size) == Error::NONE);
+    CHECK(t->readFile("/new") == std::string("\0x\0", 3));
+}
+
+HANDLER_TEST(truncateDirectory) {
+    t->fs().mkdir("/d");
+    CHECK(truncate(t, "/d", 0) == Error::UNABLE_TO_OPEN_FILE);
+}
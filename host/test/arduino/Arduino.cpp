@@ -0,0 +1,39 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   Arduino.cpp
+ *
+ *   @brief  Host versions of the Arduino functions which the library uses.
+ *
+ ****************************************************************************/
+
+#include "Arduino.h"
+
+#include <chrono>
+
+#include "LittleFS.h"
+
+fs::LittleFSFS LittleFS;
+
+//! @returns The time since the program started.
+template <typename Duration>
+static uint32_t elapsed() {
+    static auto const start = std::chrono::steady_clock::now();
+    return static_cast<uint32_t>(
+        std::chrono::duration_cast<Duration>(std::chrono::steady_clock::now() - start).count());
+}
+
+uint32_t millis() {
+    return elapsed<std::chrono::milliseconds>();
+}
+
+uint32_t micros() {
+    return elapsed<std::chrono::microseconds>();
+}
@@ -0,0 +1,50 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   Arduino.h
+ *
+ *   @brief  The parts of the Arduino API which the library uses, so that the
+ *           packet handler can be tested on the host.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+//! Arduino's name for bool.
+typedef bool boolean;
+
+//! @returns The number of milliseconds since the program started.
+uint32_t millis();
+
+//! @returns The number of microseconds since the program started.
+uint32_t micros();
+
+//! Just enough of Arduino's String for the FileImpl interface.
+class String {
+ public:
+    //! Constructor.
+    String(char const* str = ""  //!< [in] Initial contents.
+           )
+        : m_str{str} {}
+
+    //! @returns The contents as a null terminated string.
+    char const* c_str() const { return this->m_str.c_str(); }
+
+    //! @returns The number of characters in the string.
+    size_t length() const { return this->m_str.length(); }
+
+ private:
+    std::string m_str;  //!< Contents of the string.
+};
@@ -0,0 +1,152 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   FS.h
+ *
+ *   @brief  A host version of the ESP32 core's fs::FS and fs::File, which
+ *           forward to an fs::FSImpl (like RamFs) in the same way.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <ctime>
+#include <memory>
+
+#include "Arduino.h"
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+//! Where File::seek measures the position from.
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+class FileImpl;
+using FileImplPtr = std::shared_ptr<FileImpl>;
+
+//! An open file or directory, implemented by a file system.
+class FileImpl {
+ public:
+    virtual ~FileImpl() {}
+    virtual size_t write(uint8_t const* buf, size_t size) = 0;
+    virtual size_t read(uint8_t* buf, size_t size) = 0;
+    virtual void flush() = 0;
+    virtual bool seek(uint32_t pos, SeekMode mode) = 0;
+    virtual size_t position() const = 0;
+    virtual size_t size() const = 0;
+    virtual bool setBufferSize(size_t size) = 0;
+    virtual void close() = 0;
+    virtual time_t getLastWrite() = 0;
+    virtual char const* path() const = 0;
+    virtual char const* name() const = 0;
+    virtual boolean isDirectory() = 0;
+    virtual FileImplPtr openNextFile(char const* mode) = 0;
+    virtual boolean seekDir(long position) = 0;
+    virtual String getNextFileName() = 0;
+    virtual String getNextFileName(bool* isDir) = 0;
+    virtual void rewindDirectory() = 0;
+    virtual operator bool() = 0;
+};
+
+//! Handle to an open file or directory (closed if it has no FileImpl).
+class File {
+ public:
+    File(FileImplPtr impl = FileImplPtr()) : m_impl{impl} {}
+
+    size_t write(uint8_t const* buf, size_t size) {
+        return this->m_impl ? this->m_impl->write(buf, size) : 0;
+    }
+    size_t read(uint8_t* buf, size_t size) {
+        return this->m_impl ? this->m_impl->read(buf, size) : 0;
+    }
+    int read() {
+        uint8_t byte;
+        return (this->read(&byte, 1) == 1) ? byte : -1;
+    }
+    int available() {
+        return this->m_impl ? static_cast<int>(this->size() - this->position()) : 0;
+    }
+    void flush() {
+        if (this->m_impl) {
+            this->m_impl->flush();
+        }
+    }
+    bool seek(uint32_t pos, SeekMode mode) { return this->m_impl && this->m_impl->seek(pos, mode); }
+    bool seek(uint32_t pos) { return this->seek(pos, SeekSet); }
+    size_t position() const { return this->m_impl ? this->m_impl->position() : 0; }
+    size_t size() const { return this->m_impl ? this->m_impl->size() : 0; }
+    bool setBufferSize(size_t size) { return this->m_impl && this->m_impl->setBufferSize(size); }
+    void close() {
+        if (this->m_impl) {
+            this->m_impl->close();
+            this->m_impl = nullptr;
+        }
+    }
+    operator bool() const { return this->m_impl && *this->m_impl; }
+    time_t getLastWrite() { return this->m_impl ? this->m_impl->getLastWrite() : 0; }
+    char const* path() const { return this->m_impl ? this->m_impl->path() : nullptr; }
+    char const* name() const { return this->m_impl ? this->m_impl->name() : nullptr; }
+    boolean isDirectory() { return this->m_impl && this->m_impl->isDirectory(); }
+    File openNextFile(char const* mode = FILE_READ) {
+        return this->m_impl ? File(this->m_impl->openNextFile(mode)) : File();
+    }
+    void rewindDirectory() {
+        if (this->m_impl) {
+            this->m_impl->rewindDirectory();
+        }
+    }
+
+ private:
+    FileImplPtr m_impl;  //!< The open file (nullptr if closed).
+};
+
+//! A file system implementation, used by FS.
+class FSImpl {
+ public:
+    virtual ~FSImpl() {}
+    virtual FileImplPtr open(char const* path, char const* mode, bool const create) = 0;
+    virtual bool exists(char const* path) = 0;
+    virtual bool rename(char const* pathFrom, char const* pathTo) = 0;
+    virtual bool remove(char const* path) = 0;
+    virtual bool mkdir(char const* path) = 0;
+    virtual bool rmdir(char const* path) = 0;
+};
+using FSImplPtr = std::shared_ptr<FSImpl>;
+
+//! A file system, which forwards everything to its FSImpl.
+class FS {
+ public:
+    FS(FSImplPtr impl) : _impl{impl} {}
+
+    File open(char const* path, char const* mode = FILE_READ, bool const create = false) {
+        return File(this->_impl->open(path, mode, create));
+    }
+    bool exists(char const* path) { return this->_impl->exists(path); }
+    bool remove(char const* path) { return this->_impl->remove(path); }
+    bool rename(char const* pathFrom, char const* pathTo) {
+        return this->_impl->rename(pathFrom, pathTo);
+    }
+    bool mkdir(char const* path) { return this->_impl->mkdir(path); }
+    bool rmdir(char const* path) { return this->_impl->rmdir(path); }
+
+ protected:
+    FSImplPtr _impl;  //!< Implementation (named like the ESP32 core's).
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FS;
+using fs::SeekCur;
+using fs::SeekEnd;
+using fs::SeekSet;
@@ -0,0 +1,32 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   LittleFS.h
+ *
+ *   @brief  The global LittleFS object, which is a RamFs on the host.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include "RamFs.h"
+
+namespace fs {
+
+//! Stands in for the ESP32 core's LittleFS, which the packet handler uses
+//! when it isn't given a backend.
+class LittleFSFS : public RamFs {
+ public:
+    LittleFSFS() : RamFs{256 * 1024} {}
+};
+
+}  // namespace fs
+
+extern fs::LittleFSFS LittleFS;
@@ -0,0 +1,48 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   lfs_tests.cpp
+ *
+ *   @brief  Runs the packet handler tests on the host.
+ *
+ ****************************************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include "HandlerTest.h"
+
+int main(int argc, char** argv) {
+    // Any arguments pick the tests to run by name.
+    int numRun = 0;
+    int numFailed = 0;
+    for (TestCase* test = TestCase::first; test != nullptr; test = test->next) {
+        bool wanted = (argc <= 1);
+        for (int arg = 1; arg < argc; arg++) {
+            if (strcmp(argv[arg], test->name) == 0) {
+                wanted = true;
+            }
+        }
+        if (!wanted) {
+            continue;
+        }
+        // The handler and its buffers are too big for the stack.
+        std::unique_ptr<HandlerTest> t{new HandlerTest()};
+        test->run(t.get());
+        numRun++;
+        if (t->failed()) {
+            numFailed++;
+        }
+        printf("%-30s %s\n", test->name, t->failed() ? "FAILED" : "ok");
+    }
+    printf("%d of %d tests passed\n", numRun - numFailed, numRun);
+    return (numFailed == 0 && numRun > 0) ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   Crc32.cpp
+ *
+ *   @brief  Calculates the CRC-32 (as used by zlib/Ethernet) of some data.
+ *
+ ****************************************************************************/
+
+#include "Crc32.h"
+
+//! CRC of each 4-bit value using the reflected polynomial 0xEDB88320. Using
+//! a nibble table keeps the table small, at the cost of 2 lookups per byte.
+static constexpr uint32_t CRC_TABLE[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+    0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+void Crc32::update(void const* data, size_t len) {
+    uint8_t const* bytes = static_cast<uint8_t const*>(data);
+    uint32_t crc = this->m_crc;
+    while (len-- > 0) {
+        uint8_t byte = *bytes++;
+        crc = CRC_TABLE[(crc ^ byte) & 0x0f] ^ (crc >> 4);
+        crc = CRC_TABLE[(crc ^ (byte >> 4)) & 0x0f] ^ (crc >> 4);
+    }
+    this->m_crc = crc;
+}
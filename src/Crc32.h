@@ -0,0 +1,40 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   Crc32.h
+ *
+ *   @brief  Calculates the CRC-32 (as used by zlib/Ethernet) of some data.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+//! Incrementally calculates a CRC-32.
+//! The result matches zlib.crc32 and binascii.crc32 in Python.
+class Crc32 {
+ public:
+    //! Starts a new CRC calculation.
+    void reset() { this->m_crc = 0xffffffff; }
+
+    //! Adds some data to the CRC.
+    void update(
+        void const* data,  //!< [in] Data to add.
+        size_t len         //!< [in] Number of bytes of data.
+    );
+
+    //! @returns The CRC of all of the data added since the last reset.
+    uint32_t value() const { return ~this->m_crc; }
+
+ private:
+    uint32_t m_crc = 0xffffffff;  //!< CRC calculated so far (not inverted).
+};
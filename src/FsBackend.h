@@ -0,0 +1,123 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   FsBackend.h
+ *
+ *   @brief  File systems which LittleFsPacketHandler can give the host access to.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cinttypes>
+
+#include "FS.h"
+
+//! A file system which LittleFsPacketHandler gives the host access to.
+//!
+//! fs::FS covers opening, removing and renaming files, but not the size of
+//! the file system, formatting it or garbage collecting it, so backends which
+//! support those override the virtual functions.
+class FsBackend {
+ public:
+    //! Constructor.
+    explicit FsBackend(fs::FS& fs  //!< [in] File system to use (must outlive the backend).
+                       )
+        : m_fs{fs} {}
+
+    virtual ~FsBackend() = default;
+
+    //! @returns The file system.
+    fs::FS& fs() { return this->m_fs; }
+
+    //! @returns The total number of bytes in the file system (0 if unknown).
+    virtual uint32_t totalBytes() { return 0; }
+
+    //! @returns The number of bytes in use (0 if unknown).
+    virtual uint32_t usedBytes() { return 0; }
+
+    //! Erases everything in the file system.
+    //! @returns true if the file system was formatted.
+    virtual bool format() { return false; }
+
+    //! @returns true if gc does anything for this file system.
+    virtual bool canGc() { return false; }
+
+    //! Does the garbage collection that the file system would otherwise do in
+    //! the middle of a write (like compacting metadata and erasing free
+    //! blocks), so that later writes don't stall.
+    //! @returns true if the garbage collection succeeded.
+    virtual bool gc() { return false; }
+
+ protected:
+    //! @returns value clamped to fit in a u32 (SD reports sizes as 64 bits).
+    template <typename T>
+    static uint32_t clampSize(T value) {
+        return (value > static_cast<T>(UINT32_MAX)) ? UINT32_MAX : static_cast<uint32_t>(value);
+    }
+
+ private:
+    fs::FS& m_fs;  //!< File system to use.
+};
+
+//! Backend for a file system which can report its size, like SD, SPIFFS,
+//! FFat and LittleFS.
+template <typename FsT>
+class SizedFsBackend : public FsBackend {
+ public:
+    //! Constructor.
+    explicit SizedFsBackend(FsT& fs  //!< [in] File system to use (must outlive the backend).
+                            )
+        : FsBackend{fs}, m_sizedFs{fs} {}
+
+    uint32_t totalBytes() override { return clampSize(this->m_sizedFs.totalBytes()); }
+
+    uint32_t usedBytes() override { return clampSize(this->m_sizedFs.usedBytes()); }
+
+ protected:
+    FsT& m_sizedFs;  //!< File system to use.
+};
+
+//! Backend for a file system which can also be formatted, like SPIFFS,
+//! FFat, LittleFS and RamFs.
+template <typename FsT>
+class FormattableFsBackend : public SizedFsBackend<FsT> {
+ public:
+    //! Constructor.
+    explicit FormattableFsBackend(FsT& fs  //!< [in] File system to use (must outlive the backend).
+                                  )
+        : SizedFsBackend<FsT>{fs} {}
+
+    bool format() override { return this->m_sizedFs.format(); }
+};
+
+#if defined(LFS_VERSION) && LFS_VERSION >= 0x00020008
+//! Backend for a LittleFS file system whose lfs_t is available, which uses
+//! lfs_fs_gc to do garbage collection ahead of time. The Arduino LittleFS
+//! class doesn't give access to its lfs_t, so this is only available when
+//! lfs.h is included before this file.
+template <typename FsT>
+class LfsBackend : public FormattableFsBackend<FsT> {
+ public:
+    //! Constructor.
+    LfsBackend(
+        FsT& fs,    //!< [in] File system to use (must outlive the backend).
+        lfs_t* lfs  //!< [in] LittleFS instance that fs is mounted with.
+    )
+        : FormattableFsBackend<FsT>{fs}, m_lfs{lfs} {}
+
+    bool canGc() override { return true; }
+
+    bool gc() override { return lfs_fs_gc(this->m_lfs) == 0; }
+
+ private:
+    lfs_t* m_lfs;  //!< LittleFS instance that the file system is mounted with.
+};
+#endif
@@ -0,0 +1,279 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   LittleFsConfig.h
+ *
+ *   @brief  Compile time configuration for the LittleFs packet handler.
+ *
+ *   Each of these may be overridden by defining it before this file is
+ *   included (typically from the build flags).
+ *
+ *   Most of the RAM follows from LITTLEFS_BLOCK_SIZE. With the defaults
+ *   (4K blocks), the handler takes about 23 KB, LittleFsWorker about
+ *   12.5 KB plus its 8 KB stack, and the serial receive buffer sized for
+ *   LITTLEFS_STREAM_WRITE_WINDOW about 16.6 KB. That's over 60 KB with the
+ *   sketch's own packets. The notes on each define give its share.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+//! Maximum length of a path (including the terminating null) which can be
+//! remembered by the packet handler.
+#if !defined(LITTLEFS_MAX_PATH_LEN)
+#define LITTLEFS_MAX_PATH_LEN 64
+#endif
+
+//! Number of open files kept around between READ commands. This is the fixed
+//! pool of File objects which READ, READ_COMPRESSED, HASH and SIGNATURE reuse
+//! instead of opening the file again for each packet. The first open of a
+//! path, writes, OPEN handles and jobs still allocate their File inside the VFS.
+#if !defined(LITTLEFS_FILE_CACHE_SIZE)
+#define LITTLEFS_FILE_CACHE_SIZE 4
+#endif
+
+//! Number of files which can be opened at the same time using the OPEN command.
+#if !defined(LITTLEFS_MAX_OPEN_FILES)
+#define LITTLEFS_MAX_OPEN_FILES 4
+#endif
+
+//! Number of file systems which can be mounted, including the default one.
+#if !defined(LITTLEFS_MAX_MOUNTS)
+#define LITTLEFS_MAX_MOUNTS 4
+#endif
+
+//! Number of LIST_CURSOR directory listings which can be in progress at once.
+#if !defined(LITTLEFS_MAX_DIR_CURSORS)
+#define LITTLEFS_MAX_DIR_CURSORS 2
+#endif
+
+//! Time (in milliseconds) after which an unused LIST_CURSOR cursor is freed.
+#if !defined(LITTLEFS_DIR_CURSOR_TIMEOUT_MSEC)
+#define LITTLEFS_DIR_CURSOR_TIMEOUT_MSEC 10000
+#endif
+
+//! Deepest level of subdirectories that a WALK listing can descend into.
+#if !defined(LITTLEFS_WALK_MAX_DEPTH)
+#define LITTLEFS_WALK_MAX_DEPTH 8
+#endif
+
+//! Longest line returned by SEARCH. Longer lines are split into pieces of
+//! this size, which are matched separately.
+#if !defined(LITTLEFS_SEARCH_MAX_LINE)
+#define LITTLEFS_SEARCH_MAX_LINE 128
+#endif
+
+//! Size of the buffer holding the SEARCH pattern (including the terminating
+//! null).
+#if !defined(LITTLEFS_SEARCH_MAX_PATTERN)
+#define LITTLEFS_SEARCH_MAX_PATTERN 64
+#endif
+
+//! Most lines of context that SEARCH sends before and after each match (the
+//! host can ask for fewer). Must be at least 1. Each line costs
+//! LITTLEFS_SEARCH_MAX_LINE bytes of RAM, held by the handler.
+#if !defined(LITTLEFS_SEARCH_MAX_CONTEXT)
+#define LITTLEFS_SEARCH_MAX_CONTEXT 2
+#endif
+
+//! Number of bytes that SEARCH scans for each response packet, so that the
+//! host hears back regularly when nothing matches.
+#if !defined(LITTLEFS_SEARCH_SLICE_BYTES)
+#define LITTLEFS_SEARCH_SLICE_BYTES (16 * 1024)
+#endif
+
+//! Number of files which can be watched by TAIL at the same time.
+#if !defined(LITTLEFS_MAX_TAILS)
+#define LITTLEFS_MAX_TAILS 2
+#endif
+
+//! Size of the packet that run() sends data appended to a watched file in
+//! (including the 10 bytes before the data).
+#if !defined(LITTLEFS_TAIL_PACKET_SIZE)
+#define LITTLEFS_TAIL_PACKET_SIZE 512
+#endif
+
+//! Time (in milliseconds) without a TAIL command for a watch after which the
+//! watch is stopped.
+#if !defined(LITTLEFS_TAIL_TIMEOUT_MSEC)
+#define LITTLEFS_TAIL_TIMEOUT_MSEC 10000
+#endif
+
+//! Number of paths whose STAT results are remembered, so that repeated stat,
+//! exists and directory size queries don't touch the file system. Each entry
+//! takes 24 bytes. Set to 0 to disable.
+#if !defined(LITTLEFS_META_CACHE_SIZE)
+#define LITTLEFS_META_CACHE_SIZE 16
+#endif
+
+//! Time (in milliseconds) after which metadata cached by STAT is looked up
+//! again, so that changes made by the sketch itself are noticed. Changes made
+//! by the host's commands are noticed straight away.
+#if !defined(LITTLEFS_META_CACHE_MSEC)
+#define LITTLEFS_META_CACHE_MSEC 2000
+#endif
+
+//! Size of the buffer used when the device reads a file by itself (for COPY
+//! and HASH).
+#if !defined(LITTLEFS_IO_BUFFER_SIZE)
+#define LITTLEFS_IO_BUFFER_SIZE 512
+#endif
+
+//! Number of bytes copied between the progress responses sent by COPY.
+#if !defined(LITTLEFS_COPY_PROGRESS_BYTES)
+#define LITTLEFS_COPY_PROGRESS_BYTES (16 * 1024)
+#endif
+
+//! Size of a LittleFS block, reported to the host so that it can pick block
+//! aligned transfer sizes.
+#if !defined(LITTLEFS_BLOCK_SIZE)
+#if defined(CONFIG_LITTLEFS_BLOCK_SIZE)
+#define LITTLEFS_BLOCK_SIZE CONFIG_LITTLEFS_BLOCK_SIZE
+#else
+#define LITTLEFS_BLOCK_SIZE 4096
+#endif
+#endif
+
+//! Longest file name supported by LittleFS (LFS_NAME_MAX), reported by STATFS.
+#if !defined(LITTLEFS_NAME_MAX)
+#define LITTLEFS_NAME_MAX 255
+#endif
+
+//! Largest file supported by LittleFS (LFS_FILE_MAX), reported by STATFS.
+#if !defined(LITTLEFS_FILE_MAX)
+#define LITTLEFS_FILE_MAX 2147483647
+#endif
+
+//! Size of the buffer that the next chunk of a file being downloaded with
+//! sequential READs is prefetched into by run(). Set to 0 to disable. The
+//! buffer is part of the handler.
+#if !defined(LITTLEFS_READ_AHEAD_SIZE)
+#define LITTLEFS_READ_AHEAD_SIZE LITTLEFS_BLOCK_SIZE
+#endif
+
+//! Number of STREAM_WRITE packets that the host may have in flight (it never
+//! sends more than CAPS reports). The serial receive buffer should be able to
+//! hold this many command packets, which is
+//! LITTLEFS_STREAM_WRITE_WINDOW * (LITTLEFS_BLOCK_SIZE + 64) bytes (16.6 KB with
+//! the defaults). Lower it on boards short of RAM. At 1, the host uses
+//! WRITE_HANDLE instead, and the receive buffer only needs to hold one packet.
+#if !defined(LITTLEFS_STREAM_WRITE_WINDOW)
+#define LITTLEFS_STREAM_WRITE_WINDOW 4
+#endif
+
+//! Size of the buffer which collects APPEND data before it's written to flash.
+//! Data is written whenever the file size reaches a multiple of this size.
+//! The buffer is part of the handler.
+#if !defined(LITTLEFS_APPEND_BUFFER_SIZE)
+#define LITTLEFS_APPEND_BUFFER_SIZE LITTLEFS_BLOCK_SIZE
+#endif
+
+//! Time (in milliseconds) without an APPEND after which buffered data is
+//! written and the file is closed.
+#if !defined(LITTLEFS_APPEND_IDLE_MSEC)
+#define LITTLEFS_APPEND_IDLE_MSEC 1000
+#endif
+
+//! Set to 1 to support SHA-256 in the HASH command. Defaults to enabled on
+//! ESP32, where mbedtls uses the hardware SHA accelerator.
+#if !defined(LITTLEFS_HASH_SHA256)
+#if defined(ESP32)
+#define LITTLEFS_HASH_SHA256 1
+#else
+#define LITTLEFS_HASH_SHA256 0
+#endif
+#endif
+
+//! Set to 1 to support the READ_COMPRESSED and WRITE_COMPRESSED commands.
+#if !defined(LITTLEFS_COMPRESSION)
+#define LITTLEFS_COMPRESSION 1
+#endif
+
+//! Largest amount of uncompressed data transferred by a single READ_COMPRESSED
+//! or WRITE_COMPRESSED (limited to 64K by the LZ4 block format). The handler
+//! holds a buffer of this size (8 KB with the defaults) when
+//! LITTLEFS_COMPRESSION is enabled.
+#if !defined(LITTLEFS_COMPRESS_BUFFER_SIZE)
+#define LITTLEFS_COMPRESS_BUFFER_SIZE (2 * LITTLEFS_BLOCK_SIZE)
+#endif
+
+//! Number of bytes that a COPY job copies each time run() is called.
+#if !defined(LITTLEFS_JOB_SLICE_BYTES)
+#define LITTLEFS_JOB_SLICE_BYTES 4096
+#endif
+
+//! Number of files or directories that an RMTREE job removes each time run()
+//! is called.
+#if !defined(LITTLEFS_JOB_SLICE_ENTRIES)
+#define LITTLEFS_JOB_SLICE_ENTRIES 4
+#endif
+
+//! Set to 1 to run FORMAT jobs on their own FreeRTOS task (formatting can't
+//! be split into slices). Defaults to enabled on ESP32.
+#if !defined(LITTLEFS_JOB_TASK)
+#if defined(ESP32)
+#define LITTLEFS_JOB_TASK 1
+#else
+#define LITTLEFS_JOB_TASK 0
+#endif
+#endif
+
+//! Stack size (in bytes) of the FreeRTOS task used for FORMAT jobs.
+#if !defined(LITTLEFS_JOB_TASK_STACK_SIZE)
+#define LITTLEFS_JOB_TASK_STACK_SIZE 4096
+#endif
+
+//! Time (in milliseconds) without a command after which run() garbage
+//! collects each file system whose backend supports it (one file system per
+//! call), so that the next upload doesn't have to. Set to 0 to only do this
+//! when the host starts a MAINTENANCE job.
+#if !defined(LITTLEFS_MAINTENANCE_IDLE_MSEC)
+#define LITTLEFS_MAINTENANCE_IDLE_MSEC 5000
+#endif
+
+//! Set to 1 to build LittleFsWorker, which runs the packet handler on its own
+//! FreeRTOS task so that receiving the next command overlaps with flash
+//! access. Leave it disabled on single core boards.
+#if !defined(LITTLEFS_THREADED)
+#define LITTLEFS_THREADED 0
+#endif
+
+//! Size of each packet buffer used by LittleFsWorker. This should match the
+//! size of the packets used by the bus. The worker holds
+//! LITTLEFS_WORKER_QUEUE_LEN + 1 of them (12.5 KB with the defaults).
+#if !defined(LITTLEFS_WORKER_PACKET_SIZE)
+#define LITTLEFS_WORKER_PACKET_SIZE (LITTLEFS_BLOCK_SIZE + 64)
+#endif
+
+//! Number of commands which can be waiting for the LittleFsWorker task.
+#if !defined(LITTLEFS_WORKER_QUEUE_LEN)
+#define LITTLEFS_WORKER_QUEUE_LEN 2
+#endif
+
+//! Stack size (in bytes) of the LittleFsWorker task.
+#if !defined(LITTLEFS_WORKER_STACK_SIZE)
+#define LITTLEFS_WORKER_STACK_SIZE 8192
+#endif
+
+//! FreeRTOS priority of the LittleFsWorker task.
+#if !defined(LITTLEFS_WORKER_PRIORITY)
+#define LITTLEFS_WORKER_PRIORITY 1
+#endif
+
+//! Core that the LittleFsWorker task runs on (loop() runs on core 1).
+#if !defined(LITTLEFS_WORKER_CORE)
+#define LITTLEFS_WORKER_CORE 0
+#endif
+
+//! Set to 0 to leave out the per-command and per-phase timing reported by the
+//! STATS command.
+#if !defined(LITTLEFS_STATS)
+#define LITTLEFS_STATS 1
+#endif
@@ -14,295 +14,4451 @@
  *
  ****************************************************************************/
 
+#include <cctype>
+
+#include "Bus.h"
+#include "Crc32.h"
+#include "duino_util.h"
 #include "LittleFS.h"
 #include "LittleFsPacketHandler.h"
 #include "Packer.h"
+#include "RollingChecksum.h"
 #include "Unpacker.h"
 
+#if LITTLEFS_HASH_SHA256
+#include "mbedtls/sha256.h"
+#endif
+
+#if LITTLEFS_JOB_TASK
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+//! Determines if path refers to name, or to something inside the directory name.
+//! @returns true if path is name, or is inside of name.
+static bool isSameOrChild(
+    char const* path,  //!< [in] Path to check.
+    char const* name   //!< [in] File or directory name.
+) {
+    size_t nameLen = strlen(name);
+    if (strncmp(path, name, nameLen) != 0) {
+        return false;
+    }
+    return path[nameLen] == '\0' || path[nameLen] == '/' ||
+           (nameLen > 0 && name[nameLen - 1] == '/');
+}
+
+//! Checks a path read from an IMPORT archive, which is relative to the
+//! directory being imported into.
+//! @returns true if the path stays inside that directory.
+static bool isSafeArchivePath(
+    char const* path,  //!< [in] Path to check (not null terminated).
+    size_t pathLen     //!< [in] Length of path.
+) {
+    if (pathLen == 0 || path[0] == '/' || memchr(path, '\0', pathLen) != nullptr) {
+        return false;
+    }
+    char const* end = path + pathLen;
+    for (char const* component = path; component < end;) {
+        char const* slash = static_cast<char const*>(memchr(component, '/', end - component));
+        char const* componentEnd = (slash == nullptr) ? end : slash;
+        if (componentEnd - component == 2 && component[0] == '.' && component[1] == '.') {
+            return false;
+        }
+        component = componentEnd + 1;
+    }
+    return true;
+}
+
+//! Matches name against a glob pattern, where * matches any number of
+//! characters and ? matches any single character.
+//! @returns true if name matches pattern.
+static bool globMatch(
+    char const* pattern,  //!< [in] Pattern to match.
+    char const* name      //!< [in] Name to check.
+) {
+    char const* starPattern = nullptr;
+    char const* starName = nullptr;
+    while (*name != '\0') {
+        if (*pattern == '*') {
+            // Remember where the * was, so that it can match one more character
+            // if the rest of the pattern doesn't match.
+            starPattern = ++pattern;
+            starName = name;
+        } else if (*pattern == '?' || *pattern == *name) {
+            pattern++;
+            name++;
+        } else if (starPattern != nullptr) {
+            pattern = starPattern;
+            name = ++starName;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+//! @returns true if c matches patternChar.
+static bool charMatch(
+    char patternChar,  //!< [in] Character from the pattern.
+    char c,            //!< [in] Character to check.
+    bool ignoreCase    //!< [in] Letters match in either case.
+) {
+    if (ignoreCase) {
+        return tolower(static_cast<unsigned char>(patternChar)) ==
+               tolower(static_cast<unsigned char>(c));
+    }
+    return patternChar == c;
+}
+
+//! @returns The number of characters in the regex atom at the start of re
+//!          (2 for an escaped character, otherwise 1).
+static size_t regexAtomLen(char const* re  //!< [in] Regex to check.
+) {
+    return (re[0] == '\\' && re[1] != '\0') ? 2 : 1;
+}
+
+//! @returns true if c matches the regex atom at the start of re.
+static bool regexAtomMatch(
+    char const* re,  //!< [in] Regex starting with the atom.
+    char c,          //!< [in] Character to check.
+    bool ignoreCase  //!< [in] Letters match in either case.
+) {
+    if (re[0] == '\\' && re[1] != '\0') {
+        return charMatch(re[1], c, ignoreCase);
+    }
+    return re[0] == '.' || charMatch(re[0], c, ignoreCase);
+}
+
+static bool regexMatchHere(char const* re, char const* text, char const* end, bool ignoreCase);
+
+//! Matches any number of the atom, followed by the rest of the regex.
+//! @returns true if the start of text matches.
+static bool regexMatchStar(
+    char const* atom,  //!< [in] Atom which is repeated.
+    char const* re,    //!< [in] Rest of the regex, after the *.
+    char const* text,  //!< [in] Text to match.
+    char const* end,   //!< [in] End of text.
+    bool ignoreCase    //!< [in] Letters match in either case.
+) {
+    do {
+        if (regexMatchHere(re, text, end, ignoreCase)) {
+            return true;
+        }
+    } while (text < end && regexAtomMatch(atom, *text++, ignoreCase));
+    return false;
+}
+
+//! Matches a regex against the start of text.
+//! @returns true if the start of text matches.
+static bool regexMatchHere(
+    char const* re,    //!< [in] Regex to match.
+    char const* text,  //!< [in] Text to match.
+    char const* end,   //!< [in] End of text.
+    bool ignoreCase    //!< [in] Letters match in either case.
+) {
+    while (re[0] != '\0') {
+        size_t atomLen = regexAtomLen(re);
+        if (re[atomLen] == '*') {
+            return regexMatchStar(re, &re[atomLen + 1], text, end, ignoreCase);
+        }
+        if (re[0] == '$' && re[1] == '\0') {
+            return text == end;
+        }
+        if (text == end || !regexAtomMatch(re, *text, ignoreCase)) {
+            return false;
+        }
+        re += atomLen;
+        text++;
+    }
+    return true;
+}
+
+//! Matches a regex anywhere in text. This is the small matcher from "The
+//! Practice of Programming", which supports c, \c, ., *, ^ and $.
+//! @returns true if some part of text matches.
+static bool regexMatch(
+    char const* re,    //!< [in] Regex to match.
+    char const* text,  //!< [in] Text to search.
+    size_t len,        //!< [in] Length of text.
+    bool ignoreCase    //!< [in] Letters match in either case.
+) {
+    char const* end = text + len;
+    if (re[0] == '^') {
+        return regexMatchHere(re + 1, text, end, ignoreCase);
+    }
+    do {
+        if (regexMatchHere(re, text, end, ignoreCase)) {
+            return true;
+        }
+    } while (text++ < end);
+    return false;
+}
+
+//! @returns true if pattern appears anywhere in text.
+static bool bytesMatch(
+    char const* pattern,  //!< [in] Bytes to search for.
+    size_t patternLen,    //!< [in] Length of pattern.
+    char const* text,     //!< [in] Text to search.
+    size_t len,           //!< [in] Length of text.
+    bool ignoreCase       //!< [in] Letters match in either case.
+) {
+    for (size_t start = 0; start + patternLen <= len; start++) {
+        size_t i = 0;
+        while (i < patternLen && charMatch(pattern[i], text[start + i], ignoreCase)) {
+            i++;
+        }
+        if (i == patternLen) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//! @returns the number of bytes that a line takes up in a SEARCH response.
+static size_t searchEntrySize(
+    char const* name,  //!< [in] Name of the file containing the line.
+    size_t lineLen     //!< [in] Length of the line.
+) {
+    return strlen(name) + 2 + 2 * sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint16_t) + lineLen;
+}
+
+//! Appends a line found by SEARCH to a response.
+//! @returns true if the line fitted in the response.
+static bool appendSearchMatch(
+    Packet* rsp,          //!< [mod] Place to append the line.
+    char const* name,     //!< [in] Name of the file containing the line.
+    uint32_t lineNumber,  //!< [in] Number of the line (starting at 1).
+    uint32_t lineStart,   //!< [in] Offset of the start of the line.
+    uint8_t flags,        //!< [in] SearchLineFlags.
+    char const* line,     //!< [in] The line.
+    size_t lineLen,       //!< [in] Length of line.
+    bool truncate         //!< [in] Cut the line short, rather than fail, if it doesn't fit.
+) {
+    size_t space = rsp->getSpaceRemaining();
+    size_t entrySize = searchEntrySize(name, lineLen);
+    if (entrySize > space) {
+        size_t fixedSize = entrySize - lineLen;
+        if (!truncate || fixedSize >= space) {
+            return false;
+        }
+        lineLen = space - fixedSize;
+        flags |= LittleFsPacketHandler::SearchLineFlags::TRUNCATED;
+    }
+    uint16_t len = lineLen;
+    rsp->append(name);
+    rsp->append(lineNumber);
+    rsp->append(lineStart);
+    rsp->append(flags);
+    rsp->append(len);
+    memcpy(rsp->getWriteData(lineLen), line, lineLen);
+    return true;
+}
+
+//! Mode which opens an existing file for reading and writing, without
+//! truncating it. FS.h only defines the read, write and append modes.
+static constexpr char const* FILE_UPDATE = "r+";
+
+//! Creates the name of a hidden temporary file which lives in the same
+//! directory as path (so that it can be renamed over path).
+//! For example, /dir/name.txt with suffix .tmp becomes /dir/.name.txt.tmp
+//! @returns true if the temporary name fit in tempPath.
+static bool makeTempPath(
+    char const* path,    //!< [in] Path of the file that the temporary file is for.
+    char const* suffix,  //!< [in] Suffix to add to the temporary file's name.
+    char* tempPath,      //!< [out] Place to store the name of the temporary file.
+    size_t tempPathLen   //!< [in] Size of tempPath.
+) {
+    char const* baseName = strrchr(path, '/');
+    baseName = (baseName == nullptr) ? path : baseName + 1;
+    size_t dirLen = baseName - path;
+    if (dirLen + 1 + strlen(baseName) + strlen(suffix) + 1 > tempPathLen) {
+        return false;
+    }
+    memcpy(tempPath, path, dirLen);
+    tempPath[dirLen] = '.';
+    strcpy(&tempPath[dirLen + 1], baseName);
+    strcat(tempPath, suffix);
+    return true;
+}
+
+//! Backend used when the handler isn't given a default file system.
+static FormattableFsBackend<fs::LittleFSFS> littleFsBackend(LittleFS);
+
+LittleFsPacketHandler::LittleFsPacketHandler(IBus* bus, FsBackend* backend) : m_bus{bus} {
+    this->m_mounts[0].prefix = "";
+    this->m_mounts[0].backend = (backend == nullptr) ? &littleFsBackend : backend;
+}
+
+bool LittleFsPacketHandler::mount(char const* prefix, FsBackend* backend) {
+    size_t prefixLen = strlen(prefix);
+    if (prefixLen < 2 || prefix[0] != '/' || prefix[prefixLen - 1] == '/' ||
+        this->m_numMounts >= LEN(this->m_mounts)) {
+        return false;
+    }
+    this->m_mounts[this->m_numMounts].prefix = prefix;
+    this->m_mounts[this->m_numMounts].backend = backend;
+    this->m_numMounts++;
+    // Paths inside prefix now come from a different file system.
+    this->forgetMetadata(nullptr);
+    return true;
+}
+
+//! Stores the header of an archive record.
+//! @returns The length of the header.
+static uint16_t packArchiveHeader(
+    uint8_t* header,                            //!< [out] Place to store the header.
+    LittleFsPacketHandler::ArchiveRecord type,  //!< [in] Type of the record.
+    char const* path,                           //!< [in] Path of the entry.
+    uint16_t pathLen,                           //!< [in] Length of path.
+    uint32_t size,                              //!< [in] Size of the file (0 for a directory).
+    uint32_t timestamp                          //!< [in] Time the entry was last written.
+) {
+    header[0] = to_underlying(type);
+    memcpy(&header[1], &pathLen, sizeof(pathLen));
+    memcpy(&header[3], path, pathLen);
+    memcpy(&header[3 + pathLen], &size, sizeof(size));
+    memcpy(&header[7 + pathLen], &timestamp, sizeof(timestamp));
+    return 11 + pathLen;
+}
+
+#if __cplusplus < 201703L
+// Before C++17 the table declared in the class still needs a definition.
+constexpr LittleFsPacketHandler::CommandInfo LittleFsPacketHandler::COMMAND_TABLE[];
+#endif
+
 char const* LittleFsPacketHandler::as_str(Packet::Command::Type cmd) const {
-    switch (cmd) {
-        case Command::FORMAT:
-            return "FORMAT";
-        case Command::INFO:
-            return "INFO";
-        case Command::LIST:
-            return "LIST";
-        case Command::MKDIR:
-            return "MKDIR";
-        case Command::REMOVE:
-            return "REMOVE";
-        case Command::RENAME:
-            return "RENAME";
-        case Command::COPY:
-            return "COPY";
-        case Command::READ:
-            return "READ";
-        case Command::WRITE:
-            return "WRITE";
-        case Command::APPEND:
-            return "APPEND";
-        case Command::RMDIR:
-            return "RMDIR";
-    }
-    return "???";
+    static_assert(isCommandTableInOrder(), "COMMAND_TABLE must be in command order");
+    if (!isCommand(cmd)) {
+        return "???";
+    }
+    return COMMAND_TABLE[cmd - Command::FORMAT].name;
+}
+
+bool LittleFsPacketHandler::handlePacket(Packet const& cmd, Packet* rsp) {
+    if (!isCommand(cmd.getCommand())) {
+        return false;
+    }
+#if LITTLEFS_STATS
+    uint32_t start = micros();
+    bool handled = this->dispatchPacket(cmd, rsp);
+    addStats(
+        &this->m_commandStats[cmd.getCommand() - Command::FORMAT], micros() - start,
+        cmd.getDataLength() + rsp->getDataLength());
+    return handled;
+#else
+    return this->dispatchPacket(cmd, rsp);
+#endif
+}
+
+bool LittleFsPacketHandler::dispatchPacket(Packet const& cmd, Packet* rsp) {
+    CommandInfo const& info = COMMAND_TABLE[cmd.getCommand() - Command::FORMAT];
+    if ((info.flags & CommandFlags::KEEP_APPEND) == 0) {
+        // Make sure that every command which uses files sees any buffered
+        // APPEND data.
+        this->flushAppendBuffer(true);
+    }
+    // The file systems get garbage collected again once the host goes quiet.
+    this->m_lastCommand = millis();
+    this->m_idleGcMount = 0;
+    if (this->m_job.type != JobType::NONE &&
+        this->m_job.state.load(std::memory_order_acquire) == JobState::RUNNING &&
+        ((info.flags & CommandFlags::MODIFIES) != 0 ||
+         (this->m_job.type == JobType::FORMAT && cmd.getCommand() != Command::CAPS &&
+          cmd.getCommand() != Command::JOB_STATUS))) {
+        // Nothing else can use the file system while it's being formatted, and
+        // nothing can change files while another job might be working on them.
+        // Most responses start with an error code, so that's all that is sent.
+        rsp->setCommand(cmd.getCommand());
+        rsp->appendByte(to_underlying(Error::BUSY));
+        return true;
+    }
+    if (cmd.getDataLength() < info.minLength) {
+        rsp->setCommand(cmd.getCommand());
+        rsp->appendByte(to_underlying(Error::INVALID_COMMAND));
+        return true;
+    }
+    (this->*info.handler)(cmd, rsp);
+    return true;
+}
+
+void LittleFsPacketHandler::run() {
+    uint32_t now = millis();
+    if (this->m_appendFile && now - this->m_appendLastUsed >= LITTLEFS_APPEND_IDLE_MSEC) {
+        this->flushAppendBuffer(true);
+    }
+    this->expireCursors();
+    for (auto& watch : this->m_tailWatches) {
+        if (!watch.file) {
+            continue;
+        }
+        if (now - watch.lastUsed >= LITTLEFS_TAIL_TIMEOUT_MSEC) {
+            // The host has gone away, so stop sending it data.
+            this->closeTailWatch(&watch);
+        } else {
+            this->pollTailWatch(&watch, now);
+        }
+    }
+#if LITTLEFS_READ_AHEAD_SIZE > 0
+    if (this->m_readAheadPending > 0) {
+        // The host is busy with the previous READ response, so fetch the data
+        // it will ask for next.
+        this->m_readAheadLen =
+            this->readFile(&this->m_readAheadFile->file, this->m_readAheadBuffer,
+                           this->m_readAheadPending);
+        this->m_readAheadPending = 0;
+    }
+#endif
+#if LITTLEFS_MAINTENANCE_IDLE_MSEC > 0
+    if (this->m_idleGcMount < this->m_numMounts && this->m_job.type == JobType::NONE &&
+        now - this->m_lastCommand >= LITTLEFS_MAINTENANCE_IDLE_MSEC) {
+        // Only one file system is collected per call, so that loop() still
+        // gets to run in between.
+        Mount* mount = &this->m_mounts[this->m_idleGcMount++];
+        if (mount->backend->canGc()) {
+            this->gcMount(mount);
+        }
+    }
+#endif
+    this->stepJob();
+}
+
+void LittleFsPacketHandler::expireCursors() {
+    uint32_t now = millis();
+    for (auto& cursor : this->m_dirCursors) {
+        if (cursor.dir && now - cursor.lastUsed >= LITTLEFS_DIR_CURSOR_TIMEOUT_MSEC) {
+            this->closeDirCursor(&cursor);
+        }
+    }
+    if (this->m_walkCursor.depth > 0 &&
+        now - this->m_walkCursor.lastUsed >= LITTLEFS_DIR_CURSOR_TIMEOUT_MSEC) {
+        this->closeWalkCursor();
+    }
+    if ((this->m_searchCursor.file || this->m_searchCursor.dir) &&
+        now - this->m_searchCursor.lastUsed >= LITTLEFS_DIR_CURSOR_TIMEOUT_MSEC) {
+        this->closeSearchCursor();
+    }
+    if (this->m_exportCursor.active &&
+        now - this->m_exportCursor.lastUsed >= LITTLEFS_DIR_CURSOR_TIMEOUT_MSEC) {
+        this->closeExportCursor();
+    }
+    if (this->m_import.active &&
+        now - this->m_import.lastUsed >= LITTLEFS_DIR_CURSOR_TIMEOUT_MSEC) {
+        this->closeImport();
+    }
+}
+
+void LittleFsPacketHandler::pollTailWatch(TailWatch* watch, uint32_t now) {
+    if (now - watch->lastSent < watch->intervalMsec) {
+        return;
+    }
+    // Only the size is checked until the file grows, so an idle watch doesn't
+    // read from flash.
+    uint32_t size = watch->file.size();
+    bool truncated = size < watch->offset;
+    if (truncated) {
+        // The file was truncated or rewritten, so send it again from the start.
+        watch->offset = 0;
+    } else if (size == watch->offset) {
+        return;
+    }
+    Packet* pkt = &this->m_tailPacket;
+    pkt->setCommand(Command::TAIL);
+    pkt->setDataLength(0);
+    uint8_t* errPtr = pkt->getWriteData();
+    pkt->appendByte(to_underlying(Error::NONE));
+    pkt->append(static_cast<uint8_t>(watch - this->m_tailWatches));
+    pkt->append(watch->offset);
+    pkt->append(size);
+
+    uint32_t length = size - watch->offset;
+    if (watch->maxBytes != 0 && length > watch->maxBytes) {
+        length = watch->maxBytes;
+    }
+    uint32_t bytesRead = 0;
+    if (length > 0) {
+        if (this->seekFile(&watch->file, watch->offset)) {
+            bytesRead = this->readIntoPacket(&watch->file, length, pkt);
+        }
+        if (bytesRead == 0) {
+            // Data written through another handle may not be visible to this
+            // one, so reopen the file and try again.
+            this->closeFile(&watch->file);
+            watch->file = this->openFile(watch->path, FILE_READ);
+            if (watch->file && this->seekFile(&watch->file, watch->offset)) {
+                bytesRead = this->readIntoPacket(&watch->file, length, pkt);
+            }
+        }
+        if (bytesRead == 0) {
+            *errPtr = to_underlying(Error::READ_FAILED);
+        }
+    }
+    watch->offset += bytesRead;
+    watch->lastSent = now;
+    this->m_bus->writePacket(*pkt);
+    if (*errPtr != to_underlying(Error::NONE)) {
+        this->closeTailWatch(watch);
+    }
+}
+
+void LittleFsPacketHandler::closeTailWatch(TailWatch* watch) {
+    if (watch->file) {
+        this->closeFile(&watch->file);
+    }
+    watch->file = File();
+}
+
+void LittleFsPacketHandler::stepJob() {
+    Job* job = &this->m_job;
+    if (job->type == JobType::NONE ||
+        job->state.load(std::memory_order_acquire) != JobState::RUNNING) {
+        return;
+    }
+    switch (job->type) {
+        case JobType::COPY: {
+            for (uint32_t sliceBytes = 0; sliceBytes < LITTLEFS_JOB_SLICE_BYTES;) {
+                size_t bytesRead =
+                    this->readFile(&job->src, this->m_ioBuffer, sizeof(this->m_ioBuffer));
+                if (bytesRead == 0) {
+                    this->finishJob(job->progress == job->total ? Error::NONE : Error::READ_FAILED);
+                    return;
+                }
+                if (this->writeFile(&job->dst, this->m_ioBuffer, bytesRead) != bytesRead) {
+                    this->finishJob(Error::WRITE_FAILED);
+                    return;
+                }
+                job->progress += bytesRead;
+                sliceBytes += bytesRead;
+            }
+            return;
+        }
+
+        case JobType::RMTREE: {
+            for (uint32_t i = 0; i < LITTLEFS_JOB_SLICE_ENTRIES; i++) {
+                if (this->stepRmTree()) {
+                    return;
+                }
+            }
+            return;
+        }
+
+        case JobType::FORMAT: {
+            if (job->onTask) {
+                // jobTask sets the state once the format is done.
+                return;
+            }
+            this->finishJob(
+                this->m_mounts[0].backend->format() ? Error::NONE : Error::FORMAT_FAILED);
+            return;
+        }
+
+        case JobType::MAINTENANCE: {
+            // One file system per call, since a collection can take a while.
+            while (job->mount < this->m_numMounts) {
+                Mount* mount = &this->m_mounts[job->mount++];
+                if (mount->backend->canGc()) {
+                    if (!this->gcMount(mount)) {
+                        this->finishJob(Error::WRITE_FAILED);
+                        return;
+                    }
+                    job->progress++;
+                    return;
+                }
+            }
+            this->finishJob(Error::NONE);
+            return;
+        }
+
+        default: {
+            this->finishJob(Error::UNSUPPORTED);
+            return;
+        }
+    }
+}
+
+bool LittleFsPacketHandler::stepRmTree() {
+    Job* job = &this->m_job;
+    File dir = this->fsOpen(job->path);
+    if (!dir || !dir.isDirectory()) {
+        this->finishJob(Error::RMDIR_FAILED);
+        return true;
+    }
+    File entry = dir.openNextFile();
+    if (!entry) {
+        // The directory is empty, so remove it and go back up to its parent.
+        dir.close();
+        if (!this->fsRmdir(job->path)) {
+            this->finishJob(Error::RMDIR_FAILED);
+            return true;
+        }
+        job->progress++;
+        if (strlen(job->path) <= job->rootLen) {
+            this->finishJob(Error::NONE);
+            return true;
+        }
+        *strrchr(job->path, '/') = '\0';
+        return false;
+    }
+
+    // entry.path() is relative to the file system that the directory is
+    // mounted from, so the path is built from the one sent by the host.
+    char entryPath[LITTLEFS_MAX_PATH_LEN];
+    bool isDir = entry.isDirectory();
+    char const* name = strrchr(entry.name(), '/');
+    name = (name == nullptr) ? entry.name() : name + 1;
+    size_t dirLen = strlen(job->path);
+    bool needSlash = dirLen == 0 || job->path[dirLen - 1] != '/';
+    bool fits = dirLen + needSlash + strlen(name) < sizeof(entryPath);
+    if (fits) {
+        strcpy(entryPath, job->path);
+        if (needSlash) {
+            strcat(entryPath, "/");
+        }
+        strcat(entryPath, name);
+    }
+    entry.close();
+    dir.close();
+    if (!fits) {
+        this->finishJob(Error::UNSUPPORTED);
+        return true;
+    }
+    if (isDir) {
+        // Empty the subdirectory first.
+        strcpy(job->path, entryPath);
+        return false;
+    }
+    this->evictCachedFiles(entryPath);
+    if (!this->fsRemove(entryPath)) {
+        this->finishJob(Error::REMOVE_FAILED);
+        return true;
+    }
+    job->progress++;
+    return false;
+}
+
+void LittleFsPacketHandler::finishJob(Error result) {
+    Job* job = &this->m_job;
+    if (job->src) {
+        job->src.close();
+    }
+    job->src = File();
+    if (job->dst) {
+        job->dst.close();
+    }
+    job->dst = File();
+    job->result = result;
+    job->state.store(JobState::DONE, std::memory_order_release);
+}
+
+#if LITTLEFS_JOB_TASK
+void LittleFsPacketHandler::jobTask(void* arg) {
+    LittleFsPacketHandler* handler = static_cast<LittleFsPacketHandler*>(arg);
+    Job* job = &handler->m_job;
+    // Only the state is shared with the loop task. The result is published
+    // by the release store, so it's valid once the loop's acquire load sees
+    // that the job is DONE.
+    job->result = handler->m_mounts[0].backend->format() ? Error::NONE : Error::FORMAT_FAILED;
+    job->state.store(JobState::DONE, std::memory_order_release);
+    vTaskDelete(nullptr);
+}
+#endif
+
+FsBackend* LittleFsPacketHandler::findBackend(char const* path, char const** fsPath) {
+    for (uint8_t i = 1; i < this->m_numMounts; i++) {
+        size_t prefixLen = strlen(this->m_mounts[i].prefix);
+        if (strncmp(path, this->m_mounts[i].prefix, prefixLen) == 0 &&
+            (path[prefixLen] == '\0' || path[prefixLen] == '/')) {
+            *fsPath = (path[prefixLen] == '\0') ? "/" : &path[prefixLen];
+            return this->m_mounts[i].backend;
+        }
+    }
+    *fsPath = path;
+    return this->m_mounts[0].backend;
+}
+
+File LittleFsPacketHandler::fsOpen(char const* path, char const* mode) {
+    char const* fsPath;
+    if (strcmp(mode, FILE_READ) != 0) {
+        this->forgetMetadata(path);
+    }
+    return this->findBackend(path, &fsPath)->fs().open(fsPath, mode);
+}
+
+bool LittleFsPacketHandler::fsExists(char const* path) {
+    char const* fsPath;
+    return this->findBackend(path, &fsPath)->fs().exists(fsPath);
+}
+
+bool LittleFsPacketHandler::fsMkdir(char const* path) {
+    char const* fsPath;
+    this->forgetMetadata(path);
+    return this->findBackend(path, &fsPath)->fs().mkdir(fsPath);
+}
+
+bool LittleFsPacketHandler::fsRemove(char const* path) {
+    char const* fsPath;
+    this->forgetMetadata(path);
+    return this->findBackend(path, &fsPath)->fs().remove(fsPath);
+}
+
+bool LittleFsPacketHandler::fsRename(char const* from, char const* to) {
+    char const* fsFrom;
+    char const* fsTo;
+    // Everything inside a directory moves along with it.
+    this->forgetMetadata(nullptr);
+    FsBackend* backend = this->findBackend(from, &fsFrom);
+    if (this->findBackend(to, &fsTo) != backend) {
+        return false;
+    }
+    return backend->fs().rename(fsFrom, fsTo);
+}
+
+bool LittleFsPacketHandler::fsRmdir(char const* path) {
+    char const* fsPath;
+    this->forgetMetadata(path);
+    return this->findBackend(path, &fsPath)->fs().rmdir(fsPath);
+}
+
+File LittleFsPacketHandler::openFile(char const* filename, char const* mode) {
+#if LITTLEFS_STATS
+    uint32_t start = micros();
+    File file = this->fsOpen(filename, mode);
+    addStats(&this->m_phaseStats[to_underlying(StatsPhase::OPEN)], micros() - start, 0);
+    return file;
+#else
+    return this->fsOpen(filename, mode);
+#endif
+}
+
+bool LittleFsPacketHandler::seekFile(File* file, uint32_t offset) {
+    if (file->position() == offset) {
+        return true;
+    }
+#if LITTLEFS_STATS
+    uint32_t start = micros();
+    bool seeked = file->seek(offset);
+    addStats(&this->m_phaseStats[to_underlying(StatsPhase::SEEK)], micros() - start, 0);
+    return seeked;
+#else
+    return file->seek(offset);
+#endif
+}
+
+size_t LittleFsPacketHandler::readFile(File* file, uint8_t* data, size_t length) {
+#if LITTLEFS_STATS
+    uint32_t start = micros();
+    size_t bytesRead = file->read(data, length);
+    addStats(&this->m_phaseStats[to_underlying(StatsPhase::READ)], micros() - start, bytesRead);
+    return bytesRead;
+#else
+    return file->read(data, length);
+#endif
+}
+
+size_t LittleFsPacketHandler::writeFile(File* file, uint8_t const* data, size_t length) {
+#if LITTLEFS_STATS
+    uint32_t start = micros();
+    size_t written = file->write(data, length);
+    addStats(&this->m_phaseStats[to_underlying(StatsPhase::WRITE)], micros() - start, written);
+    return written;
+#else
+    return file->write(data, length);
+#endif
+}
+
+void LittleFsPacketHandler::closeFile(File* file) {
+#if LITTLEFS_STATS
+    uint32_t start = micros();
+    file->close();
+    addStats(&this->m_phaseStats[to_underlying(StatsPhase::CLOSE)], micros() - start, 0);
+#else
+    file->close();
+#endif
+}
+
+bool LittleFsPacketHandler::gcMount(Mount* mount) {
+#if LITTLEFS_STATS
+    uint32_t start = micros();
+    bool collected = mount->backend->gc();
+    addStats(&this->m_phaseStats[to_underlying(StatsPhase::GC)], micros() - start, 0);
+    return collected;
+#else
+    return mount->backend->gc();
+#endif
+}
+
+#if LITTLEFS_STATS
+void LittleFsPacketHandler::addStats(Stats* stats, uint32_t usec, uint32_t bytes) {
+    stats->count++;
+    stats->bytes += bytes;
+    stats->totalUsec += usec;
+    if (usec > stats->maxUsec) {
+        stats->maxUsec = usec;
+    }
+}
+#endif
+
+LittleFsPacketHandler::Error LittleFsPacketHandler::appendBuffered(
+    char const* filename,
+    uint8_t const* data,
+    uint32_t length) {
+    if (!this->m_appendFile || strcmp(this->m_appendPath, filename) != 0) {
+        this->flushAppendBuffer(true);
+        this->evictCachedFiles(filename);
+        this->m_appendFile = this->openFile(filename, FILE_APPEND);
+        if (!this->m_appendFile) {
+            return Error::UNABLE_TO_OPEN_FILE;
+        }
+        strcpy(this->m_appendPath, filename);
+        this->m_appendOffset = this->m_appendFile.size();
+        this->m_appendLen = 0;
+    }
+    this->m_appendLastUsed = millis();
+
+    while (length > 0) {
+        // Fill the buffer up to the next multiple of its size within the
+        // file, so that each write ends on a block boundary.
+        uint32_t fill = sizeof(this->m_appendBuffer) -
+                        (this->m_appendOffset % sizeof(this->m_appendBuffer));
+        uint32_t count = fill - this->m_appendLen;
+        if (count > length) {
+            count = length;
+        }
+        memcpy(&this->m_appendBuffer[this->m_appendLen], data, count);
+        this->m_appendLen += count;
+        data += count;
+        length -= count;
+
+        if (this->m_appendLen == fill) {
+            this->flushAppendBuffer(false);
+        }
+    }
+
+    Error err = this->m_appendError;
+    this->m_appendError = Error::NONE;
+    return err;
+}
+
+void LittleFsPacketHandler::flushAppendBuffer(bool close) {
+    if (!this->m_appendFile) {
+        return;
+    }
+    if (this->m_appendLen > 0) {
+        if (this->writeFile(&this->m_appendFile, this->m_appendBuffer, this->m_appendLen) !=
+                this->m_appendLen &&
+            this->m_appendError == Error::NONE) {
+            this->m_appendError = Error::WRITE_FAILED;
+        }
+        this->forgetMetadata(this->m_appendPath);
+        this->m_appendOffset += this->m_appendLen;
+        this->m_appendLen = 0;
+    }
+    if (close) {
+        this->closeFile(&this->m_appendFile);
+        this->m_appendFile = File();
+        this->m_appendPath[0] = '\0';
+    }
+}
+
+bool LittleFsPacketHandler::appendDirEntries(
+    File* dir,
+    File* file,
+    uint16_t* index,
+    Packet* rsp) {
+    while (*file) {
+        Flags flags;
+        if (file->isDirectory()) {
+            flags.set(Flags::DIR);
+        }
+        uint32_t fileSize = file->size();
+        uint32_t timestamp = file->getLastWrite();
+        char const* filename = file->name();
+
+        uint32_t entrySize = sizeof(*index) + sizeof(flags) + sizeof(fileSize) +
+                             sizeof(timestamp) + strlen(filename) + 2;
+        if (entrySize > rsp->getSpaceRemaining()) {
+            return false;
+        }
+
+        rsp->append(*index);
+        rsp->append(flags);
+        rsp->append(fileSize);
+        rsp->append(timestamp);
+        rsp->append(filename);
+        (*index)++;
+        *file = dir->openNextFile();
+    }
+    return true;
+}
+
+bool LittleFsPacketHandler::appendCompactDirEntries(
+    DirCursor* cursor,
+    uint8_t fields,
+    Packet* rsp) {
+    // The first entry in each response is sent in full, so that responses can
+    // be decoded without the previous one.
+    char prevName[LITTLEFS_MAX_PATH_LEN];
+    prevName[0] = '\0';
+    while (cursor->next) {
+        File* file = &cursor->next;
+        char const* filename = file->name();
+        size_t nameLen = strlen(filename);
+        if (nameLen > UINT8_MAX) {
+            nameLen = UINT8_MAX;
+        }
+        size_t prefixLen = 0;
+        while (prefixLen < nameLen && prevName[prefixLen] == filename[prefixLen]) {
+            prefixLen++;
+        }
+        size_t suffixLen = nameLen - prefixLen;
+
+        size_t entrySize = 2 + suffixLen;
+        if ((fields & ListFields::FLAGS) != 0) {
+            entrySize += sizeof(uint8_t);
+        }
+        if ((fields & ListFields::SIZE) != 0) {
+            entrySize += sizeof(uint32_t);
+        }
+        if ((fields & ListFields::TIMESTAMP) != 0) {
+            entrySize += sizeof(uint32_t);
+        }
+        if (entrySize > rsp->getSpaceRemaining()) {
+            return false;
+        }
+
+        if ((fields & ListFields::FLAGS) != 0) {
+            Flags flags;
+            if (file->isDirectory()) {
+                flags.set(Flags::DIR);
+            }
+            rsp->append(flags);
+        }
+        if ((fields & ListFields::SIZE) != 0) {
+            rsp->append(static_cast<uint32_t>(file->size()));
+        }
+        if ((fields & ListFields::TIMESTAMP) != 0) {
+            rsp->append(static_cast<uint32_t>(file->getLastWrite()));
+        }
+        rsp->appendByte(static_cast<uint8_t>(prefixLen));
+        rsp->appendByte(static_cast<uint8_t>(suffixLen));
+        memcpy(rsp->getWriteData(suffixLen), &filename[prefixLen], suffixLen);
+
+        if (nameLen < sizeof(prevName)) {
+            strcpy(prevName, filename);
+        } else {
+            prevName[0] = '\0';
+        }
+        cursor->index++;
+        cursor->next = cursor->dir.openNextFile();
+    }
+    return true;
+}
+
+LittleFsPacketHandler::DirCursor* LittleFsPacketHandler::getDirCursor(
+    uint8_t* cursorNum,
+    Unpacker* unpacker,
+    Error* err) {
+    DirCursor* cursor;
+    if (*cursorNum == NO_CURSOR) {
+        char const* dirName;
+        unpacker->unpack(&dirName);
+
+        // Reuse a free cursor, or the least recently used one.
+        *cursorNum = 0;
+        for (uint8_t i = 0; i < LEN(this->m_dirCursors); i++) {
+            if (!this->m_dirCursors[i].dir) {
+                *cursorNum = i;
+                break;
+            }
+            if (this->m_dirCursors[i].lastUsed < this->m_dirCursors[*cursorNum].lastUsed) {
+                *cursorNum = i;
+            }
+        }
+        cursor = &this->m_dirCursors[*cursorNum];
+        this->closeDirCursor(cursor);
+
+        cursor->dir = this->fsOpen(dirName);
+        if (!cursor->dir || !cursor->dir.isDirectory()) {
+            this->closeDirCursor(cursor);
+            *err = Error::UNABLE_TO_OPEN_FILE;
+            return nullptr;
+        }
+        cursor->next = cursor->dir.openNextFile();
+        cursor->index = 0;
+    } else {
+        if (*cursorNum >= LEN(this->m_dirCursors) || !this->m_dirCursors[*cursorNum].dir) {
+            *err = Error::INVALID_CURSOR;
+            return nullptr;
+        }
+        cursor = &this->m_dirCursors[*cursorNum];
+    }
+    cursor->lastUsed = millis();
+    return cursor;
+}
+
+void LittleFsPacketHandler::closeDirCursor(DirCursor* cursor) {
+    cursor->next = File();
+    if (cursor->dir) {
+        cursor->dir.close();
+    }
+    cursor->dir = File();
+}
+
+bool LittleFsPacketHandler::appendWalkEntries(Packet* rsp) {
+    WalkCursor* walk = &this->m_walkCursor;
+    while (walk->depth > 0) {
+        if (!walk->next) {
+            walk->next = walk->dirs[walk->depth - 1].openNextFile();
+            if (!walk->next) {
+                // Finished with this directory, so continue with its parent.
+                walk->depth--;
+                walk->dirs[walk->depth].close();
+                walk->dirs[walk->depth] = File();
+                continue;
+            }
+        }
+
+        File* file = &walk->next;
+        char const* path = file->path();
+        if (strlen(path) < walk->prefixLen) {
+            // Shouldn't happen, but don't run off the end of the path if it does.
+            *file = File();
+            continue;
+        }
+        char const* relPath = path + walk->prefixLen;
+        char const* matchName = strchr(walk->pattern, '/') != nullptr ? relPath : file->name();
+        bool isDir = file->isDirectory();
+        if (walk->pattern[0] == '\0' || globMatch(walk->pattern, matchName)) {
+            Flags flags;
+            if (isDir) {
+                flags.set(Flags::DIR);
+            }
+            uint32_t fileSize = file->size();
+            uint32_t timestamp = file->getLastWrite();
+
+            uint32_t entrySize =
+                sizeof(flags) + sizeof(fileSize) + sizeof(timestamp) + strlen(relPath) + 2;
+            if (entrySize > rsp->getSpaceRemaining()) {
+                return false;
+            }
+            rsp->append(flags);
+            rsp->append(fileSize);
+            rsp->append(timestamp);
+            rsp->append(relPath);
+        }
+
+        if (isDir && walk->depth < walk->maxDepth) {
+            walk->dirs[walk->depth++] = *file;
+        }
+        *file = File();
+    }
+    return true;
+}
+
+void LittleFsPacketHandler::closeWalkCursor() {
+    WalkCursor* walk = &this->m_walkCursor;
+    walk->next = File();
+    while (walk->depth > 0) {
+        walk->depth--;
+        walk->dirs[walk->depth].close();
+        walk->dirs[walk->depth] = File();
+    }
+}
+
+bool LittleFsPacketHandler::searchLineMatches(char const* line, size_t lineLen) const {
+    SearchCursor const* search = &this->m_searchCursor;
+    bool ignoreCase = (search->flags & SearchFlags::IGNORE_CASE) != 0;
+    if ((search->flags & SearchFlags::REGEX) != 0) {
+        return regexMatch(search->pattern, line, lineLen, ignoreCase);
+    }
+    return bytesMatch(search->pattern, search->patternLen, line, lineLen, ignoreCase);
+}
+
+bool LittleFsPacketHandler::appendSearchLine(
+    Packet* rsp,
+    char const* name,
+    char const* line,
+    size_t lineLen,
+    bool* empty,
+    Error* err) {
+    SearchCursor* search = &this->m_searchCursor;
+    if (!this->searchLineMatches(line, lineLen)) {
+        if (search->afterLeft > 0) {
+            if (!appendSearchMatch(rsp, name, search->lineNumber, search->lineStart,
+                                   SearchLineFlags::CONTEXT, line, lineLen, *empty)) {
+                if (*empty) {
+                    *err = Error::UNSUPPORTED;
+                }
+                return false;
+            }
+            *empty = false;
+            search->afterLeft--;
+        } else if (search->context > 0) {
+            // Keep the line, in case it comes before a match.
+            uint8_t index = (search->firstBefore + search->numBefore) % LITTLEFS_SEARCH_MAX_CONTEXT;
+            if (search->numBefore < search->context) {
+                search->numBefore++;
+            } else {
+                search->firstBefore = (search->firstBefore + 1) % LITTLEFS_SEARCH_MAX_CONTEXT;
+            }
+            SearchLine* before = &search->before[index];
+            memcpy(before->data, line, lineLen);
+            before->len = lineLen;
+            before->start = search->lineStart;
+            before->number = search->lineNumber;
+        }
+        return true;
+    }
+
+    // A match goes in the same packet as the lines before it. They're only
+    // dropped when they won't fit in an empty packet along with it.
+    size_t space = rsp->getSpaceRemaining();
+    size_t groupSize = searchEntrySize(name, lineLen);
+    for (uint8_t i = 0; i < search->numBefore; i++) {
+        uint8_t index = (search->firstBefore + i) % LITTLEFS_SEARCH_MAX_CONTEXT;
+        groupSize += searchEntrySize(name, search->before[index].len);
+    }
+    uint8_t skip = 0;
+    if (groupSize > space) {
+        if (!*empty) {
+            return false;
+        }
+        while (skip < search->numBefore && groupSize > space) {
+            uint8_t index = (search->firstBefore + skip) % LITTLEFS_SEARCH_MAX_CONTEXT;
+            groupSize -= searchEntrySize(name, search->before[index].len);
+            skip++;
+        }
+    }
+    for (uint8_t i = skip; i < search->numBefore; i++) {
+        SearchLine const* before =
+            &search->before[(search->firstBefore + i) % LITTLEFS_SEARCH_MAX_CONTEXT];
+        appendSearchMatch(rsp, name, before->number, before->start, SearchLineFlags::CONTEXT,
+                          before->data, before->len, false);
+    }
+    // A match which is too big for an empty packet is truncated, since
+    // waiting for the next packet wouldn't help.
+    if (!appendSearchMatch(rsp, name, search->lineNumber, search->lineStart, 0, line, lineLen,
+                           *empty)) {
+        if (*empty) {
+            *err = Error::UNSUPPORTED;
+        }
+        return false;
+    }
+    *empty = false;
+    search->firstBefore = 0;
+    search->numBefore = 0;
+    search->afterLeft = search->context;
+    return true;
+}
+
+bool LittleFsPacketHandler::appendSearchMatches(Packet* rsp, Error* err) {
+    SearchCursor* search = &this->m_searchCursor;
+    char line[LITTLEFS_SEARCH_MAX_LINE];
+    uint32_t bytesScanned = 0;
+    bool empty = true;
+    while (true) {
+        if (!search->file) {
+            if (!search->dir) {
+                return true;
+            }
+            search->file = search->dir.openNextFile();
+            if (!search->file) {
+                search->dir.close();
+                search->dir = File();
+                return true;
+            }
+            if (search->file.isDirectory() ||
+                (search->glob[0] != '\0' && !globMatch(search->glob, search->file.name()))) {
+                search->file = File();
+                continue;
+            }
+            this->startSearchFile();
+        }
+
+        // A line which was cut off by the end of the last response (or slice)
+        // is scanned again from its start.
+        File* file = &search->file;
+        if (!this->seekFile(file, search->lineStart)) {
+            search->file = File();
+            continue;
+        }
+        char const* name = file->name();
+        uint32_t chunkOffset = search->lineStart;
+        size_t lineLen = 0;
+        while (true) {
+            if (bytesScanned >= LITTLEFS_SEARCH_SLICE_BYTES) {
+                return false;
+            }
+            size_t bytesRead = this->readFile(file, this->m_ioBuffer, sizeof(this->m_ioBuffer));
+            if (bytesRead == 0) {
+                break;
+            }
+            bytesScanned += bytesRead;
+            for (size_t i = 0; i < bytesRead; i++) {
+                char c = static_cast<char>(this->m_ioBuffer[i]);
+                bool endOfLine = (c == '\n');
+                if (!endOfLine) {
+                    line[lineLen++] = c;
+                    if (lineLen < sizeof(line)) {
+                        continue;
+                    }
+                }
+                // Lines which are too long are split into pieces, which all
+                // have the line number of the whole line.
+                size_t matchLen = (endOfLine && lineLen > 0 && line[lineLen - 1] == '\r')
+                                      ? lineLen - 1
+                                      : lineLen;
+                if (!this->appendSearchLine(rsp, name, line, matchLen, &empty, err)) {
+                    // Either the response is full, or the line can't be sent.
+                    return *err != Error::NONE;
+                }
+                search->lineStart = chunkOffset + i + 1;
+                if (endOfLine) {
+                    search->lineNumber++;
+                }
+                lineLen = 0;
+            }
+            chunkOffset += bytesRead;
+        }
+
+        // The last line of the file doesn't have to end with a newline.
+        if (lineLen > 0 && !this->appendSearchLine(rsp, name, line, lineLen, &empty, err)) {
+            return *err != Error::NONE;
+        }
+        search->file.close();
+        search->file = File();
+    }
+}
+
+void LittleFsPacketHandler::startSearchFile() {
+    SearchCursor* search = &this->m_searchCursor;
+    search->lineStart = 0;
+    search->lineNumber = 1;
+    search->firstBefore = 0;
+    search->numBefore = 0;
+    search->afterLeft = 0;
+}
+
+void LittleFsPacketHandler::closeSearchCursor() {
+    SearchCursor* search = &this->m_searchCursor;
+    search->file.close();
+    search->file = File();
+    search->dir.close();
+    search->dir = File();
+}
+
+LittleFsPacketHandler::Error LittleFsPacketHandler::readArchive(
+    uint8_t* data,
+    size_t length,
+    size_t* bytesRead) {
+    ExportCursor* exp = &this->m_exportCursor;
+    size_t len = 0;
+    while (len < length) {
+        if (exp->headerPos < exp->headerLen) {
+            size_t chunk = exp->headerLen - exp->headerPos;
+            if (chunk > length - len) {
+                chunk = length - len;
+            }
+            memcpy(&data[len], &exp->header[exp->headerPos], chunk);
+            exp->headerPos += chunk;
+            len += chunk;
+            continue;
+        }
+        if (exp->file) {
+            if (exp->fileLeft > 0) {
+                size_t chunk = exp->fileLeft;
+                if (chunk > length - len) {
+                    chunk = length - len;
+                }
+                size_t chunkRead = this->readFile(&exp->file, &data[len], chunk);
+                if (chunkRead == 0) {
+                    *bytesRead = len;
+                    return Error::READ_FAILED;
+                }
+                exp->crc.update(&data[len], chunkRead);
+                exp->fileLeft -= chunkRead;
+                len += chunkRead;
+                continue;
+            }
+            // All of the data has been sent, so follow it with its CRC.
+            this->closeFile(&exp->file);
+            exp->file = File();
+            uint32_t crc = exp->crc.value();
+            memcpy(exp->header, &crc, sizeof(crc));
+            exp->headerLen = sizeof(crc);
+            exp->headerPos = 0;
+            continue;
+        }
+        if (exp->ended) {
+            break;
+        }
+        if (exp->depth == 0) {
+            exp->header[0] = to_underlying(ArchiveRecord::END);
+            exp->headerLen = 1;
+            exp->headerPos = 0;
+            exp->ended = true;
+            continue;
+        }
+
+        File next = exp->dirs[exp->depth - 1].openNextFile();
+        if (!next) {
+            // Finished with this directory, so continue with its parent.
+            exp->depth--;
+            exp->dirs[exp->depth].close();
+            exp->dirs[exp->depth] = File();
+            continue;
+        }
+        char const* path = next.path();
+        size_t pathLen = strlen(path);
+        if (pathLen < exp->prefixLen) {
+            // Shouldn't happen, but don't run off the end of the path if it does.
+            continue;
+        }
+        bool isDir = next.isDirectory();
+        if (pathLen - exp->prefixLen > LITTLEFS_MAX_PATH_LEN ||
+            (isDir && exp->depth >= LEN(exp->dirs))) {
+            // Leaving the entry out would make the backup incomplete.
+            *bytesRead = len;
+            return Error::UNSUPPORTED;
+        }
+        uint32_t size = isDir ? 0 : next.size();
+        exp->headerLen = packArchiveHeader(
+            exp->header, isDir ? ArchiveRecord::DIR : ArchiveRecord::FILE, path + exp->prefixLen,
+            pathLen - exp->prefixLen, size, next.getLastWrite());
+        exp->headerPos = 0;
+        if (isDir) {
+            exp->dirs[exp->depth++] = next;
+        } else {
+            exp->file = next;
+            exp->fileLeft = size;
+            exp->crc.reset();
+        }
+    }
+    *bytesRead = len;
+    return Error::NONE;
+}
+
+void LittleFsPacketHandler::closeExportCursor() {
+    ExportCursor* exp = &this->m_exportCursor;
+    if (exp->file) {
+        this->closeFile(&exp->file);
+    }
+    exp->file = File();
+    while (exp->depth > 0) {
+        exp->depth--;
+        exp->dirs[exp->depth].close();
+        exp->dirs[exp->depth] = File();
+    }
+    exp->active = false;
+}
+
+LittleFsPacketHandler::Error LittleFsPacketHandler::importData(uint8_t const* data, size_t length) {
+    ImportState* imp = &this->m_import;
+    size_t pos = 0;
+    while (true) {
+        size_t chunk = length - pos;
+        if (chunk == 0 && imp->phase != ImportPhase::HEADER) {
+            return Error::NONE;
+        }
+        switch (imp->phase) {
+            case ImportPhase::HEADER: {
+                // The header is collected a piece at a time, since the type
+                // and path length say how long the rest of it is.
+                size_t needed = 1;
+                if (imp->headerLen >= 1 &&
+                    imp->header[0] != to_underlying(ArchiveRecord::END)) {
+                    needed = 3;
+                    if (imp->headerLen >= 3) {
+                        uint16_t pathLen;
+                        memcpy(&pathLen, &imp->header[1], sizeof(pathLen));
+                        if (pathLen > LITTLEFS_MAX_PATH_LEN) {
+                            return Error::UNSUPPORTED;
+                        }
+                        needed = ARCHIVE_HEADER_LEN + pathLen;
+                    }
+                }
+                if (imp->headerLen < needed) {
+                    if (chunk == 0) {
+                        return Error::NONE;
+                    }
+                    if (chunk > needed - imp->headerLen) {
+                        chunk = needed - imp->headerLen;
+                    }
+                    memcpy(&imp->header[imp->headerLen], &data[pos], chunk);
+                    imp->headerLen += chunk;
+                    pos += chunk;
+                    continue;
+                }
+                Error err = this->importRecord();
+                if (err != Error::NONE) {
+                    return err;
+                }
+                imp->headerLen = 0;
+                continue;
+            }
+
+            case ImportPhase::DATA: {
+                if (chunk > imp->fileLeft) {
+                    chunk = imp->fileLeft;
+                }
+                if (this->writeFile(&imp->file, &data[pos], chunk) != chunk) {
+                    return Error::WRITE_FAILED;
+                }
+                imp->crc.update(&data[pos], chunk);
+                imp->fileLeft -= chunk;
+                pos += chunk;
+                if (imp->fileLeft == 0) {
+                    this->closeFile(&imp->file);
+                    imp->phase = ImportPhase::CRC;
+                }
+                continue;
+            }
+
+            case ImportPhase::CRC: {
+                uint32_t crc;
+                if (chunk > sizeof(crc) - imp->headerLen) {
+                    chunk = sizeof(crc) - imp->headerLen;
+                }
+                memcpy(&imp->header[imp->headerLen], &data[pos], chunk);
+                imp->headerLen += chunk;
+                pos += chunk;
+                if (imp->headerLen == sizeof(crc)) {
+                    memcpy(&crc, imp->header, sizeof(crc));
+                    if (crc != imp->crc.value()) {
+                        return Error::VERIFY_FAILED;
+                    }
+                    imp->headerLen = 0;
+                    imp->phase = ImportPhase::HEADER;
+                }
+                continue;
+            }
+
+            case ImportPhase::DONE: {
+                // Anything after the END record is ignored.
+                return Error::NONE;
+            }
+        }
+    }
+}
+
+LittleFsPacketHandler::Error LittleFsPacketHandler::importRecord() {
+    ImportState* imp = &this->m_import;
+    ArchiveRecord type = static_cast<ArchiveRecord>(imp->header[0]);
+    if (type == ArchiveRecord::END) {
+        imp->phase = ImportPhase::DONE;
+        return Error::NONE;
+    }
+    uint16_t pathLen;
+    uint32_t size;
+    memcpy(&pathLen, &imp->header[1], sizeof(pathLen));
+    memcpy(&size, &imp->header[3 + pathLen], sizeof(size));
+
+    // Archives come from the host, so a path like ../../boot.cfg mustn't be
+    // able to reach outside of the import directory.
+    char const* recordPath = reinterpret_cast<char const*>(&imp->header[3]);
+    if (!isSafeArchivePath(recordPath, pathLen)) {
+        return Error::INVALID_PATH;
+    }
+    char path[LITTLEFS_MAX_PATH_LEN];
+    size_t dirLen = strlen(imp->dir);
+    if (dirLen + 1 + pathLen >= sizeof(path)) {
+        return Error::UNSUPPORTED;
+    }
+    memcpy(path, imp->dir, dirLen);
+    path[dirLen] = '/';
+    memcpy(&path[dirLen + 1], recordPath, pathLen);
+    path[dirLen + 1 + pathLen] = '\0';
+
+    // The timestamp can't be set through the Arduino FS API, so it's ignored.
+    switch (type) {
+        case ArchiveRecord::DIR: {
+            if (!this->fsMkdir(path) && !this->fsExists(path)) {
+                return Error::MKDIR_FAILED;
+            }
+            return Error::NONE;
+        }
+
+        case ArchiveRecord::FILE: {
+            this->evictCachedFiles(path);
+            imp->file = this->openFile(path, FILE_WRITE);
+            if (!imp->file) {
+                return Error::UNABLE_TO_OPEN_FILE;
+            }
+            imp->fileLeft = size;
+            imp->crc.reset();
+            imp->phase = ImportPhase::DATA;
+            if (size == 0) {
+                this->closeFile(&imp->file);
+                imp->phase = ImportPhase::CRC;
+            }
+            return Error::NONE;
+        }
+
+        default: {
+            return Error::UNSUPPORTED;
+        }
+    }
+}
+
+void LittleFsPacketHandler::closeImport() {
+    ImportState* imp = &this->m_import;
+    if (imp->file) {
+        this->closeFile(&imp->file);
+    }
+    imp->file = File();
+    imp->active = false;
+}
+
+LittleFsPacketHandler::CachedFile* LittleFsPacketHandler::openCachedFile(
+    char const* filename,
+    uint32_t offset,
+    Error* err) {
+    CachedFile* cached = nullptr;
+    for (auto& entry : this->m_fileCache) {
+        if (entry.file && strcmp(entry.path, filename) == 0) {
+            cached = &entry;
+            break;
+        }
+    }
+#if LITTLEFS_READ_AHEAD_SIZE > 0
+    if (cached != nullptr && cached == this->m_readAheadFile) {
+        // Prefetched data wasn't used, so the file is positioned past it.
+        this->dropReadAhead();
+    }
+#endif
+
+    if (cached == nullptr) {
+        // Reuse a free entry, or the least recently used one.
+        cached = &this->m_fileCache[0];
+        for (auto& entry : this->m_fileCache) {
+            if (!entry.file) {
+                cached = &entry;
+                break;
+            }
+            if (entry.lastUsed < cached->lastUsed) {
+                cached = &entry;
+            }
+        }
+        this->closeCachedFile(cached);
+
+        cached->file = this->openFile(filename, FILE_READ);
+        if (!cached->file) {
+            *err = Error::UNABLE_TO_OPEN_FILE;
+            return nullptr;
+        }
+        if (strlen(filename) < sizeof(cached->path)) {
+            strcpy(cached->path, filename);
+        }
+        cached->sequential = false;
+    } else {
+        cached->sequential = cached->file.position() == offset;
+    }
+    cached->lastUsed = ++this->m_cacheTick;
+
+    if (!this->seekFile(&cached->file, offset)) {
+        this->closeCachedFile(cached);
+        *err = Error::SEEK_FAILED;
+        return nullptr;
+    }
+    return cached;
+}
+
+LittleFsPacketHandler::CachedFile* LittleFsPacketHandler::openCachedRegularFile(
+    char const* filename,
+    uint32_t offset,
+    Error* err) {
+    CachedFile* cached = this->openCachedFile(filename, offset, err);
+    if (cached != nullptr && cached->file.isDirectory()) {
+        this->closeCachedFile(cached);
+        *err = Error::UNABLE_TO_OPEN_FILE;
+        return nullptr;
+    }
+    return cached;
+}
+
+void LittleFsPacketHandler::releaseCachedFile(CachedFile* cached) {
+    if (cached->path[0] == '\0') {
+        // The filename was too long to remember, so don't keep it open.
+        this->closeCachedFile(cached);
+    }
+}
+
+void LittleFsPacketHandler::closeCachedFile(CachedFile* cached) {
+#if LITTLEFS_READ_AHEAD_SIZE > 0
+    if (cached == this->m_readAheadFile) {
+        this->dropReadAhead();
+    }
+#endif
+    if (cached->file) {
+        this->closeFile(&cached->file);
+    }
+    cached->file = File();
+    cached->path[0] = '\0';
+}
+
+void LittleFsPacketHandler::evictCachedFiles(char const* path) {
+    for (auto& entry : this->m_fileCache) {
+        if (entry.file && (path == nullptr || isSameOrChild(entry.path, path))) {
+            this->closeCachedFile(&entry);
+        }
+    }
+    this->forgetMetadata(path);
+}
+
+void LittleFsPacketHandler::forgetMetadata(char const* path) {
+#if LITTLEFS_META_CACHE_SIZE > 0
+    if (path == nullptr) {
+        for (auto& entry : this->m_metaCache) {
+            entry.pathLen = 0;
+        }
+        return;
+    }
+    size_t pathLen = strlen(path);
+    while (pathLen > 1 && path[pathLen - 1] == '/') {
+        pathLen--;
+    }
+    // The CRC is built up a character at a time, so that each directory
+    // leading up to path (starting with /) can be forgotten along the way.
+    Crc32 crc;
+    for (size_t len = 1; len <= pathLen; len++) {
+        crc.update(&path[len - 1], 1);
+        if (len != 1 && len != pathLen && path[len] != '/') {
+            continue;
+        }
+        uint32_t hash = crc.value();
+        for (auto& entry : this->m_metaCache) {
+            if (entry.pathLen == len && entry.hash == hash) {
+                entry.pathLen = 0;
+            }
+        }
+    }
+#endif
+}
+
+#if LITTLEFS_META_CACHE_SIZE > 0
+LittleFsPacketHandler::MetaEntry* LittleFsPacketHandler::findMetadata(
+    char const* path,
+    size_t pathLen) {
+    Crc32 crc;
+    crc.update(path, pathLen);
+    uint32_t hash = crc.value();
+    for (auto& entry : this->m_metaCache) {
+        if (entry.pathLen != pathLen || entry.hash != hash) {
+            continue;
+        }
+        if (millis() - entry.filled >= LITTLEFS_META_CACHE_MSEC) {
+            entry.pathLen = 0;
+            return nullptr;
+        }
+        entry.lastUsed = ++this->m_metaTick;
+        return &entry;
+    }
+    return nullptr;
+}
+
+LittleFsPacketHandler::MetaEntry* LittleFsPacketHandler::allocMetadata(
+    char const* path,
+    size_t pathLen) {
+    // Replace the entry for path if there is one, otherwise use a free entry,
+    // otherwise the least recently used one.
+    Crc32 crc;
+    crc.update(path, pathLen);
+    uint32_t hash = crc.value();
+    MetaEntry* oldest = &this->m_metaCache[0];
+    for (auto& entry : this->m_metaCache) {
+        if (entry.pathLen == pathLen && entry.hash == hash) {
+            oldest = &entry;
+            break;
+        }
+        if (oldest->pathLen != 0 && (entry.pathLen == 0 || entry.lastUsed < oldest->lastUsed)) {
+            oldest = &entry;
+        }
+    }
+    oldest->hash = hash;
+    oldest->pathLen = pathLen;
+    oldest->filled = millis();
+    oldest->lastUsed = ++this->m_metaTick;
+    return oldest;
+}
+#endif
+
+bool LittleFsPacketHandler::scanTree(char const* path, TreeTotals* totals) {
+    File dirs[LITTLEFS_WALK_MAX_DEPTH];
+    uint8_t depth = 0;
+    dirs[depth] = this->fsOpen(path);
+    if (!dirs[depth]) {
+        return false;
+    }
+    depth++;
+    while (depth > 0) {
+        File file = dirs[depth - 1].openNextFile();
+        if (!file) {
+            depth--;
+            dirs[depth].close();
+            dirs[depth] = File();
+            continue;
+        }
+        if (file.isDirectory()) {
+            totals->numDirs++;
+            if (depth < LEN(dirs)) {
+                dirs[depth++] = file;
+                continue;
+            }
+            totals->truncated = true;
+        } else {
+            uint32_t fileSize = file.size();
+            totals->numFiles++;
+            totals->fileBytes += fileSize;
+            totals->fileBlocks += (fileSize + LITTLEFS_BLOCK_SIZE - 1) / LITTLEFS_BLOCK_SIZE;
+        }
+        file.close();
+    }
+    return true;
+}
+
+#if LITTLEFS_READ_AHEAD_SIZE > 0
+uint32_t LittleFsPacketHandler::readAheadIntoPacket(uint32_t length, Packet* rsp) {
+    if (length > rsp->getSpaceRemaining()) {
+        length = rsp->getSpaceRemaining();
+    }
+    uint32_t bytesCopied = this->m_readAheadLen - this->m_readAheadStart;
+    if (bytesCopied > length) {
+        bytesCopied = length;
+    }
+    memcpy(
+        rsp->getWriteData(bytesCopied), &this->m_readAheadBuffer[this->m_readAheadStart],
+        bytesCopied);
+    this->m_readAheadStart += bytesCopied;
+    this->m_readAheadOffset += bytesCopied;
+
+    CachedFile* cached = this->m_readAheadFile;
+    cached->lastUsed = ++this->m_cacheTick;
+    if (this->m_readAheadStart < this->m_readAheadLen) {
+        return bytesCopied;
+    }
+    // Everything prefetched has been sent, so the file is positioned at the
+    // next byte the host wants.
+    this->dropReadAhead();
+    return bytesCopied + this->readIntoPacket(&cached->file, length - bytesCopied, rsp);
+}
+
+void LittleFsPacketHandler::startReadAhead(CachedFile* cached, uint32_t offset, uint32_t length) {
+    if (length > sizeof(this->m_readAheadBuffer)) {
+        length = sizeof(this->m_readAheadBuffer);
+    }
+    this->m_readAheadFile = cached;
+    this->m_readAheadOffset = offset;
+    this->m_readAheadStart = 0;
+    this->m_readAheadLen = 0;
+    this->m_readAheadPending = length;
+}
+
+void LittleFsPacketHandler::dropReadAhead() {
+    this->m_readAheadFile = nullptr;
+    this->m_readAheadStart = 0;
+    this->m_readAheadLen = 0;
+    this->m_readAheadPending = 0;
+}
+#endif
+
+LittleFsPacketHandler::FileHandle* LittleFsPacketHandler::allocFileHandle(uint8_t* handle) {
+    for (uint8_t i = 0; i < LEN(this->m_fileHandles); i++) {
+        if (!this->m_fileHandles[i].file) {
+            *handle = i;
+            return &this->m_fileHandles[i];
+        }
+    }
+    return nullptr;
+}
+
+LittleFsPacketHandler::FileHandle* LittleFsPacketHandler::getFileHandle(uint8_t handle) {
+    if (handle >= LEN(this->m_fileHandles) || !this->m_fileHandles[handle].file) {
+        return nullptr;
+    }
+    return &this->m_fileHandles[handle];
+}
+
+void LittleFsPacketHandler::closeFileHandle(FileHandle* fileHandle) {
+    if (fileHandle->file) {
+        this->closeFile(&fileHandle->file);
+    }
+    fileHandle->file = File();
+    fileHandle->path[0] = '\0';
+    fileHandle->uploadPath[0] = '\0';
+}
+
+void LittleFsPacketHandler::handleAppend(Packet const& cmd, Packet* rsp) {
+    this->handleWriteAppend(FILE_APPEND, cmd, rsp);
+}
+
+void LittleFsPacketHandler::handleBatch(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - flags (BatchFlags)
+    //      u8  - number of operations
+    //  For each operation:
+    //      u8  - command (MKDIR, REMOVE, RMDIR or RENAME)
+    //      The same arguments as the command takes on its own.
+    // Response:
+    //      u8  - error code (UNSUPPORTED if an operation couldn't be parsed)
+    //      u8  - number of operations which were run
+    //      u8  - error code of each operation which was run
+    Unpacker unpacker(cmd);
+    uint8_t flags;
+    uint8_t numOps;
+    unpacker.unpack(&flags);
+    unpacker.unpack(&numOps);
+
+    rsp->setCommand(Command::BATCH);
+    uint8_t* errPtr = rsp->getWriteData();
+    rsp->append(to_underlying(Error::NONE));
+    uint8_t* numRunPtr = rsp->getWriteData();
+    rsp->append(static_cast<uint8_t>(0));
+
+    for (uint8_t i = 0; i < numOps; i++) {
+        Command::Type op;
+        unpacker.unpack(&op);
+
+        char const* name;
+        Error err;
+        switch (op) {
+            case Command::MKDIR: {
+                unpacker.unpack(&name);
+                err = this->mkDir(name);
+                break;
+            }
+            case Command::REMOVE: {
+                unpacker.unpack(&name);
+                err = this->removeFile(name);
+                break;
+            }
+            case Command::RMDIR: {
+                unpacker.unpack(&name);
+                err = this->rmDir(name);
+                break;
+            }
+            case Command::RENAME: {
+                char const* newName;
+                unpacker.unpack(&name);
+                unpacker.unpack(&newName);
+                err = this->renameFile(name, newName);
+                break;
+            }
+            default: {
+                // The arguments can't be skipped, so nothing after this can run.
+                *errPtr = to_underlying(Error::UNSUPPORTED);
+                return;
+            }
+        }
+        rsp->append(to_underlying(err));
+        (*numRunPtr)++;
+        if (err != Error::NONE && (flags & BatchFlags::STOP_ON_ERROR) != 0) {
+            return;
+        }
+    }
+}
+
+void LittleFsPacketHandler::handleCaps(Packet const& cmd, Packet* rsp) {
+    // Command: No Data
+    // Response:
+    //      u32 - capabilities (Capabilities)
+    //      u32 - size of the command packet buffer
+    //      u32 - size of the response packet buffer
+    //      u32 - LittleFS block size
+    //      u8  - number of STREAM_WRITE packets which may be in flight
+    //      u32 - largest amount of uncompressed data in READ/WRITE_COMPRESSED
+    rsp->setCommand(Command::CAPS);
+
+    Capabilities caps;
+    if (this->m_bus != nullptr) {
+        caps.set(Capabilities::STREAM);
+    }
+#if LITTLEFS_HASH_SHA256
+    caps.set(Capabilities::HASH_SHA256);
+#endif
+#if LITTLEFS_COMPRESSION
+    caps.set(Capabilities::COMPRESSION);
+#endif
+    caps.set(Capabilities::JOBS);
+    caps.set(Capabilities::LIST_COMPACT);
+    caps.set(Capabilities::UPLOAD);
+    caps.set(Capabilities::SEARCH);
+    if (this->m_bus != nullptr) {
+        caps.set(Capabilities::TAIL);
+    }
+    caps.set(Capabilities::ARCHIVE);
+    caps.set(Capabilities::STAT);
+    rsp->append(caps);
+    rsp->append(static_cast<uint32_t>(cmd.getMaxDataLength()));
+    rsp->append(static_cast<uint32_t>(rsp->getMaxDataLength()));
+    rsp->append(static_cast<uint32_t>(LITTLEFS_BLOCK_SIZE));
+    rsp->append(static_cast<uint8_t>(LITTLEFS_STREAM_WRITE_WINDOW));
+#if LITTLEFS_COMPRESSION
+    rsp->append(static_cast<uint32_t>(LITTLEFS_COMPRESS_BUFFER_SIZE));
+#else
+    rsp->append(static_cast<uint32_t>(0));
+#endif
+}
+
+void LittleFsPacketHandler::handleClose(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8 - handle
+    // Response:
+    //      u8 - error code.
+    rsp->setCommand(Command::CLOSE);
+    Unpacker unpacker(cmd);
+    uint8_t handle;
+    unpacker.unpack(&handle);
+
+    FileHandle* fileHandle = this->getFileHandle(handle);
+    if (fileHandle == nullptr) {
+        rsp->appendByte(to_underlying(Error::INVALID_HANDLE));
+        return;
+    }
+    this->closeFileHandle(fileHandle);
+    rsp->appendByte(to_underlying(Error::NONE));
+}
+
+void LittleFsPacketHandler::handleCopy(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      str - source filename
+    //      str - destination filename
+    // Response:
+    //      u8  - error code
+    //      u8  - flags (StreamFlags::LAST is set on the final response)
+    //      u32 - number of bytes copied so far
+    //      u32 - size of the source file
+    //
+    // If the handler has a bus, then a progress response (without
+    // StreamFlags::LAST) is sent every LITTLEFS_COPY_PROGRESS_BYTES. If the
+    // copy fails part way, the partial destination file is removed.
+    Unpacker unpacker(cmd);
+    char const* srcName;
+    char const* dstName;
+    unpacker.unpack(&srcName);
+    unpacker.unpack(&dstName);
+
+    rsp->setCommand(Command::COPY);
+    uint8_t* errPtr = rsp->getWriteData();
+    rsp->append(to_underlying(Error::NONE));
+    uint8_t* flagsPtr = rsp->getWriteData();
+    rsp->append(static_cast<uint8_t>(StreamFlags::LAST));
+    uint32_t* copiedPtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
+    rsp->append(static_cast<uint32_t>(0));
+    uint32_t* sizePtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
+    rsp->append(static_cast<uint32_t>(0));
+
+    if (strcmp(srcName, dstName) == 0) {
+        *errPtr = to_underlying(Error::UNABLE_TO_OPEN_FILE);
+        return;
+    }
+    File src = this->openFile(srcName, FILE_READ);
+    if (!src || src.isDirectory()) {
+        if (src) {
+            this->closeFile(&src);
+        }
+        *errPtr = to_underlying(Error::UNABLE_TO_OPEN_FILE);
+        return;
+    }
+    *sizePtr = src.size();
+
+    this->evictCachedFiles(dstName);
+    File dst = this->openFile(dstName, FILE_WRITE);
+    if (!dst) {
+        this->closeFile(&src);
+        *errPtr = to_underlying(Error::UNABLE_TO_OPEN_FILE);
+        return;
+    }
+
+    Error err = Error::NONE;
+    uint32_t nextProgress = LITTLEFS_COPY_PROGRESS_BYTES;
+    while (*copiedPtr < *sizePtr) {
+        size_t bytesRead = this->readFile(&src, this->m_ioBuffer, sizeof(this->m_ioBuffer));
+        if (bytesRead == 0) {
+            err = Error::READ_FAILED;
+            break;
+        }
+        if (this->writeFile(&dst, this->m_ioBuffer, bytesRead) != bytesRead) {
+            err = Error::WRITE_FAILED;
+            break;
+        }
+        *copiedPtr += bytesRead;
+
+        if (this->m_bus != nullptr && *copiedPtr >= nextProgress && *copiedPtr < *sizePtr) {
+            // Let the host know that we're still busy, so it doesn't time out.
+            *flagsPtr = 0;
+            this->m_bus->writePacket(*rsp);
+            *flagsPtr = StreamFlags::LAST;
+            nextProgress += LITTLEFS_COPY_PROGRESS_BYTES;
+        }
+    }
+    this->closeFile(&dst);
+    this->closeFile(&src);
+    if (err != Error::NONE) {
+        // Don't leave part of the file behind.
+        this->fsRemove(dstName);
+        *errPtr = to_underlying(err);
+    }
+}
+
+void LittleFsPacketHandler::handleExport(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - cursor (NO_CURSOR to start a new archive)
+    //      u8  - window (number of response packets to send)
+    //  Only used when starting a new archive:
+    //      u8  - flags (ExportFlags)
+    //      str - dirname
+    // Response (up to window packets, the last one has StreamFlags::LAST set):
+    //      u8  - error code
+    //      u8  - flags (StreamFlags, END_OF_FILE is set once the archive is done)
+    //      u8  - sequence number (0 to window - 1)
+    //      u8  - cursor to pass to the next EXPORT (NO_CURSOR when done)
+    //      u32 - offset of the data within the archive
+    //      u8  - codec (Codec)
+    //      u32 - length (uncompressed)
+    //      bytes - data (the rest of the packet)
+    //
+    // The archive is a stream of ArchiveRecords describing everything inside
+    // dirname, which is split across the packets without regard for the
+    // record boundaries. The cursor is freed if it isn't used for
+    // LITTLEFS_DIR_CURSOR_TIMEOUT_MSEC.
+    Unpacker unpacker(cmd);
+    uint8_t cursorNum;
+    uint8_t window;
+    unpacker.unpack(&cursorNum);
+    unpacker.unpack(&window);
+
+    if (window == 0 || this->m_bus == nullptr) {
+        window = 1;
+    }
+    this->expireCursors();
+
+    ExportCursor* exp = &this->m_exportCursor;
+    Error err = Error::NONE;
+    if (cursorNum == NO_CURSOR) {
+        uint8_t flags;
+        char const* dirName;
+        unpacker.unpack(&flags);
+        unpacker.unpack(&dirName);
+
+        // Only one EXPORT can be in progress, so starting a new one replaces it.
+        this->closeExportCursor();
+        if (++this->m_exportCursorNum == NO_CURSOR) {
+            this->m_exportCursorNum = 0;
+        }
+        exp->dirs[0] = this->fsOpen(dirName);
+        if (!exp->dirs[0] || !exp->dirs[0].isDirectory()) {
+            exp->dirs[0] = File();
+            err = Error::UNABLE_TO_OPEN_FILE;
+        } else {
+            exp->depth = 1;
+            size_t rootLen = strlen(exp->dirs[0].path());
+            exp->prefixLen =
+                (rootLen > 0 && exp->dirs[0].path()[rootLen - 1] == '/') ? rootLen : rootLen + 1;
+            exp->headerLen = 0;
+            exp->headerPos = 0;
+            exp->active = true;
+            exp->ended = false;
+            exp->flags = flags;
+            exp->offset = 0;
+        }
+    } else if (cursorNum != this->m_exportCursorNum || !exp->active) {
+        err = Error::INVALID_CURSOR;
+    }
+
+    for (uint8_t seq = 0;; seq++) {
+        rsp->setCommand(Command::EXPORT);
+        rsp->setDataLength(0);
+        uint8_t* errPtr = rsp->getWriteData();
+        rsp->append(to_underlying(err));
+        uint8_t* flagsPtr = rsp->getWriteData();
+        rsp->append(static_cast<uint8_t>(seq + 1 == window ? StreamFlags::LAST : 0));
+        rsp->append(seq);
+        uint8_t* cursorPtr = rsp->getWriteData();
+        rsp->append(this->m_exportCursorNum);
+        rsp->append(err == Error::NONE ? exp->offset : 0);
+        uint8_t* codecPtr = rsp->getWriteData();
+        rsp->append(to_underlying(Codec::NONE));
+        uint32_t* lenPtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
+        rsp->append(static_cast<uint32_t>(0));
+
+        size_t bytesRead = 0;
+        if (err == Error::NONE) {
+            exp->lastUsed = millis();
+            size_t space = rsp->getSpaceRemaining();
+            uint8_t* data = rsp->getWriteData(0);
+            size_t dataLen;
+#if LITTLEFS_COMPRESSION
+            if ((exp->flags & ExportFlags::COMPRESS) != 0) {
+                // Only read what will fit uncompressed, since data taken from
+                // the archive can't be put back if it doesn't compress.
+                if (space > sizeof(this->m_compressBuffer)) {
+                    space = sizeof(this->m_compressBuffer);
+                }
+                err = this->readArchive(this->m_compressBuffer, space, &bytesRead);
+                dataLen = this->m_lz4.compress(this->m_compressBuffer, bytesRead, data, space);
+                if (dataLen > 0 && dataLen < bytesRead) {
+                    *codecPtr = to_underlying(Codec::LZ4);
+                } else {
+                    dataLen = bytesRead;
+                    memcpy(data, this->m_compressBuffer, dataLen);
+                }
+            } else {
+                err = this->readArchive(data, space, &bytesRead);
+                dataLen = bytesRead;
+            }
+#else
+            (void)codecPtr;
+            err = this->readArchive(data, space, &bytesRead);
+            dataLen = bytesRead;
+#endif
+            (void)rsp->getWriteData(dataLen);
+            *lenPtr = bytesRead;
+            exp->offset += bytesRead;
+        }
+
+        if (err != Error::NONE) {
+            *errPtr = to_underlying(err);
+            this->closeExportCursor();
+            *flagsPtr |= StreamFlags::LAST;
+            *cursorPtr = NO_CURSOR;
+            return;
+        }
+        if (exp->ended && exp->headerPos == exp->headerLen) {
+            this->closeExportCursor();
+            *flagsPtr |= StreamFlags::LAST | StreamFlags::END_OF_FILE;
+            *cursorPtr = NO_CURSOR;
+        }
+        if ((*flagsPtr & StreamFlags::LAST) != 0) {
+            // The last packet is sent by the bus as the reply to the command.
+            return;
+        }
+        this->m_bus->writePacket(*rsp);
+    }
+}
+
+void LittleFsPacketHandler::handleFlush(Packet const& /*cmd*/, Packet* rsp) {
+    // Command: No Data
+    // Response:
+    //      u8 - Error code
+    //
+    // Writes any buffered APPEND data (and closes the file), and reports any
+    // error which occurred while writing it.
+    this->flushAppendBuffer(true);
+    rsp->setCommand(Command::FLUSH);
+    rsp->appendByte(to_underlying(this->m_appendError));
+    this->m_appendError = Error::NONE;
+}
+
+void LittleFsPacketHandler::handleFormat(Packet const& /*cmd*/, Packet* rsp) {
+    // Command: No Data
+    // Response:
+    //      u8 - Error Code (BUSY while a job is running)
+    //
+    // dispatchPacket returns BUSY while a job is running, since the job would
+    // carry on with its files on the new file system.
+    rsp->setCommand(Command::FORMAT);
+
+    this->evictCachedFiles(nullptr);
+    for (auto& fileHandle : this->m_fileHandles) {
+        this->closeFileHandle(&fileHandle);
+    }
+    for (auto& cursor : this->m_dirCursors) {
+        this->closeDirCursor(&cursor);
+    }
+    this->closeWalkCursor();
+    this->closeSearchCursor();
+    this->closeExportCursor();
+    this->closeImport();
+    for (auto& watch : this->m_tailWatches) {
+        this->closeTailWatch(&watch);
+    }
+    this->abortPatch();
+    if (this->m_mounts[0].backend->format()) {
+        rsp->appendByte(to_underlying(Error::NONE));
+    } else {
+        rsp->appendByte(to_underlying(Error::FORMAT_FAILED));
+    }
+}
+
+void LittleFsPacketHandler::handleHash(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      str - filename
+    //      u32 - offset
+    //      u32 - length (TO_END_OF_FILE hashes everything after offset)
+    //      u8  - hash type (HashType)
+    // Response:
+    //      u8  - error code
+    //      u32 - number of bytes hashed
+    //      u8  - digest length
+    //      bytes - digest
+    Unpacker unpacker(cmd);
+    char const* filename;
+    uint32_t offset;
+    uint32_t length;
+    uint8_t hashType;
+
+    unpacker.unpack(&filename);
+    unpacker.unpack(&offset);
+    unpacker.unpack(&length);
+    unpacker.unpack(&hashType);
+
+    rsp->setCommand(Command::HASH);
+    uint8_t* errPtr = rsp->getWriteData();
+    rsp->append(to_underlying(Error::NONE));
+    uint32_t* hashedPtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
+    rsp->append(static_cast<uint32_t>(0));
+
+    switch (static_cast<HashType>(hashType)) {
+        case HashType::CRC32:
+#if LITTLEFS_HASH_SHA256
+        case HashType::SHA256:
+#endif
+            break;
+        default: {
+            *errPtr = to_underlying(Error::UNSUPPORTED);
+            rsp->appendByte(0);
+            return;
+        }
+    }
+
+    Error err = Error::NONE;
+    CachedFile* cached = this->openCachedRegularFile(filename, offset, &err);
+    if (cached == nullptr) {
+        *errPtr = to_underlying(err);
+        rsp->appendByte(0);
+        return;
+    }
+
+    Crc32 crc;
+#if LITTLEFS_HASH_SHA256
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+#endif
+    while (*hashedPtr < length) {
+        uint32_t count = sizeof(this->m_ioBuffer);
+        if (length - *hashedPtr < count) {
+            count = length - *hashedPtr;
+        }
+        size_t bytesRead = this->readFile(&cached->file, this->m_ioBuffer, count);
+        if (bytesRead == 0) {
+            break;
+        }
+        if (static_cast<HashType>(hashType) == HashType::CRC32) {
+            crc.update(this->m_ioBuffer, bytesRead);
+        }
+#if LITTLEFS_HASH_SHA256
+        else {
+            mbedtls_sha256_update(&sha, this->m_ioBuffer, bytesRead);
+        }
+#endif
+        *hashedPtr += bytesRead;
+    }
+    this->releaseCachedFile(cached);
+
+    if (static_cast<HashType>(hashType) == HashType::CRC32) {
+        uint32_t digest = crc.value();
+        rsp->appendByte(sizeof(digest));
+        rsp->append(digest);
+    }
+#if LITTLEFS_HASH_SHA256
+    else {
+        uint8_t digest[32];
+        mbedtls_sha256_finish(&sha, digest);
+        rsp->appendByte(sizeof(digest));
+        rsp->appendData(sizeof(digest), digest);
+    }
+    mbedtls_sha256_free(&sha);
+#endif
+}
+
+void LittleFsPacketHandler::handleImport(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - flags (ImportFlags)
+    //      u32 - offset of the data within the archive
+    //      str - dirname to unpack into (only with ImportFlags::BEGIN)
+    //      u8  - codec (Codec)
+    //      u32 - length (uncompressed, at most LITTLEFS_COMPRESS_BUFFER_SIZE)
+    //      u32 - data length
+    //      bytes - data
+    // Response:
+    //      u8  - error code
+    //      u8  - flags (StreamFlags::END_OF_FILE once the END record has been unpacked)
+    //      u32 - number of archive bytes unpacked (where the next chunk should start)
+    //
+    // The archive is in the format sent by EXPORT. Like STREAM_WRITE, the host
+    // may send several chunks before waiting for their responses. A chunk
+    // which starts past the data unpacked so far is rejected with
+    // OUT_OF_SEQUENCE, and the host resends starting from the returned
+    // offset. Directories are created as needed and files are replaced, but
+    // nothing is removed. A record whose path starts with /, has a ..
+    // component or holds a null fails with INVALID_PATH. Any error stops the
+    // import.
+    Unpacker unpacker(cmd);
+    uint8_t flags;
+    uint32_t offset;
+    unpacker.unpack(&flags);
+    unpacker.unpack(&offset);
+
+    rsp->setCommand(Command::IMPORT);
+    uint8_t* errPtr = rsp->getWriteData();
+    rsp->append(to_underlying(Error::NONE));
+    uint8_t* flagsPtr = rsp->getWriteData();
+    rsp->append(static_cast<uint8_t>(0));
+    uint32_t* committedPtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
+    rsp->append(static_cast<uint32_t>(0));
+
+    ImportState* imp = &this->m_import;
+    if ((flags & ImportFlags::BEGIN) != 0) {
+        char const* dirName;
+        unpacker.unpack(&dirName);
+        this->closeImport();
+        size_t dirLen = strlen(dirName);
+        if (dirLen > 0 && dirName[dirLen - 1] == '/') {
+            // Paths in the archive are appended after a slash.
+            dirLen--;
+        }
+        if (dirLen >= sizeof(imp->dir)) {
+            *errPtr = to_underlying(Error::UNSUPPORTED);
+            return;
+        }
+        memcpy(imp->dir, dirName, dirLen);
+        imp->dir[dirLen] = '\0';
+        if (dirLen > 0 && !this->fsExists(imp->dir) && !this->fsMkdir(imp->dir)) {
+            *errPtr = to_underlying(Error::MKDIR_FAILED);
+            return;
+        }
+        imp->headerLen = 0;
+        imp->phase = ImportPhase::HEADER;
+        imp->offset = 0;
+        imp->active = true;
+    }
+
+    uint8_t codec;
+    uint32_t length;
+    uint32_t dataLen;
+    uint8_t const* data;
+    unpacker.unpack(&codec);
+    unpacker.unpack(&length);
+    unpacker.unpack(&dataLen);
+    unpacker.unpack(dataLen, &data);
+
+    if (!imp->active) {
+        *errPtr = to_underlying(Error::INVALID_CURSOR);
+        return;
+    }
+    imp->lastUsed = millis();
+    *committedPtr = imp->offset;
+    if (offset > imp->offset) {
+        *errPtr = to_underlying(Error::OUT_OF_SEQUENCE);
+        return;
+    }
+
+    Error err = Error::NONE;
+    switch (static_cast<Codec>(codec)) {
+        case Codec::NONE: {
+            if (dataLen != length) {
+                err = Error::WRITE_FAILED;
+            }
+            break;
+        }
+#if LITTLEFS_COMPRESSION
+        case Codec::LZ4: {
+            size_t decompressedLen;
+            if (!Lz4::decompress(
+                    data, dataLen, this->m_compressBuffer, sizeof(this->m_compressBuffer),
+                    &decompressedLen) ||
+                decompressedLen != length) {
+                err = Error::WRITE_FAILED;
+            }
+            data = this->m_compressBuffer;
+            break;
+        }
+#endif
+        default: {
+            err = Error::UNSUPPORTED;
+            break;
+        }
+    }
+    // offset isn't past imp->offset, so this can't wrap.
+    uint32_t skip = imp->offset - offset;
+    if (err == Error::NONE && length > skip) {
+        if (length - skip > UINT32_MAX - imp->offset) {
+            // The archive would be larger than 4G.
+            err = Error::UNSUPPORTED;
+        } else {
+            // Skip anything which was unpacked from an earlier copy of the
+            // chunk. The chunk may grow a file opened by an earlier one, so
+            // the cached metadata for everything is forgotten.
+            this->forgetMetadata(nullptr);
+            err = this->importData(&data[skip], length - skip);
+            if (err == Error::NONE) {
+                imp->offset += length - skip;
+            }
+        }
+    }
+    if (err != Error::NONE) {
+        this->closeImport();
+        *errPtr = to_underlying(err);
+        return;
+    }
+    *committedPtr = imp->offset;
+    if (imp->phase == ImportPhase::DONE) {
+        *flagsPtr = StreamFlags::END_OF_FILE;
+    }
+}
+
+void LittleFsPacketHandler::handleInfo(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      str - path within the file system (optional, defaults to /)
+    // Response:
+    //      u32 - totalBytes
+    //      u32 - usedBytes
+
+    rsp->setCommand(Command::INFO);
+    char const* path = "/";
+    if (cmd.getDataLength() > 0) {
+        Unpacker unpacker(cmd);
+        unpacker.unpack(&path);
+    }
+    char const* fsPath;
+    FsBackend* backend = this->findBackend(path, &fsPath);
+
+    InfoResponse info = {};
+    info.totalBytes = backend->totalBytes();
+    info.usedBytes = backend->usedBytes();
+
+    rsp->appendData(sizeof(info), &info);
+}
+
+void LittleFsPacketHandler::handleJobStart(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - job type (JobType)
+    //  JobType::COPY:
+    //      str - source filename
+    //      str - destination filename
+    //  JobType::RMTREE:
+    //      str - directory to remove
+    //  JobType::FORMAT: No Data
+    //  JobType::MAINTENANCE: No Data
+    // Response:
+    //      u8  - error code (BUSY if another job hasn't been collected yet)
+    //      u8  - job number to pass to JOB_STATUS
+    //
+    // Jobs run a slice at a time from run(), so run() needs to be called from
+    // loop(). FORMAT can't be split up, so it runs on its own task when
+    // LITTLEFS_JOB_TASK is enabled (other commands get BUSY until it's done).
+    // MAINTENANCE garbage collects one file system per slice, and returns
+    // UNSUPPORTED if none of the backends can be garbage collected. While any
+    // other job is running, commands which change files get BUSY.
+    Unpacker unpacker(cmd);
+    uint8_t type;
+    unpacker.unpack(&type);
+
+    rsp->setCommand(Command::JOB_START);
+    uint8_t* errPtr = rsp->getWriteData();
+    rsp->append(to_underlying(Error::NONE));
+    uint8_t* jobPtr = rsp->getWriteData();
+    rsp->append(this->m_jobNum);
+
+    Job* job = &this->m_job;
+    if (job->type != JobType::NONE) {
+        *errPtr = to_underlying(Error::BUSY);
+        return;
+    }
+    job->progress = 0;
+    job->total = 0;
+    job->result = Error::NONE;
+    job->onTask = false;
+
+    switch (static_cast<JobType>(type)) {
+        case JobType::COPY: {
+            char const* srcName;
+            char const* dstName;
+            unpacker.unpack(&srcName);
+            unpacker.unpack(&dstName);
+            if (strcmp(srcName, dstName) == 0) {
+                *errPtr = to_underlying(Error::UNABLE_TO_OPEN_FILE);
+                return;
+            }
+            job->src = this->fsOpen(srcName, FILE_READ);
+            if (!job->src || job->src.isDirectory()) {
+                job->src = File();
+                *errPtr = to_underlying(Error::UNABLE_TO_OPEN_FILE);
+                return;
+            }
+            this->evictCachedFiles(dstName);
+            job->dst = this->fsOpen(dstName, FILE_WRITE);
+            if (!job->dst) {
+                job->src.close();
+                job->src = File();
+                *errPtr = to_underlying(Error::UNABLE_TO_OPEN_FILE);
+                return;
+            }
+            job->total = job->src.size();
+            break;
+        }
+
+        case JobType::RMTREE: {
+            char const* dirName;
+            unpacker.unpack(&dirName);
+            size_t len = strlen(dirName);
+            while (len > 1 && dirName[len - 1] == '/') {
+                len--;
+            }
+            if (len >= sizeof(job->path) || len <= 1) {
+                // Use FORMAT to remove everything.
+                *errPtr = to_underlying(Error::RMDIR_FAILED);
+                return;
+            }
+            memcpy(job->path, dirName, len);
+            job->path[len] = '\0';
+            job->rootLen = len;
+            this->evictCachedFiles(job->path);
+            for (auto& cursor : this->m_dirCursors) {
+                this->closeDirCursor(&cursor);
+            }
+            this->closeWalkCursor();
+            this->closeSearchCursor();
+            this->closeExportCursor();
+            break;
+        }
+
+        case JobType::FORMAT: {
+            this->evictCachedFiles(nullptr);
+            for (auto& fileHandle : this->m_fileHandles) {
+                this->closeFileHandle(&fileHandle);
+            }
+            for (auto& cursor : this->m_dirCursors) {
+                this->closeDirCursor(&cursor);
+            }
+            this->closeWalkCursor();
+            this->closeSearchCursor();
+            this->closeExportCursor();
+            this->closeImport();
+            for (auto& watch : this->m_tailWatches) {
+                this->closeTailWatch(&watch);
+            }
+            this->abortPatch();
+            break;
+        }
+
+        case JobType::MAINTENANCE: {
+            job->mount = 0;
+            for (uint8_t i = 0; i < this->m_numMounts; i++) {
+                if (this->m_mounts[i].backend->canGc()) {
+                    job->total++;
+                }
+            }
+            if (job->total == 0) {
+                *errPtr = to_underlying(Error::UNSUPPORTED);
+                return;
+            }
+            break;
+        }
+
+        default: {
+            *errPtr = to_underlying(Error::UNSUPPORTED);
+            return;
+        }
+    }
+
+    if (++this->m_jobNum == 0) {
+        this->m_jobNum = 1;
+    }
+    *jobPtr = this->m_jobNum;
+    // STAT doesn't use the cache while the job is changing files.
+    this->forgetMetadata(nullptr);
+    job->type = static_cast<JobType>(type);
+    job->state.store(JobState::RUNNING, std::memory_order_release);
+#if LITTLEFS_JOB_TASK
+    if (job->type == JobType::FORMAT) {
+        // If the task can't be created, then stepJob formats from run() instead.
+        job->onTask = xTaskCreate(jobTask, "littlefs_job", LITTLEFS_JOB_TASK_STACK_SIZE, this,
+                                  tskIDLE_PRIORITY + 1, nullptr) == pdPASS;
+    }
+#endif
+}
+
+void LittleFsPacketHandler::handleJobStatus(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - job number (returned by JOB_START)
+    // Response:
+    //      u8  - error code
+    //      u8  - state (JobState)
+    //      u8  - result of the job (once the state is DONE)
+    //      u32 - progress (bytes copied, entries removed or mounts collected)
+    //      u32 - total (size of the file for COPY, mounts for MAINTENANCE, otherwise 0)
+    //
+    // The job is freed once JOB_STATUS has reported that it's DONE.
+    Unpacker unpacker(cmd);
+    uint8_t jobNum;
+    unpacker.unpack(&jobNum);
+
+    rsp->setCommand(Command::JOB_STATUS);
+    Job* job = &this->m_job;
+    if (job->type == JobType::NONE || jobNum != this->m_jobNum) {
+        rsp->append(to_underlying(Error::INVALID_JOB));
+        rsp->append(to_underlying(JobState::DONE));
+        rsp->append(to_underlying(Error::NONE));
+        rsp->append(static_cast<uint32_t>(0));
+        rsp->append(static_cast<uint32_t>(0));
+        return;
+    }
+    JobState state = job->state.load(std::memory_order_acquire);
+    rsp->append(to_underlying(Error::NONE));
+    rsp->append(to_underlying(state));
+    rsp->append(to_underlying(job->result));
+    rsp->append(job->progress);
+    rsp->append(job->total);
+    if (state == JobState::DONE) {
+        job->type = JobType::NONE;
+    }
+}
+
+void LittleFsPacketHandler::handleList(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u16 - index
+    //      str - dirname
+    // Response:
+    //  Variable number of entries
+    //      u16 - index
+    //      u8  - flags
+    //      u32 - filesize
+    //      u32 - timestamp
+    //      str - filename
+    Unpacker unpacker(cmd);
+    uint16_t index;
+    char const* dirName;
+
+    unpacker.unpack(&index);
+    unpacker.unpack(&dirName);
+
+    uint16_t fileNum = 0;
+    File dir = this->fsOpen(dirName);
+    File file = dir.openNextFile();
+    while (fileNum < index) {
+        fileNum++;
+        file = dir.openNextFile();
+    }
+
+    rsp->setCommand(Command::LIST);
+    (void)this->appendDirEntries(&dir, &file, &fileNum, rsp);
+}
+
+void LittleFsPacketHandler::handleListCompact(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - cursor (NO_CURSOR to start a new listing)
+    //      u8  - fields to include in each entry (ListFields)
+    //      str - dirname (only used when starting a new listing)
+    // Response:
+    //      u8  - error code
+    //      u8  - cursor to pass to the next LIST_COMPACT (NO_CURSOR when done)
+    //  Variable number of entries
+    //      u8  - flags (only if fields includes FLAGS)
+    //      u32 - filesize (only if fields includes SIZE)
+    //      u32 - timestamp (only if fields includes TIMESTAMP)
+    //      u8  - number of leading characters shared with the previous name
+    //      u8  - length of the rest of the name
+    //      bytes - rest of the name (not NUL terminated)
+    //
+    // The first entry in each response always has a shared length of 0.
+    Unpacker unpacker(cmd);
+    uint8_t cursorNum;
+    uint8_t fields;
+    unpacker.unpack(&cursorNum);
+    unpacker.unpack(&fields);
+
+    rsp->setCommand(Command::LIST_COMPACT);
+    this->expireCursors();
+
+    Error err = Error::NONE;
+    DirCursor* cursor = this->getDirCursor(&cursorNum, &unpacker, &err);
+    if (cursor == nullptr) {
+        rsp->appendByte(to_underlying(err));
+        rsp->appendByte(NO_CURSOR);
+        return;
+    }
+
+    rsp->appendByte(to_underlying(Error::NONE));
+    uint8_t* cursorPtr = rsp->getWriteData();
+    rsp->appendByte(cursorNum);
+    if (this->appendCompactDirEntries(cursor, fields, rsp)) {
+        this->closeDirCursor(cursor);
+        *cursorPtr = NO_CURSOR;
+    }
+}
+
+void LittleFsPacketHandler::handleListCursor(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - cursor (NO_CURSOR to start a new listing)
+    //      str - dirname (only used when starting a new listing)
+    // Response:
+    //      u8  - error code
+    //      u8  - cursor to pass to the next LIST_CURSOR (NO_CURSOR when done)
+    //  Variable number of entries (same layout as LIST)
+    //      u16 - index
+    //      u8  - flags
+    //      u32 - filesize
+    //      u32 - timestamp
+    //      str - filename
+    //
+    // Cursors which aren't used for LITTLEFS_DIR_CURSOR_TIMEOUT_MSEC are freed.
+    Unpacker unpacker(cmd);
+    uint8_t cursorNum;
+    unpacker.unpack(&cursorNum);
+
+    rsp->setCommand(Command::LIST_CURSOR);
+    this->expireCursors();
+
+    Error err = Error::NONE;
+    DirCursor* cursor = this->getDirCursor(&cursorNum, &unpacker, &err);
+    if (cursor == nullptr) {
+        rsp->appendByte(to_underlying(err));
+        rsp->appendByte(NO_CURSOR);
+        return;
+    }
+
+    rsp->appendByte(to_underlying(Error::NONE));
+    uint8_t* cursorPtr = rsp->getWriteData();
+    rsp->appendByte(cursorNum);
+    if (this->appendDirEntries(&cursor->dir, &cursor->next, &cursor->index, rsp)) {
+        this->closeDirCursor(cursor);
+        *cursorPtr = NO_CURSOR;
+    }
+}
+
+void LittleFsPacketHandler::handleMkDir(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      str - dirname
+    // Response:
+    //      u8 - error code.
+    rsp->setCommand(Command::MKDIR);
+    Unpacker unpacker(cmd);
+    char const* dirName;
+    unpacker.unpack(&dirName);
+
+    rsp->appendByte(to_underlying(this->mkDir(dirName)));
+}
+
+void LittleFsPacketHandler::handleOpen(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - mode (OpenMode)
+    //      str - filename
+    // Response:
+    //      u8 - error code.
+    //      u8 - handle
+    rsp->setCommand(Command::OPEN);
+    Unpacker unpacker(cmd);
+    uint8_t mode;
+    char const* filename;
+    unpacker.unpack(&mode);
+    unpacker.unpack(&filename);
+
+    uint8_t handle;
+    FileHandle* fileHandle = this->allocFileHandle(&handle);
+    if (fileHandle == nullptr) {
+        rsp->appendByte(to_underlying(Error::NO_FREE_HANDLES));
+        rsp->appendByte(0);
+        return;
+    }
+
+    char const* fileMode;
+    switch (static_cast<OpenMode>(mode)) {
+        case OpenMode::READ: {
+            fileMode = FILE_READ;
+            break;
+        }
+        case OpenMode::WRITE: {
+            fileMode = FILE_WRITE;
+            break;
+        }
+        case OpenMode::APPEND: {
+            fileMode = FILE_APPEND;
+            break;
+        }
+        case OpenMode::UPDATE: {
+            fileMode = FILE_UPDATE;
+            break;
+        }
+        default: {
+            rsp->appendByte(to_underlying(Error::UNABLE_TO_OPEN_FILE));
+            rsp->appendByte(0);
+            return;
+        }
+    }
+
+    if (static_cast<OpenMode>(mode) != OpenMode::READ) {
+        this->evictCachedFiles(filename);
+    }
+    fileHandle->file = this->openFile(filename, fileMode);
+    if (!fileHandle->file) {
+        rsp->appendByte(to_underlying(Error::UNABLE_TO_OPEN_FILE));
+        rsp->appendByte(0);
+        return;
+    }
+    fileHandle->path[0] = '\0';
+    fileHandle->uploadPath[0] = '\0';
+    if (strlen(filename) < sizeof(fileHandle->path)) {
+        strcpy(fileHandle->path, filename);
+    }
+
+    rsp->appendByte(to_underlying(Error::NONE));
+    rsp->appendByte(handle);
+}
+
+void LittleFsPacketHandler::handleRemove(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      str - filename
+    // Response:
+    //      u8 - error code.
+    rsp->setCommand(Command::REMOVE);
+    Unpacker unpacker(cmd);
+    char const* fileName;
+    unpacker.unpack(&fileName);
+
+    rsp->appendByte(to_underlying(this->removeFile(fileName)));
+}
+
+void LittleFsPacketHandler::handleRename(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      str - old name
+    //      str - new name
+    // Response:
+    //      u8 - error code.
+    rsp->setCommand(Command::RENAME);
+    Unpacker unpacker(cmd);
+    char const* oldName;
+    char const* newName;
+    unpacker.unpack(&oldName);
+    unpacker.unpack(&newName);
+
+    rsp->appendByte(to_underlying(this->renameFile(oldName, newName)));
+}
+
+void LittleFsPacketHandler::handlePatch(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8 - number of operations
+    //  Followed by that many operations, each starting with a u8 PatchOp:
+    //      BEGIN:   str - filename, u32 - block size
+    //      COPY:    u32 - first block, u32 - number of blocks
+    //      LITERAL: u32 - length, bytes - data
+    //      END:     u32 - CRC-32 of the new file
+    //      ABORT:   No Data
+    // Response:
+    //      u8  - error code
+    //      u32 - number of bytes written to the new file
+    //
+    // The new file is built in a hidden temporary file, which is renamed over
+    // the existing file by PatchOp::END once its CRC has been checked. A COPY
+    // whose offset or length doesn't fit in 32 bits fails with
+    // INVALID_COMMAND. Any error aborts the patch.
+    Unpacker unpacker(cmd);
+    uint8_t numOps;
+    unpacker.unpack(&numOps);
+
+    rsp->setCommand(Command::PATCH);
+    Error err = Error::NONE;
+    while (numOps-- > 0 && err == Error::NONE) {
+        err = this->patchOp(&unpacker);
+    }
+    if (err != Error::NONE) {
+        this->abortPatch();
+    }
+    rsp->appendByte(to_underlying(err));
+    rsp->append(this->m_patchLen);
+}
+
+LittleFsPacketHandler::Error LittleFsPacketHandler::patchOp(Unpacker* unpacker) {
+    uint8_t op;
+    unpacker->unpack(&op);
+
+    if (static_cast<PatchOp>(op) == PatchOp::BEGIN) {
+        char const* filename;
+        unpacker->unpack(&filename);
+        unpacker->unpack(&this->m_patchBlockSize);
+
+        this->abortPatch();
+        if (strlen(filename) >= sizeof(this->m_patchPath) ||
+            !makeTempPath(filename, ".patch", this->m_patchTempPath,
+                          sizeof(this->m_patchTempPath))) {
+            return Error::UNABLE_TO_OPEN_FILE;
+        }
+        strcpy(this->m_patchPath, filename);
+        this->m_patchLen = 0;
+        this->m_patchCrc.reset();
+        // The file being patched doesn't need to exist, in which case the
+        // new file can only be built from literal data.
+        this->m_patchSrc = this->openFile(filename, FILE_READ);
+        this->m_patchDst = this->openFile(this->m_patchTempPath, FILE_WRITE);
+        if (!this->m_patchDst) {
+            return Error::UNABLE_TO_OPEN_FILE;
+        }
+        return Error::NONE;
+    }
+
+    if (!this->m_patchDst) {
+        return Error::INVALID_HANDLE;
+    }
+
+    switch (static_cast<PatchOp>(op)) {
+        case PatchOp::COPY: {
+            uint32_t firstBlock;
+            uint32_t numBlocks;
+            unpacker->unpack(&firstBlock);
+            unpacker->unpack(&numBlocks);
+            if (!this->m_patchSrc || this->m_patchBlockSize == 0) {
+                return Error::READ_FAILED;
+            }
+            if (firstBlock > UINT32_MAX / this->m_patchBlockSize ||
+                numBlocks > UINT32_MAX / this->m_patchBlockSize) {
+                // The offset or length wouldn't fit in 32 bits.
+                return Error::INVALID_COMMAND;
+            }
+            if (!this->seekFile(&this->m_patchSrc, firstBlock * this->m_patchBlockSize)) {
+                return Error::SEEK_FAILED;
+            }
+            uint32_t remaining = numBlocks * this->m_patchBlockSize;
+            while (remaining > 0) {
+                uint32_t count = sizeof(this->m_ioBuffer);
+                if (remaining < count) {
+                    count = remaining;
+                }
+                size_t bytesRead = this->readFile(&this->m_patchSrc, this->m_ioBuffer, count);
+                if (bytesRead == 0) {
+                    // Only the last block can be short.
+                    break;
+                }
+                if (this->writeFile(&this->m_patchDst, this->m_ioBuffer, bytesRead) != bytesRead) {
+                    return Error::WRITE_FAILED;
+                }
+                this->m_patchCrc.update(this->m_ioBuffer, bytesRead);
+                this->m_patchLen += bytesRead;
+                remaining -= bytesRead;
+            }
+            return Error::NONE;
+        }
+
+        case PatchOp::LITERAL: {
+            uint32_t length;
+            uint8_t const* data;
+            unpacker->unpack(&length);
+            unpacker->unpack(length, &data);
+            if (this->writeFile(&this->m_patchDst, data, length) != length) {
+                return Error::WRITE_FAILED;
+            }
+            this->m_patchCrc.update(data, length);
+            this->m_patchLen += length;
+            return Error::NONE;
+        }
+
+        case PatchOp::END: {
+            uint32_t crc;
+            unpacker->unpack(&crc);
+            if (crc != this->m_patchCrc.value()) {
+                return Error::VERIFY_FAILED;
+            }
+            this->closeFile(&this->m_patchDst);
+            this->m_patchDst = File();
+            if (this->m_patchSrc) {
+                this->closeFile(&this->m_patchSrc);
+                this->m_patchSrc = File();
+            }
+            this->evictCachedFiles(this->m_patchPath);
+            if (!this->fsRename(this->m_patchTempPath, this->m_patchPath)) {
+                this->fsRemove(this->m_patchTempPath);
+                return Error::RENAME_FAILED;
+            }
+            return Error::NONE;
+        }
+
+        case PatchOp::ABORT: {
+            this->abortPatch();
+            return Error::NONE;
+        }
+
+        default: {
+            return Error::UNSUPPORTED;
+        }
+    }
+}
+
+void LittleFsPacketHandler::abortPatch() {
+    if (this->m_patchSrc) {
+        this->closeFile(&this->m_patchSrc);
+    }
+    this->m_patchSrc = File();
+    if (this->m_patchDst) {
+        this->closeFile(&this->m_patchDst);
+        this->fsRemove(this->m_patchTempPath);
+    }
+    this->m_patchDst = File();
+}
+
+void LittleFsPacketHandler::handleRead(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      str - filename
+    //      u32 - offset
+    //      u32 - length (clamped to what fits in the response)
+    // Response:
+    //      u8  - error code
+    //      u32 - offset
+    //      u32 - length
+    //      bytes - data
+    Unpacker unpacker(cmd);
+    char const* filename;
+    uint32_t offset;
+    uint32_t length;
+
+    unpacker.unpack(&filename);
+    unpacker.unpack(&offset);
+    unpacker.unpack(&length);
+
+    rsp->setCommand(Command::READ);
+    uint8_t* errPtr = rsp->getWriteData();
+    rsp->append(to_underlying(Error::NONE));
+    rsp->append(offset);
+    uint32_t* lenPtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
+    rsp->append(static_cast<uint32_t>(0));
+
+    CachedFile* cached;
+#if LITTLEFS_READ_AHEAD_SIZE > 0
+    cached = this->m_readAheadFile;
+    if (cached != nullptr && this->m_readAheadStart < this->m_readAheadLen &&
+        offset == this->m_readAheadOffset && strcmp(cached->path, filename) == 0) {
+        *lenPtr = this->readAheadIntoPacket(length, rsp);
+    } else
+#endif
+    {
+        Error err = Error::NONE;
+        cached = this->openCachedFile(filename, offset, &err);
+        if (cached == nullptr) {
+            *errPtr = to_underlying(err);
+            return;
+        }
+        *lenPtr = this->readIntoPacket(&cached->file, length, rsp);
+    }
+
+    if (cached->path[0] == '\0') {
+        // The filename was too long to remember, so don't keep it open.
+        this->closeCachedFile(cached);
+    }
+#if LITTLEFS_READ_AHEAD_SIZE > 0
+    else if (cached->sequential && *lenPtr > 0 && this->m_readAheadFile == nullptr) {
+        // The host is reading the file sequentially, so it will most likely
+        // ask for the same amount of data from where this READ ended.
+        this->startReadAhead(cached, offset + *lenPtr, *lenPtr);
+    }
+#endif
+    *errPtr = to_underlying(Error::NONE);
+}
+
+void LittleFsPacketHandler::handleReadCompressed(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      str - filename
+    //      u32 - offset
+    //      u32 - length (clamped to LITTLEFS_COMPRESS_BUFFER_SIZE)
+    // Response:
+    //      u8  - error code
+    //      u32 - offset
+    //      u32 - length (uncompressed)
+    //      u8  - codec (Codec)
+    //      u32 - data length
+    //      bytes - data
+    Unpacker unpacker(cmd);
+    char const* filename;
+    uint32_t offset;
+    uint32_t length;
+
+    unpacker.unpack(&filename);
+    unpacker.unpack(&offset);
+    unpacker.unpack(&length);
+
+    rsp->setCommand(Command::READ_COMPRESSED);
+    uint8_t* errPtr = rsp->getWriteData();
+    rsp->append(to_underlying(Error::NONE));
+    rsp->append(offset);
+    uint32_t* lenPtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
+    rsp->append(static_cast<uint32_t>(0));
+    uint8_t* codecPtr = rsp->getWriteData();
+    rsp->append(to_underlying(Codec::NONE));
+    uint32_t* dataLenPtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
+    rsp->append(static_cast<uint32_t>(0));
+
+#if LITTLEFS_COMPRESSION
+    Error err = Error::NONE;
+    CachedFile* cached = this->openCachedFile(filename, offset, &err);
+    if (cached == nullptr) {
+        *errPtr = to_underlying(err);
+        return;
+    }
+
+    if (length > sizeof(this->m_compressBuffer)) {
+        length = sizeof(this->m_compressBuffer);
+    }
+    uint32_t bytesRead = this->readFile(&cached->file, this->m_compressBuffer, length);
+    uint32_t space = rsp->getSpaceRemaining();
+    uint8_t* data = rsp->getWriteData(0);
+    uint32_t dataLen = this->m_lz4.compress(this->m_compressBuffer, bytesRead, data, space);
+    if (dataLen == 0 && bytesRead > space) {
+        // Too much data to fit once compressed, so try again with less.
+        bytesRead = space;
+        dataLen = this->m_lz4.compress(this->m_compressBuffer, bytesRead, data, space);
+    }
+    if (dataLen > 0 && dataLen < bytesRead) {
+        *codecPtr = to_underlying(Codec::LZ4);
+    } else {
+        // The data didn't compress, so send as much of it as fits. The cached
+        // file seeks back if the host continues from the end of this data.
+        bytesRead = bytesRead < space ? bytesRead : space;
+        dataLen = bytesRead;
+        memcpy(data, this->m_compressBuffer, dataLen);
+    }
+    (void)rsp->getWriteData(dataLen);
+    *lenPtr = bytesRead;
+    *dataLenPtr = dataLen;
+
+    if (cached->path[0] == '\0') {
+        // The filename was too long to remember, so don't keep it open.
+        this->closeCachedFile(cached);
+    }
+#else
+    (void)filename;
+    (void)codecPtr;
+    (void)lenPtr;
+    (void)dataLenPtr;
+    *errPtr = to_underlying(Error::UNSUPPORTED);
+#endif
+}
+
+void LittleFsPacketHandler::handleReadHandle(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - handle
+    //      u32 - offset
+    //      u32 - length (clamped to what fits in the response)
+    // Response:
+    //      u8  - error code
+    //      u32 - offset
+    //      u32 - length
+    //      bytes - data
+    Unpacker unpacker(cmd);
+    uint8_t handle;
+    uint32_t offset;
+    uint32_t length;
+
+    unpacker.unpack(&handle);
+    unpacker.unpack(&offset);
+    unpacker.unpack(&length);
+
+    rsp->setCommand(Command::READ_HANDLE);
+    uint8_t* errPtr = rsp->getWriteData();
+    rsp->append(to_underlying(Error::NONE));
+    rsp->append(offset);
+    uint32_t* lenPtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
+    rsp->append(static_cast<uint32_t>(0));
+
+    FileHandle* fileHandle = this->getFileHandle(handle);
+    if (fileHandle == nullptr) {
+        *errPtr = to_underlying(Error::INVALID_HANDLE);
+        return;
+    }
+    if (!this->seekFile(&fileHandle->file, offset)) {
+        *errPtr = to_underlying(Error::SEEK_FAILED);
+        return;
+    }
+
+    *lenPtr = this->readIntoPacket(&fileHandle->file, length, rsp);
+}
+
+uint32_t LittleFsPacketHandler::readIntoPacket(File* file, uint32_t length, Packet* rsp) {
+    if (length > rsp->getSpaceRemaining()) {
+        length = rsp->getSpaceRemaining();
+    }
+    // Read directly into the response, rather than through a staging buffer.
+    uint32_t bytesRead = this->readFile(file, rsp->getWriteData(0), length);
+    (void)rsp->getWriteData(bytesRead);
+    return bytesRead;
+}
+
+void LittleFsPacketHandler::handleRmDir(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      str - dirname
+    // Response:
+    //      u8 - error code.
+    rsp->setCommand(Command::RMDIR);
+    Unpacker unpacker(cmd);
+    char const* dirName;
+    unpacker.unpack(&dirName);
+
+    rsp->appendByte(to_underlying(this->rmDir(dirName)));
+}
+
+void LittleFsPacketHandler::handleSearch(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - cursor (NO_CURSOR to start a new search)
+    //      u8  - window (number of response packets to send)
+    //  Only used when starting a new search:
+    //      u8  - flags (SearchFlags)
+    //      str - path of a file, a directory (to search every file in it) or
+    //            a directory followed by a glob (like /logs/*.txt)
+    //      str - pattern. Without SearchFlags::REGEX this is the bytes to
+    //            look for. With it, . matches any character, * matches any
+    //            number of the previous character, ^ and $ match the start
+    //            and end of the line, and \ makes the next character literal.
+    //      u8  - number of lines of context to send before and after each
+    //            match (optional, defaults to 0, limited to
+    //            LITTLEFS_SEARCH_MAX_CONTEXT)
+    // Response (up to window packets, the last one has StreamFlags::LAST set):
+    //      u8  - error code
+    //      u8  - flags (StreamFlags, END_OF_FILE is set once the search is done)
+    //      u8  - sequence number (0 to window - 1)
+    //      u8  - cursor to pass to the next SEARCH (NO_CURSOR when done)
+    //  Variable number of matches
+    //      str - name of the file
+    //      u32 - line number (starting at 1)
+    //      u32 - offset of the start of the line
+    //      u8  - flags (SearchLineFlags)
+    //      u16 - length of the line
+    //      bytes - line (without the newline)
+    //
+    // Each packet covers at most LITTLEFS_SEARCH_SLICE_BYTES of the files, so
+    // packets may have no matches. A match is sent in the same packet as the
+    // context before it. A line which doesn't fit in an empty packet is cut
+    // short (and flagged as SearchLineFlags::TRUNCATED), and if not even the
+    // file name fits, the search stops with Error::UNSUPPORTED. The cursor is
+    // freed if it isn't used for LITTLEFS_DIR_CURSOR_TIMEOUT_MSEC.
+    Unpacker unpacker(cmd);
+    uint8_t cursorNum;
+    uint8_t window;
+    unpacker.unpack(&cursorNum);
+    unpacker.unpack(&window);
+
+    if (window == 0 || this->m_bus == nullptr) {
+        window = 1;
+    }
+    this->expireCursors();
+
+    SearchCursor* search = &this->m_searchCursor;
+    Error err = Error::NONE;
+    if (cursorNum == NO_CURSOR) {
+        uint8_t flags;
+        char const* path;
+        char const* pattern;
+        unpacker.unpack(&flags);
+        unpacker.unpack(&path);
+        unpacker.unpack(&pattern);
+        uint8_t context;
+        if (!unpacker.unpack(&context)) {
+            // Older hosts don't ask for context lines.
+            context = 0;
+        }
+
+        // Only one SEARCH can be in progress, so starting a new one replaces it.
+        this->closeSearchCursor();
+        if (++this->m_searchCursorNum == NO_CURSOR) {
+            this->m_searchCursorNum = 0;
+        }
+        size_t patternLen = strlen(pattern);
+        char const* baseName = strrchr(path, '/');
+        baseName = (baseName == nullptr) ? path : baseName + 1;
+        bool isGlob = strpbrk(baseName, "*?") != nullptr;
+        if (patternLen >= sizeof(search->pattern) || strlen(path) >= sizeof(search->glob)) {
+            err = Error::UNSUPPORTED;
+        } else if (isGlob) {
+            // Open the directory part of the path, and keep the glob.
+            char dirName[LITTLEFS_MAX_PATH_LEN];
+            size_t dirLen = baseName - path;
+            if (dirLen > 1) {
+                dirLen--;
+            }
+            memcpy(dirName, path, dirLen);
+            dirName[dirLen] = '\0';
+            strcpy(search->glob, baseName);
+            search->dir = this->fsOpen(dirName);
+        } else {
+            search->glob[0] = '\0';
+            search->dir = this->fsOpen(path);
+        }
+        if (err == Error::NONE) {
+            if (!search->dir) {
+                err = Error::UNABLE_TO_OPEN_FILE;
+            } else if (!search->dir.isDirectory()) {
+                if (isGlob) {
+                    err = Error::UNABLE_TO_OPEN_FILE;
+                } else {
+                    // A single file is searched without a directory.
+                    search->file = search->dir;
+                    this->startSearchFile();
+                }
+                search->dir = File();
+            }
+            memcpy(search->pattern, pattern, patternLen + 1);
+            search->patternLen = patternLen;
+            search->flags = flags;
+            search->context =
+                (context > LITTLEFS_SEARCH_MAX_CONTEXT) ? LITTLEFS_SEARCH_MAX_CONTEXT : context;
+        }
+    } else if (cursorNum != this->m_searchCursorNum || (!search->file && !search->dir)) {
+        err = Error::INVALID_CURSOR;
+    }
+
+    for (uint8_t seq = 0;; seq++) {
+        rsp->setCommand(Command::SEARCH);
+        rsp->setDataLength(0);
+        uint8_t* errPtr = rsp->getWriteData();
+        rsp->append(to_underlying(err));
+        uint8_t* flagsPtr = rsp->getWriteData();
+        rsp->append(static_cast<uint8_t>(seq + 1 == window ? StreamFlags::LAST : 0));
+        rsp->append(seq);
+        uint8_t* cursorPtr = rsp->getWriteData();
+        rsp->append(this->m_searchCursorNum);
+
+        if (err != Error::NONE) {
+            this->closeSearchCursor();
+            *flagsPtr |= StreamFlags::LAST;
+            *cursorPtr = NO_CURSOR;
+            return;
+        }
+        search->lastUsed = millis();
+        if (this->appendSearchMatches(rsp, &err)) {
+            this->closeSearchCursor();
+            *errPtr = to_underlying(err);
+            *flagsPtr |= (err == Error::NONE) ? StreamFlags::LAST | StreamFlags::END_OF_FILE
+                                              : StreamFlags::LAST;
+            *cursorPtr = NO_CURSOR;
+        }
+        if ((*flagsPtr & StreamFlags::LAST) != 0) {
+            // The last packet is sent by the bus as the reply to the command.
+            return;
+        }
+        this->m_bus->writePacket(*rsp);
+    }
+}
+
+void LittleFsPacketHandler::handleSignature(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      str - filename
+    //      u32 - block size
+    //      u32 - first block
+    // Response:
+    //      u8  - error code (INVALID_COMMAND if the first block starts past 4G)
+    //      u32 - file size
+    //      u32 - first block
+    //  Variable number of entries, one per block (the last block may be short)
+    //      u32 - weak checksum (RollingChecksum)
+    //      u32 - CRC-32
+    Unpacker unpacker(cmd);
+    char const* filename;
+    uint32_t blockSize;
+    uint32_t firstBlock;
+
+    unpacker.unpack(&filename);
+    unpacker.unpack(&blockSize);
+    unpacker.unpack(&firstBlock);
+
+    rsp->setCommand(Command::SIGNATURE);
+    uint8_t* errPtr = rsp->getWriteData();
+    rsp->append(to_underlying(Error::NONE));
+    uint32_t* sizePtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
+    rsp->append(static_cast<uint32_t>(0));
+    rsp->append(firstBlock);
+
+    if (blockSize == 0) {
+        *errPtr = to_underlying(Error::UNSUPPORTED);
+        return;
+    }
+    if (firstBlock > UINT32_MAX / blockSize) {
+        // The offset of the first block doesn't fit in 32 bits.
+        *errPtr = to_underlying(Error::INVALID_COMMAND);
+        return;
+    }
+    Error err = Error::NONE;
+    CachedFile* cached = this->openCachedRegularFile(filename, firstBlock * blockSize, &err);
+    if (cached == nullptr) {
+        *errPtr = to_underlying(err);
+        return;
+    }
+    *sizePtr = cached->file.size();
+
+    RollingChecksum weak;
+    Crc32 crc;
+    while (rsp->getSpaceRemaining() >= 2 * sizeof(uint32_t)) {
+        weak.reset();
+        crc.reset();
+        uint32_t blockLen = 0;
+        while (blockLen < blockSize) {
+            uint32_t count = sizeof(this->m_ioBuffer);
+            if (blockSize - blockLen < count) {
+                count = blockSize - blockLen;
+            }
+            size_t bytesRead = this->readFile(&cached->file, this->m_ioBuffer, count);
+            if (bytesRead == 0) {
+                break;
+            }
+            weak.update(this->m_ioBuffer, bytesRead);
+            crc.update(this->m_ioBuffer, bytesRead);
+            blockLen += bytesRead;
+        }
+        if (blockLen == 0) {
+            break;
+        }
+        rsp->append(weak.value());
+        rsp->append(crc.value());
+    }
+    this->releaseCachedFile(cached);
+}
+
+void LittleFsPacketHandler::handleStat(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - flags (StatFlags::DIR_SIZE and NO_CACHE)
+    //      str - file or directory to report on
+    // Response:
+    //      u8  - error code (UNABLE_TO_OPEN_FILE if the path doesn't exist)
+    //      u8  - flags (StatFlags::TRUNCATED and CACHED)
+    //      u8  - flags of the entry (Flags)
+    //      u32 - size of the file. For a directory, the total size of the
+    //            files inside it with DIR_SIZE, otherwise 0.
+    //      u32 - time the entry was last written
+    //
+    // This saves listing the whole parent directory to find one file. The
+    // results (including paths which don't exist) are kept in a small cache
+    // which the commands that change files update, so repeatedly polling a
+    // file or the size of a directory doesn't touch the file system. Jobs
+    // change files from run(), so the cache isn't used while one exists.
+    Unpacker unpacker(cmd);
+    uint8_t flags;
+    char const* path;
+    unpacker.unpack(&flags);
+    unpacker.unpack(&path);
+
+    rsp->setCommand(Command::STAT);
+    uint8_t* errPtr = rsp->getWriteData();
+    rsp->append(to_underlying(Error::NONE));
+
+    char name[LITTLEFS_MAX_PATH_LEN];
+    size_t nameLen = strlen(path);
+    while (nameLen > 1 && path[nameLen - 1] == '/') {
+        nameLen--;
+    }
+    if (nameLen < sizeof(name)) {
+        memcpy(name, path, nameLen);
+        name[nameLen] = '\0';
+        path = name;
+    }
+    if (this->m_appendFile && isSameOrChild(this->m_appendPath, path)) {
+        // The size has to include any buffered APPEND data.
+        this->flushAppendBuffer(true);
+    }
+
+    StatFlags rspFlags;
+    bool cached = false;
+    uint8_t entryFlags = 0;
+    uint8_t entryStat = 0;
+    uint32_t size = 0;
+    uint32_t timestamp = 0;
+#if LITTLEFS_META_CACHE_SIZE > 0
+    bool cacheable = path == name && this->m_job.type == JobType::NONE;
+    MetaEntry* entry = nullptr;
+    if (cacheable && (flags & StatFlags::NO_CACHE) == 0) {
+        entry = this->findMetadata(path, nameLen);
+    }
+    if (entry != nullptr && (flags & StatFlags::DIR_SIZE) != 0 &&
+        (entry->flags & Flags::DIR) != 0 && (entry->stat & StatFlags::DIR_SIZE) == 0) {
+        // The directory was cached without adding up its files.
+        entry = nullptr;
+    }
+    if (entry != nullptr) {
+        cached = true;
+        rspFlags.set(StatFlags::CACHED);
+        entryFlags = entry->flags;
+        entryStat = entry->stat;
+        size = entry->size;
+        timestamp = entry->timestamp;
+    }
+#endif
+    if (!cached) {
+        File file = this->fsOpen(path);
+        if (!file) {
+            entryFlags = META_MISSING;
+        } else {
+            timestamp = file.getLastWrite();
+            if (!file.isDirectory()) {
+                size = file.size();
+            } else {
+                entryFlags = Flags::DIR;
+            }
+            file.close();
+        }
+        if ((entryFlags & Flags::DIR) != 0 && (flags & StatFlags::DIR_SIZE) != 0) {
+            TreeTotals totals;
+            this->scanTree(path, &totals);
+            size = totals.fileBytes;
+            entryStat = totals.truncated ? (StatFlags::DIR_SIZE | StatFlags::TRUNCATED)
+                                         : StatFlags::DIR_SIZE;
+        }
+#if LITTLEFS_META_CACHE_SIZE > 0
+        if (cacheable) {
+            entry = this->allocMetadata(path, nameLen);
+            entry->flags = entryFlags;
+            entry->stat = entryStat;
+            entry->size = size;
+            entry->timestamp = timestamp;
+        }
+#endif
+    }
+
+    if ((entryFlags & META_MISSING) != 0) {
+        *errPtr = to_underlying(Error::UNABLE_TO_OPEN_FILE);
+        entryFlags = 0;
+    }
+    if ((entryFlags & Flags::DIR) != 0 && (flags & StatFlags::DIR_SIZE) == 0) {
+        // The directory may have been cached by an earlier DIR_SIZE.
+        size = 0;
+        entryStat = 0;
+    }
+    if ((entryStat & StatFlags::TRUNCATED) != 0) {
+        rspFlags.set(StatFlags::TRUNCATED);
+    }
+    rsp->append(rspFlags);
+    rsp->append(entryFlags);
+    rsp->append(size);
+    rsp->append(timestamp);
+}
+
+void LittleFsPacketHandler::handleStatFs(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - flags (StatFsFlags::SCAN to total up the files)
+    //      str - directory in the file system to report on (optional, defaults
+    //            to /). Only the files inside it are scanned.
+    // Response:
+    //      u8  - error code
+    //      u8  - flags (SCAN if the files were scanned, TRUNCATED if some weren't)
+    //      u32 - block size
+    //      u32 - block count
+    //      u32 - free blocks
+    //      u32 - longest file name
+    //      u32 - largest file size
+    //      u32 - size of the command packet buffer
+    //      u32 - size of the response packet buffer
+    //      u32 - number of files (only if scanned)
+    //      u32 - number of directories (only if scanned)
+    //      u32 - total size of all files (only if scanned)
+    //      u32 - blocks needed to hold just the file data (only if scanned)
+    //
+    // The used blocks which aren't needed for file data are taken up by
+    // metadata, partially filled blocks, and blocks waiting to be compacted,
+    // so comparing the last value with the block count gives the host an
+    // idea of how fragmented the file system is.
+    Unpacker unpacker(cmd);
+    uint8_t flags;
+    char const* path = "/";
+    unpacker.unpack(&flags);
+    if (cmd.getDataLength() > sizeof(flags)) {
+        unpacker.unpack(&path);
+    }
+    char const* fsPath;
+    FsBackend* backend = this->findBackend(path, &fsPath);
+
+    rsp->setCommand(Command::STATFS);
+    uint8_t* errPtr = rsp->getWriteData();
+    rsp->append(to_underlying(Error::NONE));
+
+    TreeTotals totals;
+    StatFsFlags rspFlags;
+    if ((flags & StatFsFlags::SCAN) != 0) {
+        if (!this->scanTree(path, &totals)) {
+            *errPtr = to_underlying(Error::UNABLE_TO_OPEN_FILE);
+        } else {
+            rspFlags.set(StatFsFlags::SCAN);
+        }
+        if (totals.truncated) {
+            rspFlags.set(StatFsFlags::TRUNCATED);
+        }
+    }
+
+    uint32_t blockCount = backend->totalBytes() / LITTLEFS_BLOCK_SIZE;
+    uint32_t usedBlocks = backend->usedBytes() / LITTLEFS_BLOCK_SIZE;
+    rsp->append(rspFlags);
+    rsp->append(static_cast<uint32_t>(LITTLEFS_BLOCK_SIZE));
+    rsp->append(blockCount);
+    rsp->append(usedBlocks < blockCount ? blockCount - usedBlocks : static_cast<uint32_t>(0));
+    rsp->append(static_cast<uint32_t>(LITTLEFS_NAME_MAX));
+    rsp->append(static_cast<uint32_t>(LITTLEFS_FILE_MAX));
+    rsp->append(static_cast<uint32_t>(cmd.getMaxDataLength()));
+    rsp->append(static_cast<uint32_t>(rsp->getMaxDataLength()));
+    rsp->append(totals.numFiles);
+    rsp->append(totals.numDirs);
+    rsp->append(totals.fileBytes);
+    rsp->append(totals.fileBlocks);
+}
+
+void LittleFsPacketHandler::handleStats(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - flags (StatsFlags)
+    //      u8  - index of the first entry to send (0 to start)
+    // Response:
+    //      u8  - error code
+    //      u8  - index to pass to the next STATS (0 once everything was sent)
+    //  Variable number of entries (only those with a non-zero count)
+    //      u8  - StatsPhase (for file operations) or command code (0x40 and up)
+    //      u32 - count
+    //      u32 - bytes (file bytes for phases, packet data bytes for commands)
+    //      u32 - total time in microseconds
+    //      u32 - longest time in microseconds
+    //
+    // The phases come first, followed by the commands. The counters wrap
+    // (the total time after about 71 minutes), so hosts should reset them
+    // between measurements.
+    Unpacker unpacker(cmd);
+    uint8_t flags;
+    uint8_t index;
+    unpacker.unpack(&flags);
+    unpacker.unpack(&index);
+
+    rsp->setCommand(Command::STATS);
+#if LITTLEFS_STATS
+    rsp->append(to_underlying(Error::NONE));
+    uint8_t* nextPtr = rsp->getWriteData();
+    rsp->appendByte(0);
+
+    constexpr size_t entrySize = sizeof(uint8_t) + 4 * sizeof(uint32_t);
+    for (; index < NUM_STATS_PHASES + NUM_COMMANDS; index++) {
+        Stats const* stats;
+        uint8_t id;
+        if (index < NUM_STATS_PHASES) {
+            stats = &this->m_phaseStats[index];
+            id = index;
+        } else {
+            stats = &this->m_commandStats[index - NUM_STATS_PHASES];
+            id = Command::FORMAT + index - NUM_STATS_PHASES;
+        }
+        if (stats->count == 0) {
+            continue;
+        }
+        if (entrySize > rsp->getSpaceRemaining()) {
+            *nextPtr = index;
+            return;
+        }
+        rsp->appendByte(id);
+        rsp->append(stats->count);
+        rsp->append(stats->bytes);
+        rsp->append(stats->totalUsec);
+        rsp->append(stats->maxUsec);
+    }
+    if ((flags & StatsFlags::RESET) != 0) {
+        for (auto& stats : this->m_phaseStats) {
+            stats = Stats();
+        }
+        for (auto& stats : this->m_commandStats) {
+            stats = Stats();
+        }
+    }
+#else
+    rsp->append(to_underlying(Error::UNSUPPORTED));
+    rsp->appendByte(0);
+#endif
+}
+
+void LittleFsPacketHandler::handleStreamRead(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - handle
+    //      u32 - offset
+    //      u8  - window (number of response packets to send)
+    //      u16 - chunk size (0 = as much as fits in a packet)
+    // Response (window packets, the last one has StreamFlags::LAST set):
+    //      u8  - error code
+    //      u8  - flags (StreamFlags)
+    //      u8  - sequence number (0 to window - 1)
+    //      u32 - offset
+    //      u32 - length
+    //      bytes - data
+    //
+    // The host acknowledges the data it has received by sending the next
+    // STREAM_READ starting at the end of the data it received in order.
+    Unpacker unpacker(cmd);
+    uint8_t handle;
+    uint32_t offset;
+    uint8_t window;
+    uint16_t chunkSize;
+
+    unpacker.unpack(&handle);
+    unpacker.unpack(&offset);
+    unpacker.unpack(&window);
+    unpacker.unpack(&chunkSize);
+
+    if (window == 0 || this->m_bus == nullptr) {
+        window = 1;
+    }
+    FileHandle* fileHandle = this->getFileHandle(handle);
+
+    for (uint8_t seq = 0;; seq++) {
+        rsp->setCommand(Command::STREAM_READ);
+        rsp->setDataLength(0);
+        uint8_t* errPtr = rsp->getWriteData();
+        rsp->append(to_underlying(Error::NONE));
+        uint8_t* flagsPtr = rsp->getWriteData();
+        rsp->append(static_cast<uint8_t>(seq + 1 == window ? StreamFlags::LAST : 0));
+        rsp->append(seq);
+        rsp->append(offset);
+        uint32_t* lenPtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
+        rsp->append(static_cast<uint32_t>(0));
+
+        if (fileHandle == nullptr) {
+            *errPtr = to_underlying(Error::INVALID_HANDLE);
+            *flagsPtr |= StreamFlags::LAST;
+            return;
+        }
+        if (!this->seekFile(&fileHandle->file, offset)) {
+            *errPtr = to_underlying(Error::SEEK_FAILED);
+            *flagsPtr |= StreamFlags::LAST;
+            return;
+        }
+
+        uint32_t length = rsp->getSpaceRemaining();
+        if (chunkSize != 0 && chunkSize < length) {
+            length = chunkSize;
+        }
+        *lenPtr = this->readIntoPacket(&fileHandle->file, length, rsp);
+        offset += *lenPtr;
+
+        if (*lenPtr < length) {
+            *flagsPtr |= StreamFlags::LAST | StreamFlags::END_OF_FILE;
+        }
+        if ((*flagsPtr & StreamFlags::LAST) != 0) {
+            // The last packet is sent by the bus as the reply to the command.
+            return;
+        }
+        this->m_bus->writePacket(*rsp);
+    }
+}
+
+void LittleFsPacketHandler::handleStreamWrite(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - handle
+    //      u8  - sequence number
+    //      u32 - offset
+    //      u32 - data length
+    //      bytes - data
+    // Response:
+    //      u8  - error code
+    //      u8  - sequence number
+    //      u32 - number of bytes written in order (where the next chunk should start)
+    //
+    // The host may send several chunks before waiting for their responses.
+    // A chunk which starts past the end of the data written so far (because
+    // an earlier chunk was lost) is rejected with OUT_OF_SEQUENCE, and the
+    // host resends starting from the returned offset.
+    Unpacker unpacker(cmd);
+    uint8_t handle;
+    uint8_t seq;
+    uint32_t offset;
+    uint32_t length;
+    uint8_t const* data;
+
+    unpacker.unpack(&handle);
+    unpacker.unpack(&seq);
+    unpacker.unpack(&offset);
+    unpacker.unpack(&length);
+    unpacker.unpack(length, &data);
+
+    rsp->setCommand(Command::STREAM_WRITE);
+    uint8_t* errPtr = rsp->getWriteData();
+    rsp->append(to_underlying(Error::NONE));
+    rsp->append(seq);
+    uint32_t* committedPtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
+    rsp->append(static_cast<uint32_t>(0));
+
+    FileHandle* fileHandle = this->getFileHandle(handle);
+    if (fileHandle == nullptr) {
+        *errPtr = to_underlying(Error::INVALID_HANDLE);
+        return;
+    }
+    uint32_t committed = fileHandle->file.position();
+    *committedPtr = committed;
+    if (offset > committed) {
+        *errPtr = to_underlying(Error::OUT_OF_SEQUENCE);
+        return;
+    }
+    if (fileHandle->path[0] != '\0') {
+        this->evictCachedFiles(fileHandle->path);
+    }
+    if (offset != committed && !fileHandle->file.seek(offset)) {
+        *errPtr = to_underlying(Error::SEEK_FAILED);
+        return;
+    }
+    size_t written = this->writeFile(&fileHandle->file, data, length);
+    *committedPtr = offset + written;
+    if (written != length) {
+        *errPtr = to_underlying(Error::WRITE_FAILED);
+    }
 }
 
-bool LittleFsPacketHandler::handlePacket(Packet const& cmd, Packet* rsp) {
-    switch (cmd.getCommand()) {
-        case Command::COPY: {
-            this->handleCopy(cmd, rsp);
-            return true;
-        }
-        case Command::FORMAT: {
-            this->handleFormat(cmd, rsp);
-            return true;
-        }
-        case Command::INFO: {
-            this->handleInfo(cmd, rsp);
-            return true;
+void LittleFsPacketHandler::handleTail(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - watch (NO_CURSOR to start watching a file)
+    //      u8  - flags (TailFlags)
+    //      u16 - shortest time between data packets, in milliseconds
+    //      u16 - most data to send in each packet (0 to fill the packet)
+    //  Only used when starting a new watch:
+    //      str - filename
+    //      u32 - number of bytes before the current end of the file to start
+    //            from (TO_END_OF_FILE to start from the beginning)
+    // Response, and each packet of new data sent by run():
+    //      u8  - error code
+    //      u8  - watch (NO_CURSOR if no watch is active)
+    //      u32 - file offset of the data
+    //      u32 - size of the file
+    //      bytes - data (the response to TAIL itself has none)
+    //
+    // run() checks the size of each watched file, and sends any data appended
+    // since the last packet. If the file gets shorter, it's sent again from
+    // the start. A packet with an error stops the watch. The host needs to
+    // send TAIL for the watch (which may change the interval and packet size)
+    // at least every LITTLEFS_TAIL_TIMEOUT_MSEC to keep it going.
+    rsp->setCommand(Command::TAIL);
+    Unpacker unpacker(cmd);
+    uint8_t watchNum;
+    uint8_t flags;
+    uint16_t intervalMsec;
+    uint16_t maxBytes;
+    unpacker.unpack(&watchNum);
+    unpacker.unpack(&flags);
+    unpacker.unpack(&intervalMsec);
+    unpacker.unpack(&maxBytes);
+
+    TailWatch* watch = nullptr;
+    Error err = Error::NONE;
+    if (this->m_bus == nullptr) {
+        err = Error::UNSUPPORTED;
+    } else if (watchNum == NO_CURSOR) {
+        char const* filename;
+        uint32_t back;
+        unpacker.unpack(&filename);
+        unpacker.unpack(&back);
+        for (auto& candidate : this->m_tailWatches) {
+            if (!candidate.file) {
+                watch = &candidate;
+                break;
+            }
         }
-        case Command::LIST: {
-            this->handleList(cmd, rsp);
-            return true;
+        if (watch == nullptr) {
+            err = Error::NO_FREE_HANDLES;
+        } else if (strlen(filename) >= sizeof(watch->path)) {
+            err = Error::UNABLE_TO_OPEN_FILE;
+        } else {
+            watch->file = this->openFile(filename, FILE_READ);
+            if (!watch->file || watch->file.isDirectory()) {
+                err = Error::UNABLE_TO_OPEN_FILE;
+            }
         }
-        case Command::MKDIR: {
-            this->handleMkDir(cmd, rsp);
-            return true;
+        if (err == Error::NONE) {
+            strcpy(watch->path, filename);
+            uint32_t size = watch->file.size();
+            watch->offset = (back >= size) ? 0 : size - back;
+            // Send the starting data on the next run().
+            watch->lastSent = millis() - intervalMsec;
+            watchNum = watch - this->m_tailWatches;
+        } else if (watch != nullptr) {
+            this->closeTailWatch(watch);
         }
-        case Command::REMOVE: {
-            this->handleRemove(cmd, rsp);
-            return true;
+    } else if (watchNum >= LEN(this->m_tailWatches) || !this->m_tailWatches[watchNum].file) {
+        err = Error::INVALID_CURSOR;
+    } else {
+        watch = &this->m_tailWatches[watchNum];
+    }
+
+    if (err == Error::NONE && (flags & TailFlags::STOP) != 0) {
+        this->closeTailWatch(watch);
+        watchNum = NO_CURSOR;
+        watch = nullptr;
+    }
+    rsp->appendByte(to_underlying(err));
+    if (err != Error::NONE || watch == nullptr) {
+        rsp->append(NO_CURSOR);
+        rsp->append(static_cast<uint32_t>(0));
+        rsp->append(static_cast<uint32_t>(0));
+        return;
+    }
+    watch->intervalMsec = intervalMsec;
+    watch->maxBytes = maxBytes;
+    watch->lastUsed = millis();
+    rsp->append(watchNum);
+    rsp->append(watch->offset);
+    rsp->append(static_cast<uint32_t>(watch->file.size()));
+}
+
+void LittleFsPacketHandler::handleTruncate(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      str - filename
+    //      u32 - new length of the file
+    // Response:
+    //      u8  - error code
+    //
+    // Files are created if they don't exist, and extended with zeros if
+    // they're shorter than the new length, so TRUNCATE can also be used to
+    // lay out a file before filling it in with WRITE_AT.
+    Unpacker unpacker(cmd);
+    char const* filename;
+    uint32_t length;
+
+    unpacker.unpack(&filename);
+    unpacker.unpack(&length);
+
+    rsp->setCommand(Command::TRUNCATE);
+    uint8_t* errPtr = rsp->getWriteData();
+    rsp->append(to_underlying(Error::NONE));
+
+    this->evictCachedFiles(filename);
+    File file = this->openFile(filename, FILE_READ);
+    bool exists = file;
+    if (exists && file.isDirectory()) {
+        this->closeFile(&file);
+        *errPtr = to_underlying(Error::UNABLE_TO_OPEN_FILE);
+        return;
+    }
+    uint32_t size = exists ? file.size() : 0;
+    if (length >= size) {
+        if (exists) {
+            this->closeFile(&file);
+            if (length == size) {
+                return;
+            }
         }
-        case Command::RENAME: {
-            this->handleRename(cmd, rsp);
-            return true;
+        file = this->openFile(filename, FILE_APPEND);
+        if (!file) {
+            *errPtr = to_underlying(Error::UNABLE_TO_OPEN_FILE);
+            return;
         }
-        case Command::READ: {
-            this->handleRead(cmd, rsp);
-            return true;
+        memset(this->m_ioBuffer, 0, sizeof(this->m_ioBuffer));
+        while (size < length) {
+            uint32_t count = length - size;
+            if (count > sizeof(this->m_ioBuffer)) {
+                count = sizeof(this->m_ioBuffer);
+            }
+            if (this->writeFile(&file, this->m_ioBuffer, count) != count) {
+                this->closeFile(&file);
+                *errPtr = to_underlying(Error::WRITE_FAILED);
+                return;
+            }
+            size += count;
         }
-        case Command::WRITE: {
-            this->handleWriteAppend(FILE_WRITE, cmd, rsp);
-            return true;
+        this->closeFile(&file);
+        return;
+    }
+
+    // fs::File can't truncate, so copy the part of the file being kept into
+    // a temporary file, and replace the file with it.
+    char tempPath[LITTLEFS_MAX_PATH_LEN];
+    if (!makeTempPath(filename, ".trunc", tempPath, sizeof(tempPath))) {
+        this->closeFile(&file);
+        *errPtr = to_underlying(Error::UNABLE_TO_OPEN_FILE);
+        return;
+    }
+    File temp = this->openFile(tempPath, FILE_WRITE);
+    if (!temp) {
+        this->closeFile(&file);
+        *errPtr = to_underlying(Error::UNABLE_TO_OPEN_FILE);
+        return;
+    }
+    Error err = Error::NONE;
+    for (uint32_t copied = 0; copied < length;) {
+        uint32_t count = length - copied;
+        if (count > sizeof(this->m_ioBuffer)) {
+            count = sizeof(this->m_ioBuffer);
         }
-        case Command::APPEND: {
-            this->handleWriteAppend(FILE_APPEND, cmd, rsp);
-            return true;
+        size_t bytesRead = this->readFile(&file, this->m_ioBuffer, count);
+        if (bytesRead != count) {
+            err = Error::READ_FAILED;
+            break;
         }
-        case Command::RMDIR: {
-            this->handleRmDir(cmd, rsp);
-            return true;
+        if (this->writeFile(&temp, this->m_ioBuffer, count) != count) {
+            err = Error::WRITE_FAILED;
+            break;
         }
+        copied += count;
     }
-    return false;
-}
-
-void LittleFsPacketHandler::handleCopy(Packet const& cmd, Packet* rsp) {
-    rsp->setCommand(Command::COPY);
+    this->closeFile(&temp);
+    this->closeFile(&file);
+    if (err == Error::NONE && !this->fsRename(tempPath, filename)) {
+        err = Error::RENAME_FAILED;
+    }
+    if (err != Error::NONE) {
+        this->fsRemove(tempPath);
+    }
+    *errPtr = to_underlying(err);
 }
 
-void LittleFsPacketHandler::handleFormat(Packet const& cmd, Packet* rsp) {
-    // Command: No Data
+void LittleFsPacketHandler::handleUploadBegin(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - flags (UploadFlags)
+    //      str - filename
     // Response:
-    //      u8 - Error Code
-    rsp->setCommand(Command::FORMAT);
+    //      u8  - error code
+    //      u8  - handle
+    //      u32 - number of bytes already uploaded (where the first chunk should start)
+    //      u32 - CRC-32 of the bytes already uploaded
+    //
+    // The data is sent to the returned handle using STREAM_WRITE or
+    // WRITE_HANDLE, and goes into a hidden temporary file next to filename,
+    // so filename isn't touched until UPLOAD_COMMIT. If the link drops, the
+    // temporary file is kept, and a session started with UploadFlags::RESUME
+    // carries on from the end of it. The host compares the CRC with the start
+    // of its own copy to check that the data came from the same file.
+    Unpacker unpacker(cmd);
+    uint8_t flags;
+    char const* filename;
 
-    if (LittleFS.format()) {
-        rsp->appendByte(to_underlying(Error::NONE));
+    unpacker.unpack(&flags);
+    unpacker.unpack(&filename);
+
+    rsp->setCommand(Command::UPLOAD_BEGIN);
+    uint8_t* errPtr = rsp->getWriteData();
+    rsp->appendByte(to_underlying(Error::NONE));
+    uint8_t* handlePtr = rsp->getWriteData();
+    rsp->appendByte(0);
+    uint32_t* committedPtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
+    rsp->append(static_cast<uint32_t>(0));
+    uint32_t* crcPtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
+    rsp->append(static_cast<uint32_t>(0));
+
+    uint8_t handle;
+    FileHandle* fileHandle = this->allocFileHandle(&handle);
+    if (fileHandle == nullptr) {
+        *errPtr = to_underlying(Error::NO_FREE_HANDLES);
+        return;
+    }
+    if (strlen(filename) >= sizeof(fileHandle->uploadPath) ||
+        !makeTempPath(filename, ".upload", fileHandle->path, sizeof(fileHandle->path))) {
+        *errPtr = to_underlying(Error::UNABLE_TO_OPEN_FILE);
+        return;
+    }
+
+    uint32_t committed = 0;
+    Crc32 crc;
+    if ((flags & UploadFlags::RESUME) != 0 && this->fsExists(fileHandle->path)) {
+        fileHandle->file = this->openFile(fileHandle->path, FILE_UPDATE);
+        if (fileHandle->file) {
+            size_t bytesRead;
+            while ((bytesRead = this->readFile(&fileHandle->file, this->m_ioBuffer,
+                                               sizeof(this->m_ioBuffer))) > 0) {
+                crc.update(this->m_ioBuffer, bytesRead);
+                committed += bytesRead;
+            }
+            // A seek is needed when switching from reading to writing.
+            if (!this->seekFile(&fileHandle->file, committed)) {
+                this->closeFileHandle(fileHandle);
+                *errPtr = to_underlying(Error::SEEK_FAILED);
+                return;
+            }
+        }
     } else {
-        rsp->appendByte(to_underlying(Error::FORMAT_FAILED));
+        fileHandle->file = this->openFile(fileHandle->path, FILE_WRITE);
+    }
+    if (!fileHandle->file) {
+        this->closeFileHandle(fileHandle);
+        *errPtr = to_underlying(Error::UNABLE_TO_OPEN_FILE);
+        return;
     }
+    strcpy(fileHandle->uploadPath, filename);
+    *handlePtr = handle;
+    *committedPtr = committed;
+    *crcPtr = crc.value();
 }
 
-void LittleFsPacketHandler::handleInfo(Packet const& cmd, Packet* rsp) {
-    // Command: No Data
+void LittleFsPacketHandler::handleUploadCommit(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      u8  - handle returned by UPLOAD_BEGIN
+    //      u8  - flags (UploadFlags)
+    //      u32 - length of the complete file
     // Response:
-    //      u32 - totalBytes
-    //      u32 - usedBytes
+    //      u8  - error code
+    //
+    // The handle is always closed. If the temporary file isn't the length
+    // that the host expects, VERIFY_FAILED is returned and the temporary file
+    // is kept so that the upload can be resumed (or aborted).
+    Unpacker unpacker(cmd);
+    uint8_t handle;
+    uint8_t flags;
+    uint32_t length;
 
-    rsp->setCommand(Command::INFO);
+    unpacker.unpack(&handle);
+    unpacker.unpack(&flags);
+    unpacker.unpack(&length);
 
-    InfoResponse info = {};
-    info.totalBytes = LittleFS.totalBytes();
-    info.usedBytes = LittleFS.usedBytes();
+    rsp->setCommand(Command::UPLOAD_COMMIT);
+    FileHandle* fileHandle = this->getFileHandle(handle);
+    if (fileHandle == nullptr || fileHandle->uploadPath[0] == '\0') {
+        rsp->appendByte(to_underlying(Error::INVALID_HANDLE));
+        return;
+    }
+    char tempPath[LITTLEFS_MAX_PATH_LEN];
+    char path[LITTLEFS_MAX_PATH_LEN];
+    strcpy(tempPath, fileHandle->path);
+    strcpy(path, fileHandle->uploadPath);
+    uint32_t size = fileHandle->file.size();
+    this->closeFileHandle(fileHandle);
 
-    rsp->appendData(sizeof(info), &info);
+    if ((flags & UploadFlags::ABORT) != 0) {
+        this->fsRemove(tempPath);
+        rsp->appendByte(to_underlying(Error::NONE));
+        return;
+    }
+    if (size != length) {
+        rsp->appendByte(to_underlying(Error::VERIFY_FAILED));
+        return;
+    }
+    this->evictCachedFiles(path);
+    if (!this->fsRename(tempPath, path)) {
+        rsp->appendByte(to_underlying(Error::RENAME_FAILED));
+        return;
+    }
+    rsp->appendByte(to_underlying(Error::NONE));
 }
 
-void LittleFsPacketHandler::handleList(Packet const& cmd, Packet* rsp) {
+void LittleFsPacketHandler::handleWalk(Packet const& cmd, Packet* rsp) {
     // Command:
-    //      u16 - index
+    //      u8  - cursor (NO_CURSOR to start a new listing)
+    //      u8  - window (number of response packets to send)
+    //  Only used when starting a new listing:
     //      str - dirname
-    // Response:
+    //      u8  - maximum depth (1 = just dirname, 0 = LITTLEFS_WALK_MAX_DEPTH)
+    //      str - glob pattern (empty for everything). Patterns containing a
+    //            slash are matched against the whole relative path, and other
+    //            patterns against the last component.
+    // Response (up to window packets, the last one has StreamFlags::LAST set):
+    //      u8  - error code
+    //      u8  - flags (StreamFlags, END_OF_FILE is set once the walk is done)
+    //      u8  - sequence number (0 to window - 1)
+    //      u8  - cursor to pass to the next WALK (NO_CURSOR when done)
     //  Variable number of entries
-    //      u16 - index
     //      u8  - flags
     //      u32 - filesize
     //      u32 - timestamp
-    //      str - filename
+    //      str - path (relative to dirname)
+    //
+    // Subdirectories are listed straight after the entry for the directory.
+    // The cursor is freed if it isn't used for LITTLEFS_DIR_CURSOR_TIMEOUT_MSEC.
     Unpacker unpacker(cmd);
-    uint16_t index;
-    char const* dirName;
-
-    unpacker.unpack(&index);
-    unpacker.unpack(&dirName);
+    uint8_t cursorNum;
+    uint8_t window;
+    unpacker.unpack(&cursorNum);
+    unpacker.unpack(&window);
 
-    uint16_t fileNum = 0;
-    File dir = LittleFS.open(dirName);
-    File file = dir.openNextFile();
-    while (fileNum < index) {
-        fileNum++;
-        file = dir.openNextFile();
+    if (window == 0 || this->m_bus == nullptr) {
+        window = 1;
     }
+    this->expireCursors();
 
-    rsp->setCommand(Command::LIST);
-    while (file) {
-        Flags flags;
-        if (file.isDirectory()) {
-            flags.set(Flags::DIR);
-        }
-        uint32_t fileSize = file.size();
-        uint32_t timestamp = file.getLastWrite();
-        char const* filename = file.name();
+    WalkCursor* walk = &this->m_walkCursor;
+    Error err = Error::NONE;
+    if (cursorNum == NO_CURSOR) {
+        char const* dirName;
+        uint8_t maxDepth;
+        char const* pattern;
+        unpacker.unpack(&dirName);
+        unpacker.unpack(&maxDepth);
+        unpacker.unpack(&pattern);
 
-        uint32_t entrySize = sizeof(fileNum) + sizeof(flags) + sizeof(fileSize) +
-                             sizeof(timestamp) + strlen(filename) + 1;
-        if (entrySize > rsp->getSpaceRemaining()) {
-            break;
+        // Only one WALK can be in progress, so starting a new one replaces it.
+        this->closeWalkCursor();
+        if (++this->m_walkCursorNum == NO_CURSOR) {
+            this->m_walkCursorNum = 0;
         }
-
-        rsp->append(fileNum);
-        rsp->append(flags);
-        rsp->append(fileSize);
-        rsp->append(timestamp);
-        rsp->append(filename);
-        fileNum++;
-        file = dir.openNextFile();
+        if (strlen(pattern) >= sizeof(walk->pattern)) {
+            err = Error::UNSUPPORTED;
+        } else {
+            walk->dirs[0] = this->fsOpen(dirName);
+            if (!walk->dirs[0] || !walk->dirs[0].isDirectory()) {
+                walk->dirs[0] = File();
+                err = Error::UNABLE_TO_OPEN_FILE;
+            } else {
+                walk->depth = 1;
+                walk->maxDepth = (maxDepth == 0 || maxDepth > LEN(walk->dirs)) ? LEN(walk->dirs)
+                                                                               : maxDepth;
+                size_t rootLen = strlen(walk->dirs[0].path());
+                walk->prefixLen =
+                    (rootLen > 0 && walk->dirs[0].path()[rootLen - 1] == '/') ? rootLen
+                                                                              : rootLen + 1;
+                strcpy(walk->pattern, pattern);
+            }
+        }
+    } else if (cursorNum != this->m_walkCursorNum || walk->depth == 0) {
+        err = Error::INVALID_CURSOR;
     }
-}
 
-void LittleFsPacketHandler::handleMkDir(Packet const& cmd, Packet* rsp) {
-    // Command:
-    //      str - dirname
-    // Response:
-    //      u8 - error code.
-    rsp->setCommand(Command::MKDIR);
-    Unpacker unpacker(cmd);
-    char const* dirName;
-    unpacker.unpack(&dirName);
+    for (uint8_t seq = 0;; seq++) {
+        rsp->setCommand(Command::WALK);
+        rsp->setDataLength(0);
+        rsp->append(to_underlying(err));
+        uint8_t* flagsPtr = rsp->getWriteData();
+        rsp->append(static_cast<uint8_t>(seq + 1 == window ? StreamFlags::LAST : 0));
+        rsp->append(seq);
+        uint8_t* cursorPtr = rsp->getWriteData();
+        rsp->append(this->m_walkCursorNum);
 
-    if (LittleFS.mkdir(dirName)) {
-        rsp->appendByte(to_underlying(Error::NONE));
-    } else {
-        rsp->appendByte(to_underlying(Error::MKDIR_FAILED));
+        if (err != Error::NONE) {
+            *flagsPtr |= StreamFlags::LAST;
+            *cursorPtr = NO_CURSOR;
+            return;
+        }
+        walk->lastUsed = millis();
+        if (this->appendWalkEntries(rsp)) {
+            this->closeWalkCursor();
+            *flagsPtr |= StreamFlags::LAST | StreamFlags::END_OF_FILE;
+            *cursorPtr = NO_CURSOR;
+        }
+        if ((*flagsPtr & StreamFlags::LAST) != 0) {
+            // The last packet is sent by the bus as the reply to the command.
+            return;
+        }
+        this->m_bus->writePacket(*rsp);
     }
 }
 
-void LittleFsPacketHandler::handleRemove(Packet const& cmd, Packet* rsp) {
+void LittleFsPacketHandler::handleWriteAppend(char const* mode, Packet const& cmd, Packet* rsp) {
     // Command:
     //      str - filename
+    //      u32 - data length
+    //      bytes - data
     // Response:
-    //      u8 - error code.
-    rsp->setCommand(Command::REMOVE);
+    //      u8 - Error code
     Unpacker unpacker(cmd);
-    char const* fileName;
-    unpacker.unpack(&fileName);
+    char const* filename;
+    uint32_t length;
+    uint8_t const* data;
 
-    if (LittleFS.remove(fileName)) {
-        rsp->appendByte(to_underlying(Error::NONE));
-    } else {
-        rsp->appendByte(to_underlying(Error::REMOVE_FAILED));
-    }
+    unpacker.unpack(&filename);
+    unpacker.unpack(&length);
+    unpacker.unpack(length, &data);
+
+    rsp->setCommand(cmd.getCommand());
+    rsp->appendByte(to_underlying(this->writeData(mode, filename, data, length)));
 }
 
-void LittleFsPacketHandler::handleRename(Packet const& cmd, Packet* rsp) {
-    rsp->setCommand(Command::RENAME);
+void LittleFsPacketHandler::handleWrite(Packet const& cmd, Packet* rsp) {
+    this->handleWriteAppend(FILE_WRITE, cmd, rsp);
 }
 
-void LittleFsPacketHandler::handleRead(Packet const& cmd, Packet* rsp) {
+void LittleFsPacketHandler::handleWriteAt(Packet const& cmd, Packet* rsp) {
+    // Command:
+    //      str - filename
+    //      u32 - offset
+    //      u32 - data length
+    //      bytes - data
+    // Response:
+    //      u8  - error code
+    //      u32 - size of the file after writing
+    //
+    // The file must already exist. Writing past the end of the file extends
+    // it, with any gap filled with zeros.
     Unpacker unpacker(cmd);
     char const* filename;
     uint32_t offset;
     uint32_t length;
+    uint8_t const* data;
 
     unpacker.unpack(&filename);
     unpacker.unpack(&offset);
     unpacker.unpack(&length);
+    unpacker.unpack(length, &data);
 
-    rsp->setCommand(Command::READ);
+    rsp->setCommand(Command::WRITE_AT);
     uint8_t* errPtr = rsp->getWriteData();
     rsp->append(to_underlying(Error::NONE));
-    rsp->append(offset);
-    uint32_t* lenPtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
-    rsp->append(length);
-
-    if (length > rsp->getSpaceRemaining()) {
-        *errPtr = to_underlying(Error::READ_FAILED);
-        *lenPtr = 0;
-        return;
-    }
+    uint32_t* sizePtr = reinterpret_cast<uint32_t*>(rsp->getWriteData());
+    rsp->append(static_cast<uint32_t>(0));
 
-    File file = LittleFS.open(filename, FILE_READ);
+    this->evictCachedFiles(filename);
+    File file = this->openFile(filename, FILE_UPDATE);
     if (!file) {
         *errPtr = to_underlying(Error::UNABLE_TO_OPEN_FILE);
         return;
     }
-    if (!file.seek(offset)) {
+    if (!this->seekFile(&file, offset)) {
         *errPtr = to_underlying(Error::SEEK_FAILED);
-        return;
+    } else if (this->writeFile(&file, data, length) != length) {
+        *errPtr = to_underlying(Error::WRITE_FAILED);
     }
-
-    *lenPtr = file.read(rsp->getWriteData(0), length);
-    (void)rsp->getWriteData(*lenPtr);
-
-    file.close();
-    *errPtr = to_underlying(Error::NONE);
+    *sizePtr = file.size();
+    this->closeFile(&file);
 }
 
-void LittleFsPacketHandler::handleRmDir(Packet const& cmd, Packet* rsp) {
+void LittleFsPacketHandler::handleWriteCompressed(Packet const& cmd, Packet* rsp) {
     // Command:
-    //      str - dirname
+    //      str - filename
+    //      u8  - mode (OpenMode::WRITE or OpenMode::APPEND)
+    //      u8  - codec (Codec)
+    //      u32 - length (uncompressed, at most LITTLEFS_COMPRESS_BUFFER_SIZE)
+    //      u32 - data length
+    //      bytes - data
     // Response:
-    //      u8 - error code.
-    rsp->setCommand(Command::RMDIR);
+    //      u8 - Error code
     Unpacker unpacker(cmd);
-    char const* dirName;
-    unpacker.unpack(&dirName);
+    char const* filename;
+    uint8_t mode;
+    uint8_t codec;
+    uint32_t length;
+    uint32_t dataLen;
+    uint8_t const* data;
 
-    if (LittleFS.rmdir(dirName)) {
-        rsp->appendByte(to_underlying(Error::NONE));
-    } else {
-        rsp->appendByte(to_underlying(Error::RMDIR_FAILED));
+    unpacker.unpack(&filename);
+    unpacker.unpack(&mode);
+    unpacker.unpack(&codec);
+    unpacker.unpack(&length);
+    unpacker.unpack(&dataLen);
+    unpacker.unpack(dataLen, &data);
+
+    rsp->setCommand(Command::WRITE_COMPRESSED);
+
+    char const* fileMode;
+    switch (static_cast<OpenMode>(mode)) {
+        case OpenMode::WRITE: {
+            fileMode = FILE_WRITE;
+            break;
+        }
+        case OpenMode::APPEND: {
+            fileMode = FILE_APPEND;
+            break;
+        }
+        default: {
+            rsp->appendByte(to_underlying(Error::UNSUPPORTED));
+            return;
+        }
+    }
+
+    switch (static_cast<Codec>(codec)) {
+        case Codec::NONE: {
+            if (dataLen != length) {
+                rsp->appendByte(to_underlying(Error::WRITE_FAILED));
+                return;
+            }
+            break;
+        }
+#if LITTLEFS_COMPRESSION
+        case Codec::LZ4: {
+            size_t decompressedLen;
+            if (!Lz4::decompress(
+                    data, dataLen, this->m_compressBuffer, sizeof(this->m_compressBuffer),
+                    &decompressedLen) ||
+                decompressedLen != length) {
+                rsp->appendByte(to_underlying(Error::WRITE_FAILED));
+                return;
+            }
+            data = this->m_compressBuffer;
+            break;
+        }
+#endif
+        default: {
+            rsp->appendByte(to_underlying(Error::UNSUPPORTED));
+            return;
+        }
     }
+    rsp->appendByte(to_underlying(this->writeData(fileMode, filename, data, length)));
 }
 
-void LittleFsPacketHandler::handleWriteAppend(char const* mode, Packet const& cmd, Packet* rsp) {
+void LittleFsPacketHandler::handleWriteHandle(Packet const& cmd, Packet* rsp) {
     // Command:
-    //      str - filename
+    //      u8  - handle
+    //      u32 - offset
     //      u32 - data length
     //      bytes - data
     // Response:
     //      u8 - Error code
     Unpacker unpacker(cmd);
-    char const* filename;
+    uint8_t handle;
+    uint32_t offset;
     uint32_t length;
     uint8_t const* data;
 
-    unpacker.unpack(&filename);
+    unpacker.unpack(&handle);
+    unpacker.unpack(&offset);
     unpacker.unpack(&length);
     unpacker.unpack(length, &data);
 
-    rsp->setCommand(cmd.getCommand());
+    rsp->setCommand(Command::WRITE_HANDLE);
 
-    File file = LittleFS.open(filename, mode);
-    if (!file) {
-        rsp->appendByte(to_underlying(Error::UNABLE_TO_OPEN_FILE));
+    FileHandle* fileHandle = this->getFileHandle(handle);
+    if (fileHandle == nullptr) {
+        rsp->appendByte(to_underlying(Error::INVALID_HANDLE));
+        return;
+    }
+    if (fileHandle->path[0] != '\0') {
+        this->evictCachedFiles(fileHandle->path);
+    }
+    if (!this->seekFile(&fileHandle->file, offset)) {
+        rsp->appendByte(to_underlying(Error::SEEK_FAILED));
         return;
     }
-    if (file.write(data, length) != length) {
+    if (this->writeFile(&fileHandle->file, data, length) != length) {
         rsp->appendByte(to_underlying(Error::WRITE_FAILED));
         return;
     }
-    file.close();
     rsp->appendByte(to_underlying(Error::NONE));
 }
+
+LittleFsPacketHandler::Error LittleFsPacketHandler::writeData(
+    char const* mode,
+    char const* filename,
+    uint8_t const* data,
+    uint32_t length) {
+    if (strcmp(mode, FILE_APPEND) == 0 && strlen(filename) < sizeof(this->m_appendPath)) {
+        // Consecutive APPENDs to the same file are collected in the append
+        // buffer, and written to flash a block at a time.
+        return this->appendBuffered(filename, data, length);
+    }
+
+    this->flushAppendBuffer(true);
+    this->evictCachedFiles(filename);
+    File file = this->openFile(filename, mode);
+    if (!file) {
+        return Error::UNABLE_TO_OPEN_FILE;
+    }
+    if (this->writeFile(&file, data, length) != length) {
+        return Error::WRITE_FAILED;
+    }
+    this->closeFile(&file);
+    return Error::NONE;
+}
+
+LittleFsPacketHandler::Error LittleFsPacketHandler::mkDir(char const* dirName) {
+    if (!this->fsMkdir(dirName)) {
+        return Error::MKDIR_FAILED;
+    }
+    return Error::NONE;
+}
+
+LittleFsPacketHandler::Error LittleFsPacketHandler::removeFile(char const* fileName) {
+    this->evictCachedFiles(fileName);
+    if (!this->fsRemove(fileName)) {
+        return Error::REMOVE_FAILED;
+    }
+    return Error::NONE;
+}
+
+LittleFsPacketHandler::Error LittleFsPacketHandler::renameFile(
+    char const* oldName,
+    char const* newName) {
+    this->evictCachedFiles(oldName);
+    this->evictCachedFiles(newName);
+    if (!this->fsRename(oldName, newName)) {
+        return Error::RENAME_FAILED;
+    }
+    return Error::NONE;
+}
+
+LittleFsPacketHandler::Error LittleFsPacketHandler::rmDir(char const* dirName) {
+    this->evictCachedFiles(dirName);
+    for (auto& cursor : this->m_dirCursors) {
+        this->closeDirCursor(&cursor);
+    }
+    this->closeWalkCursor();
+    this->closeSearchCursor();
+    this->closeExportCursor();
+    if (!this->fsRmdir(dirName)) {
+        return Error::RMDIR_FAILED;
+    }
+    return Error::NONE;
+}
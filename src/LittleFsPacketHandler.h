@@ -16,26 +16,104 @@
 
 #pragma once
 
+#include <atomic>
 #include <cinttypes>
 
+#include "Crc32.h"
+#include "FS.h"
+#include "FsBackend.h"
+#include "LittleFsConfig.h"
+#include "Lz4.h"
 #include "PacketHandler.h"
 
+class IBus;
+class LittleFsPacketHandler;
+class Unpacker;
+
+//! Entry in LittleFsPacketHandler::COMMAND_TABLE. This lives outside of the
+//! class so that it is complete, and its constructor usable in a constant
+//! expression, where the class initializes the table.
+struct LittleFsCommandInfo {
+    //! Member function which handles a command.
+    using Handler = void (LittleFsPacketHandler::*)(Packet const& cmd, Packet* rsp);
+
+    //! @returns The smallest number of bytes which can hold the arguments
+    //! described by args (b = u8, h = u16, w = u32, s = str).
+    static constexpr uint8_t minArgsLength(char const* args) {
+        return (*args == '\0') ? 0
+                                : ((*args == 'b') ? 1 : (*args == 'w') ? 4 : 2) +
+                                      minArgsLength(args + 1);
+    }
+
+    //! Constructor.
+    constexpr LittleFsCommandInfo(
+        Packet::Command::Type command,  //!< [in] Command that the entry is for.
+        char const* name,               //!< [in] Name returned by as_str.
+        char const* args,               //!< [in] Arguments which every command has.
+        Handler handler,                //!< [in] Function which handles the command.
+        uint8_t flags = 0               //!< [in] LittleFsPacketHandler::CommandFlags.
+        )
+        : command{command},
+          name{name},
+          args{args},
+          minLength{minArgsLength(args)},
+          flags{flags},
+          handler{handler} {}
+
+    Packet::Command::Type command;  //!< Command that the entry is for.
+    char const* name;               //!< Name returned by as_str.
+    char const* args;               //!< Arguments which every command has (see minArgsLength).
+    uint8_t minLength;              //!< Smallest amount of data which holds args.
+    uint8_t flags;                  //!< LittleFsPacketHandler::CommandFlags.
+    Handler handler;                //!< Function which handles the command.
+};
+
 //! Packet handler for dealing with core commands.
 class LittleFsPacketHandler : public IPacketHandler {
  public:
     //! Commands accepted by the Core packet handler.
     struct Command : public Packet::Command {
-        static constexpr Type FORMAT = 0x40;  //!< Format a file system.
-        static constexpr Type INFO = 0x41;    //!< Return info about a file system.
-        static constexpr Type LIST = 0x42;    //!< List files in a directory
-        static constexpr Type MKDIR = 0x43;   //!< Create a new directory.
-        static constexpr Type REMOVE = 0x44;  //!< Remove a file or directory.
-        static constexpr Type RENAME = 0x45;  //!< Rename a file or directory.
-        static constexpr Type COPY = 0x46;    //!< Copy a file
-        static constexpr Type READ = 0x47;    //!< Read data from a file.
-        static constexpr Type WRITE = 0x48;   //!< Write data to a file.
-        static constexpr Type APPEND = 0x49;  //!< Append data to a file.
-        static constexpr Type RMDIR = 0x4a;   //!< Remove a directory.
+        static constexpr Type FORMAT = 0x40;            //!< Format a file system.
+        static constexpr Type INFO = 0x41;              //!< Return info about a file system.
+        static constexpr Type LIST = 0x42;              //!< List files in a directory
+        static constexpr Type MKDIR = 0x43;             //!< Create a new directory.
+        static constexpr Type REMOVE = 0x44;            //!< Remove a file or directory.
+        static constexpr Type RENAME = 0x45;            //!< Rename a file or directory.
+        static constexpr Type COPY = 0x46;              //!< Copy a file
+        static constexpr Type READ = 0x47;              //!< Read data from a file.
+        static constexpr Type WRITE = 0x48;             //!< Write data to a file.
+        static constexpr Type APPEND = 0x49;            //!< Append data to a file.
+        static constexpr Type RMDIR = 0x4a;             //!< Remove a directory.
+        static constexpr Type OPEN = 0x4b;              //!< Open a file, returning a handle.
+        static constexpr Type READ_HANDLE = 0x4c;       //!< Read data from an open file.
+        static constexpr Type WRITE_HANDLE = 0x4d;      //!< Write data to an open file.
+        static constexpr Type CLOSE = 0x4e;             //!< Close an open file.
+        static constexpr Type LIST_CURSOR = 0x4f;       //!< List files, resuming from a cursor.
+        static constexpr Type STREAM_READ = 0x50;       //!< Read a window of packets from a file.
+        static constexpr Type STREAM_WRITE = 0x51;      //!< Write one chunk of a windowed upload.
+        static constexpr Type CAPS = 0x52;              //!< Return capabilities and buffer sizes.
+        static constexpr Type FLUSH = 0x53;             //!< Write buffered APPEND data to flash.
+        static constexpr Type HASH = 0x54;              //!< Return a CRC-32 or SHA-256 of a file.
+        static constexpr Type SIGNATURE = 0x55;         //!< Return per-block checksums of a file.
+        static constexpr Type PATCH = 0x56;             //!< Build a file from blocks and new data.
+        static constexpr Type READ_COMPRESSED = 0x57;   //!< Read compressed data from a file.
+        static constexpr Type WRITE_COMPRESSED = 0x58;  //!< Write compressed data to a file.
+        static constexpr Type WALK = 0x59;              //!< List all of the files in a tree.
+        static constexpr Type BATCH = 0x5a;             //!< Run several MKDIR/REMOVE/RMDIR/RENAMEs.
+        static constexpr Type JOB_START = 0x5b;         //!< Start a long operation as a job.
+        static constexpr Type JOB_STATUS = 0x5c;        //!< Return the progress or result of a job.
+        static constexpr Type LIST_COMPACT = 0x5d;      //!< List selected fields of each file.
+        static constexpr Type STATFS = 0x5e;            //!< Return file system geometry and usage.
+        static constexpr Type STATS = 0x5f;             //!< Return timing counters.
+        static constexpr Type WRITE_AT = 0x60;          //!< Overwrite part of an existing file.
+        static constexpr Type TRUNCATE = 0x61;          //!< Shrink or extend a file.
+        static constexpr Type UPLOAD_BEGIN = 0x62;      //!< Start or resume an upload session.
+        static constexpr Type UPLOAD_COMMIT = 0x63;     //!< Replace a file with a finished upload.
+        static constexpr Type SEARCH = 0x64;            //!< Return the lines of files which match.
+        static constexpr Type TAIL = 0x65;              //!< Send data as it's appended to a file.
+        static constexpr Type EXPORT = 0x66;            //!< Read a directory tree as an archive.
+        static constexpr Type IMPORT = 0x67;            //!< Unpack an archive into a directory.
+        static constexpr Type STAT = 0x68;              //!< Return the size and type of one file.
     };
 
     //! Error codes
@@ -49,6 +127,25 @@ class LittleFsPacketHandler : public IPacketHandler {
         MKDIR_FAILED = 6,         //!< Creating a directory failed.
         RMDIR_FAILED = 7,         //!< Removing a directory failed.
         REMOVE_FAILED = 8,        //!< Remmoving a file failed.
+        INVALID_HANDLE = 9,       //!< The file handle isn't open.
+        NO_FREE_HANDLES = 10,     //!< All of the file handles are in use.
+        INVALID_CURSOR = 11,      //!< The directory cursor doesn't exist (or has expired).
+        OUT_OF_SEQUENCE = 12,     //!< A STREAM_WRITE chunk didn't follow the previous one.
+        RENAME_FAILED = 13,       //!< Renaming a file or directory failed.
+        UNSUPPORTED = 14,         //!< The requested option isn't supported by this device.
+        VERIFY_FAILED = 15,       //!< The data written doesn't match the expected CRC.
+        BUSY = 16,                //!< A job is running which the command would disturb.
+        INVALID_JOB = 17,         //!< The job doesn't exist (or its result was collected).
+        INVALID_COMMAND = 18,     //!< The command is too short to hold its arguments.
+        INVALID_PATH = 19,        //!< A path would leave the directory it belongs in.
+    };
+
+    //! Modes that a file can be opened with using the OPEN command.
+    enum class OpenMode : uint8_t {
+        READ = 0,    //!< Open an existing file for reading.
+        WRITE = 1,   //!< Create a file, truncating it if it already exists.
+        APPEND = 2,  //!< Open a file for writing starting at the end.
+        UPDATE = 3,  //!< Open an existing file for reading and writing, without truncating it.
     };
 
     //! Flags for a directory entry
@@ -56,12 +153,190 @@ class LittleFsPacketHandler : public IPacketHandler {
         static constexpr Type DIR = 0x01;  //!< Directory entry is a directory.
     };
 
+    //! Optional features reported by the CAPS command.
+    struct Capabilities : public Bits<uint32_t> {
+        static constexpr Type STREAM = 0x00000001;        //!< STREAM_READ sends many packets.
+        static constexpr Type HASH_SHA256 = 0x00000002;   //!< HASH supports HashType::SHA256.
+        static constexpr Type COMPRESSION = 0x00000004;   //!< READ/WRITE_COMPRESSED support LZ4.
+        static constexpr Type JOBS = 0x00000008;          //!< Supports JOB_START and JOB_STATUS.
+        static constexpr Type LIST_COMPACT = 0x00000010;  //!< Supports LIST_COMPACT.
+        static constexpr Type UPLOAD = 0x00000020;        //!< Supports UPLOAD_BEGIN/COMMIT.
+        static constexpr Type SEARCH = 0x00000040;        //!< Supports SEARCH.
+        static constexpr Type TAIL = 0x00000080;          //!< Supports TAIL.
+        static constexpr Type ARCHIVE = 0x00000100;       //!< Supports EXPORT and IMPORT.
+        static constexpr Type STAT = 0x00000200;          //!< Supports STAT.
+    };
+
+    //! Fields included in each LIST_COMPACT entry (the name is always included).
+    struct ListFields : public Bits<uint8_t> {
+        static constexpr Type FLAGS = 0x01;      //!< Include the entry flags (Flags).
+        static constexpr Type SIZE = 0x02;       //!< Include the file size.
+        static constexpr Type TIMESTAMP = 0x04;  //!< Include the last write time.
+    };
+
+    //! Flags passed with the UPLOAD_BEGIN and UPLOAD_COMMIT commands.
+    struct UploadFlags : public Bits<uint8_t> {
+        static constexpr Type RESUME = 0x01;  //!< UPLOAD_BEGIN: Keep data from an earlier session.
+        static constexpr Type ABORT = 0x02;   //!< UPLOAD_COMMIT: Remove the temporary file instead.
+    };
+
+    //! Flags passed with the SEARCH command.
+    struct SearchFlags : public Bits<uint8_t> {
+        static constexpr Type IGNORE_CASE = 0x01;  //!< Letters match in either case.
+        static constexpr Type REGEX = 0x02;        //!< The pattern is a regex (see handleSearch).
+    };
+
+    //! Flags sent with each line in a SEARCH response.
+    struct SearchLineFlags : public Bits<uint8_t> {
+        static constexpr Type CONTEXT = 0x01;    //!< The line is context around a match.
+        static constexpr Type TRUNCATED = 0x02;  //!< The line was cut short to fit the packet.
+    };
+
+    //! Flags passed with the TAIL command.
+    struct TailFlags : public Bits<uint8_t> {
+        static constexpr Type STOP = 0x01;  //!< Stop watching the file.
+    };
+
+    //! Flags passed with the EXPORT command.
+    struct ExportFlags : public Bits<uint8_t> {
+        static constexpr Type COMPRESS = 0x01;  //!< Compress the archive with LZ4 when it helps.
+    };
+
+    //! Flags passed with the IMPORT command.
+    struct ImportFlags : public Bits<uint8_t> {
+        static constexpr Type BEGIN = 0x01;  //!< Start unpacking a new archive.
+    };
+
+    //! Types of the records in an EXPORT archive. Each record starts with:
+    //!     u8  - type
+    //!     u16 - path length, followed by the path (relative to the exported
+    //!           directory, without a terminating null)
+    //!     u32 - size (0 for a directory)
+    //!     u32 - timestamp
+    //! A FILE record is followed by size bytes of data and a u32 CRC-32 of
+    //! the data. An END record is just the type.
+    enum class ArchiveRecord : uint8_t {
+        END = 0,   //!< End of the archive.
+        DIR = 1,   //!< A directory.
+        FILE = 2,  //!< A file.
+    };
+
+    //! Flags passed with the STATS command.
+    struct StatsFlags : public Bits<uint8_t> {
+        static constexpr Type RESET = 0x01;  //!< Clear the counters once they've all been sent.
+    };
+
+    //! File system operations timed separately by STATS.
+    enum class StatsPhase : uint8_t {
+        OPEN = 0,   //!< Opening a file.
+        SEEK = 1,   //!< Seeking within a file.
+        READ = 2,   //!< Reading from a file.
+        WRITE = 3,  //!< Writing to a file.
+        CLOSE = 4,  //!< Closing a file (which flushes any data written to it).
+        GC = 5,     //!< Garbage collecting a file system.
+    };
+
+    //! Number of StatsPhase values.
+    static constexpr uint8_t NUM_STATS_PHASES = 6;
+
+    //! Flags passed with, and returned by, the STATFS command.
+    struct StatFsFlags : public Bits<uint8_t> {
+        static constexpr Type SCAN = 0x01;       //!< Add up the sizes of all of the files.
+        static constexpr Type TRUNCATED = 0x02;  //!< SCAN skipped directories nested too deeply.
+    };
+
+    //! Flags passed with, and returned by, the STAT command.
+    struct StatFlags : public Bits<uint8_t> {
+        static constexpr Type DIR_SIZE = 0x01;   //!< Add up the sizes of the files in a directory.
+        static constexpr Type NO_CACHE = 0x02;   //!< Read from the file system, not the cache.
+        static constexpr Type TRUNCATED = 0x04;  //!< DIR_SIZE skipped deeply nested directories.
+        static constexpr Type CACHED = 0x08;     //!< The response came from the metadata cache.
+    };
+
+    //! Algorithms supported by the HASH command.
+    enum class HashType : uint8_t {
+        CRC32 = 0,   //!< CRC-32, as calculated by zlib (4 byte digest).
+        SHA256 = 1,  //!< SHA-256 (32 byte digest).
+    };
+
+    //! Ways that the data in READ_COMPRESSED and WRITE_COMPRESSED can be encoded.
+    enum class Codec : uint8_t {
+        NONE = 0,  //!< Data is sent as is (used when it doesn't compress).
+        LZ4 = 1,   //!< Data is a single LZ4 block.
+    };
+
+    //! Operations contained in a PATCH command.
+    enum class PatchOp : uint8_t {
+        BEGIN = 0,    //!< Start building a new version of a file.
+        COPY = 1,     //!< Copy blocks from the existing version of the file.
+        LITERAL = 2,  //!< Add data sent by the host.
+        END = 3,      //!< Verify the new file and replace the existing one.
+        ABORT = 4,    //!< Throw away the new file.
+    };
+
+    //! Operations which can be started by JOB_START.
+    enum class JobType : uint8_t {
+        NONE = 0,         //!< No job.
+        COPY = 1,         //!< Copy a file.
+        RMTREE = 2,       //!< Remove a directory and everything inside it.
+        FORMAT = 3,       //!< Format the file system.
+        MAINTENANCE = 4,  //!< Garbage collect each file system which supports it.
+    };
+
+    //! State of a job, as reported by JOB_STATUS.
+    enum class JobState : uint8_t {
+        RUNNING = 0,  //!< The job hasn't finished yet.
+        DONE = 1,     //!< The job has finished, and its result is available.
+    };
+
+    //! Flags passed with the BATCH command.
+    struct BatchFlags : public Bits<uint8_t> {
+        static constexpr Type STOP_ON_ERROR = 0x01;  //!< Don't run the rest after an error.
+    };
+
+    //! Length passed to HASH to include everything up to the end of the file.
+    static constexpr uint32_t TO_END_OF_FILE = 0xffffffff;
+
+    //! Flags sent with each STREAM_READ, COPY, WALK and SEARCH response.
+    struct StreamFlags : public Bits<uint8_t> {
+        static constexpr Type LAST = 0x01;         //!< Last packet sent for this request.
+        static constexpr Type END_OF_FILE = 0x02;  //!< The end of the file (or WALK) was reached.
+    };
+
+    //! Cursor value which starts a new LIST_CURSOR, WALK or SEARCH listing, and
+    //! which is returned once the listing is complete.
+    static constexpr uint8_t NO_CURSOR = 0xff;
+
     //! Response returned by INFO command.
     struct InfoResponse {
         uint32_t totalBytes;  //!< Total number of bytes in the file system.
         uint32_t usedBytes;   //!< Number of used bytes in the file system.
     };
 
+    //! Constructor.
+    explicit LittleFsPacketHandler(
+        IBus* bus = nullptr,          //!< [in] Bus used to send extra responses (may be nullptr).
+        FsBackend* backend = nullptr  //!< [in] Default file system (nullptr for LittleFS).
+    );
+
+    //! Makes another file system available to the host. Paths starting with
+    //! prefix (like /sd/logs/today.txt for the prefix /sd) are looked up in
+    //! backend, and everything else goes to the default file system.
+    //! @returns true if the file system was mounted, false if prefix isn't
+    //!          valid or the mount table is full.
+    bool mount(
+        char const* prefix,  //!< [in] Directory the file system appears as (kept, not copied).
+        FsBackend* backend   //!< [in] File system to add (must outlive the handler).
+    );
+
+    //! Forgets the metadata cached by STAT for path and for each directory
+    //! that it's in (whose DIR_SIZE includes it), or everything if path is
+    //! nullptr. Changes made by the host are noticed automatically, but a
+    //! sketch which writes files itself can call this so that STAT sees them
+    //! straight away, rather than after LITTLEFS_META_CACHE_MSEC.
+    void forgetMetadata(char const* path  //!< [in] File or directory which changed.
+    );
+
     //! Function called to handle an incoming packet.
     //! @returns true if the packet was handled, false if it wasn't.
     bool handlePacket(
@@ -74,65 +349,976 @@ class LittleFsPacketHandler : public IPacketHandler {
     char const* as_str(Packet::Command::Type cmd  //!< The command tp lookup.
     ) const override;
 
+    //! @returns true if cmd is one of the commands handled by this class.
+    static bool isCommand(Packet::Command::Type cmd  //!< [in] Command to check.
+    ) {
+        return cmd >= Command::FORMAT && cmd < Command::FORMAT + NUM_COMMANDS;
+    }
+
+    //! Performs background work, like freeing abandoned directory cursors and
+    //! sending data appended to files being watched by TAIL. This should be
+    //! called from loop().
+    void run();
+
  private:
+    //! Number of commands handled by this class.
+    static constexpr uint8_t NUM_COMMANDS = Command::STAT - Command::FORMAT + 1;
+
+    //! Flags stored in CommandInfo::flags.
+    struct CommandFlags : public Bits<uint8_t> {
+        //! The command doesn't need buffered APPEND data to be written first.
+        //! Set for APPEND itself, WRITE_COMPRESSED (writeData flushes when it
+        //! doesn't append) and the commands which just report on the device
+        //! (STAT flushes for itself when it reports on the appended file).
+        //! Every other command sees the data on flash.
+        static constexpr Type KEEP_APPEND = 0x01;
+
+        //! The command changes files or directories (or opens a file which
+        //! could be). It gets BUSY while a job is running, so that it can't
+        //! change the files that a COPY or RMTREE is working on.
+        static constexpr Type MODIFIES = 0x02;
+    };
+
+    //! Entry in COMMAND_TABLE.
+    using CommandInfo = LittleFsCommandInfo;
+
+    //! @returns true if each entry in COMMAND_TABLE, starting at index, is
+    //! for the command with that number.
+    static constexpr bool isCommandTableInOrder(uint8_t index = 0) {
+        return index >= NUM_COMMANDS ||
+               (COMMAND_TABLE[index].command == Command::FORMAT + index &&
+                isCommandTableInOrder(index + 1));
+    }
+
+    //! A file system mounted by mount().
+    struct Mount {
+        char const* prefix;  //!< Start of the paths which are in this file system.
+        FsBackend* backend;  //!< File system to use.
+    };
+
+    //! Counters kept for each command and StatsPhase.
+    struct Stats {
+        uint32_t count = 0;      //!< Number of times the command or phase ran.
+        uint32_t bytes = 0;      //!< Packet bytes (commands) or file bytes (phases) moved.
+        uint32_t totalUsec = 0;  //!< Total time taken, in microseconds.
+        uint32_t maxUsec = 0;    //!< Longest single time taken, in microseconds.
+    };
+
+    //! A file which is kept open between READ commands.
+    struct CachedFile {
+        File file;                         //!< The open file (closed if the entry is free).
+        uint32_t lastUsed;                 //!< Value of m_cacheTick when last used.
+        char path[LITTLEFS_MAX_PATH_LEN];  //!< Path that the file was opened with.
+        bool sequential;                   //!< Last access continued where the previous one ended.
+    };
+
+    //! What STAT found for a path, kept in the metadata cache.
+    struct MetaEntry {
+        uint32_t hash;         //!< CRC-32 of the path.
+        uint16_t pathLen = 0;  //!< Length of the path (0 if the entry is free).
+        uint8_t flags;         //!< Flags of the file (or META_MISSING).
+        uint8_t stat;          //!< StatFlags::DIR_SIZE and TRUNCATED, as found by STAT.
+        uint32_t size;         //!< Size of the file, or of the directory's files.
+        uint32_t timestamp;    //!< Time the file was last written.
+        uint32_t filled;       //!< Value of millis() when the entry was filled.
+        uint32_t lastUsed;     //!< Value of m_metaTick when last used.
+    };
+
+    //! Flags stored in MetaEntry::flags, alongside Flags.
+    static constexpr uint8_t META_MISSING = 0x80;  //!< The path doesn't exist.
+
+    //! Totals found by scanTree.
+    struct TreeTotals {
+        uint32_t numFiles = 0;    //!< Number of files.
+        uint32_t numDirs = 0;     //!< Number of directories (not including the top one).
+        uint32_t fileBytes = 0;   //!< Total size of the files.
+        uint32_t fileBlocks = 0;  //!< Blocks needed to hold just the file data.
+        bool truncated = false;   //!< Directories nested too deeply were skipped.
+    };
+
+    //! A file opened by the OPEN command.
+    struct FileHandle {
+        File file;                               //!< The open file (closed if the handle is free).
+        char path[LITTLEFS_MAX_PATH_LEN];        //!< Path that the file was opened with.
+        char uploadPath[LITTLEFS_MAX_PATH_LEN];  //!< File replaced by UPLOAD_COMMIT (or empty).
+    };
+
+    //! A directory listing which is in progress.
+    struct DirCursor {
+        File dir;           //!< Directory being listed (closed if the cursor is free).
+        File next;          //!< Next entry to return.
+        uint16_t index;     //!< Index of next.
+        uint32_t lastUsed;  //!< Value of millis() when the cursor was last used.
+    };
+
+    //! A recursive WALK listing which is in progress.
+    struct WalkCursor {
+        File dirs[LITTLEFS_WALK_MAX_DEPTH];   //!< Directories being listed, from the top down.
+        uint8_t depth;                        //!< Number of dirs which are open (0 if free).
+        uint8_t maxDepth;                     //!< Deepest level to descend to.
+        File next;                            //!< Next entry to return.
+        size_t prefixLen;                     //!< Length of the top directory's path + slash.
+        char pattern[LITTLEFS_MAX_PATH_LEN];  //!< Glob that returned entries must match.
+        uint32_t lastUsed;                    //!< Value of millis() when last used.
+    };
+
+    //! A line kept by SEARCH, to send as context before the next match.
+    struct SearchLine {
+        char data[LITTLEFS_SEARCH_MAX_LINE];  //!< The line (not null terminated).
+        uint16_t len;                         //!< Length of data.
+        uint32_t start;                       //!< File offset of the start of the line.
+        uint32_t number;                      //!< Number of the line (starting at 1).
+    };
+
+    //! A SEARCH which is in progress.
+    struct SearchCursor {
+        File dir;                                        //!< Directory being searched (or closed).
+        File file;                                       //!< File being searched.
+        char glob[LITTLEFS_MAX_PATH_LEN];                //!< Names of the files in dir to search.
+        char pattern[LITTLEFS_SEARCH_MAX_PATTERN];       //!< Bytes or regex to search for.
+        uint8_t patternLen;                              //!< Length of pattern.
+        uint8_t flags;                                   //!< SearchFlags.
+        uint32_t lineStart;                              //!< File offset of the line being scanned.
+        uint32_t lineNumber;                             //!< Number of that line (starting at 1).
+        SearchLine before[LITTLEFS_SEARCH_MAX_CONTEXT];  //!< Lines preceding the next match.
+        uint8_t firstBefore;                             //!< Index in before of the oldest line.
+        uint8_t numBefore;                               //!< Number of lines in before.
+        uint8_t context;                                 //!< Lines to send on each side of a match.
+        uint8_t afterLeft;                               //!< Lines still to send after a match.
+        uint32_t lastUsed;                               //!< Value of millis() when last used.
+    };
+
+    //! A file being watched by TAIL.
+    struct TailWatch {
+        File file;                         //!< The open file (closed if the watch is free).
+        char path[LITTLEFS_MAX_PATH_LEN];  //!< Path that the file was opened with.
+        uint32_t offset;                   //!< File offset of the next byte to send.
+        uint16_t intervalMsec;             //!< Shortest time between data packets.
+        uint16_t maxBytes;                 //!< Most data to send in one packet (0 for no limit).
+        uint32_t lastSent;                 //!< Value of millis() when data was last sent.
+        uint32_t lastUsed;                 //!< Value of millis() when the host last sent TAIL.
+    };
+
+    //! Length of the fixed size part of an ArchiveRecord header.
+    static constexpr size_t ARCHIVE_HEADER_LEN = 11;
+
+    //! Size of the buffers which hold an ArchiveRecord header.
+    static constexpr size_t ARCHIVE_HEADER_MAX = ARCHIVE_HEADER_LEN + LITTLEFS_MAX_PATH_LEN;
+
+    //! An EXPORT archive which is being sent.
+    struct ExportCursor {
+        File dirs[LITTLEFS_WALK_MAX_DEPTH];  //!< Directories being exported.
+        uint8_t depth;                       //!< Number of dirs which are open.
+        size_t prefixLen;                    //!< Length of the top path + slash.
+        File file;                           //!< File whose data is being sent.
+        uint32_t fileLeft;                   //!< Bytes of file still to send.
+        Crc32 crc;                           //!< CRC of the data sent from file.
+        uint8_t header[ARCHIVE_HEADER_MAX];  //!< Header or CRC to send.
+        uint16_t headerLen;                  //!< Number of bytes in header.
+        uint16_t headerPos;                  //!< Number of them already sent.
+        bool active = false;                 //!< The cursor is in use.
+        bool ended;                          //!< The END record was queued.
+        uint8_t flags;                       //!< ExportFlags.
+        uint32_t offset;                     //!< Archive bytes sent so far.
+        uint32_t lastUsed;                   //!< Value of millis() when last used.
+    };
+
+    //! Part of an archive that IMPORT expects next.
+    enum class ImportPhase : uint8_t {
+        HEADER = 0,  //!< The header of a record.
+        DATA = 1,    //!< The data of a FILE record.
+        CRC = 2,     //!< The CRC following a FILE record's data.
+        DONE = 3,    //!< Nothing (the END record has been unpacked).
+    };
+
+    //! An archive being unpacked by IMPORT.
+    struct ImportState {
+        char dir[LITTLEFS_MAX_PATH_LEN];     //!< Directory to unpack into.
+        File file;                           //!< File being written.
+        uint32_t fileLeft;                   //!< Bytes of file still to come.
+        Crc32 crc;                           //!< CRC of the data written.
+        uint8_t header[ARCHIVE_HEADER_MAX];  //!< Header or CRC so far.
+        uint16_t headerLen;                  //!< Number of bytes in header.
+        bool active = false;                 //!< An import is in progress.
+        ImportPhase phase;                   //!< Part of the archive expected next.
+        uint32_t offset;                     //!< Archive bytes unpacked.
+        uint32_t lastUsed;                   //!< Value of millis() when last used.
+    };
+
+    //! A long running operation started by JOB_START.
+    struct Job {
+        JobType type = JobType::NONE;                  //!< Operation (NONE if no job exists).
+        std::atomic<JobState> state{JobState::DONE};  //!< Set by the job task when it finishes.
+        Error result = Error::NONE;                    //!< Result of the job, once DONE.
+        uint32_t progress = 0;                         //!< Bytes, entries or mounts done so far.
+        uint32_t total = 0;                            //!< COPY: File size. MAINTENANCE: Mounts.
+        File src;                                      //!< COPY: File being copied.
+        File dst;                                      //!< COPY: File being created.
+        char path[LITTLEFS_MAX_PATH_LEN];              //!< RMTREE: Directory being emptied.
+        size_t rootLen = 0;                            //!< RMTREE: Length of the top directory.
+        bool onTask = false;                           //!< FORMAT: Running on the job task.
+        uint8_t mount = 0;                             //!< MAINTENANCE: Next mount to collect.
+    };
+
+    //! Calls the handler for a command.
+    //! @returns true if the packet was handled, false if it wasn't.
+    bool dispatchPacket(
+        Packet const& cmd,  //!< [in] Packet that was received.
+        Packet* rsp         //!< [out] Place to store response.
+    );
+
+    //! Finds the file system that a path sent by the host lives in.
+    //! @returns The file system's backend.
+    FsBackend* findBackend(
+        char const* path,    //!< [in] Path sent by the host.
+        char const** fsPath  //!< [out] Path to use within the returned file system.
+    );
+
+    //! Opens a file or directory in whichever file system path belongs to.
+    //! @returns The opened file.
+    File fsOpen(
+        char const* path,             //!< [in] Name of the file to open.
+        char const* mode = FILE_READ  //!< [in] FILE_READ, FILE_WRITE or FILE_APPEND.
+    );
+
+    //! @returns true if path exists.
+    bool fsExists(char const* path  //!< [in] Name of the file to check.
+    );
+
+    //! Creates a directory.
+    //! @returns true if the directory was created.
+    bool fsMkdir(char const* path  //!< [in] Name of the directory to create.
+    );
+
+    //! Removes a file.
+    //! @returns true if the file was removed.
+    bool fsRemove(char const* path  //!< [in] Name of the file to remove.
+    );
+
+    //! Renames a file or directory (both names have to be in the same file system).
+    //! @returns true if the file was renamed.
+    bool fsRename(
+        char const* from,  //!< [in] Existing name.
+        char const* to     //!< [in] New name.
+    );
+
+    //! Removes an empty directory.
+    //! @returns true if the directory was removed.
+    bool fsRmdir(char const* path  //!< [in] Name of the directory to remove.
+    );
+
+    //! Opens a file, timing it as StatsPhase::OPEN.
+    //! @returns The opened file.
+    File openFile(
+        char const* filename,  //!< [in] Name of the file to open.
+        char const* mode       //!< [in] FILE_READ, FILE_WRITE or FILE_APPEND.
+    );
+
+    //! Moves to offset, unless the file is already there, timing it as
+    //! StatsPhase::SEEK.
+    //! @returns true if the file is positioned at offset.
+    bool seekFile(
+        File* file,      //!< [mod] File to position.
+        uint32_t offset  //!< [in] Offset to move to.
+    );
+
+    //! Reads from a file, timing it as StatsPhase::READ.
+    //! @returns The number of bytes read.
+    size_t readFile(
+        File* file,     //!< [mod] File to read from.
+        uint8_t* data,  //!< [out] Place to store the data.
+        size_t length   //!< [in] Maximum number of bytes to read.
+    );
+
+    //! Writes to a file, timing it as StatsPhase::WRITE.
+    //! @returns The number of bytes written.
+    size_t writeFile(
+        File* file,           //!< [mod] File to write to.
+        uint8_t const* data,  //!< [in] Data to write.
+        size_t length         //!< [in] Number of bytes to write.
+    );
+
+    //! Closes a file, timing it as StatsPhase::CLOSE.
+    void closeFile(File* file  //!< [mod] File to close.
+    );
+
+    //! Garbage collects a file system, timing it as StatsPhase::GC.
+    //! @returns true if the garbage collection succeeded.
+    bool gcMount(Mount* mount  //!< [in] File system to garbage collect.
+    );
+
+#if LITTLEFS_STATS
+    //! Adds a single measurement to a set of counters.
+    static void addStats(
+        Stats* stats,   //!< [mod] Counters to update.
+        uint32_t usec,  //!< [in] Time taken, in microseconds.
+        uint32_t bytes  //!< [in] Number of bytes moved.
+    );
+#endif
+
+    //! Appends as many directory entries as will fit into a LIST or LIST_CURSOR
+    //! response.
+    //! @returns true if the end of the directory was reached.
+    bool appendDirEntries(
+        File* dir,        //!< [mod] Directory being listed.
+        File* file,       //!< [mod] Next entry to append, updated to the first one not appended.
+        uint16_t* index,  //!< [mod] Index of file.
+        Packet* rsp       //!< [mod] Place to append the entries.
+    );
+
+    //! Appends as many LIST_COMPACT entries as will fit into a response.
+    //! @returns true if the end of the directory was reached.
+    bool appendCompactDirEntries(
+        DirCursor* cursor,  //!< [mod] Listing to continue.
+        uint8_t fields,     //!< [in] ListFields to include in each entry.
+        Packet* rsp         //!< [mod] Place to append the entries.
+    );
+
+    //! Starts a new directory listing (when cursorNum is NO_CURSOR, reading the
+    //! directory name from unpacker), or looks up an existing one.
+    //! @returns The cursor, or nullptr if an error occurred.
+    DirCursor* getDirCursor(
+        uint8_t* cursorNum,  //!< [mod] Cursor sent by the host, updated for a new listing.
+        Unpacker* unpacker,  //!< [mod] Command to read the directory name from.
+        Error* err           //!< [out] Reason that the cursor couldn't be returned.
+    );
+
+    //! Closes a directory cursor, freeing it.
+    void closeDirCursor(DirCursor* cursor  //!< [mod] Cursor to free.
+    );
+
+    //! Appends as many WALK entries as will fit into a response.
+    //! @returns true if the whole tree has been listed.
+    bool appendWalkEntries(Packet* rsp  //!< [mod] Place to append the entries.
+    );
+
+    //! Closes the WALK cursor, freeing it.
+    void closeWalkCursor();
+
+    //! @returns true if a line matches the SEARCH pattern.
+    bool searchLineMatches(
+        char const* line,  //!< [in] Line to check (not null terminated).
+        size_t lineLen     //!< [in] Length of line.
+    ) const;
+
+    //! Checks one line of the file being searched, appending it to a response
+    //! if it matches (along with the context before it) or is context after a
+    //! match, and otherwise keeping it as context for the next match.
+    //! @returns false if the line has to wait for the next response, or err was set.
+    bool appendSearchLine(
+        Packet* rsp,       //!< [mod] Place to append the lines.
+        char const* name,  //!< [in] Name of the file being searched.
+        char const* line,  //!< [in] Line to check (not null terminated).
+        size_t lineLen,    //!< [in] Length of line.
+        bool* empty,       //!< [mod] true until a line has been appended to rsp.
+        Error* err         //!< [out] Set if the line can't be sent at all.
+    );
+
+    //! Scans the SEARCH files, appending each line which matches to a response,
+    //! until the response is full or LITTLEFS_SEARCH_SLICE_BYTES have been read.
+    //! @returns true if every file has been searched, or err was set.
+    bool appendSearchMatches(
+        Packet* rsp,  //!< [mod] Place to append the matches.
+        Error* err    //!< [out] Set if a line couldn't be sent.
+    );
+
+    //! Resets the SEARCH cursor to the start of the file it has just opened.
+    void startSearchFile();
+
+    //! Closes the SEARCH cursor, freeing it.
+    void closeSearchCursor();
+
+    //! Sends a packet with any data which has been appended to a watched file
+    //! since the last one, if the watch's interval has passed.
+    void pollTailWatch(
+        TailWatch* watch,  //!< [mod] Watch to check.
+        uint32_t now       //!< [in] Current value of millis().
+    );
+
+    //! Closes the file being watched, freeing the watch.
+    void closeTailWatch(TailWatch* watch  //!< [mod] Watch to free.
+    );
+
+    //! Copies the next part of the EXPORT archive into data.
+    //! @returns Error::NONE if the data was read (which may be less than
+    //!          length once the end of the archive is reached).
+    Error readArchive(
+        uint8_t* data,     //!< [out] Place to store the archive data.
+        size_t length,     //!< [in] Most data to store.
+        size_t* bytesRead  //!< [out] Number of bytes stored in data.
+    );
+
+    //! Closes the EXPORT cursor, freeing it.
+    void closeExportCursor();
+
+    //! Unpacks the next part of an IMPORT archive.
+    //! @returns Error::NONE if the data was unpacked.
+    Error importData(
+        uint8_t const* data,  //!< [in] Archive data.
+        size_t length         //!< [in] Number of bytes of data.
+    );
+
+    //! Unpacks a complete record header received by IMPORT.
+    //! @returns Error::NONE if the record was unpacked.
+    Error importRecord();
+
+    //! Stops the IMPORT in progress, closing the file being written.
+    void closeImport();
+
+    //! Frees the listing, search, EXPORT and IMPORT cursors which haven't
+    //! been used for LITTLEFS_DIR_CURSOR_TIMEOUT_MSEC (called from run(), and
+    //! by the commands which allocate a cursor).
+    void expireCursors();
+
+    //! Runs the next slice of the current job (called from run()).
+    void stepJob();
+
+    //! Removes one entry from the tree being removed by an RMTREE job.
+    //! @returns true once the job has finished.
+    bool stepRmTree();
+
+    //! Marks the current job as finished, closing any files it had open.
+    void finishJob(Error result  //!< [in] Result to report to JOB_STATUS.
+    );
+
+#if LITTLEFS_JOB_TASK
+    //! Body of the FreeRTOS task which runs FORMAT jobs.
+    static void jobTask(void* arg  //!< [in] The LittleFsPacketHandler that started the job.
+    );
+#endif
+
+    //! Returns an open file for reading, positioned at offset. Sequential reads
+    //! reuse the same file without reopening or seeking.
+    //! @returns A pointer to the cache entry, or nullptr if an error occurred.
+    CachedFile* openCachedFile(
+        char const* filename,  //!< [in] Name of the file to open.
+        uint32_t offset,       //!< [in] Offset to position the file at.
+        Error* err             //!< [out] Reason that the file couldn't be opened.
+    );
+
+    //! Like openCachedFile, but fails with UNABLE_TO_OPEN_FILE for a directory.
+    //! @returns A pointer to the cache entry, or nullptr if an error occurred.
+    CachedFile* openCachedRegularFile(
+        char const* filename,  //!< [in] Name of the file to open.
+        uint32_t offset,       //!< [in] Offset to position the file at.
+        Error* err             //!< [out] Reason that the file couldn't be opened.
+    );
+
+    //! Finishes with a file returned by openCachedFile. It's kept open for the
+    //! next command, unless its name was too long to remember.
+    void releaseCachedFile(CachedFile* cached  //!< [mod] Entry to finish with.
+    );
+
+    //! Closes a cached file, freeing the cache entry.
+    void closeCachedFile(CachedFile* cached  //!< [mod] Entry to free.
+    );
+
+    //! Closes any cached files for path, or for anything within the directory
+    //! named path, and forgets the cached metadata for it (see
+    //! forgetMetadata). Closes all cached files if path is nullptr.
+    void evictCachedFiles(char const* path  //!< [in] File or directory to evict.
+    );
+
+#if LITTLEFS_META_CACHE_SIZE > 0
+    //! @returns The cache entry for path, or nullptr if it isn't cached (or
+    //!          the entry has expired).
+    MetaEntry* findMetadata(
+        char const* path,  //!< [in] Path to look up.
+        size_t pathLen     //!< [in] Length of path.
+    );
+
+    //! @returns A cache entry to store the metadata for path in, replacing
+    //!          the least recently used one if they're all in use.
+    MetaEntry* allocMetadata(
+        char const* path,  //!< [in] Path which will be stored.
+        size_t pathLen     //!< [in] Length of path.
+    );
+#endif
+
+    //! Adds up the files inside a directory, descending up to
+    //! LITTLEFS_WALK_MAX_DEPTH levels.
+    //! @returns false if path couldn't be opened.
+    bool scanTree(
+        char const* path,   //!< [in] Directory to scan.
+        TreeTotals* totals  //!< [out] What was found.
+    );
+
+#if LITTLEFS_READ_AHEAD_SIZE > 0
+    //! Copies prefetched data for offset into a READ response, followed by
+    //! data read from the file if more is needed.
+    //! @returns The number of bytes added to the response.
+    uint32_t readAheadIntoPacket(
+        uint32_t length,  //!< [in] Maximum number of bytes to add.
+        Packet* rsp       //!< [mod] Response to add the data to.
+    );
+
+    //! Arranges for run() to prefetch the next length bytes of a cached file.
+    void startReadAhead(
+        CachedFile* cached,  //!< [in] File to read from.
+        uint32_t offset,     //!< [in] Current position of the file.
+        uint32_t length      //!< [in] Number of bytes to prefetch.
+    );
+
+    //! Throws away any prefetched data.
+    void dropReadAhead();
+#endif
+
+    //! Finds a free file handle.
+    //! @returns A pointer to the free handle, or nullptr if they're all in use.
+    FileHandle* allocFileHandle(uint8_t* handle  //!< [out] Number of the handle.
+    );
+
+    //! Looks up the file handle sent in a command.
+    //! @returns A pointer to the open file handle, or nullptr if it isn't open.
+    FileHandle* getFileHandle(uint8_t handle  //!< [in] Handle returned by OPEN.
+    );
+
+    //! Closes the file associated with a file handle, freeing the handle.
+    void closeFileHandle(FileHandle* fileHandle  //!< [mod] Handle to close.
+    );
+
+    //! Adds APPEND data to the append buffer, writing it to the file each time
+    //! the file size reaches a multiple of the buffer size.
+    //! @returns The first error that occurred since the last APPEND or FLUSH.
+    Error appendBuffered(
+        char const* filename,  //!< [in] Name of the file to append to.
+        uint8_t const* data,   //!< [in] Data to append.
+        uint32_t length        //!< [in] Number of bytes of data.
+    );
+
+    //! Writes any data in the append buffer to the file. Errors are remembered
+    //! and returned by the next APPEND or FLUSH.
+    void flushAppendBuffer(bool close  //!< [in] Close the file as well.
+    );
+
+    //! Handles the APPEND command
+    void handleAppend(
+        Packet const& cmd,  //!< [in] APPEND command packet.
+        Packet* rsp         //!< [mod] Place to store the APPEND response.
+    );
+
+    //! Handles the BATCH command
+    void handleBatch(
+        Packet const& cmd,  //!< [in] BATCH command packet.
+        Packet* rsp         //!< [mod] Place to store the BATCH response.
+    );
+
+    //! Handles the CAPS command
+    void handleCaps(
+        Packet const& cmd,  //!< [in] CAPS command packet.
+        Packet* rsp         //!< [mod] Place to store the CAPS response.
+    );
+
+    //! Handles the CLOSE command
+    void handleClose(
+        Packet const& cmd,  //!< [in] CLOSE command packet.
+        Packet* rsp         //!< [mod] Place to store the CLOSE response.
+    );
+
     //! Handles the COPY command
     void handleCopy(
-        Packet const& cmd,  //!< [in] Ping packet.
-        Packet* rsp         //!< [mod] Place to store ping response.
+        Packet const& cmd,  //!< [in] COPY command packet.
+        Packet* rsp         //!< [mod] Place to store the COPY response.
+    );
+
+    //! Handles the EXPORT command
+    void handleExport(
+        Packet const& cmd,  //!< [in] EXPORT command packet.
+        Packet* rsp         //!< [mod] Place to store the EXPORT response.
+    );
+
+    //! Handles the FLUSH command
+    void handleFlush(
+        Packet const& cmd,  //!< [in] FLUSH command packet.
+        Packet* rsp         //!< [mod] Place to store the FLUSH response.
     );
 
     //! Handles the FORMAT command
     void handleFormat(
-        Packet const& cmd,  //!< [in] Ping packet.
-        Packet* rsp         //!< [mod] Place to store ping response.
+        Packet const& cmd,  //!< [in] FORMAT command packet.
+        Packet* rsp         //!< [mod] Place to store the FORMAT response.
+    );
+
+    //! Handles the HASH command
+    void handleHash(
+        Packet const& cmd,  //!< [in] HASH command packet.
+        Packet* rsp         //!< [mod] Place to store the HASH response.
+    );
+
+    //! Handles the IMPORT command
+    void handleImport(
+        Packet const& cmd,  //!< [in] IMPORT command packet.
+        Packet* rsp         //!< [mod] Place to store the IMPORT response.
     );
 
     //! Handles the INFO command
     void handleInfo(
-        Packet const& cmd,  //!< [in] Ping packet.
-        Packet* rsp         //!< [mod] Place to store ping response.
+        Packet const& cmd,  //!< [in] INFO command packet.
+        Packet* rsp         //!< [mod] Place to store the INFO response.
+    );
+
+    //! Handles the JOB_START command
+    void handleJobStart(
+        Packet const& cmd,  //!< [in] JOB_START command packet.
+        Packet* rsp         //!< [mod] Place to store the JOB_START response.
+    );
+
+    //! Handles the JOB_STATUS command
+    void handleJobStatus(
+        Packet const& cmd,  //!< [in] JOB_STATUS command packet.
+        Packet* rsp         //!< [mod] Place to store the JOB_STATUS response.
     );
 
     //! Handles the LIST command
     void handleList(
-        Packet const& cmd,  //!< [in] Ping packet.
-        Packet* rsp         //!< [mod] Place to store ping response.
+        Packet const& cmd,  //!< [in] LIST command packet.
+        Packet* rsp         //!< [mod] Place to store the LIST response.
+    );
+
+    //! Handles the LIST_COMPACT command
+    void handleListCompact(
+        Packet const& cmd,  //!< [in] LIST_COMPACT command packet.
+        Packet* rsp         //!< [mod] Place to store the LIST_COMPACT response.
+    );
+
+    //! Handles the LIST_CURSOR command
+    void handleListCursor(
+        Packet const& cmd,  //!< [in] LIST_CURSOR command packet.
+        Packet* rsp         //!< [mod] Place to store the LIST_CURSOR response.
     );
 
     //! Handles the MKDIR command
     void handleMkDir(
-        Packet const& cmd,  //!< [in] Ping packet.
-        Packet* rsp         //!< [mod] Place to store ping response.
+        Packet const& cmd,  //!< [in] MKDIR command packet.
+        Packet* rsp         //!< [mod] Place to store the MKDIR response.
     );
 
     //! Handles the REMOVE command
     void handleRemove(
-        Packet const& cmd,  //!< [in] Ping packet.
-        Packet* rsp         //!< [mod] Place to store ping response.
+        Packet const& cmd,  //!< [in] REMOVE command packet.
+        Packet* rsp         //!< [mod] Place to store the REMOVE response.
     );
 
     //! Handles the RENAME command
     void handleRename(
-        Packet const& cmd,  //!< [in] Ping packet.
-        Packet* rsp         //!< [mod] Place to store ping response.
+        Packet const& cmd,  //!< [in] RENAME command packet.
+        Packet* rsp         //!< [mod] Place to store the RENAME response.
+    );
+
+    //! Handles the OPEN command
+    void handleOpen(
+        Packet const& cmd,  //!< [in] OPEN command packet.
+        Packet* rsp         //!< [mod] Place to store the OPEN response.
+    );
+
+    //! Handles the PATCH command
+    void handlePatch(
+        Packet const& cmd,  //!< [in] PATCH command packet.
+        Packet* rsp         //!< [mod] Place to store the PATCH response.
+    );
+
+    //! Runs a single operation from a PATCH command.
+    //! @returns Error::NONE if the operation succeeded.
+    Error patchOp(Unpacker* unpacker  //!< [mod] Unpacker positioned at the operation.
     );
 
+    //! Closes the files used by PATCH, removing the partially built file.
+    void abortPatch();
+
     //! Handles the READ command
     void handleRead(
-        Packet const& cmd,  //!< [in] Ping packet.
-        Packet* rsp         //!< [mod] Place to store ping response.
+        Packet const& cmd,  //!< [in] READ command packet.
+        Packet* rsp         //!< [mod] Place to store the READ response.
+    );
+
+    //! Handles the READ_COMPRESSED command
+    void handleReadCompressed(
+        Packet const& cmd,  //!< [in] READ_COMPRESSED command packet.
+        Packet* rsp         //!< [mod] Place to store the READ_COMPRESSED response.
+    );
+
+    //! Handles the READ_HANDLE command
+    void handleReadHandle(
+        Packet const& cmd,  //!< [in] READ_HANDLE command packet.
+        Packet* rsp         //!< [mod] Place to store the READ_HANDLE response.
+    );
+
+    //! Reads file data directly into the end of a response packet. Requests for
+    //! more data than will fit are clamped to the space remaining.
+    //! @returns The number of bytes read.
+    uint32_t readIntoPacket(
+        File* file,       //!< [mod] File to read from.
+        uint32_t length,  //!< [in] Number of bytes requested.
+        Packet* rsp       //!< [mod] Packet to append the data to.
     );
 
     //! Handles the RMDIR command
     void handleRmDir(
-        Packet const& cmd,  //!< [in] Ping packet.
-        Packet* rsp         //!< [mod] Place to store ping response.
+        Packet const& cmd,  //!< [in] RMDIR command packet.
+        Packet* rsp         //!< [mod] Place to store the RMDIR response.
     );
 
-    //! Handles the Write command
+    //! Handles the WRITE and APPEND commands
     void handleWriteAppend(
         char const* mode,   //!< [in] FILE_WRITE or FILE_APPEND
-        Packet const& cmd,  //!< [in] Ping packet.
-        Packet* rsp         //!< [mod] Place to store ping response.
+        Packet const& cmd,  //!< [in] WRITE or APPEND command packet.
+        Packet* rsp         //!< [mod] Place to store the response.
+    );
+
+    //! Handles the SEARCH command
+    void handleSearch(
+        Packet const& cmd,  //!< [in] SEARCH command packet.
+        Packet* rsp         //!< [mod] Place to store the SEARCH response.
+    );
+
+    //! Handles the SIGNATURE command
+    void handleSignature(
+        Packet const& cmd,  //!< [in] SIGNATURE command packet.
+        Packet* rsp         //!< [mod] Place to store the SIGNATURE response.
+    );
+
+    //! Handles the STAT command
+    void handleStat(
+        Packet const& cmd,  //!< [in] STAT command packet.
+        Packet* rsp         //!< [mod] Place to store the STAT response.
+    );
+
+    //! Handles the STATFS command
+    void handleStatFs(
+        Packet const& cmd,  //!< [in] STATFS command packet.
+        Packet* rsp         //!< [mod] Place to store the STATFS response.
+    );
+
+    //! Handles the STATS command
+    void handleStats(
+        Packet const& cmd,  //!< [in] STATS command packet.
+        Packet* rsp         //!< [mod] Place to store the STATS response.
+    );
+
+    //! Handles the STREAM_READ command
+    void handleStreamRead(
+        Packet const& cmd,  //!< [in] STREAM_READ command packet.
+        Packet* rsp         //!< [mod] Place to store the STREAM_READ response.
+    );
+
+    //! Handles the STREAM_WRITE command
+    void handleStreamWrite(
+        Packet const& cmd,  //!< [in] STREAM_WRITE command packet.
+        Packet* rsp         //!< [mod] Place to store the STREAM_WRITE response.
+    );
+
+    //! Handles the TAIL command
+    void handleTail(
+        Packet const& cmd,  //!< [in] TAIL command packet.
+        Packet* rsp         //!< [mod] Place to store the TAIL response.
+    );
+
+    //! Handles the TRUNCATE command
+    void handleTruncate(
+        Packet const& cmd,  //!< [in] TRUNCATE command packet.
+        Packet* rsp         //!< [mod] Place to store the TRUNCATE response.
+    );
+
+    //! Handles the UPLOAD_BEGIN command
+    void handleUploadBegin(
+        Packet const& cmd,  //!< [in] UPLOAD_BEGIN command packet.
+        Packet* rsp         //!< [mod] Place to store the UPLOAD_BEGIN response.
+    );
+
+    //! Handles the UPLOAD_COMMIT command
+    void handleUploadCommit(
+        Packet const& cmd,  //!< [in] UPLOAD_COMMIT command packet.
+        Packet* rsp         //!< [mod] Place to store the UPLOAD_COMMIT response.
+    );
+
+    //! Handles the WALK command
+    void handleWalk(
+        Packet const& cmd,  //!< [in] WALK command packet.
+        Packet* rsp         //!< [mod] Place to store the WALK response.
+    );
+
+    //! Handles the WRITE command
+    void handleWrite(
+        Packet const& cmd,  //!< [in] WRITE command packet.
+        Packet* rsp         //!< [mod] Place to store the WRITE response.
+    );
+
+    //! Handles the WRITE_AT command
+    void handleWriteAt(
+        Packet const& cmd,  //!< [in] WRITE_AT command packet.
+        Packet* rsp         //!< [mod] Place to store the WRITE_AT response.
+    );
+
+    //! Handles the WRITE_COMPRESSED command
+    void handleWriteCompressed(
+        Packet const& cmd,  //!< [in] WRITE_COMPRESSED command packet.
+        Packet* rsp         //!< [mod] Place to store the WRITE_COMPRESSED response.
+    );
+
+    //! Handles the WRITE_HANDLE command
+    void handleWriteHandle(
+        Packet const& cmd,  //!< [in] WRITE_HANDLE command packet.
+        Packet* rsp         //!< [mod] Place to store the WRITE_HANDLE response.
+    );
+
+    //! Creates a directory (used by MKDIR and BATCH).
+    Error mkDir(char const* dirName  //!< [in] Directory to create.
+    );
+
+    //! Removes a file (used by REMOVE and BATCH).
+    Error removeFile(char const* fileName  //!< [in] File to remove.
+    );
+
+    //! Renames a file or directory (used by RENAME and BATCH).
+    Error renameFile(
+        char const* oldName,  //!< [in] Existing name.
+        char const* newName   //!< [in] Name to change it to.
+    );
+
+    //! Removes a directory (used by RMDIR and BATCH).
+    Error rmDir(char const* dirName  //!< [in] Directory to remove.
     );
+
+    //! Writes or appends data to a file (used by WRITE, APPEND and
+    //! WRITE_COMPRESSED).
+    Error writeData(
+        char const* mode,      //!< [in] FILE_WRITE or FILE_APPEND
+        char const* filename,  //!< [in] File to write to.
+        uint8_t const* data,   //!< [in] Data to write.
+        uint32_t length        //!< [in] Number of bytes of data.
+    );
+
+    IBus* m_bus;                                  //!< Bus for extra responses (or nullptr).
+    Mount m_mounts[LITTLEFS_MAX_MOUNTS];          //!< Default file system, then mount()ed ones.
+    uint8_t m_numMounts = 1;                      //!< Number of entries used in m_mounts.
+    uint8_t m_ioBuffer[LITTLEFS_IO_BUFFER_SIZE];  //!< Buffer used by COPY, HASH and SIGNATURE.
+
+    CachedFile m_fileCache[LITTLEFS_FILE_CACHE_SIZE];   //!< Files kept open between READs.
+    uint32_t m_cacheTick = 0;                           //!< Incremented on each cache access.
+    FileHandle m_fileHandles[LITTLEFS_MAX_OPEN_FILES];  //!< Files opened by OPEN.
+    DirCursor m_dirCursors[LITTLEFS_MAX_DIR_CURSORS];   //!< Listings started by LIST_CURSOR.
+    WalkCursor m_walkCursor;                            //!< Listing started by WALK.
+    uint8_t m_walkCursorNum = 0;                        //!< Cursor number of m_walkCursor.
+    SearchCursor m_searchCursor;                        //!< Search started by SEARCH.
+    uint8_t m_searchCursorNum = 0;                      //!< Cursor number of m_searchCursor.
+    TailWatch m_tailWatches[LITTLEFS_MAX_TAILS];        //!< Files being watched by TAIL.
+    ExportCursor m_exportCursor;                        //!< Archive being sent by EXPORT.
+    uint8_t m_exportCursorNum = 0;                      //!< Cursor number of m_exportCursor.
+    ImportState m_import;                               //!< Archive being unpacked by IMPORT.
+    Job m_job;                                          //!< Job started by JOB_START.
+    uint8_t m_jobNum = 0;                               //!< Number returned for m_job.
+    uint32_t m_lastCommand = 0;                         //!< Value of millis() at the last command.
+    uint8_t m_idleGcMount = LITTLEFS_MAX_MOUNTS;        //!< Next mount for run() to collect.
+
+#if LITTLEFS_META_CACHE_SIZE > 0
+    MetaEntry m_metaCache[LITTLEFS_META_CACHE_SIZE];  //!< Paths looked up by STAT.
+    uint32_t m_metaTick = 0;                          //!< Incremented on each STAT.
+#endif
+
+#if LITTLEFS_READ_AHEAD_SIZE > 0
+    CachedFile* m_readAheadFile = nullptr;                //!< File the prefetched data is from.
+    uint32_t m_readAheadOffset = 0;                       //!< File offset of the next unsent byte.
+    uint32_t m_readAheadStart = 0;                        //!< Index of that byte in the buffer.
+    uint32_t m_readAheadLen = 0;                          //!< Number of bytes prefetched.
+    uint32_t m_readAheadPending = 0;                      //!< Number of bytes for run() to read.
+    uint8_t m_readAheadBuffer[LITTLEFS_READ_AHEAD_SIZE];  //!< Prefetched file data.
+#endif
+
+    File m_appendFile;                                    //!< File that m_appendBuffer belongs to.
+    char m_appendPath[LITTLEFS_MAX_PATH_LEN];             //!< Path of m_appendFile.
+    uint32_t m_appendOffset = 0;                          //!< File offset of m_appendBuffer[0].
+    uint32_t m_appendLen = 0;                             //!< Number of bytes in m_appendBuffer.
+    uint32_t m_appendLastUsed = 0;                        //!< Value of millis() at the last APPEND.
+    Error m_appendError = Error::NONE;                    //!< Error from writing buffered data.
+    uint8_t m_appendBuffer[LITTLEFS_APPEND_BUFFER_SIZE];  //!< Buffered APPEND data.
+
+    File m_patchSrc;                              //!< File that PATCH copies blocks from.
+    File m_patchDst;                              //!< New file being built by PATCH.
+    char m_patchPath[LITTLEFS_MAX_PATH_LEN];      //!< File that PATCH will replace.
+    char m_patchTempPath[LITTLEFS_MAX_PATH_LEN];  //!< Path of m_patchDst.
+    uint32_t m_patchBlockSize = 0;                //!< Block size used by PatchOp::COPY.
+    uint32_t m_patchLen = 0;                      //!< Number of bytes written to m_patchDst.
+    Crc32 m_patchCrc;                             //!< CRC of the data written to m_patchDst.
+
+    uint8_t m_tailData[LITTLEFS_TAIL_PACKET_SIZE];               //!< Storage for m_tailPacket.
+    Packet m_tailPacket{LITTLEFS_TAIL_PACKET_SIZE, m_tailData};  //!< Data sent by run().
+
+#if LITTLEFS_STATS
+    Stats m_commandStats[NUM_COMMANDS];     //!< Counters for each command.
+    Stats m_phaseStats[NUM_STATS_PHASES];  //!< Counters for each StatsPhase.
+#endif
+
+#if LITTLEFS_COMPRESSION
+    Lz4 m_lz4;                                                //!< Used by READ_COMPRESSED.
+    uint8_t m_compressBuffer[LITTLEFS_COMPRESS_BUFFER_SIZE];  //!< Uncompressed file data.
+#endif
+
+    //! Name, arguments and handler for each command, starting with
+    //! Command::FORMAT. Trailing variable length data isn't included in the
+    //! arguments. The handlers are looked up by indexing this table with the
+    //! command number, so it has to stay in the same order as the commands
+    //! (checked in as_str). It is initialized here, after the handlers are
+    //! declared, so that it can be used in constant expressions.
+    static constexpr CommandInfo COMMAND_TABLE[NUM_COMMANDS] = {
+        {Command::FORMAT, "FORMAT", "", &LittleFsPacketHandler::handleFormat,
+         CommandFlags::MODIFIES},
+        {Command::INFO, "INFO", "", &LittleFsPacketHandler::handleInfo, CommandFlags::KEEP_APPEND},
+        {Command::LIST, "LIST", "hs", &LittleFsPacketHandler::handleList},
+        {Command::MKDIR, "MKDIR", "s", &LittleFsPacketHandler::handleMkDir, CommandFlags::MODIFIES},
+        {Command::REMOVE, "REMOVE", "s", &LittleFsPacketHandler::handleRemove,
+         CommandFlags::MODIFIES},
+        {Command::RENAME, "RENAME", "ss", &LittleFsPacketHandler::handleRename,
+         CommandFlags::MODIFIES},
+        {Command::COPY, "COPY", "ss", &LittleFsPacketHandler::handleCopy, CommandFlags::MODIFIES},
+        {Command::READ, "READ", "sww", &LittleFsPacketHandler::handleRead},
+        {Command::WRITE, "WRITE", "sw", &LittleFsPacketHandler::handleWrite,
+         CommandFlags::MODIFIES},
+        {Command::APPEND, "APPEND", "sw", &LittleFsPacketHandler::handleAppend,
+         CommandFlags::KEEP_APPEND | CommandFlags::MODIFIES},
+        {Command::RMDIR, "RMDIR", "s", &LittleFsPacketHandler::handleRmDir, CommandFlags::MODIFIES},
+        {Command::OPEN, "OPEN", "bs", &LittleFsPacketHandler::handleOpen, CommandFlags::MODIFIES},
+        {Command::READ_HANDLE, "READ_HANDLE", "bww", &LittleFsPacketHandler::handleReadHandle},
+        {Command::WRITE_HANDLE, "WRITE_HANDLE", "bww", &LittleFsPacketHandler::handleWriteHandle,
+         CommandFlags::MODIFIES},
+        {Command::CLOSE, "CLOSE", "b", &LittleFsPacketHandler::handleClose},
+        {Command::LIST_CURSOR, "LIST_CURSOR", "b", &LittleFsPacketHandler::handleListCursor},
+        {Command::STREAM_READ, "STREAM_READ", "bwbh", &LittleFsPacketHandler::handleStreamRead},
+        {Command::STREAM_WRITE, "STREAM_WRITE", "bbww", &LittleFsPacketHandler::handleStreamWrite,
+         CommandFlags::MODIFIES},
+        {Command::CAPS, "CAPS", "", &LittleFsPacketHandler::handleCaps, CommandFlags::KEEP_APPEND},
+        {Command::FLUSH, "FLUSH", "", &LittleFsPacketHandler::handleFlush},
+        {Command::HASH, "HASH", "swwb", &LittleFsPacketHandler::handleHash},
+        {Command::SIGNATURE, "SIGNATURE", "sww", &LittleFsPacketHandler::handleSignature},
+        {Command::PATCH, "PATCH", "b", &LittleFsPacketHandler::handlePatch, CommandFlags::MODIFIES},
+        {Command::READ_COMPRESSED, "READ_COMPRESSED", "sww",
+         &LittleFsPacketHandler::handleReadCompressed},
+        {Command::WRITE_COMPRESSED, "WRITE_COMPRESSED", "sbbww",
+         &LittleFsPacketHandler::handleWriteCompressed,
+         CommandFlags::KEEP_APPEND | CommandFlags::MODIFIES},
+        {Command::WALK, "WALK", "bb", &LittleFsPacketHandler::handleWalk},
+        {Command::BATCH, "BATCH", "bb", &LittleFsPacketHandler::handleBatch,
+         CommandFlags::MODIFIES},
+        {Command::JOB_START, "JOB_START", "b", &LittleFsPacketHandler::handleJobStart},
+        {Command::JOB_STATUS, "JOB_STATUS", "b", &LittleFsPacketHandler::handleJobStatus,
+         CommandFlags::KEEP_APPEND},
+        {Command::LIST_COMPACT, "LIST_COMPACT", "bb", &LittleFsPacketHandler::handleListCompact},
+        {Command::STATFS, "STATFS", "b", &LittleFsPacketHandler::handleStatFs},
+        {Command::STATS, "STATS", "bb", &LittleFsPacketHandler::handleStats,
+         CommandFlags::KEEP_APPEND},
+        {Command::WRITE_AT, "WRITE_AT", "sww", &LittleFsPacketHandler::handleWriteAt,
+         CommandFlags::MODIFIES},
+        {Command::TRUNCATE, "TRUNCATE", "sw", &LittleFsPacketHandler::handleTruncate,
+         CommandFlags::MODIFIES},
+        {Command::UPLOAD_BEGIN, "UPLOAD_BEGIN", "bs", &LittleFsPacketHandler::handleUploadBegin,
+         CommandFlags::MODIFIES},
+        {Command::UPLOAD_COMMIT, "UPLOAD_COMMIT", "bbw", &LittleFsPacketHandler::handleUploadCommit,
+         CommandFlags::MODIFIES},
+        {Command::SEARCH, "SEARCH", "bb", &LittleFsPacketHandler::handleSearch},
+        {Command::TAIL, "TAIL", "bbhh", &LittleFsPacketHandler::handleTail},
+        {Command::EXPORT, "EXPORT", "bb", &LittleFsPacketHandler::handleExport},
+        {Command::IMPORT, "IMPORT", "bw", &LittleFsPacketHandler::handleImport,
+         CommandFlags::MODIFIES},
+        {Command::STAT, "STAT", "bs", &LittleFsPacketHandler::handleStat,
+         CommandFlags::KEEP_APPEND},
+    };
 };
@@ -0,0 +1,89 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   LittleFsWorker.cpp
+ *
+ *   @brief  Runs the LittleFs packet handler on its own FreeRTOS task.
+ *
+ ****************************************************************************/
+
+#include "LittleFsWorker.h"
+
+#if LITTLEFS_THREADED
+
+#include <cstring>
+
+#include "freertos/task.h"
+
+#include "Bus.h"
+
+//! How long the worker waits for a command before calling
+//! LittleFsPacketHandler::run() anyway.
+static constexpr TickType_t IDLE_TICKS = pdMS_TO_TICKS(10);
+
+LittleFsWorker::LittleFsWorker(LittleFsPacketHandler* handler, IBus* bus)
+    : m_handler{handler}, m_bus{bus} {}
+
+bool LittleFsWorker::begin() {
+    this->m_freeQueue = xQueueCreate(LITTLEFS_WORKER_QUEUE_LEN, sizeof(Slot*));
+    this->m_cmdQueue = xQueueCreate(LITTLEFS_WORKER_QUEUE_LEN, sizeof(Slot*));
+    this->m_busLock = xSemaphoreCreateMutex();
+    if (this->m_freeQueue == nullptr || this->m_cmdQueue == nullptr ||
+        this->m_busLock == nullptr) {
+        return false;
+    }
+    for (auto& slot : this->m_slots) {
+        Slot* slotPtr = &slot;
+        xQueueSend(this->m_freeQueue, &slotPtr, 0);
+    }
+    return xTaskCreatePinnedToCore(
+               task, "littlefs", LITTLEFS_WORKER_STACK_SIZE, this, LITTLEFS_WORKER_PRIORITY,
+               nullptr, LITTLEFS_WORKER_CORE) == pdPASS;
+}
+
+bool LittleFsWorker::submit(Packet const& cmd) {
+    if (!LittleFsPacketHandler::isCommand(cmd.getCommand())) {
+        return false;
+    }
+    Slot* slot;
+    xQueueReceive(this->m_freeQueue, &slot, portMAX_DELAY);
+    slot->packet.setCommand(cmd.getCommand());
+    slot->packet.setDataLength(0);
+    memcpy(slot->packet.getWriteData(cmd.getDataLength()), cmd.getData(), cmd.getDataLength());
+    xQueueSend(this->m_cmdQueue, &slot, portMAX_DELAY);
+    return true;
+}
+
+void LittleFsWorker::task(void* arg) {
+    static_cast<LittleFsWorker*>(arg)->run();
+}
+
+void LittleFsWorker::run() {
+    for (;;) {
+        Slot* slot;
+        if (xQueueReceive(this->m_cmdQueue, &slot, IDLE_TICKS) == pdTRUE) {
+            // Extra responses (e.g. STREAM_READ) are written to the bus from
+            // inside handlePacket, so the lock is held for the whole command.
+            this->lockBus();
+            this->m_rsp.setDataLength(0);
+            if (this->m_handler->handlePacket(slot->packet, &this->m_rsp)) {
+                this->m_bus->writePacket(this->m_rsp);
+            }
+            this->unlockBus();
+            xQueueSend(this->m_freeQueue, &slot, portMAX_DELAY);
+        }
+        // run() sends the data for TAIL watches.
+        this->lockBus();
+        this->m_handler->run();
+        this->unlockBus();
+    }
+}
+
+#endif  // LITTLEFS_THREADED
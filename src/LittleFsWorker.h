@@ -0,0 +1,90 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   LittleFsWorker.h
+ *
+ *   @brief  Runs the LittleFs packet handler on its own FreeRTOS task.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include "LittleFsConfig.h"
+
+#if LITTLEFS_THREADED
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "LittleFsPacketHandler.h"
+#include "Packet.h"
+
+class IBus;
+
+//! Runs a LittleFsPacketHandler on a FreeRTOS task of its own, so that the
+//! task reading from the bus can receive the next command while the worker
+//! is busy accessing flash.
+//!
+//! Commands are copied into one of LITTLEFS_WORKER_QUEUE_LEN pre-allocated
+//! packets and queued for the worker, which sends the response itself. Every
+//! task which writes to the bus needs to hold the bus lock while doing so.
+class LittleFsWorker {
+ public:
+    //! Constructor.
+    LittleFsWorker(
+        LittleFsPacketHandler* handler,  //!< [in] Handler to run on the worker task.
+        IBus* bus                        //!< [in] Bus to send responses on.
+    );
+
+    //! Creates the queues and starts the worker task.
+    //! @returns true if the worker was started.
+    bool begin();
+
+    //! If cmd is a LittleFs command, hands a copy of it to the worker task.
+    //! Waits for a free packet if all of them are queued.
+    //! @returns true if the command was queued, false if it should be passed
+    //!          to the other packet handlers.
+    bool submit(Packet const& cmd  //!< [in] Command packet to queue.
+    );
+
+    //! Acquires the lock which serializes writes to the bus.
+    void lockBus() { xSemaphoreTake(this->m_busLock, portMAX_DELAY); }
+
+    //! Releases the lock acquired by lockBus.
+    void unlockBus() { xSemaphoreGive(this->m_busLock); }
+
+ private:
+    //! A command packet, along with the storage for its data.
+    struct Slot {
+        uint8_t data[LITTLEFS_WORKER_PACKET_SIZE];         //!< Storage for the packet data.
+        Packet packet{LITTLEFS_WORKER_PACKET_SIZE, data};  //!< The queued command.
+    };
+
+    //! Body of the worker task.
+    static void task(void* arg  //!< [in] The LittleFsWorker to run.
+    );
+
+    //! Handles queued commands, and calls LittleFsPacketHandler::run().
+    void run();
+
+    LittleFsPacketHandler* m_handler;  //!< Handler run on the worker task.
+    IBus* m_bus;                       //!< Bus that responses are sent on.
+
+    Slot m_slots[LITTLEFS_WORKER_QUEUE_LEN];  //!< Packets which commands are copied into.
+    QueueHandle_t m_freeQueue = nullptr;      //!< Slots which aren't in use.
+    QueueHandle_t m_cmdQueue = nullptr;       //!< Slots waiting for the worker.
+    SemaphoreHandle_t m_busLock = nullptr;    //!< Held while writing to the bus.
+
+    uint8_t m_rspData[LITTLEFS_WORKER_PACKET_SIZE];        //!< Storage for m_rsp.
+    Packet m_rsp{LITTLEFS_WORKER_PACKET_SIZE, m_rspData};  //!< Response built by the worker.
+};
+
+#endif  // LITTLEFS_THREADED
@@ -0,0 +1,182 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   Lz4.cpp
+ *
+ *   @brief  Compresses and decompresses data using the LZ4 block format.
+ *
+ ****************************************************************************/
+
+#include "Lz4.h"
+
+#include <cstring>
+
+//! Shortest match which can be encoded.
+static constexpr size_t MIN_MATCH = 4;
+
+//! The last match must start at least this many bytes before the end of the
+//! block (required by the LZ4 block format).
+static constexpr size_t MF_LIMIT = 12;
+
+//! The last this many bytes of a block are always literals.
+static constexpr size_t LAST_LITERALS = 5;
+
+static uint32_t read32(uint8_t const* data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+//! @returns The number of extra bytes needed to store a length.
+static size_t lengthSize(size_t len) {
+    return len < 15 ? 0 : (len - 15) / 255 + 1;
+}
+
+//! Stores the extra bytes of a length which doesn't fit in a token nibble.
+static uint8_t* storeLength(uint8_t* dst, size_t len) {
+    for (len -= 15; len >= 255; len -= 255) {
+        *dst++ = 255;
+    }
+    *dst++ = static_cast<uint8_t>(len);
+    return dst;
+}
+
+//! Stores a sequence (literals, optionally followed by a match).
+//! @returns The new end of dst, or nullptr if the sequence doesn't fit.
+static uint8_t* storeSequence(
+    uint8_t* dst,
+    uint8_t const* dstEnd,
+    uint8_t const* literals,
+    size_t literalLen,
+    size_t offset,
+    size_t matchLen
+) {
+    size_t needed = 1 + lengthSize(literalLen) + literalLen;
+    if (matchLen > 0) {
+        needed += 2 + lengthSize(matchLen - MIN_MATCH);
+    }
+    if (needed > static_cast<size_t>(dstEnd - dst)) {
+        return nullptr;
+    }
+
+    uint8_t* token = dst++;
+    *token = static_cast<uint8_t>((literalLen < 15 ? literalLen : 15) << 4);
+    if (literalLen >= 15) {
+        dst = storeLength(dst, literalLen);
+    }
+    memcpy(dst, literals, literalLen);
+    dst += literalLen;
+    if (matchLen > 0) {
+        *dst++ = static_cast<uint8_t>(offset);
+        *dst++ = static_cast<uint8_t>(offset >> 8);
+        matchLen -= MIN_MATCH;
+        *token |= static_cast<uint8_t>(matchLen < 15 ? matchLen : 15);
+        if (matchLen >= 15) {
+            dst = storeLength(dst, matchLen);
+        }
+    }
+    return dst;
+}
+
+//! Reads the extra bytes of a length whose token nibble was 15.
+static bool loadLength(uint8_t const** src, uint8_t const* srcEnd, size_t* len) {
+    uint8_t byte;
+    do {
+        if (*src >= srcEnd) {
+            return false;
+        }
+        byte = *(*src)++;
+        *len += byte;
+    } while (byte == 255);
+    return true;
+}
+
+size_t Lz4::compress(uint8_t const* src, size_t srcLen, uint8_t* dst, size_t dstLen) {
+    if (srcLen > MAX_BLOCK_SIZE) {
+        return 0;
+    }
+    memset(this->m_table, 0, sizeof(this->m_table));
+
+    uint8_t* out = dst;
+    uint8_t const* outEnd = dst + dstLen;
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (pos + MF_LIMIT < srcLen) {
+        uint32_t sequence = read32(&src[pos]);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+        size_t ref = this->m_table[hash];
+        this->m_table[hash] = static_cast<uint16_t>(pos);
+        if (ref >= pos || read32(&src[ref]) != sequence) {
+            pos++;
+            continue;
+        }
+
+        size_t matchLen = MIN_MATCH;
+        while (pos + matchLen < srcLen - LAST_LITERALS &&
+               src[ref + matchLen] == src[pos + matchLen]) {
+            matchLen++;
+        }
+        out = storeSequence(out, outEnd, &src[anchor], pos - anchor, pos - ref, matchLen);
+        if (out == nullptr) {
+            return 0;
+        }
+        pos += matchLen;
+        anchor = pos;
+    }
+    out = storeSequence(out, outEnd, &src[anchor], srcLen - anchor, 0, 0);
+    if (out == nullptr) {
+        return 0;
+    }
+    return out - dst;
+}
+
+bool Lz4::decompress(uint8_t const* src, size_t srcLen, uint8_t* dst, size_t dstLen, size_t* len) {
+    uint8_t const* srcEnd = src + srcLen;
+    size_t out = 0;
+    *len = 0;
+    while (src < srcEnd) {
+        uint8_t token = *src++;
+
+        size_t literalLen = token >> 4;
+        if (literalLen == 15 && !loadLength(&src, srcEnd, &literalLen)) {
+            return false;
+        }
+        if (literalLen > static_cast<size_t>(srcEnd - src) || literalLen > dstLen - out) {
+            return false;
+        }
+        memcpy(&dst[out], src, literalLen);
+        src += literalLen;
+        out += literalLen;
+        if (src == srcEnd) {
+            // The last sequence only contains literals.
+            break;
+        }
+
+        if (srcEnd - src < 2) {
+            return false;
+        }
+        size_t offset = src[0] | (src[1] << 8);
+        src += 2;
+        size_t matchLen = token & 0x0f;
+        if (matchLen == 15 && !loadLength(&src, srcEnd, &matchLen)) {
+            return false;
+        }
+        matchLen += MIN_MATCH;
+        if (offset == 0 || offset > out || matchLen > dstLen - out) {
+            return false;
+        }
+        // Matches may overlap the data being written, so copy a byte at a time.
+        for (size_t i = 0; i < matchLen; i++, out++) {
+            dst[out] = dst[out - offset];
+        }
+    }
+    *len = out;
+    return true;
+}
@@ -0,0 +1,60 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   Lz4.h
+ *
+ *   @brief  Compresses and decompresses data using the LZ4 block format.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+//! Compresses and decompresses single blocks of data using the LZ4 block
+//! format (without the LZ4 frame header). Blocks are limited to 64K, so
+//! match offsets always refer to data within the same block.
+class Lz4 {
+ public:
+    //! Largest block which can be compressed.
+    static constexpr size_t MAX_BLOCK_SIZE = 0xffff;
+
+    //! @returns The size of the buffer needed to compress len bytes, even
+    //!          if the data doesn't compress at all.
+    static constexpr size_t maxCompressedSize(size_t len) { return len + len / 255 + 16; }
+
+    //! Compresses a block of data.
+    //! @returns The number of bytes stored in dst, or 0 if the compressed data
+    //!          doesn't fit in dst (or srcLen is larger than MAX_BLOCK_SIZE).
+    size_t compress(
+        uint8_t const* src,  //!< [in] Data to compress.
+        size_t srcLen,       //!< [in] Number of bytes of data.
+        uint8_t* dst,        //!< [out] Place to store the compressed data.
+        size_t dstLen        //!< [in] Size of dst.
+    );
+
+    //! Decompresses a block of data.
+    //! @returns true if the data was valid and fit in dst.
+    static bool decompress(
+        uint8_t const* src,  //!< [in] Compressed data.
+        size_t srcLen,       //!< [in] Number of bytes of compressed data.
+        uint8_t* dst,        //!< [out] Place to store the decompressed data.
+        size_t dstLen,       //!< [in] Size of dst.
+        size_t* len          //!< [out] Number of bytes stored in dst.
+    );
+
+ private:
+    static constexpr unsigned HASH_BITS = 10;  //!< Number of bits in a hash table index.
+
+    //! Position within the block being compressed of the last place each hash
+    //! of 4 bytes was seen.
+    uint16_t m_table[1 << HASH_BITS];
+};
@@ -0,0 +1,453 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   RamFs.cpp
+ *
+ *   @brief  A file system which keeps its files in RAM.
+ *
+ ****************************************************************************/
+
+#include "RamFs.h"
+
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+//! A file or directory in a RamFs.
+struct RamFsNode {
+    std::string path;           //!< Full path of the file (/ for the root directory).
+    bool isDir;                 //!< true if this is a directory.
+    std::vector<uint8_t> data;  //!< Contents of the file.
+    time_t lastWrite;           //!< Time that the file was last written to.
+};
+
+using RamFsNodePtr = std::shared_ptr<RamFsNode>;
+
+// Version 3 of the ESP32 core added setBufferSize, seekDir and both
+// getNextFileName functions to FileImpl. RamFileImpl overrides them there,
+// and just provides them on older cores.
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+#define RAMFS_CORE3_OVERRIDE override
+#else
+#define RAMFS_CORE3_OVERRIDE
+#endif
+
+//! Checks that path is absolute and removes any trailing slashes.
+//! @returns true if the path is valid.
+static bool normalizePath(
+    char const* path,        //!< [in] Path to check.
+    std::string* normalized  //!< [out] Place to store the tidied up path.
+) {
+    if (path == nullptr || path[0] != '/') {
+        return false;
+    }
+    *normalized = path;
+    while (normalized->size() > 1 && normalized->back() == '/') {
+        normalized->pop_back();
+    }
+    return true;
+}
+
+//! @returns The directory containing path.
+static std::string parentOf(std::string const& path  //!< [in] Path of a file or directory.
+) {
+    size_t slash = path.rfind('/');
+    return (slash == 0) ? std::string("/") : path.substr(0, slash);
+}
+
+//! @returns true if path is somewhere inside the directory dir.
+static bool isInside(
+    std::string const& path,  //!< [in] Path to check.
+    std::string const& dir    //!< [in] Directory to check against.
+) {
+    if (dir == "/") {
+        return path.size() > 1;
+    }
+    return path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0 &&
+           path[dir.size()] == '/';
+}
+
+//! The implementation behind RamFs.
+class RamFsImpl : public fs::FSImpl {
+ public:
+    //! Constructor.
+    explicit RamFsImpl(size_t capacity  //!< [in] Largest number of bytes of file data to hold.
+                       )
+        : m_capacity{capacity} {
+        this->format();
+    }
+
+    fs::FileImplPtr open(const char* path, const char* mode, const bool create) override;
+    bool exists(const char* path) override;
+    bool rename(const char* pathFrom, const char* pathTo) override;
+    bool remove(const char* path) override;
+    bool mkdir(const char* path) override;
+    bool rmdir(const char* path) override;
+
+    //! @returns The largest number of bytes of file data which can be held.
+    size_t capacity() const { return this->m_capacity; }
+
+    //! @returns The number of bytes of file data currently held.
+    size_t used() const {
+        size_t used = 0;
+        for (auto const& node : this->m_nodes) {
+            used += node->data.size();
+        }
+        return used;
+    }
+
+    //! Removes everything except for the root directory.
+    void format() {
+        this->m_nodes.clear();
+        this->m_nodes.push_back(
+            std::make_shared<RamFsNode>(RamFsNode{"/", true, {}, time(nullptr)}));
+    }
+
+    //! @returns The node for path, or nullptr if it doesn't exist.
+    RamFsNodePtr findNode(std::string const& path) const {
+        for (auto const& node : this->m_nodes) {
+            if (node->path == path) {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    //! Finds the next entry in a directory.
+    //! @returns The entry, or nullptr if there are no more.
+    RamFsNodePtr nextChild(
+        std::string const& dir,  //!< [in] Directory being listed.
+        size_t* index            //!< [mod] Position in the node list to continue from.
+    ) const {
+        while (*index < this->m_nodes.size()) {
+            RamFsNodePtr node = this->m_nodes[(*index)++];
+            if (isInside(node->path, dir) && parentOf(node->path) == dir) {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+ private:
+    //! Adds a new, empty file or directory (whose parent has to exist).
+    //! @returns The new node, or nullptr if the parent isn't a directory.
+    RamFsNodePtr addNode(
+        std::string const& path,  //!< [in] Path of the new node.
+        bool isDir                //!< [in] true to create a directory.
+    ) {
+        RamFsNodePtr parent = this->findNode(parentOf(path));
+        if (!parent || !parent->isDir) {
+            return nullptr;
+        }
+        RamFsNodePtr node = std::make_shared<RamFsNode>(RamFsNode{path, isDir, {}, time(nullptr)});
+        this->m_nodes.push_back(node);
+        return node;
+    }
+
+    //! Removes a node from the node list (files which have it open can still
+    //! use it).
+    void eraseNode(RamFsNodePtr const& node  //!< [in] Node to remove.
+    ) {
+        for (auto it = this->m_nodes.begin(); it != this->m_nodes.end(); ++it) {
+            if (*it == node) {
+                this->m_nodes.erase(it);
+                return;
+            }
+        }
+    }
+
+    size_t m_capacity;                  //!< Largest number of bytes of file data to hold.
+    std::vector<RamFsNodePtr> m_nodes;  //!< Every file and directory, starting with the root.
+};
+
+//! A file or directory opened from a RamFs.
+class RamFileImpl : public fs::FileImpl {
+ public:
+    //! Constructor.
+    RamFileImpl(
+        RamFsImpl* fs,      //!< [in] File system that the file belongs to.
+        RamFsNodePtr node,  //!< [in] File or directory which was opened.
+        bool canRead,       //!< [in] The file was opened for reading.
+        bool canWrite,      //!< [in] The file was opened for writing.
+        bool append         //!< [in] Every write goes to the end of the file.
+        )
+        : m_fs{fs},
+          m_node{node},
+          m_path{node->path},
+          m_canRead{canRead},
+          m_canWrite{canWrite},
+          m_append{append} {}
+
+    size_t write(const uint8_t* buf, size_t size) override {
+        if (!this->m_node || !this->m_canWrite) {
+            return 0;
+        }
+        std::vector<uint8_t>& data = this->m_node->data;
+        if (this->m_append) {
+            this->m_position = data.size();
+        }
+        size_t maxEnd = data.size() + (this->m_fs->capacity() - this->m_fs->used());
+        if (this->m_position >= maxEnd) {
+            return 0;
+        }
+        if (size > maxEnd - this->m_position) {
+            size = maxEnd - this->m_position;
+        }
+        if (this->m_position + size > data.size()) {
+            data.resize(this->m_position + size);
+        }
+        memcpy(&data[this->m_position], buf, size);
+        this->m_position += size;
+        this->m_node->lastWrite = time(nullptr);
+        return size;
+    }
+
+    size_t read(uint8_t* buf, size_t size) override {
+        if (!this->m_node || !this->m_canRead || this->m_node->isDir ||
+            this->m_position >= this->m_node->data.size()) {
+            return 0;
+        }
+        if (size > this->m_node->data.size() - this->m_position) {
+            size = this->m_node->data.size() - this->m_position;
+        }
+        memcpy(buf, &this->m_node->data[this->m_position], size);
+        this->m_position += size;
+        return size;
+    }
+
+    void flush() override {}
+
+    bool seek(uint32_t pos, fs::SeekMode mode) override {
+        if (!this->m_node || this->m_node->isDir) {
+            return false;
+        }
+        switch (mode) {
+            case fs::SeekSet: {
+                this->m_position = pos;
+                return true;
+            }
+            case fs::SeekCur: {
+                this->m_position += pos;
+                return true;
+            }
+            case fs::SeekEnd: {
+                this->m_position = this->m_node->data.size() + pos;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t position() const override { return this->m_position; }
+
+    size_t size() const override { return this->m_node ? this->m_node->data.size() : 0; }
+
+    void close() override { this->m_node.reset(); }
+
+    time_t getLastWrite() override { return this->m_node ? this->m_node->lastWrite : 0; }
+
+    const char* path() const override { return this->m_path.c_str(); }
+
+    const char* name() const override {
+        return (this->m_path == "/") ? this->m_path.c_str()
+                                     : &this->m_path[this->m_path.rfind('/') + 1];
+    }
+
+    boolean isDirectory() override { return this->m_node && this->m_node->isDir; }
+
+    fs::FileImplPtr openNextFile(const char* /*mode*/) override {
+        RamFsNodePtr node = this->nextChild();
+        if (!node) {
+            return fs::FileImplPtr();
+        }
+        return std::make_shared<RamFileImpl>(this->m_fs, node, true, false, false);
+    }
+
+    void rewindDirectory() override { this->m_dirIndex = 0; }
+
+    operator bool() override { return this->m_node != nullptr; }
+
+    //! There's no buffering, so this does nothing.
+    bool setBufferSize(size_t /*size*/) RAMFS_CORE3_OVERRIDE { return true; }
+
+    //! Moves to a position returned by an earlier listing.
+    boolean seekDir(long position) RAMFS_CORE3_OVERRIDE {
+        this->m_dirIndex = position;
+        return true;
+    }
+
+    //! @returns The path of the next entry in the directory ("" if there are no more).
+    String getNextFileName() RAMFS_CORE3_OVERRIDE {
+        RamFsNodePtr node = this->nextChild();
+        return String(node ? node->path.c_str() : "");
+    }
+
+    //! @returns The path of the next entry in the directory ("" if there are no more).
+    String getNextFileName(bool* isDir) RAMFS_CORE3_OVERRIDE {
+        RamFsNodePtr node = this->nextChild();
+        *isDir = node && node->isDir;
+        return String(node ? node->path.c_str() : "");
+    }
+
+ private:
+    //! @returns The next entry in the directory, or nullptr if there are no more.
+    RamFsNodePtr nextChild() {
+        if (!this->m_node || !this->m_node->isDir) {
+            return nullptr;
+        }
+        return this->m_fs->nextChild(this->m_path, &this->m_dirIndex);
+    }
+
+    RamFsImpl* m_fs;        //!< File system that the file belongs to.
+    RamFsNodePtr m_node;    //!< File which is open (nullptr once closed).
+    std::string m_path;     //!< Path that the file was opened with.
+    bool m_canRead;         //!< The file was opened for reading.
+    bool m_canWrite;        //!< The file was opened for writing.
+    bool m_append;          //!< Every write goes to the end of the file.
+    size_t m_position = 0;  //!< Offset that the next read or write starts at.
+    size_t m_dirIndex = 0;  //!< Where a directory listing continues from.
+};
+
+fs::FileImplPtr RamFsImpl::open(const char* path, const char* mode, const bool create) {
+    std::string filePath;
+    if (!normalizePath(path, &filePath) || mode == nullptr) {
+        return fs::FileImplPtr();
+    }
+    bool plus = strchr(mode, '+') != nullptr;
+    RamFsNodePtr node = this->findNode(filePath);
+    if (mode[0] == 'r') {
+        if (!node || (plus && node->isDir)) {
+            return fs::FileImplPtr();
+        }
+        return std::make_shared<RamFileImpl>(this, node, true, plus, false);
+    }
+    if (mode[0] != 'w' && mode[0] != 'a') {
+        return fs::FileImplPtr();
+    }
+    if (node && node->isDir) {
+        return fs::FileImplPtr();
+    }
+    if (!node) {
+        if (create) {
+            // Create any missing parent directories, like the ESP32 VFS does.
+            for (size_t slash = filePath.find('/', 1); slash != std::string::npos;
+                 slash = filePath.find('/', slash + 1)) {
+                std::string dir = filePath.substr(0, slash);
+                if (!this->findNode(dir) && !this->addNode(dir, true)) {
+                    return fs::FileImplPtr();
+                }
+            }
+        }
+        node = this->addNode(filePath, false);
+        if (!node) {
+            return fs::FileImplPtr();
+        }
+    } else if (mode[0] == 'w') {
+        node->data.clear();
+        node->lastWrite = time(nullptr);
+    }
+    return std::make_shared<RamFileImpl>(this, node, plus, true, mode[0] == 'a');
+}
+
+bool RamFsImpl::exists(const char* path) {
+    std::string filePath;
+    return normalizePath(path, &filePath) && this->findNode(filePath);
+}
+
+bool RamFsImpl::rename(const char* pathFrom, const char* pathTo) {
+    std::string from;
+    std::string to;
+    if (!normalizePath(pathFrom, &from) || !normalizePath(pathTo, &to) || from == "/") {
+        return false;
+    }
+    RamFsNodePtr node = this->findNode(from);
+    if (!node) {
+        return false;
+    }
+    if (from == to) {
+        return true;
+    }
+    RamFsNodePtr parent = this->findNode(parentOf(to));
+    if (!parent || !parent->isDir || (node->isDir && isInside(to, from))) {
+        return false;
+    }
+    RamFsNodePtr existing = this->findNode(to);
+    if (existing) {
+        // Files replace existing files, like LittleFS.
+        if (node->isDir || existing->isDir) {
+            return false;
+        }
+        this->eraseNode(existing);
+    }
+    for (auto& entry : this->m_nodes) {
+        if (entry->path == from) {
+            entry->path = to;
+        } else if (node->isDir && isInside(entry->path, from)) {
+            entry->path = to + entry->path.substr(from.size());
+        }
+    }
+    return true;
+}
+
+bool RamFsImpl::remove(const char* path) {
+    std::string filePath;
+    if (!normalizePath(path, &filePath)) {
+        return false;
+    }
+    RamFsNodePtr node = this->findNode(filePath);
+    if (!node || node->isDir) {
+        return false;
+    }
+    this->eraseNode(node);
+    return true;
+}
+
+bool RamFsImpl::mkdir(const char* path) {
+    std::string dirPath;
+    if (!normalizePath(path, &dirPath) || this->findNode(dirPath)) {
+        return false;
+    }
+    return this->addNode(dirPath, true) != nullptr;
+}
+
+bool RamFsImpl::rmdir(const char* path) {
+    std::string dirPath;
+    if (!normalizePath(path, &dirPath) || dirPath == "/") {
+        return false;
+    }
+    RamFsNodePtr node = this->findNode(dirPath);
+    if (!node || !node->isDir) {
+        return false;
+    }
+    size_t index = 0;
+    if (this->nextChild(dirPath, &index)) {
+        return false;
+    }
+    this->eraseNode(node);
+    return true;
+}
+
+RamFs::RamFs(size_t capacity) : RamFs{std::make_shared<RamFsImpl>(capacity)} {}
+
+RamFs::RamFs(std::shared_ptr<RamFsImpl> impl) : fs::FS{impl}, m_ramImpl{impl} {}
+
+size_t RamFs::totalBytes() {
+    return this->m_ramImpl->capacity();
+}
+
+size_t RamFs::usedBytes() {
+    return this->m_ramImpl->used();
+}
+
+bool RamFs::format() {
+    this->m_ramImpl->format();
+    return true;
+}
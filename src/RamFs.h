@@ -0,0 +1,56 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   RamFs.h
+ *
+ *   @brief  A file system which keeps its files in RAM.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <memory>
+
+#include "FS.h"
+
+class RamFsImpl;
+
+//! A file system which keeps all of its files in RAM (allocated from the
+//! heap as they grow), and which is empty each time it's created.
+//!
+//! This is meant for testing and benchmarking the packet protocol without
+//! any flash latency, either as the default file system of a
+//! LittleFsPacketHandler or mounted alongside LittleFS. Files which are open
+//! must be closed before the RamFs is destroyed.
+class RamFs : public fs::FS {
+ public:
+    //! Constructor.
+    explicit RamFs(size_t capacity  //!< [in] Largest number of bytes of file data to hold.
+    );
+
+    //! @returns The largest number of bytes of file data which can be held.
+    size_t totalBytes();
+
+    //! @returns The number of bytes of file data currently held.
+    size_t usedBytes();
+
+    //! Removes all of the files and directories.
+    //! @returns true (formatting can't fail).
+    bool format();
+
+ private:
+    //! Constructor used once the implementation has been allocated.
+    explicit RamFs(std::shared_ptr<RamFsImpl> impl  //!< [in] Implementation to use.
+    );
+
+    std::shared_ptr<RamFsImpl> m_ramImpl;  //!< Same as _impl, without needing a cast.
+};
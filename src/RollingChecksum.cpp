@@ -0,0 +1,29 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   RollingChecksum.cpp
+ *
+ *   @brief  rsync style weak checksum of a block of data.
+ *
+ ****************************************************************************/
+
+#include "RollingChecksum.h"
+
+void RollingChecksum::update(void const* data, size_t len) {
+    uint8_t const* bytes = static_cast<uint8_t const*>(data);
+    uint32_t a = this->m_a;
+    uint32_t b = this->m_b;
+    while (len-- > 0) {
+        a = (a + *bytes++) & 0xffff;
+        b = (b + a) & 0xffff;
+    }
+    this->m_a = a;
+    this->m_b = b;
+}
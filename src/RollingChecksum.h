@@ -0,0 +1,45 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2024 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   RollingChecksum.h
+ *
+ *   @brief  rsync style weak checksum of a block of data.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+//! Calculates the rsync weak checksum of a block of data. The host can
+//! "roll" this checksum along its copy of a file one byte at a time to find
+//! blocks which the device already has.
+class RollingChecksum {
+ public:
+    //! Starts a new checksum calculation.
+    void reset() {
+        this->m_a = 0;
+        this->m_b = 0;
+    }
+
+    //! Adds some data to the checksum.
+    void update(
+        void const* data,  //!< [in] Data to add.
+        size_t len         //!< [in] Number of bytes of data.
+    );
+
+    //! @returns The checksum of all of the data added since the last reset.
+    uint32_t value() const { return (this->m_b << 16) | this->m_a; }
+
+ private:
+    uint32_t m_a = 0;  //!< Sum of the bytes (modulo 2^16).
+    uint32_t m_b = 0;  //!< Sum of the running values of m_a (modulo 2^16).
+};
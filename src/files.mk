@@ -1,4 +1,9 @@
 # This list of files only includes the files requried for testing
 
 SOURCES_CPP += \
-    LittleFsPacketHandler.cpp
+    Crc32.cpp \
+    LittleFsPacketHandler.cpp \
+    LittleFsWorker.cpp \
+    Lz4.cpp \
+    RamFs.cpp \
+    RollingChecksum.cpp